@@ -0,0 +1,704 @@
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "apsp.h"
+#include "dist_heap.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define APSP_AVX2
+#endif
+
+/* Offset of entry (i,j) in the tiled matrices */
+#define APSP_AT(a,i,j) \
+	((((size_t)(i)/APSP_BLOCK)*(a)->tiles+(j)/APSP_BLOCK)*APSP_TILE+ \
+	 ((i)%APSP_BLOCK)*APSP_BLOCK+(j)%APSP_BLOCK)
+
+/* Offset of the start of row i within column of tiles jt */
+#define APSP_ROW(a,i,jt) APSP_AT(a, i, (jt)*APSP_BLOCK)
+
+
+/**
+ * apsp_relax_scalar:
+ * Lowers dist[j] to via+dist_k[j] for each of the `n' entries where
+ * that is shorter, taking the predecessor from pred_k[j].
+ */
+static void apsp_relax_scalar( uint32_t *dist, int32_t *pred, uint32_t via,
+			       const uint32_t *dist_k, const int32_t *pred_k,
+			       uint32_t n )
+{
+	uint32_t j;
+
+	for ( j= 0; j < n; j++ ) {
+		uint32_t d= via+dist_k[j];
+
+		if ( d < dist[j] ) {
+			dist[j]= d;
+			pred[j]= pred_k[j];
+		}
+	}
+}
+
+
+#ifdef APSP_AVX2
+/**
+ * apsp_relax_avx2:
+ * apsp_relax_scalar() eight entries at a time. Distances are below
+ * 2^28 and `via' is less than INFINITY, so sums fit in a signed int.
+ */
+__attribute__((target("avx2")))
+static void apsp_relax_avx2( uint32_t *dist, int32_t *pred, uint32_t via,
+			     const uint32_t *dist_k, const int32_t *pred_k,
+			     uint32_t n )
+{
+	__m256i v= _mm256_set1_epi32( via );
+	uint32_t j;
+
+	for ( j= 0; j+8 <= n; j+= 8 ) {
+		__m256i d= _mm256_loadu_si256( (const __m256i*)(dist+j) );
+		__m256i s= _mm256_add_epi32( v, _mm256_loadu_si256(
+						(const __m256i*)(dist_k+j)) );
+		__m256i shorter= _mm256_cmpgt_epi32( d, s );
+		__m256i p;
+
+		if ( _mm256_testz_si256(shorter, shorter) )
+			continue;
+
+		p= _mm256_blendv_epi8(
+			_mm256_loadu_si256( (const __m256i*)(pred+j) ),
+			_mm256_loadu_si256( (const __m256i*)(pred_k+j) ),
+			shorter );
+		_mm256_storeu_si256( (__m256i*)(dist+j), _mm256_min_epu32(d, s) );
+		_mm256_storeu_si256( (__m256i*)(pred+j), p );
+	}
+
+	if ( j < n )
+		apsp_relax_scalar( dist+j, pred+j, via, dist_k+j, pred_k+j, n-j );
+}
+#endif
+
+
+/**
+ * apsp_init:
+ * Creates an empty matrix, to be kept for up to `max_nodes' nodes, and
+ * makes `apsp' point to it.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int apsp_init( apsp_t **apsp, uint32_t max_nodes )
+{
+	apsp_t *a= (apsp_t*)calloc( 1, sizeof(apsp_t) );
+
+	if ( a == NULL )
+		return FALSE;
+
+	a->max_nodes= max_nodes;
+	a->relax= &apsp_relax_scalar;
+#ifdef APSP_AVX2
+	if ( __builtin_cpu_supports("avx2") )
+		a->relax= &apsp_relax_avx2;
+#endif
+
+	*apsp= a;
+	return TRUE;
+}
+
+
+/**
+ * apsp_destroy:
+ * Frees the matrix, and sets *apsp to NULL.
+ */
+void apsp_destroy( apsp_t **apsp )
+{
+	apsp_t *a= *apsp;
+
+	free( a->ips );
+	free( a->names );
+	free( a->dist );
+	free( a->pred );
+	free( a->edges );
+	free( a->first );
+	free( a->next_edges );
+	free( a->changes );
+	free( a->row_dist );
+	free( a->row_pred );
+	free( a->stale );
+	free( a->heap );
+	free( a );
+
+	*apsp= NULL;
+}
+
+
+/**
+ * apsp_node:
+ * Returns the index of `ip', or -1 if it is not a node.
+ */
+static int apsp_node( apsp_t *a, uint32_t ip )
+{
+	int lo= 0, hi= (int)a->num_nodes-1;
+
+	while ( lo <= hi ) {
+		int mid= (lo+hi)/2;
+
+		if ( a->names[mid].ip == ip )
+			return a->names[mid].node;
+		if ( a->names[mid].ip < ip )
+			lo= mid+1;
+		else
+			hi= mid-1;
+	}
+
+	return -1;
+}
+
+
+/**
+ * apsp_add_node:
+ * Returns the index of `ip', giving it the next one if it is new, or
+ * -1 if memory ran out.
+ */
+static int apsp_add_node( apsp_t *a, uint32_t ip )
+{
+	int node= apsp_node( a, ip );
+	uint32_t pos;
+	void *p;
+
+	if ( node != -1 )
+		return node;
+
+	if ( a->num_nodes == a->node_space ) {
+		uint32_t space= a->node_space ? a->node_space*2 : 64;
+
+		if ( (p= realloc(a->ips, space*sizeof(uint32_t))) == NULL )
+			return -1;
+		a->ips= p;
+		if ( (p= realloc(a->names, space*sizeof(apsp_name_t))) == NULL )
+			return -1;
+		a->names= p;
+
+		a->node_space= space;
+	}
+
+	for ( pos= a->num_nodes; pos > 0 && a->names[pos-1].ip > ip; pos-- )
+		a->names[pos]= a->names[pos-1];
+	a->names[pos].ip= ip;
+	a->names[pos].node= a->num_nodes;
+	a->ips[a->num_nodes]= ip;
+
+	return a->num_nodes++;
+}
+
+
+static int apsp_edge_compare( const void *x, const void *y )
+{
+	const apsp_edge_t *e= (const apsp_edge_t*)x, *f= (const apsp_edge_t*)y;
+
+	if ( e->from != f->from )
+		return e->from < f->from ? -1 : 1;
+	return e->to < f->to ? -1 : e->to > f->to;
+}
+
+
+/**
+ * apsp_heap_room:
+ * Makes sure the heap can take a run of Dijkstra's algorithm.
+ */
+static int apsp_heap_room( apsp_t *a )
+{
+	void *p= realloc( a->heap, (a->edge_space+a->tile_space*APSP_BLOCK+1)*
+			  sizeof(uint64_t) );
+
+	if ( p == NULL )
+		return FALSE;
+
+	a->heap= p;
+	return TRUE;
+}
+
+
+/**
+ * apsp_snapshot:
+ * Copies the links in `links' to next_edges, naming any new nodes.
+ * Returns FALSE if memory ran out.
+ */
+static int apsp_snapshot( apsp_t *a, links_t *links )
+{
+	link_from_t *from;
+	link_to_t *to;
+	uint32_t n= 0;
+	void *p;
+
+	for ( from= links->head; from != NULL; from= from->next_node )
+		for ( to= from->links; to != NULL; to= to->next_link )
+			n++;
+
+	if ( n > a->edge_space || a->edges == NULL ) {
+		uint32_t space= n*2+16;
+
+		if ( (p= realloc(a->edges, space*sizeof(apsp_edge_t))) == NULL )
+			return FALSE;
+		a->edges= p;
+		if ( (p= realloc(a->next_edges, space*sizeof(apsp_edge_t))) == NULL )
+			return FALSE;
+		a->next_edges= p;
+		if ( (p= realloc(a->changes, 2*space*sizeof(apsp_edge_t))) == NULL )
+			return FALSE;
+		a->changes= p;
+
+		a->edge_space= space;
+		if ( !apsp_heap_room(a) )
+			return FALSE;
+	}
+
+	n= 0;
+	for ( from= links->head; from != NULL; from= from->next_node ) {
+		int u= apsp_add_node( a, from->ip );
+
+		if ( u == -1 )
+			return FALSE;
+
+		for ( to= from->links; to != NULL; to= to->next_link ) {
+			int v= apsp_add_node( a, to->ip );
+
+			if ( v == -1 )
+				return FALSE;
+			if ( u == v || to->distance >= INFINITY )
+				continue;
+
+			a->next_edges[n].from= u;
+			a->next_edges[n].to= v;
+			a->next_edges[n].weight= to->distance;
+			n++;
+		}
+	}
+
+	qsort( a->next_edges, n, sizeof(apsp_edge_t), &apsp_edge_compare );
+	a->num_next_edges= n;
+
+	return TRUE;
+}
+
+
+/**
+ * apsp_install_edges:
+ * Makes the snapshot the current set of edges, and indexes them.
+ */
+static void apsp_install_edges( apsp_t *a )
+{
+	apsp_edge_t *tmp= a->edges;
+	uint32_t i, e= 0;
+
+	a->edges= a->next_edges;
+	a->num_edges= a->num_next_edges;
+	a->next_edges= tmp;
+
+	for ( i= 0; i < a->num_nodes; i++ ) {
+		a->first[i]= e;
+		while ( e < a->num_edges && a->edges[e].from == i )
+			e++;
+	}
+	a->first[a->num_nodes]= e;
+}
+
+
+/**
+ * apsp_alloc:
+ * Lays the matrices out for the current nodes, with some room to grow.
+ * Returns FALSE if memory ran out.
+ */
+static int apsp_alloc( apsp_t *a )
+{
+	uint32_t nodes= a->num_nodes+a->num_nodes/4+1;
+	uint32_t tiles= (nodes+APSP_BLOCK-1)/APSP_BLOCK;
+	size_t cells;
+	void *p;
+
+	if ( tiles > a->tile_space ) {
+		cells= (size_t)tiles*tiles*APSP_TILE;
+
+		if ( (p= realloc(a->dist, cells*sizeof(uint32_t))) == NULL )
+			return FALSE;
+		a->dist= p;
+		if ( (p= realloc(a->pred, cells*sizeof(int32_t))) == NULL )
+			return FALSE;
+		a->pred= p;
+
+		nodes= tiles*APSP_BLOCK;
+		if ( (p= realloc(a->first, (nodes+1)*sizeof(uint32_t))) == NULL )
+			return FALSE;
+		a->first= p;
+		if ( (p= realloc(a->row_dist, nodes*sizeof(uint32_t))) == NULL )
+			return FALSE;
+		a->row_dist= p;
+		if ( (p= realloc(a->row_pred, nodes*sizeof(int32_t))) == NULL )
+			return FALSE;
+		a->row_pred= p;
+		if ( (p= realloc(a->stale, nodes)) == NULL )
+			return FALSE;
+		a->stale= p;
+
+		a->tile_space= tiles;
+		if ( !apsp_heap_room(a) )
+			return FALSE;
+	}
+
+	a->tiles= tiles;
+	return TRUE;
+}
+
+
+/**
+ * apsp_tile:
+ * Min-plus product step of Floyd-Warshall over one tile: relaxes tile
+ * (it,jt) through each node of column of tiles kt.
+ */
+static void apsp_tile( apsp_t *a, uint32_t it, uint32_t jt, uint32_t kt )
+{
+	uint32_t *c=  a->dist+((size_t)it*a->tiles+jt)*APSP_TILE;
+	int32_t *pc=  a->pred+((size_t)it*a->tiles+jt)*APSP_TILE;
+	uint32_t *x=  a->dist+((size_t)it*a->tiles+kt)*APSP_TILE;
+	uint32_t *y=  a->dist+((size_t)kt*a->tiles+jt)*APSP_TILE;
+	int32_t *py=  a->pred+((size_t)kt*a->tiles+jt)*APSP_TILE;
+	uint32_t i, k;
+
+	for ( k= 0; k < APSP_BLOCK; k++ ) {
+		for ( i= 0; i < APSP_BLOCK; i++ ) {
+			uint32_t via= x[i*APSP_BLOCK+k];
+
+			if ( via >= INFINITY )
+				continue;
+
+			a->relax( c+i*APSP_BLOCK, pc+i*APSP_BLOCK, via,
+				  y+k*APSP_BLOCK, py+k*APSP_BLOCK, APSP_BLOCK );
+		}
+	}
+}
+
+
+/**
+ * apsp_build:
+ * Works out every distance from scratch, with Floyd-Warshall in three
+ * phases per column of tiles: the tile on the diagonal, then the rest
+ * of its row and column, then everything else.
+ */
+static void apsp_build( apsp_t *a )
+{
+	size_t cells= (size_t)a->tiles*a->tiles*APSP_TILE, n;
+	uint32_t i, e, it, jt, kt;
+
+	for ( n= 0; n < cells; n++ ) {
+		a->dist[n]= INFINITY;
+		a->pred[n]= -1;
+	}
+
+	for ( i= 0; i < a->num_nodes; i++ ) {
+		a->dist[APSP_AT(a, i, i)]= 0;
+		a->pred[APSP_AT(a, i, i)]= i;
+	}
+
+	for ( e= 0; e < a->num_edges; e++ ) {
+		apsp_edge_t *edge= &(a->edges[e]);
+
+		a->dist[APSP_AT(a, edge->from, edge->to)]= edge->weight;
+		a->pred[APSP_AT(a, edge->from, edge->to)]= edge->from;
+	}
+
+	for ( kt= 0; kt < a->tiles; kt++ ) {
+		apsp_tile( a, kt, kt, kt );
+
+		for ( jt= 0; jt < a->tiles; jt++ )
+			if ( jt != kt )
+				apsp_tile( a, kt, jt, kt );
+		for ( it= 0; it < a->tiles; it++ )
+			if ( it != kt )
+				apsp_tile( a, it, kt, kt );
+
+		for ( it= 0; it < a->tiles; it++ ) {
+			if ( it == kt )
+				continue;
+			for ( jt= 0; jt < a->tiles; jt++ )
+				if ( jt != kt )
+					apsp_tile( a, it, jt, kt );
+		}
+	}
+}
+
+
+/**
+ * apsp_row:
+ * Recomputes row `src' with Dijkstra's algorithm over the edges.
+ */
+static void apsp_row( apsp_t *a, uint32_t src )
+{
+	uint32_t *dist= a->row_dist;
+	int32_t *pred= a->row_pred;
+	uint32_t i, len= 0, jt;
+
+	for ( i= 0; i < a->tiles*APSP_BLOCK; i++ ) {
+		dist[i]= INFINITY;
+		pred[i]= -1;
+	}
+
+	dist[src]= 0;
+	pred[src]= src;
+	dist_heap_push( a->heap, &len, HEAP_ENTRY(0, src) );
+
+	while ( len ) {
+		uint64_t entry= dist_heap_pop( a->heap, &len );
+		uint32_t u= HEAP_NODE(entry), d= HEAP_DIST(entry), e;
+
+		if ( d != dist[u] )
+			continue;
+
+		for ( e= a->first[u]; e < a->first[u+1]; e++ ) {
+			uint32_t v= a->edges[e].to, nd= d+a->edges[e].weight;
+
+			if ( nd < dist[v] ) {
+				dist[v]= nd;
+				pred[v]= u;
+				dist_heap_push( a->heap, &len, HEAP_ENTRY(nd, v) );
+			}
+		}
+	}
+
+	for ( jt= 0; jt < a->tiles; jt++ ) {
+		memcpy( a->dist+APSP_ROW(a, src, jt), dist+jt*APSP_BLOCK,
+			APSP_BLOCK*sizeof(uint32_t) );
+		memcpy( a->pred+APSP_ROW(a, src, jt), pred+jt*APSP_BLOCK,
+			APSP_BLOCK*sizeof(int32_t) );
+	}
+}
+
+
+/**
+ * apsp_lighter:
+ * Takes into account the link `u'-->`v' having come down to `weight':
+ * every path which is now shorter runs i..u, then the link, then v..j,
+ * so each row is relaxed through row v. If every row is exact for the
+ * same graph, a row which doesn't gain on v can't gain anywhere and is
+ * skipped; after rows have been recomputed on their own that no longer
+ * holds, so `closed' must be FALSE.
+ */
+static void apsp_lighter( apsp_t *a, uint32_t u, uint32_t v, uint32_t weight,
+			  int closed )
+{
+	uint32_t i, jt;
+
+	for ( i= 0; i < a->num_nodes; i++ ) {
+		uint32_t via= a->dist[APSP_AT(a, i, u)];
+		int gains;
+
+		if ( via >= INFINITY )
+			continue;
+		via+= weight;
+		gains= via < a->dist[APSP_AT(a, i, v)];
+		if ( closed && !gains )
+			continue;
+
+		for ( jt= 0; jt < a->tiles; jt++ )
+			a->relax( a->dist+APSP_ROW(a, i, jt),
+				  a->pred+APSP_ROW(a, i, jt), via,
+				  a->dist+APSP_ROW(a, v, jt),
+				  a->pred+APSP_ROW(a, v, jt), APSP_BLOCK );
+
+		/* v is reached over the link itself */
+		if ( gains )
+			a->pred[APSP_AT(a, i, v)]= u;
+	}
+}
+
+
+/**
+ * apsp_update:
+ * Applies the differences between the edges and the snapshot. Rows
+ * whose paths may have run over a link which got heavier or went are
+ * recomputed; links which got lighter or appeared are then relaxed
+ * through every row.
+ */
+static void apsp_update( apsp_t *a, uint32_t old_nodes )
+{
+	apsp_edge_t *old= a->edges, *new= a->next_edges;
+	uint32_t o= 0, n= 0, heavier= 0, lighter= 0, recomputed= 0, i, c;
+	/* Heavier links are listed from the start, lighter from the end */
+	apsp_edge_t *change= a->changes;
+	uint32_t top= 2*a->edge_space;
+
+	while ( o < a->num_edges || n < a->num_next_edges ) {
+		int cmp;
+
+		if ( o == a->num_edges )
+			cmp= 1;
+		else if ( n == a->num_next_edges )
+			cmp= -1;
+		else
+			cmp= apsp_edge_compare( &old[o], &new[n] );
+
+		if ( cmp < 0 || (cmp == 0 && new[n].weight > old[o].weight) )
+			change[heavier++]= old[o];
+		else if ( cmp > 0 || new[n].weight < old[o].weight )
+			change[top-++lighter]= new[n];
+
+		if ( cmp <= 0 )
+			o++;
+		if ( cmp >= 0 )
+			n++;
+	}
+
+	/* A row can only lose a path over a link which was tight in it */
+	memset( a->stale, 0, a->num_nodes );
+	for ( c= 0; c < heavier; c++ ) {
+		for ( i= 0; i < old_nodes; i++ ) {
+			uint32_t du= a->dist[APSP_AT(a, i, change[c].from)];
+
+			if ( du < INFINITY && du+change[c].weight ==
+			     a->dist[APSP_AT(a, i, change[c].to)] )
+				a->stale[i]= TRUE;
+		}
+	}
+
+	/* New nodes start out reaching only themselves */
+	for ( i= old_nodes; i < a->num_nodes; i++ ) {
+		a->dist[APSP_AT(a, i, i)]= 0;
+		a->pred[APSP_AT(a, i, i)]= i;
+	}
+
+	apsp_install_edges( a );
+
+	for ( i= 0; i < old_nodes; i++ ) {
+		if ( a->stale[i] ) {
+			apsp_row( a, i );
+			recomputed++;
+		}
+	}
+
+	for ( c= top-lighter; c < top; c++ )
+		apsp_lighter( a, change[c].from, change[c].to, change[c].weight,
+			      recomputed == 0 );
+}
+
+
+/**
+ * apsp_sync:
+ * Brings the matrix up to date with `links', if it has changed since
+ * the last call. The caller must hold the links lock.
+ * Returns TRUE if the matrix is current, or FALSE if the graph has
+ * more than `max_nodes' nodes or memory ran out, in which case the
+ * caller should work the paths out some other way.
+ */
+int apsp_sync( apsp_t *a, links_t *links )
+{
+	uint32_t old_nodes= a->num_nodes;
+
+	if ( a->valid && a->version == links->version )
+		return TRUE;
+
+	/* Full builds number the nodes afresh, dropping any which have
+	 * lost all their links */
+	if ( !a->valid )
+		a->num_nodes= 0;
+
+	if ( !apsp_snapshot(a, links) )
+		goto fail;
+
+	if ( a->valid && a->num_nodes > a->tiles*APSP_BLOCK ) {
+		a->valid= FALSE;
+		a->num_nodes= 0;
+		if ( !apsp_snapshot(a, links) )
+			goto fail;
+	}
+
+	if ( a->num_nodes > a->max_nodes )
+		goto fail;
+
+	if ( a->valid )
+		apsp_update( a, old_nodes );
+	else {
+		if ( !apsp_alloc(a) )
+			goto fail;
+		apsp_install_edges( a );
+		apsp_build( a );
+	}
+
+	a->version= links->version;
+	a->valid= TRUE;
+	return TRUE;
+
+ fail:
+	a->valid= FALSE;
+	return FALSE;
+}
+
+
+/**
+ * apsp_distance:
+ * Returns the distance from `from_ip' to `to_ip', or INFINITY.
+ */
+uint32_t apsp_distance( apsp_t *a, uint32_t from_ip, uint32_t to_ip )
+{
+	int i= apsp_node( a, from_ip ), j= apsp_node( a, to_ip );
+
+	if ( i == -1 || j == -1 )
+		return from_ip == to_ip ? 0 : INFINITY;
+
+	return a->dist[APSP_AT(a, i, j)];
+}
+
+
+/**
+ * apsp_children:
+ * Fills `out', which must have room for num_nodes entries, with the
+ * nodes `node' forwards to in the shortest path tree rooted at
+ * `source'.
+ * Returns the number of nodes written.
+ */
+uint32_t apsp_children( apsp_t *a, uint32_t source, uint32_t node,
+			uint32_t *out )
+{
+	int s= apsp_node( a, source ), x= apsp_node( a, node );
+	uint32_t j, n= 0;
+
+	if ( s == -1 || x == -1 )
+		return 0;
+
+	for ( j= 0; j < a->num_nodes; j++ ) {
+		if ( (int)j != s && a->pred[APSP_AT(a, s, j)] == x )
+			out[n++]= a->ips[j];
+	}
+
+	return n;
+}
+
+
+/**
+ * apsp_with_link:
+ * Fills out[k] with the distance from `from_ip' to ips[k], for each of
+ * the `n' addresses, were there a link of `weight' from `from_ip' to
+ * `to_ip'.
+ */
+void apsp_with_link( apsp_t *a, uint32_t from_ip, uint32_t to_ip,
+		     uint32_t weight, const uint32_t *ips, uint32_t n,
+		     uint32_t *out )
+{
+	int f= apsp_node( a, from_ip ), t= apsp_node( a, to_ip );
+	uint32_t k;
+
+	for ( k= 0; k < n; k++ ) {
+		int x= apsp_node( a, ips[k] );
+		uint32_t now, via;
+
+		if ( f != -1 && x != -1 )
+			now= a->dist[APSP_AT(a, f, x)];
+		else
+			now= ips[k] == from_ip ? 0 : INFINITY;
+
+		if ( t != -1 && x != -1 )
+			via= a->dist[APSP_AT(a, t, x)];
+		else
+			via= ips[k] == to_ip ? 0 : INFINITY;
+
+		if ( via < INFINITY && via+weight < now )
+			now= via+weight;
+		out[k]= now;
+	}
+}
@@ -0,0 +1,139 @@
+#ifndef __APSP_
+#define __APSP_
+
+#include <stdint.h>
+
+#include "links.h"
+#include "common_defs.h"
+
+/* Side of the square tiles the matrices are stored in. A tile of
+ * distances is 4kB, so the three tiles the min-plus kernel works on
+ * at once stay in the L1 cache. */
+#define APSP_BLOCK 32
+#define APSP_TILE  (APSP_BLOCK*APSP_BLOCK)
+
+typedef struct
+{
+	uint32_t from;
+	uint32_t to;
+	uint32_t weight;
+} apsp_edge_t;
+
+typedef struct
+{
+	uint32_t ip;
+	uint32_t node;
+} apsp_name_t;
+
+typedef void (*apsp_relax_fn_t)( uint32_t *dist, int32_t *pred, uint32_t via,
+				 const uint32_t *dist_k, const int32_t *pred_k,
+				 uint32_t n );
+
+/**
+ * An apsp_t holds the distance between every pair of nodes in the links
+ * table, and the node before the last hop of each path, so that the
+ * shortest path tree from any source can be read straight out of it.
+ *
+ * Both matrices are stored as APSP_BLOCK square tiles, row-major within
+ * each tile and across the tiles. Entry (i,j) is the distance from i to
+ * j, and pred(i,j) the node j is reached from, or -1.
+ *
+ * apsp_sync() brings the matrices up to date by comparing the links
+ * table with the edges they were last built from. Links which get
+ * lighter are applied with one min-plus pass over the matrix; rows
+ * whose paths used a link which got heavier or went are recomputed on
+ * their own; Floyd-Warshall over the tiles is only run from scratch.
+ */
+typedef struct
+{
+	int valid;
+	uint32_t version;
+	/* Nodes beyond which the matrix isn't kept */
+	uint32_t max_nodes;
+
+	/* Nodes by index, including any which have lost all their
+	 * links since the last full build, and by address */
+	uint32_t num_nodes;
+	uint32_t *ips;
+	apsp_name_t *names;
+	uint32_t node_space;
+
+	/* Tiles along each side of the matrices, and room allocated */
+	uint32_t tiles;
+	uint32_t tile_space;
+	uint32_t *dist;
+	int32_t *pred;
+
+	/* Edges the matrices reflect, sorted by node indices, with the
+	 * offset of the first out of each node; the edges being compared
+	 * against them; and the differences found */
+	apsp_edge_t *edges;
+	uint32_t num_edges;
+	uint32_t *first;
+	apsp_edge_t *next_edges;
+	uint32_t num_next_edges;
+	apsp_edge_t *changes;
+	uint32_t edge_space;
+
+	/* Scratch space for recomputing a row */
+	uint32_t *row_dist;
+	int32_t *row_pred;
+	uint8_t *stale;
+	uint64_t *heap;
+
+	/* Min-plus kernel over a run of entries, picked for the CPU */
+	apsp_relax_fn_t relax;
+} apsp_t;
+
+
+/**
+ * apsp_init:
+ * Creates an empty matrix, to be kept for up to `max_nodes' nodes, and
+ * makes `apsp' point to it.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int apsp_init( apsp_t **apsp, uint32_t max_nodes );
+
+/**
+ * apsp_destroy:
+ * Frees the matrix, and sets *apsp to NULL.
+ */
+void apsp_destroy( apsp_t **apsp );
+
+/**
+ * apsp_sync:
+ * Brings the matrix up to date with `links', if it has changed since
+ * the last call. The caller must hold the links lock.
+ * Returns TRUE if the matrix is current, or FALSE if the graph has
+ * more than `max_nodes' nodes or memory ran out, in which case the
+ * caller should work the paths out some other way.
+ */
+int apsp_sync( apsp_t *a, links_t *links );
+
+/**
+ * apsp_distance:
+ * Returns the distance from `from_ip' to `to_ip', or INFINITY.
+ */
+uint32_t apsp_distance( apsp_t *a, uint32_t from_ip, uint32_t to_ip );
+
+/**
+ * apsp_children:
+ * Fills `out', which must have room for num_nodes entries, with the
+ * nodes `node' forwards to in the shortest path tree rooted at
+ * `source'.
+ * Returns the number of nodes written.
+ */
+uint32_t apsp_children( apsp_t *a, uint32_t source, uint32_t node,
+			uint32_t *out );
+
+/**
+ * apsp_with_link:
+ * Fills out[k] with the distance from `from_ip' to ips[k], for each of
+ * the `n' addresses, were there a link of `weight' from `from_ip' to
+ * `to_ip'.
+ */
+void apsp_with_link( apsp_t *a, uint32_t from_ip, uint32_t to_ip,
+		     uint32_t weight, const uint32_t *ips, uint32_t n,
+		     uint32_t *out );
+
+#endif
@@ -0,0 +1,129 @@
+
+#include "arena.h"
+
+/* Allocations are rounded up to this, which suits every type stored
+ * in an arena. */
+#define ARENA_ALIGN 16
+
+/* Space taken by the chunk header, keeping the data aligned */
+#define ARENA_HEADER ((sizeof(arena_chunk_t)+ARENA_ALIGN-1) & ~(ARENA_ALIGN-1))
+
+
+/**
+ * arena_chunk_new:
+ * Allocates a chunk with room for at least `size' bytes of data.
+ */
+static arena_chunk_t *arena_chunk_new( size_t size )
+{
+	arena_chunk_t *chunk= (arena_chunk_t*)malloc( ARENA_HEADER+size );
+
+	if ( chunk != NULL ) {
+		chunk->next= NULL;
+		chunk->size= size;
+		chunk->used= 0;
+	}
+
+	return chunk;
+}
+
+
+/**
+ * arena_init:
+ * Creates an empty arena which grows `chunk_size' bytes at a time,
+ * and makes `arena' point to it.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int arena_init( arena_t **arena, size_t chunk_size )
+{
+	arena_t *a= (arena_t*)malloc(sizeof(arena_t));
+
+	if ( a == NULL )
+		return FALSE;
+
+	a->chunk_size= chunk_size;
+	a->total= 0;
+	a->head= arena_chunk_new( chunk_size );
+
+	if ( a->head == NULL ) {
+		free( a );
+		return FALSE;
+	}
+
+	*arena= a;
+	return TRUE;
+}
+
+
+/**
+ * arena_alloc:
+ * Returns `size' bytes from `arena', suitably aligned for any type,
+ * or NULL if no memory is available.
+ */
+void *arena_alloc( arena_t *arena, size_t size )
+{
+	arena_chunk_t *chunk= arena->head;
+	void *mem;
+
+	size= (size+ARENA_ALIGN-1) & ~((size_t)ARENA_ALIGN-1);
+
+	/* Current chunk is full; start a new one at the head. Requests
+	 * larger than a chunk get a chunk of their own. */
+	if ( chunk->used+size > chunk->size ) {
+		chunk= arena_chunk_new( size > arena->chunk_size ?
+					size : arena->chunk_size );
+		if ( chunk == NULL )
+			return NULL;
+
+		chunk->next= arena->head;
+		arena->head= chunk;
+	}
+
+	mem= (char*)chunk+ARENA_HEADER+chunk->used;
+	chunk->used+= size;
+	arena->total+= size;
+
+	return mem;
+}
+
+
+/**
+ * arena_reset:
+ * Releases everything allocated from `arena', keeping the first chunk
+ * for reuse.
+ */
+void arena_reset( arena_t *arena )
+{
+	arena_chunk_t *chunk= arena->head;
+	arena_chunk_t *next;
+
+	/* Keep the oldest chunk, which is at the tail of the list */
+	while ( chunk->next != NULL ) {
+		next= chunk->next;
+		free( chunk );
+		chunk= next;
+	}
+
+	chunk->used= 0;
+	arena->head= chunk;
+	arena->total= 0;
+}
+
+
+/**
+ * arena_destroy:
+ * Releases everything allocated from `arena' and the arena itself,
+ * and sets *arena to NULL.
+ */
+void arena_destroy( arena_t **arena )
+{
+	arena_t *a= *arena;
+	arena_chunk_t *chunk, *next;
+
+	for ( chunk= a->head; chunk != NULL; chunk= next ) {
+		next= chunk->next;
+		free( chunk );
+	}
+
+	free( a );
+	*arena= NULL;
+}
@@ -0,0 +1,61 @@
+#ifndef __ARENA_
+#define __ARENA_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define TRUE 1
+#define FALSE 0
+
+typedef struct _arena_chunk
+{
+	struct _arena_chunk *next;
+	size_t size;
+	size_t used;
+} arena_chunk_t;
+
+/**
+ * An arena hands out memory by bumping a pointer through a list of
+ * malloc'd chunks. Nothing allocated from an arena is freed
+ * individually; everything goes at once when the arena is reset or
+ * destroyed.
+ */
+typedef struct
+{
+	arena_chunk_t *head;
+	size_t chunk_size;
+	/* Bytes handed out since the arena was created or last reset */
+	size_t total;
+} arena_t;
+
+
+/**
+ * arena_init:
+ * Creates an empty arena which grows `chunk_size' bytes at a time,
+ * and makes `arena' point to it.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int arena_init( arena_t **arena, size_t chunk_size );
+
+/**
+ * arena_alloc:
+ * Returns `size' bytes from `arena', suitably aligned for any type,
+ * or NULL if no memory is available.
+ */
+void *arena_alloc( arena_t *arena, size_t size );
+
+/**
+ * arena_reset:
+ * Releases everything allocated from `arena', keeping the first chunk
+ * for reuse.
+ */
+void arena_reset( arena_t *arena );
+
+/**
+ * arena_destroy:
+ * Releases everything allocated from `arena' and the arena itself,
+ * and sets *arena to NULL.
+ */
+void arena_destroy( arena_t **arena );
+
+#endif
@@ -0,0 +1,195 @@
+
+#include "channel_table.h"
+
+#include <stdlib.h>
+
+
+/**
+ * channel_hash:
+ * Multiplicative (Fibonacci) hash of the channel number, masked to
+ * the table size. Spreads runs of small, consecutive channel numbers
+ * across the table.
+ */
+static uint32_t channel_hash( channel_table_t *table, uint32_t channel )
+{
+	return (channel*2654435761u) & (table->size-1);
+}
+
+
+/**
+ * channel_table_init:
+ * Allocates an empty channel table of `size' slots (rounded up to a
+ * power of two), and makes `table' point to it.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int channel_table_init( channel_table_t **table, uint32_t size )
+{
+	channel_table_t *t= (channel_table_t*)malloc(sizeof(channel_table_t));
+	uint32_t s= 1;
+
+	if ( t == NULL )
+		return FALSE;
+
+	while ( s < size )
+		s<<= 1;
+
+	t->slots= (channel_slot_t*)calloc(s, sizeof(channel_slot_t));
+	t->order= (uint32_t*)malloc(s*sizeof(uint32_t));
+	if ( t->slots == NULL || t->order == NULL ) {
+		free( t->slots );
+		free( t->order );
+		free( t );
+		return FALSE;
+	}
+
+	t->size= s;
+	t->length= 0;
+
+	t->lock= (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
+	pthread_mutex_init( t->lock, NULL );
+
+	*table= t;
+	return TRUE;
+}
+
+
+/**
+ * channel_table_add:
+ * Registers `queue' as the queue for `channel', and `priority' as its
+ * class. Must be called with table->lock held. An existing
+ * registration is never replaced, as readers may still be holding the
+ * old queue.
+ * Returns TRUE if the channel was added, FALSE if it was already
+ * registered or the table is full.
+ */
+int channel_table_add( channel_table_t *table, uint32_t channel,
+		       queue_t *queue, int priority )
+{
+	uint32_t i= channel_hash( table, channel );
+	uint32_t probes;
+
+	/* Linear probe for either the channel or a free slot */
+	for ( probes= 0; probes < table->size; probes++ ) {
+		channel_slot_t *slot= &(table->slots[i]);
+
+		if ( !slot->used ) {
+			slot->channel= channel;
+			slot->queue= queue;
+			slot->priority= priority;
+			table->order[table->length]= i;
+
+			/* Publish the slot only once its contents are
+			 * visible to lock-free readers. */
+			__sync_synchronize();
+			slot->used= TRUE;
+			table->length++;
+
+			return TRUE;
+		}
+
+		if ( slot->channel == channel )
+			return FALSE;
+
+		i= (i+1) & (table->size-1);
+	}
+
+	/* Table is full */
+	return FALSE;
+}
+
+
+/**
+ * channel_table_find:
+ * Returns the slot registered for `channel', or NULL if there is
+ * none.
+ */
+static channel_slot_t *channel_table_find( channel_table_t *table, 
+					   uint32_t channel )
+{
+	uint32_t i= channel_hash( table, channel );
+	uint32_t probes;
+
+	for ( probes= 0; probes < table->size; probes++ ) {
+		channel_slot_t *slot= &(table->slots[i]);
+
+		/* Slots are filled in probe order and never emptied, so
+		 * the first free slot ends the search. */
+		if ( !slot->used )
+			return NULL;
+
+		__sync_synchronize();
+		if ( slot->channel == channel )
+			return slot;
+
+		i= (i+1) & (table->size-1);
+	}
+
+	return NULL;
+}
+
+
+/**
+ * channel_table_get:
+ * Returns the queue registered for `channel', or NULL if there is
+ * none. Safe to call without table->lock held.
+ */
+queue_t *channel_table_get( channel_table_t *table, uint32_t channel )
+{
+	channel_slot_t *slot= channel_table_find( table, channel );
+
+	return slot != NULL ? slot->queue : NULL;
+}
+
+
+/**
+ * channel_table_priority:
+ * Returns the class registered for `channel', or `fallback' if it
+ * isn't registered. Safe to call without table->lock held.
+ */
+int channel_table_priority( channel_table_t *table, uint32_t channel,
+			    int fallback )
+{
+	channel_slot_t *slot= channel_table_find( table, channel );
+
+	return slot != NULL ? slot->priority : fallback;
+}
+
+
+/**
+ * channel_table_at:
+ * Returns the `i'th registered slot (in registration order), for
+ * walking all channels. `i' must be less than table->length.
+ */
+channel_slot_t *channel_table_at( channel_table_t *table, uint32_t i )
+{
+	return &(table->slots[table->order[i]]);
+}
+
+
+/**
+ * channel_table_destroy:
+ * Destroys all queues held in the table, then the table itself, and
+ * sets *table to NULL.
+ */
+int channel_table_destroy( channel_table_t **table )
+{
+	channel_table_t *t= *table;
+	uint32_t i;
+
+	for ( i= 0; i < t->length; i++ ) {
+		channel_slot_t *slot= channel_table_at( t, i );
+
+		pthread_mutex_lock( slot->queue->lock );
+		queue_destroy( &(slot->queue) );
+	}
+
+	pthread_mutex_destroy( t->lock );
+	free( t->lock );
+	free( t->order );
+	free( t->slots );
+	free( t );
+
+	*table= NULL;
+
+	return TRUE;
+}
@@ -0,0 +1,93 @@
+#ifndef __CHANNEL_TABLE_
+#define __CHANNEL_TABLE_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "fifo_queue.h"
+
+#define TRUE 1
+#define FALSE 0
+
+/* Number of slots in the channel table. Must be a power of two; the
+ * table never grows, so this is also the maximum number of channels
+ * a host can register. */
+#define CHANNEL_TABLE_SIZE 1024
+
+typedef struct _channel_slot
+{
+	uint32_t channel;
+	queue_t *queue;
+	/* Class data sent from this host on the channel is forwarded
+	 * in */
+	int priority;
+	/* Set once `channel' and `queue' are valid. Slots are never
+	 * emptied, which is what allows lookups without the lock. */
+	volatile int used;
+} channel_slot_t;
+
+typedef struct
+{
+	channel_slot_t *slots;
+	uint32_t size;
+	/* Indices of used slots, in registration order, so that the
+	 * registered channels can be walked without scanning every
+	 * slot. */
+	uint32_t *order;
+	volatile uint32_t length;
+	/* Serialises registration; also the mutex orta_select() waits
+	 * on for data arriving on any channel. */
+	pthread_mutex_t *lock;
+} channel_table_t;
+
+
+/**
+ * channel_table_init:
+ * Allocates an empty channel table of `size' slots (rounded up to a
+ * power of two), and makes `table' point to it.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int channel_table_init( channel_table_t **table, uint32_t size );
+
+/**
+ * channel_table_add:
+ * Registers `queue' as the queue for `channel', and `priority' as its
+ * class. Must be called with table->lock held. An existing
+ * registration is never replaced, as readers may still be holding the
+ * old queue.
+ * Returns TRUE if the channel was added, FALSE if it was already
+ * registered or the table is full.
+ */
+int channel_table_add( channel_table_t *table, uint32_t channel,
+		       queue_t *queue, int priority );
+
+/**
+ * channel_table_get:
+ * Returns the queue registered for `channel', or NULL if there is
+ * none. Safe to call without table->lock held.
+ */
+queue_t *channel_table_get( channel_table_t *table, uint32_t channel );
+
+/**
+ * channel_table_priority:
+ * Returns the class registered for `channel', or `fallback' if it
+ * isn't registered. Safe to call without table->lock held.
+ */
+int channel_table_priority( channel_table_t *table, uint32_t channel,
+			    int fallback );
+
+/**
+ * channel_table_at:
+ * Returns the `i'th registered slot (in registration order), for
+ * walking all channels. `i' must be less than table->length.
+ */
+channel_slot_t *channel_table_at( channel_table_t *table, uint32_t i );
+
+/**
+ * channel_table_destroy:
+ * Destroys all queues held in the table, then the table itself, and
+ * sets *table to NULL.
+ */
+int channel_table_destroy( channel_table_t **table );
+
+#endif
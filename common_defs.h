@@ -3,6 +3,15 @@
 
 #define TCP_PORT 5100
 
+/* Pings are sent and answered on their own port, so they aren't
+ * queued behind data; unless configured otherwise, this far above the
+ * data port. */
+#define PING_PORT_OFFSET 1
+
+/* Most threads which may receive and forward UDP traffic, each on its
+ * own socket bound to the data port. */
+#define MAX_RX_WORKERS 16
+
 
 #define TRUE 1
 #define FALSE 0
@@ -27,6 +36,57 @@
  * adding/removing the same link. */
 #define THRESHOLD_BUFFER 0.6
 
+/* Scales the thresholds for adding and dropping links. */
+#define THRESHOLD_CONSTANT 0.008
+
+/* OFFSET_FRACTION is the distance from the advertised value the
+ * current known weight of a link must be before it is definitely sent
+ * in a refresh packet.*/
+#define OFFSET_FRACTION 0.1
+
+/* REFRESH_CYCLES_FOR_SEND is the number of times the refresh
+ * dispatcher will run before information on a link is guaranteed to
+ * be sent to the rest of the group. */
+#define REFRESH_CYCLES_FOR_SEND 5
+
+/* Seconds a member may be silent before we try to reach it (a little
+ * larger than the normal refresh cycle time). */
+#define MEMBER_TIMEOUT_S 70
+
+/* Time-to-live of data sent from this host. */
+#define DEFAULT_TTL 16
+
+/* Path MTU data is fragmented to, the smallest allowed, and the IPv4
+ * and UDP headers each fragment carries within it. */
+#define DEFAULT_MTU 1500
+#define MIN_MTU 576
+#define SEGMENT_OVERHEAD 28
+
+/* Bytes of fragments held for reassembly, and how long a message may
+ * wait for its last fragment. */
+#define REASSEMBLY_MAX_BYTES 4194304
+#define REASSEMBLY_TIMEOUT_US 1000000
+
+/* Bytes a paced link may send at once, and may hold waiting to be
+ * sent. */
+#define PACE_BURST 65536
+#define PACE_QUEUE_BYTES 1048576
+
+/* Bytes the least urgent class sends per turn under deficit round
+ * robin; each more urgent class sends twice what the next does. */
+#define DRR_QUANTUM 1500
+
+/* Under congestion control, how often each neighbour is told how its
+ * data is arriving, the queuing delay links are held to, as LEDBAT's
+ * target, and the bounds of each link's rate, in bytes per second. */
+#define CC_REPORT_INTERVAL_US 100000
+#define CC_TARGET_DELAY_US 25000
+#define CC_MIN_RATE 16384
+#define CC_MAX_RATE 125000000
+
+/* The values above are defaults only; each orta_t takes its settings
+ * from an orta_config_t. */
+
 /* Keyboard savers */
 typedef struct sockaddr_in sockaddr_in_t;
 typedef struct sockaddr sockaddr_t;
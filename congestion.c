@@ -0,0 +1,397 @@
+
+#include "congestion.h"
+#include "orta_data_packets.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+/**
+ * cc_init:
+ * Creates congestion state aiming for `target_us' of queuing delay on
+ * each link, with rates between `min_rate' and `max_rate' bytes per
+ * second, and makes `c' point to it. Links start at `start_rate', or
+ * at `max_rate' if it is 0, until loss or delay pull them down.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int cc_init( cc_t **c, uint32_t target_us, uint32_t min_rate,
+	     uint32_t max_rate, uint32_t start_rate )
+{
+	cc_t *t= (cc_t*)calloc( 1, sizeof(cc_t) );
+
+	if ( t == NULL )
+		return FALSE;
+
+	t->target_us= target_us ? target_us : 1;
+	t->min_rate= min_rate ? min_rate : 1;
+	t->max_rate= max_rate > t->min_rate ? max_rate : t->min_rate;
+	t->start_rate= start_rate ? start_rate : t->max_rate;
+	if ( t->start_rate < t->min_rate )
+		t->start_rate= t->min_rate;
+	if ( t->start_rate > t->max_rate )
+		t->start_rate= t->max_rate;
+
+	t->lock= (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
+	pthread_mutex_init( t->lock, NULL );
+
+	*c= t;
+	return TRUE;
+}
+
+
+/**
+ * cc_destroy:
+ * Frees the state and sets *c to NULL.
+ */
+void cc_destroy( cc_t **c )
+{
+	cc_t *t= *c;
+	cc_rx_t *r;
+	cc_tx_t *x;
+
+	while ( (r= t->rx) != NULL ) {
+		t->rx= r->next;
+		free( r );
+	}
+	while ( (x= t->tx) != NULL ) {
+		t->tx= x->next;
+		free( x );
+	}
+
+	pthread_mutex_destroy( t->lock );
+	free( t->lock );
+	free( t );
+	*c= NULL;
+}
+
+
+/**
+ * cc_rx:
+ * Returns the data arriving from `addr', starting afresh if it is new.
+ * The caller must hold c->lock.
+ * Returns NULL if there is no memory.
+ */
+static cc_rx_t *cc_rx( cc_t *c, uint32_t addr, uint64_t now_us )
+{
+	cc_rx_t *r;
+
+	for ( r= c->rx; r != NULL; r= r->next ) {
+		if ( r->addr == addr )
+			return r;
+	}
+
+	if ( (r= (cc_rx_t*)calloc( 1, sizeof(cc_rx_t) )) == NULL )
+		return NULL;
+
+	r->addr= addr;
+	r->reported_us= now_us;
+	r->next= c->rx;
+	c->rx= r;
+
+	return r;
+}
+
+
+/**
+ * cc_delay:
+ * Takes in a one-way delay of `d' measured at `now_us', moving on to a
+ * new period of the base delay history if the last is over.
+ */
+static void cc_delay( cc_rx_t *r, int32_t d, uint64_t now_us )
+{
+	if ( !r->have_current || d < r->current ) {
+		r->current= d;
+		r->have_current= TRUE;
+	}
+
+	if ( r->num_base && now_us-r->base_since_us < CC_BASE_PERIOD_US ) {
+		if ( d < r->base[r->num_base-1] )
+			r->base[r->num_base-1]= d;
+		return;
+	}
+
+	if ( r->num_base == CC_BASE_HISTORY ) {
+		memmove( r->base, r->base+1,
+			 (CC_BASE_HISTORY-1)*sizeof(int32_t) );
+		r->num_base--;
+	}
+	r->base[r->num_base++]= d;
+	r->base_since_us= now_us;
+}
+
+
+/**
+ * cc_arrived:
+ * Notes the `len' bytes at `buf', a run of packets `seg' bytes apart,
+ * arriving from the neighbour `from' at `now_us'. Only data and parity
+ * packets are counted.
+ */
+void cc_arrived( cc_t *c, uint32_t from, const char *buf, int len,
+		 int seg, uint64_t now_us )
+{
+	const data_packet_t *packet;
+	cc_rx_t *r;
+	uint32_t delay;
+	int off;
+
+	pthread_mutex_lock( c->lock );
+
+	if ( (r= cc_rx( c, from, now_us )) == NULL ) {
+		pthread_mutex_unlock( c->lock );
+		return;
+	}
+	r->heard_us= now_us;
+
+	for ( off= 0; off+(int)sizeof(data_header_t) <= len; off+= seg ) {
+		packet= (const data_packet_t*)(buf+off);
+		if ( packet->header.type != data && 
+		     packet->header.type != data_parity )
+			continue;
+
+		r->received++;
+		r->bytes+= len-off < seg ? len-off : seg;
+
+		/* Only differences between delays are used, so each is
+		 * kept relative to the first */
+		delay= (uint32_t)now_us-packet->sent_us;
+		if ( !r->num_base )
+			r->origin= delay;
+		cc_delay( r, (int32_t)(delay-r->origin), now_us );
+	}
+
+	pthread_mutex_unlock( c->lock );
+}
+
+
+/**
+ * cc_report:
+ * Passes `fn' a report on the data which has arrived from each
+ * neighbour since the last, and forgets those gone quiet. The reports
+ * are made under c->lock, and passed on once it is released.
+ */
+void cc_report( cc_t *c, uint64_t now_us, cc_report_fn_t fn, void *arg )
+{
+	link_report_packet_t *reports= NULL, *report;
+	uint32_t *addrs= NULL;
+	cc_rx_t **p= &(c->rx), *r;
+	int32_t base;
+	uint32_t i, n= 0, num= 0;
+
+	pthread_mutex_lock( c->lock );
+
+	for ( r= c->rx; r != NULL; r= r->next )
+		num++;
+
+	if ( num != 0 ) {
+		reports= (link_report_packet_t*)calloc( num, 
+					sizeof(link_report_packet_t) );
+		addrs= (uint32_t*)malloc( num*sizeof(uint32_t) );
+	}
+
+	while ( (r= *p) != NULL ) {
+		if ( now_us-r->heard_us > CC_IDLE_US ) {
+			*p= r->next;
+			free( r );
+			continue;
+		}
+		p= &(r->next);
+
+		/* With no memory for the reports, what they would have
+		 * said is kept for the next */
+		if ( !r->have_current || reports == NULL || addrs == NULL )
+			continue;
+
+		base= r->base[0];
+		for ( i= 1; i < r->num_base; i++ ) {
+			if ( r->base[i] < base )
+				base= r->base[i];
+		}
+
+		report= &(reports[n]);
+		report->received= r->received;
+		report->bytes= r->bytes;
+		report->interval_us= now_us-r->reported_us;
+		report->queue_delay_us= r->current-base;
+		addrs[n++]= r->addr;
+
+		r->bytes= 0;
+		r->have_current= FALSE;
+		r->reported_us= now_us;
+	}
+
+	pthread_mutex_unlock( c->lock );
+
+	for ( i= 0; i < n; i++ )
+		fn( arg, addrs[i], &(reports[i]) );
+
+	free( reports );
+	free( addrs );
+}
+
+
+/**
+ * cc_tx:
+ * Returns the link to `addr', starting it at `rate' if it is new. The
+ * caller must hold c->lock.
+ * Returns NULL if there is no memory.
+ */
+static cc_tx_t *cc_tx( cc_t *c, uint32_t addr, uint32_t rate )
+{
+	cc_tx_t *t;
+
+	for ( t= c->tx; t != NULL; t= t->next ) {
+		if ( t->addr == addr )
+			return t;
+	}
+
+	if ( (t= (cc_tx_t*)calloc( 1, sizeof(cc_tx_t) )) == NULL )
+		return NULL;
+
+	t->addr= addr;
+	t->rate= rate;
+	t->next= c->tx;
+	c->tx= t;
+
+	return t;
+}
+
+
+/**
+ * cc_forget:
+ * Forgets the rate and congestion of the link to `addr', as when the
+ * neighbour is gone.
+ */
+void cc_forget( cc_t *c, uint32_t addr )
+{
+	cc_tx_t **p= &(c->tx), *t;
+
+	pthread_mutex_lock( c->lock );
+
+	while ( (t= *p) != NULL ) {
+		if ( t->addr == addr ) {
+			*p= t->next;
+			free( t );
+			break;
+		}
+		p= &(t->next);
+	}
+
+	pthread_mutex_unlock( c->lock );
+}
+
+
+/**
+ * cc_feedback:
+ * Adapts the rate of the link to `to' from its receiver's `report',
+ * given the packets `sent' over it and the `drops' of those with no
+ * room to wait, both counted from when it was first paced, and the
+ * `queued' bytes waiting to be sent over it now. Sets *rate
+ * to the new rate and *penalty to the distance to add to the link.
+ * Loss cuts the rate in proportion, and queuing beyond the target
+ * backs it off to a little under what is getting through, as in GCC;
+ * otherwise it grows the more the further the queuing delay is below
+ * the target, as in LEDBAT, to no more than half as much again as is
+ * getting through. While data is waiting for a link found clear, it
+ * is the rate holding the data back, so the rate grows by
+ * CC_BACKLOG_GAIN instead, and data shed for want of room to queue it
+ * is not held against the link. A link found congested in CC_PERSIST
+ * reports in a row is penalised by its smoothed queuing delay and
+ * loss, counting data shed meanwhile, until it has been clear in as
+ * many.
+ * Returns TRUE on success, or FALSE if there is no memory.
+ */
+int cc_feedback( cc_t *c, uint32_t to, const link_report_packet_t *report,
+		 uint32_t sent, uint32_t drops, uint32_t queued,
+		 uint32_t *rate, uint32_t *penalty )
+{
+	cc_tx_t *t;
+	uint64_t delivered= 0, r;
+	uint32_t loss= 0, shed= 0, lost;
+	int clear, backlogged;
+
+	if ( report->interval_us )
+		delivered= (uint64_t)report->bytes*1000000/report->interval_us;
+
+	pthread_mutex_lock( c->lock );
+
+	if ( (t= cc_tx( c, to, c->start_rate )) == NULL ) {
+		pthread_mutex_unlock( c->lock );
+		return FALSE;
+	}
+
+	/* Packets lost on the link itself, rather than on the way to
+	 * us; a receiver which has started counting again finds none */
+	lost= (sent-t->sent)-(report->received-t->received);
+	if ( t->reported && sent != t->sent && 
+	     (int32_t)lost > 0 && lost <= sent-t->sent )
+		loss= (uint64_t)lost*1000/(sent-t->sent);
+	/* Data dropped here as the link couldn't keep up */
+	if ( t->reported && drops != t->drops )
+		shed= (uint64_t)(drops-t->drops)*1000/
+			(drops-t->drops+sent-t->sent);
+
+	/* Data waiting on a link which gets it through without loss or
+	 * queuing is held back by its rate alone; what is shed then is
+	 * our doing, not the link's */
+	clear= loss <= CC_LOSS_THRESHOLD && 
+		report->queue_delay_us <= c->target_us;
+	backlogged= clear && (queued != 0 || shed != 0);
+	if ( clear )
+		shed= 0;
+
+	r= t->rate;
+	if ( loss > CC_LOSS_THRESHOLD )
+		r-= r*loss/2000;
+	else if ( report->queue_delay_us > c->target_us ) {
+		if ( r > delivered*CC_BACKOFF/100 )
+			r= delivered*CC_BACKOFF/100;
+	}
+	else if ( backlogged )
+		r*= CC_BACKLOG_GAIN;
+	else {
+		r+= r*(c->target_us-report->queue_delay_us)/
+			((uint64_t)c->target_us*CC_GAIN);
+		if ( r > delivered*3/2 && r > t->rate )
+			r= delivered*3/2 > t->rate ? delivered*3/2 : t->rate;
+	}
+
+	if ( r < c->min_rate )
+		r= c->min_rate;
+	if ( r > c->max_rate )
+		r= c->max_rate;
+	t->rate= r;
+
+	/* x= 7/8 x + 1/8 sample, for each of delay and loss, counting
+	 * data shed along with that lost */
+	t->queue_delay_us= t->queue_delay_us-(t->queue_delay_us>>3)+
+		(report->queue_delay_us>>3);
+	t->loss= t->loss-(t->loss>>3)+((loss+shed)>>3);
+
+	if ( !clear ) {
+		t->clear= 0;
+		if ( t->congested < CC_PERSIST )
+			t->congested++;
+	}
+	else {
+		t->congested= 0;
+		if ( t->clear < CC_PERSIST )
+			t->clear++;
+	}
+
+	if ( t->congested >= CC_PERSIST )
+		t->penalty= t->queue_delay_us+t->loss*CC_LOSS_PENALTY_US;
+	else if ( t->clear >= CC_PERSIST )
+		t->penalty= 0;
+
+	t->sent= sent;
+	t->received= report->received;
+	t->drops= drops;
+	t->reported= TRUE;
+
+	*rate= t->rate;
+	*penalty= t->penalty;
+
+	pthread_mutex_unlock( c->lock );
+
+	return TRUE;
+}
@@ -0,0 +1,167 @@
+#ifndef __CONGESTION_
+#define __CONGESTION_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "common_defs.h"
+#include "orta_control_packets.h"
+
+/* The least delay of each of this many periods is kept, and the least
+ * of those taken as the delay of a link with nothing queued on it, as
+ * in LEDBAT (RFC 6817) */
+#define CC_BASE_HISTORY 10
+#define CC_BASE_PERIOD_US 60000000
+
+/* A neighbour not heard from for this long is forgotten */
+#define CC_IDLE_US 10000000
+
+/* Loss, in parts per thousand, above which a link is taken to be
+ * congested */
+#define CC_LOSS_THRESHOLD 20
+
+/* Below the target delay, a link's rate grows by up to 1/CC_GAIN each
+ * report, the less the nearer the target; above it, the rate drops to
+ * CC_BACKOFF percent of what is getting through, as in GCC */
+#define CC_GAIN 8
+#define CC_BACKOFF 85
+
+/* While data is waiting to be sent over a link whose reports find it
+ * clear, its rate is taken to be holding it back, and is multiplied
+ * by this each report */
+#define CC_BACKLOG_GAIN 2
+
+/* Reports in a row which must find a link congested before it is
+ * penalised, or clear before the penalty is lifted */
+#define CC_PERSIST 10
+
+/* Microseconds added to a penalised link's distance for each part per
+ * thousand of its loss */
+#define CC_LOSS_PENALTY_US 100
+
+/**
+ * The data arriving from one neighbour.
+ */
+typedef struct _cc_rx
+{
+	uint32_t addr;
+	/* Packets received ever, and bytes since the last report */
+	uint32_t received;
+	uint32_t bytes;
+	uint64_t reported_us;
+	uint64_t heard_us;
+
+	/* One-way delays are kept as offsets from the first measured,
+	 * as only their differences mean anything: the least since the
+	 * last report, and the least of each recent period, the current
+	 * one last */
+	uint32_t origin;
+	int32_t current;
+	int have_current;
+	int32_t base[CC_BASE_HISTORY];
+	uint32_t num_base;
+	uint64_t base_since_us;
+
+	struct _cc_rx *next;
+} cc_rx_t;
+
+/**
+ * The rate data is forwarded to one neighbour at, and how congested its
+ * reports have found the link.
+ */
+typedef struct _cc_tx
+{
+	uint32_t addr;
+	uint32_t rate;
+	/* Packets sent, received and dropped before being sent, as of
+	 * the last report */
+	uint32_t sent;
+	uint32_t received;
+	uint32_t drops;
+	int reported;
+	/* Queuing delay and loss, smoothed over reports, in microseconds
+	 * and parts per thousand */
+	uint32_t queue_delay_us;
+	uint32_t loss;
+	/* Reports in a row finding the link congested, or clear */
+	uint32_t congested;
+	uint32_t clear;
+	/* Microseconds added to the link's distance */
+	uint32_t penalty;
+
+	struct _cc_tx *next;
+} cc_tx_t;
+
+typedef struct
+{
+	cc_rx_t *rx;
+	cc_tx_t *tx;
+	/* Queuing delay aimed for, the bounds of each link's rate, and
+	 * the rate a link starts at */
+	uint32_t target_us;
+	uint32_t min_rate;
+	uint32_t max_rate;
+	uint32_t start_rate;
+	pthread_mutex_t *lock;
+} cc_t;
+
+/* Sends a report on the data arriving from `addr' */
+typedef void (*cc_report_fn_t)( void *arg, uint32_t addr,
+				link_report_packet_t *report );
+
+
+/**
+ * cc_init:
+ * Creates congestion state aiming for `target_us' of queuing delay on
+ * each link, with rates between `min_rate' and `max_rate' bytes per
+ * second, and makes `c' point to it. Links start at `start_rate', or
+ * at `max_rate' if it is 0, until loss or delay pull them down.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int cc_init( cc_t **c, uint32_t target_us, uint32_t min_rate,
+	     uint32_t max_rate, uint32_t start_rate );
+
+/**
+ * cc_destroy:
+ * Frees the state and sets *c to NULL.
+ */
+void cc_destroy( cc_t **c );
+
+/**
+ * cc_arrived:
+ * Notes the `len' bytes at `buf', a run of packets `seg' bytes apart,
+ * arriving from the neighbour `from' at `now_us'. Only data and parity
+ * packets are counted.
+ */
+void cc_arrived( cc_t *c, uint32_t from, const char *buf, int len,
+		 int seg, uint64_t now_us );
+
+/**
+ * cc_report:
+ * Passes `fn' a report on the data which has arrived from each
+ * neighbour since the last, and forgets those gone quiet. The reports
+ * are made under c->lock, and passed on once it is released.
+ */
+void cc_report( cc_t *c, uint64_t now_us, cc_report_fn_t fn, void *arg );
+
+/**
+ * cc_forget:
+ * Forgets the rate and congestion of the link to `addr', as when the
+ * neighbour is gone.
+ */
+void cc_forget( cc_t *c, uint32_t addr );
+
+/**
+ * cc_feedback:
+ * Adapts the rate of the link to `to' from its receiver's `report',
+ * given the packets `sent' over it and the `drops' of those with no
+ * room to wait, both counted from when it was first paced, and the
+ * `queued' bytes waiting to be sent over it now. Sets *rate
+ * to the new rate and *penalty to the distance to add to the link.
+ * Returns TRUE on success, or FALSE if there is no memory.
+ */
+int cc_feedback( cc_t *c, uint32_t to, const link_report_packet_t *report,
+		 uint32_t sent, uint32_t drops, uint32_t queued,
+		 uint32_t *rate, uint32_t *penalty );
+
+#endif
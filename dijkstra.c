@@ -116,7 +116,9 @@ void shortest_path_graph( uint32_t start_node, links_t *links, links_t *out )
 		}
 
 		if ( node == NULL ) {
-			return;
+			d_queue_data_free( data );
+			d_queue_clear( queue );
+			break;
 		}
 
 		/* For each vertex adjacent to u, such that it is in 'queue' */
@@ -132,6 +134,8 @@ void shortest_path_graph( uint32_t start_node, links_t *links, links_t *out )
 		/* Add link to output graph */
 		links_add( out, data->ip2, data->ip );
 		link_update( out, data->ip2, data->ip, data->distance );
+
+		d_queue_data_free( data );
 	}
 
 	queue_destroy( &queue );
@@ -192,6 +196,8 @@ void shortest_paths( uint32_t start_node, links_t *links, linked_list_t *out )
 			*outvar= data->distance;
 			list_add( out, data->ip, outvar );
 		}
+
+		d_queue_data_free( data );
 	}
 
 	queue_destroy( &queue );
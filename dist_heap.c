@@ -0,0 +1,42 @@
+
+#include "dist_heap.h"
+
+
+/**
+ * dist_heap_push:
+ * Adds `entry' to the `len' entries of `heap', which must have room.
+ */
+void dist_heap_push( uint64_t *heap, uint32_t *len, uint64_t entry )
+{
+	uint32_t i= (*len)++;
+
+	while ( i > 0 && heap[(i-1)/2] > entry ) {
+		heap[i]= heap[(i-1)/2];
+		i= (i-1)/2;
+	}
+	heap[i]= entry;
+}
+
+
+/**
+ * dist_heap_pop:
+ * Removes and returns the smallest of the `len' entries of `heap',
+ * which must not be empty.
+ */
+uint64_t dist_heap_pop( uint64_t *heap, uint32_t *len )
+{
+	uint64_t top= heap[0], last= heap[--(*len)];
+	uint32_t i= 0, child;
+
+	while ( (child= 2*i+1) < *len ) {
+		if ( child+1 < *len && heap[child+1] < heap[child] )
+			child++;
+		if ( heap[child] >= last )
+			break;
+		heap[i]= heap[child];
+		i= child;
+	}
+	heap[i]= last;
+
+	return top;
+}
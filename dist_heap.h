@@ -0,0 +1,30 @@
+#ifndef __DIST_HEAP_
+#define __DIST_HEAP_
+
+#include <stdint.h>
+
+/**
+ * A distance heap is a binary min-heap of 64-bit entries in a caller's
+ * array, used by the shortest path code. Each entry carries a distance
+ * in its top half and a node index in the bottom half, so plain
+ * integer comparison orders entries by distance.
+ */
+#define HEAP_ENTRY(d,n) (((uint64_t)(d)<<32) | (uint32_t)(n))
+#define HEAP_DIST(e)    ((uint32_t)((e)>>32))
+#define HEAP_NODE(e)    ((uint32_t)(e))
+
+
+/**
+ * dist_heap_push:
+ * Adds `entry' to the `len' entries of `heap', which must have room.
+ */
+void dist_heap_push( uint64_t *heap, uint32_t *len, uint64_t entry );
+
+/**
+ * dist_heap_pop:
+ * Removes and returns the smallest of the `len' entries of `heap',
+ * which must not be empty.
+ */
+uint64_t dist_heap_pop( uint64_t *heap, uint32_t *len );
+
+#endif
@@ -0,0 +1,586 @@
+
+#include "fec.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Largest data a packet may carry, and so a parity packet; the
+ * parity header holds lengths in 16 bits */
+#define FEC_MAX_DATA 65535
+
+
+/**
+ * fec_xor:
+ * XORs `len' bytes of `src' into `dst', a word at a time.
+ */
+static void fec_xor( char *dst, const char *src, uint32_t len )
+{
+	uint64_t a, b;
+	uint32_t i= 0;
+
+	for ( ; i+sizeof(uint64_t) <= len; i+= sizeof(uint64_t) ) {
+		memcpy( &a, dst+i, sizeof(a) );
+		memcpy( &b, src+i, sizeof(b) );
+		a^= b;
+		memcpy( dst+i, &a, sizeof(a) );
+	}
+	for ( ; i < len; i++ )
+		dst[i]^= src[i];
+}
+
+
+/**
+ * fec_hash:
+ * Chain for the stream on `channel' from `source'.
+ */
+static uint32_t fec_hash( uint32_t source, uint32_t channel )
+{
+	return ((source^channel)*2654435761u) >> 24 & (FEC_BUCKETS-1);
+}
+
+
+/**
+ * fec_init:
+ * Creates empty FEC state, and makes `f' point to it. Parity is
+ * passed on as it arrives, or with `reencode' set, only once the
+ * packets it covers are all in hand.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int fec_init( fec_t **f, int reencode )
+{
+	fec_t *t= (fec_t*)calloc( 1, sizeof(fec_t) );
+
+	if ( t == NULL )
+		return FALSE;
+
+	t->reencode= reencode;
+
+	t->tx_lock= (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
+	pthread_mutex_init( t->tx_lock, NULL );
+	t->lock= (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
+	pthread_mutex_init( t->lock, NULL );
+
+	*f= t;
+	return TRUE;
+}
+
+
+/**
+ * fec_stream_free:
+ * Takes stream `s' out of `f' and frees it, with the packets it holds.
+ */
+static void fec_stream_free( fec_t *f, fec_stream_t *s )
+{
+	fec_stream_t **p= &(f->buckets[fec_hash( s->source, s->channel )]);
+	int i;
+
+	while ( *p != s )
+		p= &((*p)->chain);
+	*p= s->chain;
+
+	if ( s->older != NULL ) s->older->newer= s->newer;
+	else                    f->oldest= s->newer;
+	if ( s->newer != NULL ) s->newer->older= s->older;
+	else                    f->newest= s->older;
+	f->num_streams--;
+
+	for ( i= 0; i < FEC_WINDOW; i++ )
+		free( s->slot[i].packet );
+	for ( i= 0; i < FEC_PENDING; i++ )
+		free( s->pending[i] );
+	free( s );
+}
+
+
+/**
+ * fec_destroy:
+ * Frees `f' and everything held in it, and sets *f to NULL.
+ */
+void fec_destroy( fec_t **f )
+{
+	fec_t *t= *f;
+	fec_tx_t *tx;
+
+	while ( t->oldest != NULL )
+		fec_stream_free( t, t->oldest );
+
+	while ( (tx= t->tx) != NULL ) {
+		t->tx= tx->next;
+		free( tx->parity );
+		free( tx );
+	}
+
+	pthread_mutex_destroy( t->tx_lock );
+	free( t->tx_lock );
+	pthread_mutex_destroy( t->lock );
+	free( t->lock );
+	free( t );
+
+	*f= NULL;
+}
+
+
+/**
+ * fec_tx:
+ * Returns what this host sends on `channel', making it if this is the
+ * first time, or NULL if there is no memory. The caller must hold
+ * f->tx_lock.
+ */
+static fec_tx_t *fec_tx( fec_t *f, uint32_t channel )
+{
+	fec_tx_t *tx= f->tx;
+
+	while ( tx != NULL && tx->channel != channel )
+		tx= tx->next;
+
+	if ( tx == NULL &&
+	     (tx= (fec_tx_t*)calloc( 1, sizeof(fec_tx_t) )) != NULL ) {
+		tx->channel= channel;
+		tx->next= f->tx;
+		f->tx= tx;
+	}
+
+	return tx;
+}
+
+
+/**
+ * fec_set_group:
+ * Has a parity packet sent for every `group' data packets this host
+ * sends on `channel'; 0 to send none.
+ * Returns TRUE on success, or FALSE if `group' is over FEC_MAX_GROUP
+ * or there is no memory.
+ */
+int fec_set_group( fec_t *f, uint32_t channel, uint32_t group )
+{
+	fec_tx_t *tx;
+
+	if ( group > FEC_MAX_GROUP )
+		return FALSE;
+
+	pthread_mutex_lock( f->tx_lock );
+
+	if ( (tx= fec_tx( f, channel )) == NULL ||
+	     (group && tx->parity == NULL &&
+	      (tx->parity= (char*)malloc( FEC_MAX_DATA )) == NULL) ) {
+		pthread_mutex_unlock( f->tx_lock );
+		return FALSE;
+	}
+
+	/* Packets sent already under the old setting go unprotected */
+	tx->group= group;
+	tx->count= 0;
+
+	pthread_mutex_unlock( f->tx_lock );
+
+	return TRUE;
+}
+
+
+/**
+ * fec_group:
+ * Returns the number of data packets per parity packet this host
+ * sends on `channel', or 0.
+ */
+uint32_t fec_group( fec_t *f, uint32_t channel )
+{
+	fec_tx_t *tx;
+	uint32_t group= 0;
+
+	pthread_mutex_lock( f->tx_lock );
+
+	for ( tx= f->tx; tx != NULL; tx= tx->next ) {
+		if ( tx->channel == channel ) {
+			group= tx->group;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock( f->tx_lock );
+
+	return group;
+}
+
+
+/**
+ * fec_encode:
+ * Numbers `packet', about to be sent from this host, in sequence on
+ * its channel, and adds it to the parity of its group.
+ * Returns the parity packet, to be sent after `packet' and then
+ * freed, if `packet' completed its group, or NULL.
+ */
+data_packet_t *fec_encode( fec_t *f, data_packet_t *packet )
+{
+	fec_tx_t *tx;
+	data_packet_t *parity= NULL;
+	parity_header_t *ph;
+
+	pthread_mutex_lock( f->tx_lock );
+
+	if ( (tx= fec_tx( f, packet->header.channel )) == NULL ) {
+		pthread_mutex_unlock( f->tx_lock );
+		packet->seq= 0;
+		return NULL;
+	}
+
+	packet->seq= tx->seq++;
+
+	if ( !tx->group || packet->datalen > FEC_MAX_DATA ) {
+		pthread_mutex_unlock( f->tx_lock );
+		return NULL;
+	}
+
+	if ( tx->count == 0 ) {
+		tx->first= packet->seq;
+		tx->len= 0;
+		tx->msg_id= 0;
+		tx->frag= 0;
+		tx->frags= 0;
+		tx->datalen= 0;
+	}
+
+	/* Shorter packets count as zero padded to the longest */
+	if ( packet->datalen > tx->len ) {
+		memset( tx->parity+tx->len, 0, packet->datalen-tx->len );
+		tx->len= packet->datalen;
+	}
+	fec_xor( tx->parity, &(packet->data), packet->datalen );
+	tx->msg_id^= packet->msg_id;
+	tx->frag^= packet->frag;
+	tx->frags^= packet->frags;
+	tx->datalen^= packet->datalen;
+
+	if ( ++tx->count == tx->group &&
+	     (parity= (data_packet_t*)malloc( sizeof(data_header_t)+
+					      sizeof(parity_header_t)+
+					      tx->len )) != NULL ) {
+		parity->header.type= data_parity;
+		parity->header.channel= packet->header.channel;
+		parity->header.priority= packet->header.priority;
+		parity->source= packet->source;
+		parity->ttl= packet->ttl;
+		parity->datalen= sizeof(parity_header_t)+tx->len;
+		parity->msg_id= tx->msg_id;
+		parity->frag= tx->frag;
+		parity->frags= tx->frags;
+		parity->seq= tx->first;
+
+		ph= (parity_header_t*)&(parity->data);
+		ph->first= tx->first;
+		ph->count= tx->count;
+		ph->datalen= tx->datalen;
+		memcpy( ph+1, tx->parity, tx->len );
+	}
+	if ( tx->count == tx->group )
+		tx->count= 0;
+
+	pthread_mutex_unlock( f->tx_lock );
+
+	return parity;
+}
+
+
+/**
+ * fec_stream:
+ * Returns the stream on `channel' from `source', or NULL if it isn't
+ * being followed. The caller must hold f->lock.
+ */
+static fec_stream_t *fec_stream( fec_t *f, uint32_t source, uint32_t channel )
+{
+	fec_stream_t *s= f->buckets[fec_hash( source, channel )];
+
+	while ( s != NULL && (s->source != source || s->channel != channel) )
+		s= s->chain;
+
+	/* Most recently heard moves to the end of the list */
+	if ( s != NULL && s != f->newest ) {
+		if ( s->older != NULL ) s->older->newer= s->newer;
+		else                    f->oldest= s->newer;
+		s->newer->older= s->older;
+
+		s->older= f->newest;
+		s->newer= NULL;
+		f->newest->newer= s;
+		f->newest= s;
+	}
+
+	return s;
+}
+
+
+/**
+ * fec_stream_new:
+ * Starts following the stream on `channel' from `source', giving up
+ * on the least recently heard if too many are followed already.
+ * Returns the stream, or NULL if there is no memory.
+ */
+static fec_stream_t *fec_stream_new( fec_t *f, uint32_t source,
+				     uint32_t channel )
+{
+	fec_stream_t *s;
+	uint32_t h= fec_hash( source, channel );
+
+	if ( f->num_streams >= FEC_STREAMS )
+		fec_stream_free( f, f->oldest );
+
+	if ( (s= (fec_stream_t*)calloc( 1, sizeof(fec_stream_t) )) == NULL )
+		return NULL;
+
+	s->source= source;
+	s->channel= channel;
+
+	s->chain= f->buckets[h];
+	f->buckets[h]= s;
+
+	s->older= f->newest;
+	if ( f->newest != NULL ) f->newest->newer= s;
+	else                     f->oldest= s;
+	f->newest= s;
+	f->num_streams++;
+
+	return s;
+}
+
+
+/**
+ * fec_held:
+ * Returns packet `seq' of stream `s', or NULL if it isn't held.
+ */
+static data_packet_t *fec_held( fec_stream_t *s, uint32_t seq )
+{
+	fec_slot_t *slot= &(s->slot[seq & (FEC_WINDOW-1)]);
+
+	return (slot->packet != NULL && slot->seq == seq) ? slot->packet : NULL;
+}
+
+
+/**
+ * fec_hold:
+ * Keeps a copy of `packet' in stream `s', in place of the packet
+ * FEC_WINDOW before it.
+ */
+static void fec_hold( fec_stream_t *s, data_packet_t *packet )
+{
+	fec_slot_t *slot= &(s->slot[packet->seq & (FEC_WINDOW-1)]);
+	size_t len= sizeof(data_header_t)+packet->datalen;
+
+	free( slot->packet );
+	if ( (slot->packet= (data_packet_t*)malloc( len )) != NULL ) {
+		memcpy( slot->packet, packet, len );
+		slot->seq= packet->seq;
+	}
+}
+
+
+/**
+ * fec_missing:
+ * Returns the number of packets covered by `parity' which stream `s'
+ * doesn't hold, setting *seq to one of them.
+ */
+static int fec_missing( fec_stream_t *s, data_packet_t *parity, uint32_t *seq )
+{
+	parity_header_t *ph= (parity_header_t*)&(parity->data);
+	uint32_t i;
+	int missing= 0;
+
+	for ( i= 0; i < ph->count; i++ ) {
+		if ( fec_held( s, ph->first+i ) == NULL ) {
+			*seq= ph->first+i;
+			missing++;
+		}
+	}
+
+	return missing;
+}
+
+
+/**
+ * fec_rebuild:
+ * Rebuilds packet `seq' of stream `s' from `parity' and the other
+ * packets it covers, and holds on to it.
+ * Returns the packet, or NULL if there is no memory or the parity
+ * doesn't add up.
+ */
+static data_packet_t *fec_rebuild( fec_stream_t *s, data_packet_t *parity,
+				   uint32_t seq )
+{
+	parity_header_t *ph= (parity_header_t*)&(parity->data);
+	uint32_t len= parity->datalen-sizeof(parity_header_t);
+	data_packet_t *packet, *other;
+	uint32_t i;
+
+	if ( (packet= (data_packet_t*)malloc( sizeof(data_header_t)+len )) == NULL )
+		return NULL;
+
+	packet->header.type= data;
+	packet->header.channel= parity->header.channel;
+	packet->header.priority= parity->header.priority;
+	packet->source= parity->source;
+	packet->ttl= parity->ttl;
+	packet->datalen= ph->datalen;
+	packet->msg_id= parity->msg_id;
+	packet->frag= parity->frag;
+	packet->frags= parity->frags;
+	packet->seq= seq;
+	memcpy( &(packet->data), ph+1, len );
+
+	for ( i= 0; i < ph->count; i++ ) {
+		if ( ph->first+i == seq )
+			continue;
+
+		other= fec_held( s, ph->first+i );
+		if ( other->datalen > len ) {
+			free( packet );
+			return NULL;
+		}
+		packet->datalen^= other->datalen;
+		packet->msg_id^= other->msg_id;
+		packet->frag^= other->frag;
+		packet->frags^= other->frags;
+		fec_xor( &(packet->data), &(other->data), other->datalen );
+	}
+	packet->datalen&= 0xffff;
+
+	if ( packet->datalen > len ) {
+		free( packet );
+		return NULL;
+	}
+
+	fec_hold( s, packet );
+
+	return packet;
+}
+
+
+/**
+ * fec_settle:
+ * Rebuilds the packet `parity' is missing, if it is missing only one.
+ * Returns TRUE if the group is then whole, setting *recovered to any
+ * packet rebuilt, or FALSE if more are missing.
+ */
+static int fec_settle( fec_stream_t *s, data_packet_t *parity,
+		       data_packet_t **recovered )
+{
+	uint32_t seq;
+
+	switch ( fec_missing( s, parity, &seq ) ) {
+	case 0:
+		return TRUE;
+	case 1:
+		*recovered= fec_rebuild( s, parity, seq );
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+
+/**
+ * fec_data:
+ * Holds on to arriving data packet `packet', if its stream is being
+ * followed, in case it is needed to rebuild another. Sets *recovered
+ * to a packet it let be rebuilt, and *forward to a parity packet to
+ * pass on now that its group is whole, or either to NULL; both are
+ * to be freed.
+ * Returns FALSE if `packet' has already been received, or rebuilt.
+ */
+int fec_data( fec_t *f, data_packet_t *packet,
+	      data_packet_t **recovered, data_packet_t **forward )
+{
+	fec_stream_t *s;
+	parity_header_t *ph;
+	int i;
+
+	*recovered= NULL;
+	*forward= NULL;
+
+	/* Nothing is followed until parity is seen */
+	if ( !f->num_streams )
+		return TRUE;
+
+	pthread_mutex_lock( f->lock );
+
+	if ( (s= fec_stream( f, packet->source, packet->header.channel )) == NULL ) {
+		pthread_mutex_unlock( f->lock );
+		return TRUE;
+	}
+
+	if ( fec_held( s, packet->seq ) != NULL ) {
+		pthread_mutex_unlock( f->lock );
+		return FALSE;
+	}
+	fec_hold( s, packet );
+
+	/* This may complete the group of a parity packet waiting */
+	for ( i= 0; i < FEC_PENDING; i++ ) {
+		if ( s->pending[i] == NULL )
+			continue;
+		ph= (parity_header_t*)&(s->pending[i]->data);
+		if ( packet->seq-ph->first >= ph->count )
+			continue;
+
+		if ( fec_settle( s, s->pending[i], recovered ) ) {
+			if ( f->reencode )
+				*forward= s->pending[i];
+			else
+				free( s->pending[i] );
+			s->pending[i]= NULL;
+		}
+		break;
+	}
+
+	pthread_mutex_unlock( f->lock );
+
+	return TRUE;
+}
+
+
+/**
+ * fec_parity:
+ * Rebuilds the one packet `parity' covers that is missing, if only
+ * one is, or else holds it until more of its group arrive. Sets
+ * *recovered and *forward as fec_data().
+ */
+void fec_parity( fec_t *f, data_packet_t *parity,
+		 data_packet_t **recovered, data_packet_t **forward )
+{
+	parity_header_t *ph= (parity_header_t*)&(parity->data);
+	size_t len= sizeof(data_header_t)+parity->datalen;
+	fec_stream_t *s;
+	data_packet_t *copy;
+
+	*recovered= NULL;
+	*forward= NULL;
+
+	if ( parity->datalen < sizeof(parity_header_t) ||
+	     ph->count == 0 || ph->count > FEC_MAX_GROUP )
+		return;
+
+	if ( (copy= (data_packet_t*)malloc( len )) == NULL )
+		return;
+	memcpy( copy, parity, len );
+
+	pthread_mutex_lock( f->lock );
+
+	if ( (s= fec_stream( f, parity->source, parity->header.channel )) == NULL &&
+	     (s= fec_stream_new( f, parity->source, parity->header.channel )) == NULL ) {
+		pthread_mutex_unlock( f->lock );
+		free( copy );
+		return;
+	}
+
+	if ( fec_settle( s, copy, recovered ) ) {
+		if ( f->reencode )
+			*forward= copy;
+		else
+			free( copy );
+	}
+	else {
+		/* The oldest waiting is given up on to make room */
+		free( s->pending[s->next_pending] );
+		s->pending[s->next_pending]= copy;
+		s->next_pending= (s->next_pending+1) % FEC_PENDING;
+	}
+
+	pthread_mutex_unlock( f->lock );
+}
@@ -0,0 +1,156 @@
+#ifndef __FEC_
+#define __FEC_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "common_defs.h"
+#include "orta_data_packets.h"
+
+/* Most data packets one parity packet may cover */
+#define FEC_MAX_GROUP 32
+
+/* Room a packet on a protected channel leaves, so that its parity
+ * packet is no larger than it is */
+#define FEC_OVERHEAD sizeof(parity_header_t)
+
+/* Recent packets of each stream held for rebuilding others; a power
+ * of two, and well over FEC_MAX_GROUP so that late packets are still
+ * held when their parity arrives */
+#define FEC_WINDOW 128
+
+/* Parity packets of each stream held waiting for more of their
+ * group to arrive */
+#define FEC_PENDING 8
+
+/* Streams followed at once, and their hash chains */
+#define FEC_STREAMS 64
+#define FEC_BUCKETS 64
+
+/**
+ * What this host sends on one channel: the sequence number of its
+ * next packet, and the parity of the group it is part of.
+ */
+typedef struct _fec_tx
+{
+	uint32_t channel;
+	uint32_t seq;
+
+	/* Data packets per parity packet, or 0 */
+	uint32_t group;
+	/* Packets covered so far, the first of them, and the longest */
+	uint32_t count;
+	uint32_t first;
+	uint32_t len;
+	/* Running XOR of their header fields and data */
+	uint32_t msg_id;
+	uint16_t frag;
+	uint16_t frags;
+	uint16_t datalen;
+	char *parity;
+
+	struct _fec_tx *next;
+} fec_tx_t;
+
+typedef struct
+{
+	uint32_t seq;
+	data_packet_t *packet;
+} fec_slot_t;
+
+/**
+ * A stream of packets on one channel from one source, followed from
+ * the first parity packet seen for it on.
+ */
+typedef struct _fec_stream
+{
+	uint32_t source;
+	uint32_t channel;
+	fec_slot_t slot[FEC_WINDOW];
+	data_packet_t *pending[FEC_PENDING];
+	uint32_t next_pending;
+
+	/* Hash chain, and the list from least to most recently heard */
+	struct _fec_stream *chain;
+	struct _fec_stream *older, *newer;
+} fec_stream_t;
+
+typedef struct
+{
+	/* Channels sent on, by this host */
+	fec_tx_t *tx;
+	pthread_mutex_t *tx_lock;
+
+	/* Streams received */
+	fec_stream_t *buckets[FEC_BUCKETS];
+	fec_stream_t *oldest, *newest;
+	volatile uint32_t num_streams;
+	/* Hold parity back until its group is whole here, rather than
+	 * passing it on as it arrives */
+	int reencode;
+	pthread_mutex_t *lock;
+} fec_t;
+
+
+/**
+ * fec_init:
+ * Creates empty FEC state, and makes `f' point to it. Parity is
+ * passed on as it arrives, or with `reencode' set, only once the
+ * packets it covers are all in hand.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int fec_init( fec_t **f, int reencode );
+
+/**
+ * fec_destroy:
+ * Frees `f' and everything held in it, and sets *f to NULL.
+ */
+void fec_destroy( fec_t **f );
+
+/**
+ * fec_set_group:
+ * Has a parity packet sent for every `group' data packets this host
+ * sends on `channel'; 0 to send none.
+ * Returns TRUE on success, or FALSE if `group' is over FEC_MAX_GROUP
+ * or there is no memory.
+ */
+int fec_set_group( fec_t *f, uint32_t channel, uint32_t group );
+
+/**
+ * fec_group:
+ * Returns the number of data packets per parity packet this host
+ * sends on `channel', or 0.
+ */
+uint32_t fec_group( fec_t *f, uint32_t channel );
+
+/**
+ * fec_encode:
+ * Numbers `packet', about to be sent from this host, in sequence on
+ * its channel, and adds it to the parity of its group.
+ * Returns the parity packet, to be sent after `packet' and then
+ * freed, if `packet' completed its group, or NULL.
+ */
+data_packet_t *fec_encode( fec_t *f, data_packet_t *packet );
+
+/**
+ * fec_data:
+ * Holds on to arriving data packet `packet', if its stream is being
+ * followed, in case it is needed to rebuild another. Sets *recovered
+ * to a packet it let be rebuilt, and *forward to a parity packet to
+ * pass on now that its group is whole, or either to NULL; both are
+ * to be freed.
+ * Returns FALSE if `packet' has already been received, or rebuilt.
+ */
+int fec_data( fec_t *f, data_packet_t *packet,
+	      data_packet_t **recovered, data_packet_t **forward );
+
+/**
+ * fec_parity:
+ * Rebuilds the one packet `parity' covers that is missing, if only
+ * one is, or else holds it until more of its group arrive. Sets
+ * *recovered and *forward as fec_data().
+ */
+void fec_parity( fec_t *f, data_packet_t *parity,
+		 data_packet_t **recovered, data_packet_t **forward );
+
+#endif
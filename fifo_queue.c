@@ -1,9 +1,35 @@
 
 #include "fifo_queue.h"
+#include "pool.h"
 
 #include <stdio.h>
 
 
+static pool_t item_pool= POOL_INITIALISER( "queue_item_t", 
+					   sizeof(queue_item_t) );
+
+
+/**
+ * queue_item_alloc:
+ * Returns a queue item from the shared pool of queue items, or NULL
+ * if no memory is available. Items are released by queue_dequeue(),
+ * or by queue_item_free().
+ */
+queue_item_t *queue_item_alloc( )
+{
+	return (queue_item_t*)pool_alloc( &item_pool );
+}
+
+/**
+ * queue_item_free:
+ * Returns `item' to the shared pool of queue items.
+ */
+void queue_item_free( queue_item_t *item )
+{
+	pool_free( &item_pool, item );
+}
+
+
 /**
  * queue_init:
  * Initialises `queue' to be ready for addition or removal of items. 
@@ -21,6 +47,13 @@ int queue_init( queue_t **queue )
 		pthread_mutex_init( q->lock, NULL );
 		q->flag= (pthread_cond_t*)malloc(sizeof(pthread_cond_t));
 		pthread_cond_init ( q->flag, NULL );
+		q->space= (pthread_cond_t*)malloc(sizeof(pthread_cond_t));
+		pthread_cond_init ( q->space, NULL );
+
+		q->capacity= 0;
+		q->policy= QUEUE_DROP_NEWEST;
+		q->drops= 0;
+		q->high_water= 0;
 
 		*queue= q;
 		return TRUE;
@@ -35,7 +68,7 @@ int queue_init( queue_t **queue )
  */
 int  queue_add( queue_t *queue, void *data )
 {
-	queue_item_t *item= (queue_item_t*)malloc(sizeof(queue_item_t));
+	queue_item_t *item= queue_item_alloc( );
 	queue_item_t *tempitem, *previtem;
 
 	/* Something's gone horribly wrong. Abort! Abort! */
@@ -50,18 +83,68 @@ int  queue_add( queue_t *queue, void *data )
 		queue->head= item;
 		queue->tail= item;
 		queue->length= 1;
-
-		return TRUE;
 	}
-
 	/* else !empty */
-	queue->tail->next= item;
-	queue->tail= item;
-	queue->length++;
+	else {
+		queue->tail->next= item;
+		queue->tail= item;
+		queue->length++;
+	}
+
+	if ( queue->length > queue->high_water )
+		queue->high_water= queue->length;
 
 	return TRUE;
 }
 
+
+/**
+ * queue_set_bound:
+ * Limits `queue' to `capacity' items (0 meaning no limit), with
+ * `policy' deciding what queue_add_bounded() does once it is full.
+ */
+void queue_set_bound( queue_t *queue, uint32_t capacity, int policy )
+{
+	queue->capacity= capacity;
+	queue->policy= policy;
+}
+
+
+/**
+ * queue_add_bounded:
+ * Adds `data' to `queue', applying the queue's overflow policy if it
+ * is full. Must be called with queue->lock held; under QUEUE_BLOCK
+ * this waits on queue->space until there is room. If the oldest item
+ * is evicted to make room, *dropped points to it, otherwise *dropped
+ * is NULL.
+ * Returns TRUE if `data' was queued, FALSE if it was dropped.
+ */
+int queue_add_bounded( queue_t *queue, void *data, void **dropped )
+{
+	*dropped= NULL;
+
+	if ( queue->capacity && queue->length >= queue->capacity ) {
+		switch ( queue->policy ) {
+		case QUEUE_BLOCK:
+			while ( queue->length >= queue->capacity )
+				pthread_cond_wait( queue->space, queue->lock );
+			break;
+
+		case QUEUE_DROP_OLDEST:
+			*dropped= queue_dequeue( queue );
+			queue->drops++;
+			break;
+
+		case QUEUE_DROP_NEWEST:
+		default:
+			queue->drops++;
+			return FALSE;
+		}
+	}
+
+	return queue_add( queue, data );
+}
+
 /**
  * queue_dequeue:
  * Removes the data element which has existed in the queue the longest.
@@ -77,9 +160,13 @@ void* queue_dequeue( queue_t *queue )
 		queue->head= item->next;
 		data= item->data;
 		/* Discard item */
-		free(item);
+		queue_item_free( item );
 		queue->length--;
 
+		/* Wake anybody blocked on a full bounded queue */
+		if ( queue->capacity )
+			pthread_cond_signal( queue->space );
+
 		return data;
 	}
 	else
@@ -110,7 +197,11 @@ int queue_destroy( queue_t **queue )
 	queue_clear( q );
 	pthread_mutex_unlock( q->lock );
 	pthread_mutex_destroy( q->lock );
+	pthread_cond_destroy( q->flag );
+	pthread_cond_destroy( q->space );
 	free( q->lock );
+	free( q->flag );
+	free( q->space );
 	free( q );
 	*queue= NULL;
 
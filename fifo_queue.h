@@ -8,6 +8,11 @@
 #define TRUE 1
 #define FALSE 0
 
+/* Overflow policies for bounded queues; see queue_set_bound(). */
+#define QUEUE_DROP_NEWEST 0
+#define QUEUE_DROP_OLDEST 1
+#define QUEUE_BLOCK       2
+
 
 typedef struct _queue_item
 {
@@ -22,9 +27,34 @@ typedef struct _queue
 	uint32_t length;
 	pthread_mutex_t *lock;
 	pthread_cond_t  *flag;
+
+	/* Maximum length, or 0 for an unbounded queue */
+	uint32_t capacity;
+	/* What queue_add_bounded() does when the queue is full */
+	int policy;
+	/* Signalled when an item is removed from a bounded queue */
+	pthread_cond_t  *space;
+	/* Number of items discarded because the queue was full */
+	uint32_t drops;
+	/* Largest length the queue has reached */
+	uint32_t high_water;
 } queue_t;
 
 
+/**
+ * queue_item_alloc:
+ * Returns a queue item from the shared pool of queue items, or NULL
+ * if no memory is available. Items are released by queue_dequeue(),
+ * or by queue_item_free().
+ */
+queue_item_t *queue_item_alloc( );
+
+/**
+ * queue_item_free:
+ * Returns `item' to the shared pool of queue items.
+ */
+void queue_item_free( queue_item_t *item );
+
 /**
  * queue_init:
  * Initialises `queue' to be ready for addition or removal of items. 
@@ -39,6 +69,25 @@ int queue_init( queue_t **queue );
 int  queue_add( queue_t *queue, void *data );
 
 
+/**
+ * queue_set_bound:
+ * Limits `queue' to `capacity' items (0 meaning no limit), with
+ * `policy' deciding what queue_add_bounded() does once it is full.
+ */
+void queue_set_bound( queue_t *queue, uint32_t capacity, int policy );
+
+/**
+ * queue_add_bounded:
+ * Adds `data' to `queue', applying the queue's overflow policy if it
+ * is full. Must be called with queue->lock held; under QUEUE_BLOCK
+ * this waits on queue->space until there is room. If the oldest item
+ * is evicted to make room, *dropped points to it, otherwise *dropped
+ * is NULL.
+ * Returns TRUE if `data' was queued, FALSE if it was dropped.
+ */
+int queue_add_bounded( queue_t *queue, void *data, void **dropped );
+
+
 /**
  * queue_dequeue:
  * Removes the data element which has existed in the queue the longest.
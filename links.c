@@ -1,5 +1,6 @@
 #include "common_defs.h"
 #include "links.h"
+#include "pool.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,6 +9,74 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+
+static pool_t link_to_pool=   POOL_INITIALISER( "link_to_t", 
+					       sizeof(link_to_t) );
+static pool_t link_from_pool= POOL_INITIALISER( "link_from_t", 
+					       sizeof(link_from_t) );
+
+
+/**
+ * link_to_new, link_from_new:
+ * Allocate a node for `l', from its spare list or arena if it has
+ * one, or from the shared pools otherwise.
+ */
+static link_to_t *link_to_new( links_t *l )
+{
+	link_to_t *to;
+
+	if ( l->arena == NULL )
+		return (link_to_t*)pool_alloc( &link_to_pool );
+
+	if ( (to= l->spare_to) != NULL ) {
+		l->spare_to= to->next_link;
+		return to;
+	}
+
+	return (link_to_t*)arena_alloc( l->arena, sizeof(link_to_t) );
+}
+
+static link_from_t *link_from_new( links_t *l )
+{
+	link_from_t *from;
+
+	if ( l->arena == NULL )
+		return (link_from_t*)pool_alloc( &link_from_pool );
+
+	if ( (from= l->spare_from) != NULL ) {
+		l->spare_from= from->next_node;
+		return from;
+	}
+
+	return (link_from_t*)arena_alloc( l->arena, sizeof(link_from_t) );
+}
+
+/**
+ * link_to_release, link_from_release:
+ * Release a node of `l', onto its spare list if it has an arena.
+ */
+static void link_to_release( links_t *l, link_to_t *to )
+{
+	if ( l->arena == NULL ) {
+		pool_free( &link_to_pool, to );
+		return;
+	}
+
+	to->next_link= l->spare_to;
+	l->spare_to= to;
+}
+
+static void link_from_release( links_t *l, link_from_t *from )
+{
+	if ( l->arena == NULL ) {
+		pool_free( &link_from_pool, from );
+		return;
+	}
+
+	from->next_node= l->spare_from;
+	l->spare_from= from;
+}
+
 /**
  * links_init:
  * Initiates the adjacency list of links and makes `links' point to it. If the 
@@ -20,9 +89,43 @@ int links_init( links_t **links )
 	if ( l ) {
 		l->head= NULL;
 		l->length= 0;
+		l->version= 0;
 
 		l->lock= (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t));
 		pthread_mutex_init( l->lock, NULL );
+		l->default_dist= DEFAULT_DIST;
+
+		l->arena= NULL;
+		l->spare_from= NULL;
+		l->spare_to= NULL;
+
+		*links= l;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+
+/**
+ * links_init_arena:
+ * Initiates an adjacency list whose storage all comes from `arena',
+ * for use as private scratch space. The list has no lock, and must
+ * not be passed to links_destroy(); it goes when the arena does.
+ */
+int links_init_arena( links_t **links, arena_t *arena )
+{
+	links_t *l= (links_t*)arena_alloc( arena, sizeof(links_t) );
+
+	if ( l ) {
+		l->head= NULL;
+		l->length= 0;
+		l->version= 0;
+		l->lock= NULL;
+		l->default_dist= DEFAULT_DIST;
+
+		l->arena= arena;
+		l->spare_from= NULL;
+		l->spare_to= NULL;
 
 		*links= l;
 		return TRUE;
@@ -45,15 +148,16 @@ int links_clear( links_t *links )
 		for ( to= from->links; to != NULL; ) {
 			temp_to= to;
 			to= to->next_link;
-			free( temp_to );
+			link_to_release( links, temp_to );
 		}
 		temp_from= from;
 		from= from->next_node;
-		free( temp_from );
+		link_from_release( links, temp_from );
 	}
 
 	links->length= 0;
 	links->head= NULL;
+	links->version++;
 
 	return TRUE;
 }
@@ -106,12 +210,12 @@ int links_add( links_t *l, uint32_t from_ip, uint32_t to_ip )
 
 	/* "from" hasn't been found, add a new node. */
 	if ( from == NULL ) {
-		to= (link_to_t*)malloc(sizeof(link_to_t));
+		to= link_to_new( l );
 		to->ip= to_ip;
-		to->distance= DEFAULT_DIST;
+		to->distance= l->default_dist;
 		to->next_link= NULL;
 
-		from= (link_from_t*)malloc(sizeof(link_from_t));
+		from= link_from_new( l );
 		from->ip= from_ip;
 		from->links= to;
 		from->next_node= NULL;
@@ -123,6 +227,7 @@ int links_add( links_t *l, uint32_t from_ip, uint32_t to_ip )
 			prev->next_node= from;
 
 		l->length++;
+		l->version++;
 		return TRUE;
 	}
 
@@ -131,12 +236,12 @@ int links_add( links_t *l, uint32_t from_ip, uint32_t to_ip )
 	if ( from_ip < from->ip ) {
 		link_from_t *tmp= from;
 
-		to= (link_to_t*)malloc(sizeof(link_to_t));
+		to= link_to_new( l );
 		to->ip= to_ip;
-		to->distance= DEFAULT_DIST;
+		to->distance= l->default_dist;
 		to->next_link= NULL;
 
-		from= (link_from_t*)malloc(sizeof(link_from_t));
+		from= link_from_new( l );
 		from->ip= from_ip;
 		from->links= to;
 		from->next_node= tmp;
@@ -147,6 +252,7 @@ int links_add( links_t *l, uint32_t from_ip, uint32_t to_ip )
 			l->head= from;
 
 		l->length++;
+		l->version++;
 		return TRUE;
 	}
 
@@ -162,15 +268,15 @@ int links_add( links_t *l, uint32_t from_ip, uint32_t to_ip )
 
 		/* "to" hasn't been found, add a new link. */
 		if ( to == NULL ) {
-			to= (link_to_t*)malloc(sizeof(link_to_t));
+			to= link_to_new( l );
 			to->ip= to_ip;
-			to->distance= DEFAULT_DIST;
+			to->distance= l->default_dist;
 			to->next_link= NULL;
 
 			prev_to->next_link= to;
 
 			l->length++;
-
+			l->version++;
 
 			return TRUE;
 		}
@@ -216,6 +322,7 @@ int link_update( links_t *l, uint32_t from_ip, uint32_t to_ip, uint32_t dist )
 		return FALSE;
 
 	to->distance= dist;
+	l->version++;
 	return TRUE;
 }
 
@@ -262,32 +369,35 @@ int links_rm( links_t *l, uint32_t from_ip, uint32_t to_ip )
 
 		if ( to->next_link == NULL ) {
 			l->head= from->next_node;
-			free( from );
+			link_from_release( l, from );
 		}
 		else
 			from->links= to->next_link;
 
-		free( to );
+		link_to_release( l, to );
 		l->length--;
+		l->version++;
 	}
 	else if ( prev_to == NULL ) {
 		temp_dist= to->distance;
 
 		if ( to->next_link == NULL ) {
 			prev_from->next_node= from->next_node;
-			free( from );
+			link_from_release( l, from );
 		}
 		else
 			from->links= to->next_link;
 
-		free( to );
+		link_to_release( l, to );
 		l->length--;
+		l->version++;
 	}
 	else {
 		prev_to->next_link= to->next_link;
 		temp_dist= to->distance;
-		free( to );
+		link_to_release( l, to );
 		l->length--;
+		l->version++;
 	}
 
 	return temp_dist;
@@ -8,6 +8,7 @@
 #include "orta.h"
 #include "fifo_queue.h"
 #include "linked_list.h"
+#include "arena.h"
 
 #define TRUE 1
 #define FALSE 0
@@ -30,6 +31,20 @@ typedef struct {
 	link_from_t *head;
 	uint32_t length;
 	pthread_mutex_t *lock;
+
+	/* Weight given to links before they are measured */
+	uint32_t default_dist;
+
+	/* Bumped whenever a link is added, removed or reweighted, so
+	 * anything derived from the table can tell when it is stale */
+	uint32_t version;
+
+	/* Set for scratch tables created with links_init_arena(); nodes
+	 * come from the arena, and removed nodes are kept on the spare
+	 * lists for reuse rather than freed. */
+	arena_t *arena;
+	link_from_t *spare_from;
+	link_to_t   *spare_to;
 } links_t;
 
 
@@ -40,6 +55,14 @@ typedef struct {
  */
 int links_init( links_t **links );
 
+/**
+ * links_init_arena:
+ * Initiates an adjacency list whose storage all comes from `arena',
+ * for use as private scratch space. The list has no lock, and must
+ * not be passed to links_destroy(); it goes when the arena does.
+ */
+int links_init_arena( links_t **links, arena_t *arena );
+
 /**
  * links_destroy:
  */
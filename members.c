@@ -38,6 +38,7 @@ int members_add( members_list_t *list, uint32_t member )
 	item->member= member;
 	item->seq= 0;
 	gettimeofday( &(item->tv), NULL );
+	item->probe_rtt= 0;
 
 	/* Empty */
 	if ( !list->length ) {
@@ -135,6 +136,20 @@ int members_update( members_list_t *list, uint32_t member, uint32_t seq )
 }
 
 
+/**
+ * member_probed:
+ *
+ * Records `rtt' as the latest round trip time to `member', measured
+ * while it was not a neighbour.
+ */
+int member_probed( member_t *member, uint32_t rtt )
+{
+	member->probe_rtt= rtt;
+	gettimeofday( &(member->probe_tv), NULL );
+	return TRUE;
+}
+
+
 /**
  * members_rm:
  * 
@@ -12,6 +12,10 @@ struct _member_t
 	uint32_t member;
 	uint32_t seq;
 	struct timeval tv;
+	/* Last RTT measured to this member while it was not a
+	 * neighbour, or 0, and when it was measured */
+	uint32_t probe_rtt;
+	struct timeval probe_tv;
 	struct _member_t *next;
 };
 
@@ -32,6 +36,8 @@ int members_add( members_list_t *list, uint32_t member );
 int member_update( member_t *member, uint32_t seq );
 int members_update( members_list_t *list, uint32_t member, uint32_t seq );
 
+int member_probed( member_t *member, uint32_t rtt );
+
 int members_rm( members_list_t *list, uint32_t member );
 
 int members_contains( members_list_t *list, uint32_t member );
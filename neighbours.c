@@ -23,6 +23,10 @@ int neighbours_init( neighbours_list_t **list )
 		l->lock= (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t));
 		pthread_mutex_init( l->lock, NULL );
 
+		l->default_dist= DEFAULT_DIST;
+		l->ping_interval= PING_INTERVAL_INIT;
+		l->weight_min_rtt= RTT_WEIGHT_MIN;
+
 		*list= l;
 		return TRUE;
 	}
@@ -52,7 +56,21 @@ int neighbours_add( neighbours_list_t *list,
 
 	item->sd= sd;
 	item->addr= addr;
-	item->distance= DEFAULT_DIST;
+	item->distance= list->default_dist;
+	item->srtt= 0;
+	item->rttvar= 0;
+	item->min_rtt= 0;
+	item->samples= 0;
+	item->rejects= 0;
+	item->consecutive_rejects= 0;
+
+	/* Ping straight away */
+	item->next_ping= 0;
+	item->ping_interval= list->ping_interval;
+	item->outstanding= FALSE;
+	item->ping_sent= 0;
+	item->losses= 0;
+	item->penalty= 0;
 
 	if ( sd > list->max_sd ) 
 		list->max_sd= sd;
@@ -111,24 +129,103 @@ int neighbours_add( neighbours_list_t *list,
 
 /**
  * neighbour_update:
- * Sets the distance to this neighbour if the neighbour is recently added and 
- * has not yet had a distance set, or smooths the value giving bias to 
- * previous noted distances, to avoid major fluctuations in the reported 
- * distance.
+ * Feeds the RTT sample `distance' to the estimator for `n', in
+ * `list', and returns the resulting distance for the link. The
+ * smoothed RTT and its variance follow RFC 6298; samples well above
+ * the smoothed RTT are rejected as outliers, unless several arrive in
+ * a row. The distance is then either the smallest recent sample or
+ * the smoothed RTT, according to the list's weight_min_rtt, plus any
+ * penalty the link carries.
  */
-int neighbour_update( neighbour_t *n, 
+int neighbour_update( neighbours_list_t *list, 
+		      neighbour_t *n, 
 		      uint32_t distance )
 {
-	/* Update smoothed link weight */
-	if ( n->distance == DEFAULT_DIST )
-		n->distance= distance;
+	uint32_t delta, margin;
+	int i, count;
+
+	if ( !n->samples ) {
+		/* First measurement for this link */
+		n->srtt= distance;
+		n->rttvar= distance/2;
+	}
+	else {
+		margin= RTT_OUTLIER_K*n->rttvar;
+		if ( margin < RTT_GRANULARITY )
+			margin= RTT_GRANULARITY;
+
+		if ( distance > n->srtt+margin && 
+		     n->consecutive_rejects < RTT_MAX_REJECTS ) {
+			n->rejects++;
+			n->consecutive_rejects++;
+			return n->distance;
+		}
+
+		delta= distance > n->srtt ? 
+			distance-n->srtt : n->srtt-distance;
+
+		/* rttvar= 3/4 rttvar + 1/4 |srtt-R|; srtt= 7/8 srtt + 1/8 R */
+		n->rttvar= n->rttvar-(n->rttvar>>2)+(delta>>2);
+		n->srtt=   n->srtt-(n->srtt>>3)+(distance>>3);
+	}
+
+	n->consecutive_rejects= 0;
+	n->window[n->samples%RTT_WINDOW]= distance;
+	n->samples++;
+
+	count= n->samples < RTT_WINDOW ? n->samples : RTT_WINDOW;
+	n->min_rtt= n->window[0];
+	for ( i= 1; i < count; i++ ) {
+		if ( n->window[i] < n->min_rtt )
+			n->min_rtt= n->window[i];
+	}
+
+	if ( list->weight_min_rtt )
+		n->distance= n->min_rtt;
 	else
-		n->distance= PREV_WEIGHT*(n->distance)+(1-PREV_WEIGHT)*distance;
+		n->distance= n->srtt;
+	n->distance+= n->penalty;
 
 	return n->distance;
 }
 
 
+/**
+ * neighbour_penalise:
+ * Adds `penalty' microseconds to the distance of `n', in place of any
+ * it had, and returns the resulting distance for the link. Until the
+ * link has been measured, the penalty is added to the default.
+ */
+int neighbour_penalise( neighbours_list_t *list, 
+			neighbour_t *n, 
+			uint32_t penalty )
+{
+	n->distance= n->distance-n->penalty+penalty;
+	n->penalty= penalty;
+
+	return n->distance;
+}
+
+
+/**
+ * neighbour_rto:
+ * Returns the microseconds a ping to `n' may go unanswered before it
+ * is counted lost: srtt+4*rttvar, as the RTO of RFC 6298, but no less
+ * than PING_RTO_MIN, or PING_RTO_INIT until the link is measured.
+ */
+uint32_t neighbour_rto( neighbour_t *n )
+{
+	uint32_t rto;
+
+	if ( !n->samples )
+		return PING_RTO_INIT;
+
+	rto= n->srtt+4*n->rttvar;
+
+	return rto > PING_RTO_MIN ? rto : PING_RTO_MIN;
+}
+
+
 /**
  * neighbours_get_nbr:
  * Retrieves the neighbour_t which is held for `sd'. Returns NULL if that 
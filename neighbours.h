@@ -7,17 +7,73 @@
 #include <arpa/inet.h> /* Struct sockaddr_in */
 
 
-/* For smoothing values, how much emphasis is put on older values. (0..1) */
-#define PREV_WEIGHT 0.95
+/* Number of recent accepted samples over which the minimum RTT is
+ * taken. */
+#define RTT_WINDOW 16
+
+/* A sample further than this many deviations (but at least
+ * RTT_GRANULARITY microseconds) above the smoothed RTT is rejected as
+ * an outlier... */
+#define RTT_OUTLIER_K 4
+#define RTT_GRANULARITY 1000
+/* ...unless this many in a row have been, in which case the RTT has
+ * genuinely moved and the sample is taken. */
+#define RTT_MAX_REJECTS 3
+
+/* By default, the distance advertised for a link is the minimum RTT
+ * over the window, which ignores transient queueing, rather than the
+ * smoothed RTT. */
+#define RTT_WEIGHT_MIN TRUE
+
+/* Default bounds and starting point for the interval between pings to
+ * one neighbour, in microseconds. */
+#define PING_INTERVAL_MIN  100000
+#define PING_INTERVAL_MAX  5000000
+#define PING_INTERVAL_INIT 300000
+
+/* A ping is counted lost once it has gone unanswered for the RTO of
+ * RFC 6298, srtt+4*rttvar, but no less than PING_RTO_MIN; before the
+ * link has been measured, PING_RTO_INIT. In microseconds. */
+#define PING_RTO_MIN  200000
+#define PING_RTO_INIT 1000000
 
 struct _neighbour_t
 {
 	uint32_t sd;
 	struct sockaddr_in *addr;
 	/* distance measures the distance between this host and the host 
-	 * at the other end of this link. This value should be smoothed 
-	 * to help prevent flooding the network with state changes. */
+	 * at the other end of this link. This value is derived from the
+	 * RTT estimator below to help prevent flooding the network with
+	 * state changes. */
 	uint32_t distance;
+
+	/* RTT estimator, in microseconds, after RFC 6298 */
+	uint32_t srtt;
+	uint32_t rttvar;
+	uint32_t min_rtt;
+	/* Most recent accepted samples, for the windowed minimum */
+	uint32_t window[RTT_WINDOW];
+	/* Samples accepted and rejected, and rejects since the last
+	 * accepted sample */
+	uint32_t samples;
+	uint32_t rejects;
+	uint16_t consecutive_rejects;
+
+	/* Ping schedule: monotonic time in microseconds the next ping is
+	 * due, and the current interval between pings */
+	uint64_t next_ping;
+	uint32_t ping_interval;
+	/* Set while a ping is awaiting its response, sent at
+	 * ping_sent */
+	uint8_t outstanding;
+	uint64_t ping_sent;
+	/* Pings never answered */
+	uint32_t losses;
+
+	/* Microseconds added to the distance while the link is
+	 * congested */
+	uint32_t penalty;
+
 	/* Number of refresh cycles since information on this link was sent */
 	uint16_t last_sent;
 	struct _neighbour_t *next;
@@ -29,6 +85,13 @@ struct _neighbours_list_t
 	uint32_t max_sd;
 	uint32_t length;
 	pthread_mutex_t *lock;
+
+	/* Settings for new neighbours: distance until measured, and
+	 * first ping interval. Advertise the minimum RTT if
+	 * weight_min_rtt, or the smoothed RTT otherwise. */
+	uint32_t default_dist;
+	uint32_t ping_interval;
+	int weight_min_rtt;
 };
 
 typedef struct _neighbour_t neighbour_t;
@@ -54,11 +117,30 @@ int neighbours_add( neighbours_list_t *list,
 
 /**
  * neighbour_update:
- * 
+ * Feeds the RTT sample `distance' to the estimator for `n', in
+ * `list', and returns the resulting distance for the link. Outlying
+ * samples are rejected, leaving the distance unchanged.
  */
-int neighbour_update( neighbour_t *n, 
+int neighbour_update( neighbours_list_t *list, 
+		      neighbour_t *n, 
 		      uint32_t distance );
 
+/**
+ * neighbour_penalise:
+ * Adds `penalty' microseconds to the distance of `n', in place of any
+ * it had, and returns the resulting distance for the link.
+ */
+int neighbour_penalise( neighbours_list_t *list, 
+			neighbour_t *n, 
+			uint32_t penalty );
+
+/**
+ * neighbour_rto:
+ * Returns the microseconds a ping to `n' may go unanswered before it
+ * is counted lost.
+ */
+uint32_t neighbour_rto( neighbour_t *n );
+
 /**
  * neighbours_get_nbr:
  * Retrieves the neighbour_t which is held for `sd'. Returns NULL if that 
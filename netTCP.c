@@ -4,6 +4,8 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
 
 #include <sys/time.h>
 #include <time.h>
@@ -16,12 +18,17 @@
  * connectTCP:
  * Attempts to connect to `addr', using port `tx_port' for transmission. If 
  * `tx_port' is set to zero, the host OS chooses port.
+ * The connection comes from `src_ip', unless it is INADDR_ANY, in which
+ * case the host OS chooses the source address.
  * socket descriptor created and relevant struct sockaddr_in are passed back 
  * in `sd' and `addr' respectively.
  * Returns TRUE on success or FALSE otherwise.
  */
-int connectTCP( char* dest, int tx_port, int *sd, sockaddr_in_t *addr )
+int connectTCP( char* dest, int tx_port, int *sd, sockaddr_in_t *addr,
+		uint32_t src_ip )
 {
+	sockaddr_in_t src;
+
 	addr->sin_family     = AF_INET;
 	addr->sin_port       = htons(tx_port);
 	if ( !inet_aton( dest, &(addr->sin_addr)) ) {
@@ -41,6 +48,19 @@ int connectTCP( char* dest, int tx_port, int *sd, sockaddr_in_t *addr )
 	printf( "connectTCP: Socketed.\n" );
 #endif
 
+	if ( src_ip != htonl(INADDR_ANY) ) {
+		src.sin_family     = AF_INET;
+		src.sin_port       = 0;
+		src.sin_addr.s_addr= src_ip;
+		memset( &(src.sin_zero), '\0', 8 );
+
+		if ( bind(*sd, (sockaddr_t*)&src, sizeof(sockaddr_t)) == -1 ) {
+			perror( "connectTCP" );
+			close(*sd);
+			return FALSE;
+		}
+	}
+
 	if ( connect(*sd, (sockaddr_t*)addr, sizeof(sockaddr_t)) == -1 ) {
 		fprintf( stderr, "connectTCP: can't connect to %s (%d).\n", 
 			 inet_ntoa( addr->sin_addr), tx_port );
@@ -60,11 +80,12 @@ int connectTCP( char* dest, int tx_port, int *sd, sockaddr_in_t *addr )
 
 /**
  * bindTCP:
- * Binds the port indicated and returns a socket descriptor to that port.
+ * Binds the port indicated on address `ip' (INADDR_ANY for all
+ * interfaces) and returns a socket descriptor to that port.
  * If the bind operation fails, returns a -1; else, returns the socket 
  * descriptor itself.
  */
-int bindTCP( int rx_port )
+int bindTCP( uint32_t ip, int rx_port )
 {
 	int yes= 1;
 	int sd;
@@ -86,7 +107,7 @@ int bindTCP( int rx_port )
 	/* Grab specified recieve port, and connect. */
 	addr.sin_family     = AF_INET;
 	addr.sin_port       = htons(rx_port);
-	addr.sin_addr.s_addr= htonl(INADDR_ANY);
+	addr.sin_addr.s_addr= ip;
 	/* zero the rest of the struct */
 	memset( &(addr.sin_zero), '\0', 8 );
 
@@ -3,6 +3,8 @@
 #define __netTCP
 
 
+#include <stdint.h>
+
 #include "common_defs.h"
 
 
@@ -10,20 +12,24 @@
  * connectTCP:
  * Attempts to connect to `addr', using port `tx_port' for transmission. If 
  * `tx_port' is set to zero, the host OS chooses port.
+ * The connection comes from `src_ip', unless it is INADDR_ANY, in which
+ * case the host OS chooses the source address.
  * socket descriptor created and relevant struct sockaddr_in are passed back 
  * in `sd' and `addr' respectively.
  * Returns TRUE on success or FALSE otherwise.
  */
-int connectTCP( char* dest, int tx_port, int *sd, sockaddr_in_t *addr );
+int connectTCP( char* dest, int tx_port, int *sd, sockaddr_in_t *addr,
+		uint32_t src_ip );
 
 
 /**
  * bindTCP:
- * Binds the port indicated and returns a socket descriptor to that port.
+ * Binds the port indicated on address `ip' (INADDR_ANY for all
+ * interfaces) and returns a socket descriptor to that port.
  * If the bind operation fails, returns a -1; else, returns the socket 
  * descriptor itself.
  */
-int bindTCP( int rx_port );
+int bindTCP( uint32_t ip, int rx_port );
 
 
 #endif
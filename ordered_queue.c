@@ -1,13 +1,41 @@
 #include "ordered_queue.h"
+#include "pool.h"
 /*#include "dijkstra.h"*/
 
 
+static pool_t data_pool= POOL_INITIALISER( "queue_data_t", 
+					   sizeof(queue_data_t) );
+
+
+/**
+ * d_queue_data_free:
+ * Releases a queue_data_t returned by queue_dequeue() on a queue
+ * built with d_queue_add().
+ */
+void d_queue_data_free( queue_data_t *data )
+{
+	pool_free( &data_pool, data );
+}
+
+/**
+ * d_queue_clear:
+ * Removes and releases all items in a queue built with d_queue_add().
+ */
+void d_queue_clear( queue_t *queue )
+{
+	while ( queue->length ) {
+		d_queue_data_free( queue_dequeue( queue ) );
+	}
+}
+
+
+
 /* FIXME: Want a more generic implementation of this. */
 int d_queue_add( queue_t *queue, uint32_t ip, uint32_t ip2, uint32_t distance )
 {
 	/* Variables added to list */
-	queue_item_t *q_link= (queue_item_t*)malloc(sizeof(queue_item_t));
-	queue_data_t *data= (queue_data_t*)malloc(sizeof(queue_data_t));
+	queue_item_t *q_link= queue_item_alloc( );
+	queue_data_t *data= (queue_data_t*)pool_alloc( &data_pool );
 
 	/* Temporary variables */
 	queue_item_t *tempitem, *previtem;
@@ -53,10 +81,10 @@ int d_queue_add( queue_t *queue, uint32_t ip, uint32_t ip2, uint32_t distance )
 			queue->tail= previtem;
 
 		queue->length--;
-		free( tempitem->data );
-		free( tempitem );
-		free( q_link );
-		free( data );
+		pool_free( &data_pool, tempitem->data );
+		queue_item_free( tempitem );
+		queue_item_free( q_link );
+		pool_free( &data_pool, data );
 		return d_queue_add( queue, ip, ip2, distance );
 	}
 
@@ -105,7 +133,7 @@ typedef struct
 int util_queue_add( queue_t *queue, uint32_t sd, double utility )
 {
 	/* Variables added to list */
-	queue_item_t *q_link= (queue_item_t*)malloc(sizeof(queue_item_t));
+	queue_item_t *q_link= queue_item_alloc( );
 	util_queue_data_t *data= (util_queue_data_t*)malloc(sizeof(util_queue_data_t));
 
 	/* Temporary variables */
@@ -152,8 +180,8 @@ int util_queue_add( queue_t *queue, uint32_t sd, double utility )
 
 		queue->length--;
 		free( tempitem->data );
-		free( tempitem );
-		free( q_link );
+		queue_item_free( tempitem );
+		queue_item_free( q_link );
 		free( data );
 		return util_queue_add( queue, sd, utility );
 	}
@@ -208,7 +236,7 @@ int util_queue_dequeue( queue_t *queue, uint32_t *sd, double *utility )
 
 		/* Discard item */
 		free(data);
-		free(item);
+		queue_item_free( item );
 		queue->length--;
 
 		return TRUE;
@@ -19,4 +19,7 @@ typedef struct
 	uint32_t ip2;
 } queue_data_t;
 
+void d_queue_data_free( queue_data_t *data );
+void d_queue_clear( queue_t *queue );
+
 #endif
@@ -7,7 +7,6 @@
 #include "linked_list.h"
 #include "routing_table.h"
 #include "neighbours.h"
-#include "netTCP.h"
 
 /*#include "orta_debug.h"*/
 #include "orta_ctrl_tcp.h"
@@ -26,84 +25,175 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <unistd.h>
+
+/* Default periods of the scheduled control tasks, in seconds. Each
+ * runs within SCHED_JITTER_PERCENT of its period either way, so that
+ * peers started together drift apart. */
+#define REFRESH_CYCLE_S      30
+#define EVALUATE_CYCLE_S     10
+#define RANDOM_PING_CYCLE_S  10
+#define REPARTITION_CYCLE_S  15
+#define DEBUG_CYCLE_S         5
+#define SCHED_JITTER_PERCENT 10
+
+/* Non-neighbours pinged each random ping cycle, and how long their
+ * RTTs are trusted when deciding which links to add */
+#define PROBES_PER_CYCLE      4
+#define PROBE_FRESH_S        30
+
+/* Longest the scheduler sleeps without checking it should still run */
+#define SCHED_MAX_WAIT_US 1000000
+
+
+/* Periodically check for members we haven't heard from in a while,
+ * suggesting a partition in the overlay */
+static void sched_fix_partition( void *o )
+{
+	ctrl_fix_partition( (orta_t*)o );
+}
 
-void* outgoing_data( void *o )
+/* Periodically inform neighbours of current link states */
+static void sched_refresh( void *o )
+{
+	ctrl_refresh_dispatcher( (orta_t*)o );
+}
+
+/* Randomly ping somebody who isn't a neighbour */
+static void sched_random_ping( void *o )
+{
+	random_ping( (orta_t*)o );
+}
+
+/* Check to see if we have any links worth adding, or poor quality
+ * links we should drop */
+static void sched_evaluate( void *o )
+{
+	evaluate_links( (orta_t*)o );
+}
+
+/* Ping neighbours which are due, then sleep until the next is. If
+ * pinger_wake() was called while we were pinging, keep its time. */
+static void sched_ping( void *o )
 {
 	orta_t *orta= (orta_t*)o;
-	struct timeval time;
 
-	uint32_t refresh_cycle_s= 30;
-	uint32_t drop_link_cycle_s= 20;
-	uint32_t random_ping_cycle_s= 10;
-	uint32_t repartition_cycle_s= 15;
-	uint32_t ping_delay_us= 300000;
+	timer_wheel_expedite( orta->sched, &(orta->ping_event), 
+			      pinger( orta ) );
+}
+
+/* Deliver packets held back for one missing which has waited too
+ * long, then sleep until the next wait is up */
+static void sched_reorder( void *o )
+{
+	reorder_flush( (orta_t*)o );
+}
+
+/* Drop fragmented messages whose wait for the rest is up, then sleep
+ * until the next wait is */
+static void sched_reasm( void *o )
+{
+	reasm_flush( (orta_t*)o );
+}
+
+/* Forward data held back to pace links as their rates allow, then
+ * sleep until more may go */
+static void sched_pace( void *o )
+{
+	pace_flush( (orta_t*)o );
+}
+
+/* Tell each neighbour how the data it forwards here is arriving */
+static void sched_report( void *o )
+{
+	ctrl_report_links( (orta_t*)o );
+}
+
 #ifdef DEBUG_PRINT_STATE
-	uint32_t debug_cycle_s= 5;
+static void sched_debug( void *o )
+{
+	struct timeval time;
+
+	gettimeofday( &time, NULL );
+
+	printf( "------------------------------------------------------------------------------\n" );
+	printf( "REFERENCE TIME: %u.%u\n",
+		time.tv_sec, 
+		time.tv_usec );
+	printf( "outgoing_data: Current state is:\n" );
+	print_state( (orta_t*)o );
+	printf( "------------------------------------------------------------------------------\n" );
+}
 #endif
-	uint32_t last_debug= 0;
 
-	uint32_t last_fix_partition;
-	uint32_t last_drop_link;
-	uint32_t last_refresh;
-	uint32_t last_rnd_ping;
 
-	gettimeofday( &time, NULL );
-	last_fix_partition= time.tv_sec;
-	last_drop_link= time.tv_sec;
-	last_refresh= time.tv_sec;
-	last_rnd_ping= time.tv_sec;
+/**
+ * sched_periodic:
+ * Starts `ev' calling `fn' every `period_s' seconds, give or take the
+ * jitter.
+ */
+static void sched_periodic( orta_t *orta, timer_event_t *ev, 
+			    timer_fn_t fn, uint32_t period_s )
+{
+	uint32_t period= period_s*1000000;
 
-	while (orta->connected) {
-		gettimeofday( &time, NULL );
-
-		/* Periodically check for members we haven't heard
-		 * from in a while, suggesting a partition in the
-		 * overlay */
-		if ( time.tv_sec-last_fix_partition > repartition_cycle_s ) {
-			last_fix_partition= time.tv_sec;
-			ctrl_fix_partition( orta );
-		}
+	timer_event_init( ev, fn, orta, period, 
+			  period/100*orta->config.sched_jitter_percent );
+	timer_wheel_add( orta->sched, ev, period );
+}
 
-		/* Periodically inform neighbours of current link
-		 * states */
-		if ( time.tv_sec-last_refresh > refresh_cycle_s ) {
-			last_refresh= time.tv_sec;
-			ctrl_refresh_dispatcher( orta );
-		}
 
-		/* Randomly ping somebody if we haven't pinged anybody
-		 * in a while */
-		if ( time.tv_sec - last_rnd_ping > random_ping_cycle_s ) {
-			last_rnd_ping= time.tv_sec;
-			random_ping(orta);
-		}
+/**
+ * outgoing_data:
+ * Runs the scheduled control tasks for as long as we're connected.
+ * Between tasks the thread sleeps until the next is due.
+ */
+void* outgoing_data( void *o )
+{
+	orta_t *orta= (orta_t*)o;
 
+	sched_periodic( orta, &(orta->partition_event), 
+			&sched_fix_partition, orta->config.partition_cycle_s );
+	sched_periodic( orta, &(orta->refresh_event), 
+			&sched_refresh, orta->config.refresh_cycle_s );
+	sched_periodic( orta, &(orta->random_ping_event), 
+			&sched_random_ping, orta->config.random_ping_cycle_s );
+	sched_periodic( orta, &(orta->evaluate_event), 
+			&sched_evaluate, orta->config.evaluate_cycle_s );
 #ifdef DEBUG_PRINT_STATE
-		if ( time.tv_sec - last_debug > debug_cycle_s ) {
-			printf( "------------------------------------------------------------------------------\n" );
-			printf( "REFERENCE TIME: %u.%u\n",
-				time.tv_sec, 
-				time.tv_usec );
-			printf( "outgoing_data: Current state is:\n" );
-			print_state( orta );
-			printf( "------------------------------------------------------------------------------\n" );
-
-			last_debug= time.tv_sec;
-		}
+	sched_periodic( orta, &(orta->debug_event), 
+			&sched_debug, orta->config.debug_cycle_s );
 #endif
 
-		/* Check to see if we have any poor quality links we
-		 * should drop. */
-		if ( time.tv_sec - last_drop_link > drop_link_cycle_s ) {
-			evaluate_drop_link( orta );
-			last_drop_link= time.tv_sec;
-		}
+	/* Ping event was set up in orta_init_if(), since neighbours
+	 * arriving may bring it forward at any time */
+	timer_wheel_add( orta->sched, &(orta->ping_event), 0 );
 
-		pinger( orta );
+	if ( orta->config.congestion_control )
+		timer_wheel_add( orta->sched, &(orta->report_event), 
+				 orta->config.cc_report_interval_us );
 
-		usleep( ping_delay_us );
+	while (orta->connected) {
+		timer_wheel_wait( orta->sched, SCHED_MAX_WAIT_US );
+		timer_wheel_run( orta->sched );
 	}
 
+	timer_wheel_cancel( orta->sched, &(orta->partition_event) );
+	timer_wheel_cancel( orta->sched, &(orta->refresh_event) );
+	timer_wheel_cancel( orta->sched, &(orta->random_ping_event) );
+	timer_wheel_cancel( orta->sched, &(orta->evaluate_event) );
+	timer_wheel_cancel( orta->sched, &(orta->ping_event) );
+	timer_wheel_cancel( orta->sched, &(orta->reorder_event) );
+	timer_wheel_cancel( orta->sched, &(orta->reasm_event) );
+	timer_wheel_cancel( orta->sched, &(orta->pace_event) );
+	timer_wheel_cancel( orta->sched, &(orta->report_event) );
+#ifdef DEBUG_PRINT_STATE
+	timer_wheel_cancel( orta->sched, &(orta->debug_event) );
+#endif
+
 #ifdef ORTA_DEBUG
 	printf( "Outgoing scheduler has ended.\n" );
 #endif
@@ -134,6 +224,56 @@ int orta_addr_valid( const char *addr )
 	return FALSE;
 }
 
+/**
+ * orta_iface_addr:
+ * Works out the address to run on from `iface', which may be an IPv4
+ * address or the name of an interface, or NULL for the address the
+ * host name resolves to. Sets *ip to it, and *bind_ip to the address
+ * sockets should be bound to: *ip if `iface' was given, or INADDR_ANY.
+ * Returns TRUE on success, FALSE otherwise.
+ */
+static int orta_iface_addr( const char *iface, uint32_t *ip, uint32_t *bind_ip )
+{
+	struct ifaddrs *ifas, *ifa;
+	struct in_addr addr;
+	const char *host;
+
+	if ( iface == NULL ) {
+		if ( (host= orta_host_addr()) == NULL || 
+		     !inet_aton( host, &addr ) )
+			return FALSE;
+
+		*ip= addr.s_addr;
+		*bind_ip= htonl(INADDR_ANY);
+		return TRUE;
+	}
+
+	if ( inet_aton( iface, &addr ) ) {
+		*ip= *bind_ip= addr.s_addr;
+		return TRUE;
+	}
+
+	if ( getifaddrs( &ifas ) == -1 ) {
+		perror( "orta_iface_addr" );
+		return FALSE;
+	}
+
+	for ( ifa= ifas; ifa != NULL; ifa= ifa->ifa_next ) {
+		if ( ifa->ifa_addr != NULL && 
+		     ifa->ifa_addr->sa_family == AF_INET &&
+		     !strcmp( ifa->ifa_name, iface ) ) {
+			*ip= *bind_ip= 
+				((sockaddr_in_t*)ifa->ifa_addr)->sin_addr.s_addr;
+			freeifaddrs( ifas );
+			return TRUE;
+		}
+	}
+
+	freeifaddrs( ifas );
+	return FALSE;
+}
+
+
 /**
  * orta_init:
  * 
@@ -152,6 +292,65 @@ orta_t* orta_init(uint16_t udp_rx_port, uint16_t udp_tx_port, int ttl)
 	return orta_init_if( NULL, udp_rx_port, udp_tx_port, ttl );
 }
 
+
+/**
+ * orta_config_default:
+ * 
+ * Fills `config' with the default settings.
+ */
+void orta_config_default( orta_config_t *config )
+{
+	config->refresh_cycle_s=      REFRESH_CYCLE_S;
+	config->evaluate_cycle_s=     EVALUATE_CYCLE_S;
+	config->random_ping_cycle_s=  RANDOM_PING_CYCLE_S;
+	config->partition_cycle_s=    REPARTITION_CYCLE_S;
+	config->debug_cycle_s=        DEBUG_CYCLE_S;
+	config->sched_jitter_percent= SCHED_JITTER_PERCENT;
+
+	config->member_timeout_s= MEMBER_TIMEOUT_S;
+
+	config->probes_per_cycle= PROBES_PER_CYCLE;
+	config->probe_fresh_s=    PROBE_FRESH_S;
+
+	config->ping_interval_min_us=  PING_INTERVAL_MIN;
+	config->ping_interval_max_us=  PING_INTERVAL_MAX;
+	config->ping_interval_init_us= PING_INTERVAL_INIT;
+
+	config->min_weight=     MIN_WEIGHT;
+	config->default_dist=   DEFAULT_DIST;
+	config->weight_min_rtt= RTT_WEIGHT_MIN;
+
+	config->threshold_constant= THRESHOLD_CONSTANT;
+	config->threshold_buffer=   THRESHOLD_BUFFER;
+
+	config->offset_fraction=         OFFSET_FRACTION;
+	config->refresh_cycles_for_send= REFRESH_CYCLES_FOR_SEND;
+
+	config->all_pairs_max_nodes= 0;
+
+	config->ttl= DEFAULT_TTL;
+	config->mtu= DEFAULT_MTU;
+	config->reassembly_max_bytes= REASSEMBLY_MAX_BYTES;
+	config->reassembly_timeout_us= REASSEMBLY_TIMEOUT_US;
+	config->fec_relay= ORTA_FEC_PASS;
+	config->pace_rate= 0;
+	config->pace_burst= PACE_BURST;
+	config->pace_queue_bytes= PACE_QUEUE_BYTES;
+	config->scheduler= ORTA_SCHED_STRICT;
+	config->drr_quantum[ORTA_PRIORITY_REALTIME]= 4*DRR_QUANTUM;
+	config->drr_quantum[ORTA_PRIORITY_NORMAL]=   2*DRR_QUANTUM;
+	config->drr_quantum[ORTA_PRIORITY_BULK]=     DRR_QUANTUM;
+	config->congestion_control= FALSE;
+	config->cc_report_interval_us= CC_REPORT_INTERVAL_US;
+	config->cc_target_delay_us= CC_TARGET_DELAY_US;
+	config->cc_min_rate= CC_MIN_RATE;
+	config->cc_max_rate= CC_MAX_RATE;
+	config->ping_port= 0;
+	config->rx_workers= 1;
+	config->transport= ORTA_TRANSPORT_KERNEL;
+}
+
+
 /**
  * orta_init_if:
  * 
@@ -168,28 +367,86 @@ orta_t* orta_init(uint16_t udp_rx_port, uint16_t udp_tx_port, int ttl)
  **/
 orta_t* orta_init_if(const char *iface, uint16_t udp_rx_port, 
 		     uint16_t udp_tx_port, int ttl)
+{
+	orta_config_t config;
+
+	orta_config_default( &config );
+	config.ttl= ttl;
+
+	return orta_init_config( iface, udp_rx_port, udp_tx_port, &config );
+}
+
+
+/**
+ * orta_udp_flags:
+ * Returns the options data sockets are opened with; they carry runs
+ * of segments at once only where data is segmented, and share the
+ * receive port only where more than one worker was asked for, so
+ * that otherwise a second instance on the port is still refused.
+ */
+static int orta_udp_flags( orta_t *orta )
+{
+	return (orta->config.rx_workers > 1 ? TRANSPORT_SHARED : 0) | 
+		(orta->segment_size ? TRANSPORT_SEGMENTS : 0);
+}
+
+
+/**
+ * orta_init_config:
+ * 
+ * iface: character string containing an interface name.
+ * udp_rx_port: receive port.
+ * udp_tx_port: transmit port.
+ * config: settings to use, which are copied.
+ * 
+ * As orta_init_if(), with the protocol's timers and thresholds taken
+ * from `config'.
+ * 
+ * Returns: either a valid orta_t*, or NULL.
+ **/
+orta_t* orta_init_config(const char *iface, uint16_t udp_rx_port, 
+			 uint16_t udp_tx_port, const orta_config_t *config)
 {
 	orta_t *orta= (orta_t*)malloc(sizeof(orta_t));
+	int granted, transport;
 
 	struct connect_data* d= 
 		(struct connect_data*)malloc(sizeof(struct connect_data));
 
-	/* FIXME: Constant in code */
-	char localhostname[MAXHOSTNAMELEN];
-	int sd;
-
-	sockaddr_in_t tmp_addr;
-	uint32_t udp_buffer_size= 210944;
-
 	/* FIXME: Ignore broken pipes... */
 	signal(SIGPIPE, SIG_IGN);
 
+	if ( config->mtu && config->mtu < MIN_MTU ) {
+		fprintf( stderr, "orta_init: MTU below %d.\n", MIN_MTU );
+		return NULL;
+	}
+
 	/* Determine local IP address */
-	if ( !inet_aton( orta_host_addr(), &(tmp_addr.sin_addr) ) ) {
+	if ( !orta_iface_addr( iface, &(orta->local_ip), &(orta->bind_ip) ) ) {
 		fprintf( stderr, "orta_init: Failed to determine local IP.\n");
 		return NULL;
 	}
-	orta->local_ip= tmp_addr.sin_addr.s_addr;
+
+	switch ( config->transport ) {
+	case ORTA_TRANSPORT_LOCAL: transport= TRANSPORT_LOCAL;  break;
+	case ORTA_TRANSPORT_URING: transport= TRANSPORT_URING;  break;
+	default:                   transport= TRANSPORT_KERNEL; break;
+	}
+	if ( !transport_init( &(orta->transport), transport ) ) {
+		fprintf( stderr, "orta_init: Failed to set up transport.\n");
+		return NULL;
+	}
+	/* Without interfaces to choose from, sockets are opened on the
+	 * instance's own address */
+	if ( !orta->transport->ops->wildcard )
+		orta->bind_ip= orta->local_ip;
+
+	orta->config= *config;
+	/* Segments are kept to a multiple of four bytes, so that the
+	 * headers within a run of them stay aligned */
+	orta->segment_size= config->mtu ? 
+		(config->mtu-SEGMENT_OVERHEAD) & ~3 : 0;
+	orta->next_msg_id= 0;
 
 	/* Initialise list of neighbours */
 	if ( !neighbours_init( &(orta->neighbours) ) ) {
@@ -197,6 +454,10 @@ orta_t* orta_init_if(const char *iface, uint16_t udp_rx_port,
 			"orta_init: Failed to initialise neighbours table.\n");
 		return NULL;
 	}
+	orta->neighbours->default_dist=   config->default_dist;
+	orta->neighbours->ping_interval=  config->ping_interval_init_us;
+	orta->neighbours->weight_min_rtt= config->weight_min_rtt;
+
 	/* FIXME: Convert all to adjacency list? */
 	/* Initialise list of links in overlay */
 	if ( !links_init( &(orta->links) ) ) {
@@ -204,6 +465,19 @@ orta_t* orta_init_if(const char *iface, uint16_t udp_rx_port,
 			"orta_init: Failed to initialise links table.\n");
 		return NULL;
 	}
+	orta->links->default_dist= config->default_dist;
+	if ( !spt_cache_init( &(orta->spt) ) ) {
+		fprintf(stderr,
+			"orta_init: Failed to initialise path cache.\n");
+		return NULL;
+	}
+	orta->apsp= NULL;
+	if ( config->all_pairs_max_nodes &&
+	     !apsp_init( &(orta->apsp), config->all_pairs_max_nodes ) ) {
+		fprintf(stderr,
+			"orta_init: Failed to initialise distance matrix.\n");
+		return NULL;
+	}
 	/* Initialise members list */
 	if ( !members_init( &(orta->members) ) ) {
 		fprintf(stderr,
@@ -216,49 +490,109 @@ orta_t* orta_init_if(const char *iface, uint16_t udp_rx_port,
 			"orta_init: Failed to initialise routing table.\n");
 		return NULL;
 	}
-	/* Initialise data queues list */
-	if ( !list_init( &(orta->data_queues) ) ) {
+	/* Fragments carry the least data from a sender at the smallest
+	 * MTU protecting the channel with parity */
+	if ( !reasm_init( &(orta->reasm), config->reassembly_max_bytes,
+			  ((MIN_MTU-SEGMENT_OVERHEAD) & ~3)-
+			  sizeof(data_header_t)-FEC_OVERHEAD,
+			  config->reassembly_timeout_us ) ) {
+		fprintf(stderr,
+			"orta_init: Failed to initialise reassembly buffer.\n");
+		return NULL;
+	}
+	if ( !fec_init( &(orta->fec), config->fec_relay == ORTA_FEC_REENCODE ) ) {
+		fprintf(stderr,
+			"orta_init: Failed to initialise FEC state.\n");
+		return NULL;
+	}
+	if ( !rx_streams_init( &(orta->streams) ) ) {
+		fprintf(stderr,
+			"orta_init: Failed to initialise stream table.\n");
+		return NULL;
+	}
+	if ( !pacer_init( &(orta->pacer), config->pace_rate, config->pace_burst,
+			  config->pace_queue_bytes, 
+			  config->scheduler == ORTA_SCHED_DRR ? 
+			  config->drr_quantum : NULL ) ) {
+		fprintf(stderr,
+			"orta_init: Failed to initialise pacer.\n");
+		return NULL;
+	}
+	if ( !cc_init( &(orta->cc), config->cc_target_delay_us, 
+		       config->cc_min_rate, config->cc_max_rate, 
+		       config->pace_rate ) ) {
+		fprintf(stderr,
+			"orta_init: Failed to initialise congestion state.\n");
+		return NULL;
+	}
+	/* Initialise channel table */
+	if ( !channel_table_init( &(orta->channels), CHANNEL_TABLE_SIZE ) ) {
 		fprintf(stderr,
 			"orta_init: Failed to initialise data queues.\n");
 		return NULL;
 	}
+	/* Initialise control scheduler */
+	if ( !timer_wheel_init( &(orta->sched) ) ) {
+		fprintf(stderr,
+			"orta_init: Failed to initialise scheduler.\n");
+		return NULL;
+	}
+	timer_event_init( &(orta->ping_event), &sched_ping, orta, 0, 0 );
+	timer_event_init( &(orta->reorder_event), &sched_reorder, orta, 0, 0 );
+	timer_event_init( &(orta->reasm_event), &sched_reasm, orta, 0, 0 );
+	timer_event_init( &(orta->pace_event), &sched_pace, orta, 0, 0 );
+	timer_event_init( &(orta->report_event), &sched_report, orta, 
+			  config->cc_report_interval_us, 
+			  config->cc_report_interval_us/100*
+			  config->sched_jitter_percent );
+
 	/* Add the default queue to the list */
 	orta_register_channel( orta, 0 );
 	pthread_cond_init( &(orta->data_arrived), NULL );
 
-	/* master file descriptor list*/
-	orta->fdmax= 0;
-	orta->master= (fd_set*)malloc(sizeof(fd_set));
-	FD_ZERO( orta->master );
+	/* Connections watched by the control listener */
+	if ( (orta->ctrl_epfd= epoll_create1( EPOLL_CLOEXEC )) == -1 ) {
+		perror( "orta_init" );
+		return NULL;
+	}
 
 	/* Create and bind socket for use with UDP traffic */
-	orta->udp_sd= socket( AF_INET, SOCK_DGRAM, 0 );
-	if ( setsockopt(orta->udp_sd, SOL_SOCKET, SO_SNDBUF, &udp_buffer_size, sizeof(udp_buffer_size)) == -1 )
-		perror( "orta_init_if" );
-	if ( setsockopt(orta->udp_sd, SOL_SOCKET, SO_RCVBUF, &udp_buffer_size, sizeof(udp_buffer_size)) == -1 )
-		perror( "orta_init_if" );
-
 	orta->udp_rx_port= udp_rx_port;
 	orta->udp_tx_port= udp_tx_port;
-	if ( orta->udp_sd < 0 ) {
+	orta->send_hook= NULL;
+	orta->send_hook_arg= NULL;
+	if ( (orta->udp_sd= orta->transport->ops->dgram_open( 
+		      orta->transport, orta->bind_ip, udp_rx_port, 
+		      orta_udp_flags( orta ), &granted )) < 0 ) {
 		fprintf(stderr, "orta_init: Cannot open UDP socket!\n");
 		exit(1);
 	}
-        tmp_addr.sin_family= AF_INET;
-        tmp_addr.sin_port= htons(udp_rx_port);
-        tmp_addr.sin_addr.s_addr= INADDR_ANY;
-        memset(&(tmp_addr.sin_zero), '\0', 8);
-
-	if (bind(orta->udp_sd, (sockaddr_t*)&tmp_addr, sizeof(sockaddr_t)) < 0)
-		perror( "handle_udp_data" );
+	orta->udp_segments= (granted & TRANSPORT_SEGMENTS) != 0;
 
 #ifdef ORTA_DEBUG
 	printf( "orta_init: This host is %s.\n", print_ip(orta->local_ip) );
 	printf( "orta_init: Grabbed socket %d on port %d for UDP traffic.\n", 
 		orta->udp_sd, 
-		ntohs(tmp_addr.sin_port) );
+		udp_rx_port );
 #endif
 
+	/* Pings are marked for priority handling, and timestamped on
+	 * arrival if the transport can. Other members are assumed to
+	 * keep theirs the same distance from their data port, which is
+	 * our udp_tx_port. */
+	if ( config->ping_port != 0 )
+		orta->ping_port= config->ping_port;
+	else
+		orta->ping_port= udp_rx_port + PING_PORT_OFFSET;
+	orta->peer_ping_port= udp_tx_port + (orta->ping_port - udp_rx_port);
+	if ( (orta->ping_sd= orta->transport->ops->dgram_open( 
+		      orta->transport, orta->bind_ip, orta->ping_port, 
+		      TRANSPORT_PRIORITY|TRANSPORT_STAMPED, &granted )) < 0 ) {
+		fprintf(stderr, "orta_init: Cannot open ping socket!\n");
+		exit(1);
+	}
+	orta->ping_kernel_ts= (granted & TRANSPORT_STAMPED) != 0;
+
 
 	/* Set sequence number to 0 */
 	orta->local_seq= 0;
@@ -277,35 +611,296 @@ orta_t* orta_init_if(const char *iface, uint16_t udp_rx_port,
 	d->orta= orta;
 	d->port= TCP_PORT;
 	pthread_create(&orta->ctrl_recv_thread, NULL, &ctrl_port_listener, d);
- 	pthread_create(&orta->ctrl_udp_thread,  NULL, &handle_udp_data, orta);
+	pthread_create(&orta->ctrl_ping_thread, NULL, &handle_ping_data, orta);
 
-#ifdef ORTA_DEBUG
-	/* FIXME */
-	printf( "Warning: orta_init_if is still ignoring *iface\n" );
-#endif
+	/* First receive worker uses the main UDP socket */
+	orta->rx_workers[0].orta= orta;
+	orta->rx_workers[0].sd= orta->udp_sd;
+	orta->num_rx_workers= 1;
+ 	pthread_create(&(orta->rx_workers[0].thread), NULL, &handle_udp_data, 
+		       &(orta->rx_workers[0]));
+
+	if ( config->rx_workers > 1 && 
+	     !orta_set_rx_workers( orta, config->rx_workers ) )
+		fprintf(stderr, "orta_init: Failed to start receive workers.\n");
 
 	orta->update_membership= NULL;
 
 	return orta;
 }
 
+/**
+ * orta_set_rx_workers:
+ * 
+ * Raises the number of threads receiving and forwarding UDP traffic
+ * to `n', each with its own socket on the receive port.
+ * 
+ * Returns TRUE on success, or FALSE if `n' is fewer than the current
+ * number of workers or more than MAX_RX_WORKERS, or more than one
+ * when the instance was configured with one, or the sockets could not
+ * be opened.
+ */
+int orta_set_rx_workers( orta_t *orta, int n )
+{
+	udp_worker_t *worker;
+	int granted;
+
+	if ( n < orta->num_rx_workers || n > MAX_RX_WORKERS )
+		return FALSE;
+
+	/* The receive port was only opened for sharing if more than one
+	 * worker was configured */
+	if ( n > 1 && orta->config.rx_workers <= 1 )
+		return FALSE;
+
+#ifndef SO_REUSEPORT
+	if ( n > 1 )
+		return FALSE;
+#endif
+
+	while ( orta->num_rx_workers < n ) {
+		worker= &(orta->rx_workers[orta->num_rx_workers]);
+
+		worker->orta= orta;
+		if ( (worker->sd= orta->transport->ops->dgram_open( 
+			      orta->transport, orta->bind_ip, 
+			      orta->udp_rx_port, orta_udp_flags( orta ), 
+			      &granted )) < 0 )
+			return FALSE;
+
+		if ( pthread_create( &(worker->thread), NULL, 
+				     &handle_udp_data, worker ) != 0 ) {
+			orta->transport->ops->close( orta->transport, 
+						     worker->sd );
+			return FALSE;
+		}
+
+		orta->num_rx_workers++;
+	}
+
+	return TRUE;
+}
+
+
 /**
  * orta_register_channel:
  * 
  * Registers a new data channel at this host for the purposes of
  * recieving UDP data on that particular channel. Channels can be seen
  * as an emulation of system ports.
+ *
+ * Returns TRUE on success, or FALSE if the channel is already
+ * registered or no more channels can be registered.
  */
 int orta_register_channel( orta_t *orta, uint32_t channel )
+{
+	return orta_register_channel_bounded( orta, channel, 0, 
+					      ORTA_DROP_NEWEST );
+}
+
+
+/**
+ * orta_register_channel_bounded:
+ * 
+ * As orta_register_channel(), but holds at most `capacity' packets
+ * for the application on this channel (0 meaning no limit). `policy'
+ * is an orta_overflow_policy deciding what happens to packets which
+ * arrive once the channel is full.
+ *
+ * Returns TRUE on success, or FALSE if the channel is already
+ * registered or no more channels can be registered.
+ */
+int orta_register_channel_bounded( orta_t *orta, uint32_t channel, 
+				   uint32_t capacity, int policy )
+{
+	return orta_register_channel_priority( orta, channel, capacity, policy,
+					       ORTA_PRIORITY_NORMAL );
+}
+
+
+/**
+ * orta_register_channel_priority:
+ * 
+ * As orta_register_channel_bounded(), but also puts data this host
+ * sends on `channel' in class `priority', one of enum orta_priority.
+ * Every host forwards it in that class, so that where a paced link
+ * is busy, more urgent channels are served ahead of it, or in
+ * proportion, as set by the scheduler in the configuration.
+ * Classes only take effect on paced links, where data can wait: set
+ * pace_rate or congestion_control in the configuration, or call
+ * orta_set_link_rate(). Over unpaced links data goes out as it comes,
+ * whatever its class.
+ *
+ * Returns TRUE on success, or FALSE if the channel is already
+ * registered, no more channels can be registered, or `priority' is
+ * not a class.
+ */
+int orta_register_channel_priority( orta_t *orta, uint32_t channel, 
+				    uint32_t capacity, int policy, 
+				    int priority )
 {
 	queue_t *queue;
-	queue_init( &queue );
+	int added;
 
-	pthread_mutex_lock( orta->data_queues->lock );
+	if ( priority < 0 || priority >= ORTA_PRIORITIES )
+		return FALSE;
+
+	if ( !queue_init( &queue ) )
+		return FALSE;
+
+	switch ( policy ) {
+	case ORTA_DROP_OLDEST:
+		queue_set_bound( queue, capacity, QUEUE_DROP_OLDEST );
+		break;
+	case ORTA_BLOCK:
+		queue_set_bound( queue, capacity, QUEUE_BLOCK );
+		break;
+	case ORTA_DROP_NEWEST:
+	default:
+		queue_set_bound( queue, capacity, QUEUE_DROP_NEWEST );
+		break;
+	}
 
-	list_add( orta->data_queues, channel, queue );
+	pthread_mutex_lock( orta->channels->lock );
+
+	added= channel_table_add( orta->channels, channel, queue, priority );
+
+	pthread_mutex_unlock( orta->channels->lock );
+
+	/* Channel was already registered (or the table is full); the
+	 * existing queue stays in place. */
+	if ( !added ) {
+		pthread_mutex_lock( queue->lock );
+		queue_destroy( &queue );
+	}
 
-	pthread_mutex_unlock( orta->data_queues->lock );
+	return added;
+}
+
+
+/**
+ * orta_channel_stats:
+ * 
+ * Places the number of packets dropped on `channel' because its queue
+ * was full into `drops', and the largest number of packets the queue
+ * has held into `high_water'.
+ *
+ * Returns TRUE on success, or FALSE if the channel is not registered.
+ */
+int orta_channel_stats( orta_t *orta, uint32_t channel, uint32_t *drops, 
+			uint32_t *high_water )
+{
+	queue_t *queue= channel_table_get( orta->channels, channel );
+
+	if ( queue == NULL )
+		return FALSE;
+
+	pthread_mutex_lock( queue->lock );
+	*drops= queue->drops;
+	*high_water= queue->high_water;
+	pthread_mutex_unlock( queue->lock );
+
+	return TRUE;
+}
+
+
+/**
+ * orta_set_channel_fec:
+ * 
+ * Protects data this host sends on `channel' by following every
+ * `group' packets with a parity packet, from which any one of them
+ * can be rebuilt by each host below a loss, without asking for it
+ * again; 0 to stop. Packets on the channel leave a little room for
+ * the parity header, so it fits the MTU too.
+ *
+ * Returns TRUE on success, or FALSE if `group' is more than 32.
+ */
+int orta_set_channel_fec( orta_t *orta, uint32_t channel, uint32_t group )
+{
+	return fec_set_group( orta->fec, channel, group );
+}
+
+
+/**
+ * orta_set_channel_reorder:
+ * 
+ * Delivers data arriving on `channel' in the order each source sent
+ * it. A packet following one which hasn't arrived is held back, for
+ * up to `max_delay_us', until the missing one does; no more than
+ * `depth' are held from a source at once. A packet whose turn has
+ * passed is dropped. A `depth' of 0 delivers packets as they arrive,
+ * as channels do by default. Either way, copies of a packet are
+ * delivered and forwarded only once.
+ *
+ * Returns TRUE on success, or FALSE if `depth' is more than 1024.
+ */
+int orta_set_channel_reorder( orta_t *orta, uint32_t channel, 
+			      uint32_t depth, uint32_t max_delay_us )
+{
+	return rx_streams_set_reorder( orta->streams, channel, depth, 
+				       max_delay_us );
+}
+
+
+/**
+ * orta_set_link_rate:
+ * 
+ * Paces data forwarded to `neighbour' to `rate' bytes per second,
+ * sent in bursts of up to `burst' bytes, in place of the configured
+ * pace_rate and pace_burst; a rate of 0 leaves the link unpaced. Data
+ * beyond the rate waits its turn, up to pace_queue_bytes of it, and
+ * past that is dropped. Under congestion_control, the rate is replaced
+ * as the neighbour reports how data is arriving.
+ *
+ * Returns TRUE on success, or FALSE if `neighbour' isn't an IPv4
+ * address or there is no memory.
+ */
+int orta_set_link_rate( orta_t *orta, const char *neighbour, uint32_t rate, 
+			uint32_t burst )
+{
+	struct in_addr addr;
+
+	if ( !inet_aton( neighbour, &addr ) )
+		return FALSE;
+
+	return pacer_set_rate( orta->pacer, addr.s_addr, rate, burst );
+}
+
+
+/**
+ * orta_link_stats:
+ * 
+ * Places the counts kept for data forwarded to `neighbour' while it
+ * was paced, and any penalty it carries, into `stats'.
+ *
+ * Returns TRUE on success, or FALSE if the link has never been paced.
+ */
+int orta_link_stats( orta_t *orta, const char *neighbour, 
+		     orta_link_stats_t *stats )
+{
+	struct in_addr addr;
+	pacer_stats_t ps;
+	neighbour_t *n;
+
+	if ( !inet_aton( neighbour, &addr ) || 
+	     !pacer_stats( orta->pacer, addr.s_addr, &ps ) )
+		return FALSE;
+
+	stats->rate= ps.rate;
+	stats->sent_bytes= ps.sent_bytes;
+	stats->sent_packets= ps.sent_packets;
+	stats->queued_bytes= ps.queued_bytes;
+	stats->queued_packets= ps.queued_packets;
+	stats->high_water= ps.high_water;
+	stats->drops= ps.drops;
+
+	pthread_mutex_lock( orta->neighbours->lock );
+	n= neighbours_get_nbr( orta->neighbours, neighbours_contains( 
+				       orta->neighbours, addr.s_addr ) );
+	stats->penalty= n != NULL ? n->penalty : 0;
+	pthread_mutex_unlock( orta->neighbours->lock );
+
+	return TRUE;
 }
 
 
@@ -374,8 +969,9 @@ int orta_disconnect( orta_t *orta )
 	printf( "Called orta_disconnect()\n" );fflush(stdout);
 #endif
 
-	/* Set disconnected */
+	/* Set disconnected, and stop the scheduler */
 	orta->connected= FALSE;
+	timer_wheel_wake( orta->sched );
 
 	/* Send 'leave' packet to all neighbours */
 	ctrl_leave_group( orta );
@@ -395,14 +991,11 @@ int orta_disconnect( orta_t *orta )
 #ifdef ORTA_DEBUG
 	printf( "Locking routing table.\n" );fflush(stdout);
 #endif
-	pthread_mutex_lock( orta->route->lock );
+	pthread_rwlock_wrlock( orta->route->lock );
 #ifdef ORTA_DEBUG
 	printf( "orta_disconnect: Locked everything down.\n" );fflush(stdout);
 #endif
 
-	orta->fdmax= 0;
-	FD_ZERO( orta->master );
-
         /* Clear members list */
 	members_clear( orta->members );
 #ifdef ORTA_DEBUG
@@ -427,7 +1020,7 @@ int orta_disconnect( orta_t *orta )
 	printf( "orta_disconnect: Cleared routing table.\n" );fflush(stdout);
 #endif
 
-	pthread_mutex_unlock( orta->route->lock );
+	pthread_rwlock_unlock( orta->route->lock );
 	pthread_mutex_unlock( orta->neighbours->lock );
 	pthread_mutex_unlock( orta->members->lock );
 	pthread_mutex_unlock( orta->links->lock );
@@ -456,6 +1049,7 @@ int orta_disconnect( orta_t *orta )
 void orta_destroy( orta_t **o )
 {
 	orta_t *orta= *o;
+	int i;
 
 #ifdef ORTA_DEBUG
 	printf( "orta_destroy: Entering...\n" );
@@ -463,12 +1057,23 @@ void orta_destroy( orta_t **o )
 
 	orta->alive= FALSE;
 
+	/* The receive workers and the ping thread block on their sockets,
+	 * the first worker's being udp_sd, until these are shut down
+	 * under them */
+	for ( i= 0; i < orta->num_rx_workers; i++ )
+		orta->transport->ops->shutdown( orta->transport, 
+						orta->rx_workers[i].sd );
+	orta->transport->ops->shutdown( orta->transport, orta->ping_sd );
+
 	pthread_join( orta->ctrl_recv_thread, NULL );
 	pthread_join( orta->ctrl_sched_thread, NULL );
-#ifdef ORTA_DEBUG
-	printf( "orta_destroy: FIXME: Would now join ctrl_udp_thread\n" );
-#endif
-/* 	pthread_join( orta->ctrl_udp_thread, NULL ); */
+	pthread_join( orta->ctrl_ping_thread, NULL );
+	orta->transport->ops->close( orta->transport, orta->ping_sd );
+	for ( i= 0; i < orta->num_rx_workers; i++ ) {
+		pthread_join( orta->rx_workers[i].thread, NULL );
+		orta->transport->ops->close( orta->transport, 
+					     orta->rx_workers[i].sd );
+	}
 
 #ifdef ORTA_DEBUG
 	printf( "orta_destroy: Threads have finished.\n" );
@@ -478,16 +1083,37 @@ void orta_destroy( orta_t **o )
 	pthread_mutex_lock( orta->links->lock );
 	pthread_mutex_lock( orta->members->lock );
 	pthread_mutex_lock( orta->neighbours->lock );
-	pthread_mutex_lock( orta->route->lock );
+	pthread_rwlock_wrlock( orta->route->lock );
 #ifdef ORTA_DEBUG
 	printf( "orta_destroy: Locked everything down; freeing...\n" );
 #endif
 
 	links_destroy( &(orta->links) );
+	spt_cache_destroy( &(orta->spt) );
+	if ( orta->apsp != NULL )
+		apsp_destroy( &(orta->apsp) );
 	members_destroy( &(orta->members) );
 	neighbours_destroy( &(orta->neighbours) );
 	routing_table_destroy( &(orta->route) );
 
+	/* Packets still queued for the application came from the packet
+	 * holder pool, so must be released before the queues go. */
+	for ( i= 0; i < orta->channels->length; i++ ) {
+		queue_t *queue= channel_table_at( orta->channels, i )->queue;
+
+		while ( queue->length )
+			packet_holder_free( queue_dequeue( queue ) );
+	}
+	channel_table_destroy( &(orta->channels) );
+	reasm_destroy( &(orta->reasm) );
+	fec_destroy( &(orta->fec) );
+	rx_streams_destroy( &(orta->streams) );
+	pacer_destroy( &(orta->pacer) );
+	cc_destroy( &(orta->cc) );
+	timer_wheel_destroy( &(orta->sched) );
+	close( orta->ctrl_epfd );
+	transport_destroy( &(orta->transport) );
+
 #ifdef ORTA_DEBUG
 	printf( "orta_destroy: Done.\n" );
 #endif
@@ -512,12 +1138,9 @@ int orta_recv( orta_t *m, uint32_t channel, char *buffer, int buflen )
 	char *tempdata;
 	packet_holder_t *ph;
 
-	pthread_mutex_lock( m->data_queues->lock );
-	if (list_get( m->data_queues, channel, (void**)&channel_queue ) ) {
-		pthread_mutex_unlock( m->data_queues->lock );
-
+	if ( (channel_queue= channel_table_get(m->channels, channel)) != NULL ) {
 		pthread_mutex_lock( channel_queue->lock );
-		if ( !channel_queue->length )
+		while ( !channel_queue->length )
 			pthread_cond_wait( channel_queue->flag, 
 					   channel_queue->lock );
 
@@ -529,8 +1152,7 @@ int orta_recv( orta_t *m, uint32_t channel, char *buffer, int buflen )
 		memcpy( buffer, ph->data, data_len );
 
 		/* Free memory */
-		free(ph->data);
-		free(ph);
+		packet_holder_free( ph );
 
 		pthread_mutex_unlock( channel_queue->lock );
 
@@ -539,8 +1161,6 @@ int orta_recv( orta_t *m, uint32_t channel, char *buffer, int buflen )
 		return data_len;
 	}
 	else {
-		pthread_mutex_unlock( m->data_queues->lock );
-		
 		return -1;
 	}
 }
@@ -620,10 +1240,7 @@ int orta_recv_timeout( orta_t *m, uint32_t channel, char *buffer,
 	packet_holder_t *ph;
 
 	/* Get channel */
-	pthread_mutex_lock( m->data_queues->lock );
-	if (list_get( m->data_queues, channel, (void**)&channel_queue ) ) {
-		pthread_mutex_unlock( m->data_queues->lock );
-
+	if ( (channel_queue= channel_table_get(m->channels, channel)) != NULL ) {
 		pthread_mutex_lock( channel_queue->lock );
 		if ( !channel_queue->length ) {
 			/* Add timeout to current time; pthread call takes 
@@ -655,16 +1272,13 @@ int orta_recv_timeout( orta_t *m, uint32_t channel, char *buffer,
 		memcpy( buffer, ph->data, data_len );
 
 		/* ... and free up memory */
-		free(ph->data);
-		free(ph);
+		packet_holder_free( ph );
 
 		pthread_mutex_unlock( channel_queue->lock );
 
 		return data_len;
 	}
 
-
-	pthread_mutex_unlock( channel_queue->lock );
 	return -1;
 }
 
@@ -681,8 +1295,7 @@ int orta_send( orta_t *m, uint32_t channel, char *buffer, int buflen )
 {
 	/*printf( "orta_send: Sending %d bytes.\n", buflen );*/
 
-	/* FIXME: ttl buried in code */
-	return route( m, channel, buffer, buflen, 16 );
+	return route( m, channel, buffer, buflen, m->config.ttl );
 }
 
 
@@ -716,34 +1329,33 @@ int orta_select(orta_t *m, struct timeval *timeout, int* channels, int *count )
 
 	int* ch_out;
 
-	queue_t *channel_queue;
-	list_item_t *temp;
+	channel_slot_t *slot;
+	int i;
 
-	pthread_mutex_lock( m->data_queues->lock );
+	pthread_mutex_lock( m->channels->lock );
 
 	/* Lock down all queues */
-	for ( temp= m->data_queues->head; temp != NULL; temp= temp->next ) {
-		channel_queue= (queue_t*)temp->data;
-		pthread_mutex_lock( channel_queue->lock );
+	for ( i= 0; i < m->channels->length; i++ ) {
+		slot= channel_table_at( m->channels, i );
+		pthread_mutex_lock( slot->queue->lock );
 	}
 
 	/* Search for a non-empty queue */
 	ch_out= channels;
 	*count= 0;
-	for ( temp= m->data_queues->head; temp != NULL; temp= temp->next ) {
-		channel_queue= (queue_t*)temp->data;
-		if ( channel_queue->length ) {
-			*ch_out= temp->key;
+	for ( i= 0; i < m->channels->length; i++ ) {
+		slot= channel_table_at( m->channels, i );
+		if ( slot->queue->length ) {
+			*ch_out= slot->channel;
 			ch_out++;
 			(*count)++;
 		}
 	}
 
 	/* Unlock all */
-	temp= m->data_queues->tail;
-	for ( ; temp != NULL; temp= temp->prev ) {
-		channel_queue= (queue_t*)temp->data;
-		pthread_mutex_unlock( channel_queue->lock );
+	for ( i= m->channels->length-1; i >= 0; i-- ) {
+		slot= channel_table_at( m->channels, i );
+		pthread_mutex_unlock( slot->queue->lock );
 	}
 
 	/* If all are empty */
@@ -761,31 +1373,30 @@ int orta_select(orta_t *m, struct timeval *timeout, int* channels, int *count )
 		}
 
 		timedout= pthread_cond_timedwait( &(m->data_arrived), 
-						  m->data_queues->lock, 
+						  m->channels->lock, 
 						  &wake_time );
 
 		/* The wait timed out. Unlock things and return 0 */
 		if ( timedout ) {
-			pthread_mutex_unlock( m->data_queues->lock );
+			pthread_mutex_unlock( m->channels->lock );
 			return 0;
 		}
 
 		/* Data arrived somewhere. Look for the queue with data, 
 		 * and return that channel number to the calling process */
 		ch_out= channels;
-		temp= m->data_queues->head;
-		for ( ; temp != NULL; temp= temp->next ) {
-			channel_queue= (queue_t*)temp->data;
-			pthread_mutex_lock( channel_queue->lock );
-			if ( channel_queue->length ) {
-				*ch_out= temp->key;
+		for ( i= 0; i < m->channels->length; i++ ) {
+			slot= channel_table_at( m->channels, i );
+			pthread_mutex_lock( slot->queue->lock );
+			if ( slot->queue->length ) {
+				*ch_out= slot->channel;
 				ch_out++;
 				(*count)++;
 			}
-			pthread_mutex_unlock( channel_queue->lock );
+			pthread_mutex_unlock( slot->queue->lock );
 		}
 	}
-	pthread_mutex_unlock( m->data_queues->lock );
+	pthread_mutex_unlock( m->channels->lock );
 
 	return 1;
 }
@@ -827,3 +1438,34 @@ void orta_set_update_membership_callback( orta_t *o, void *u_m )
 	o->update_membership= u_m;
 	update_membership_for_app( o );
 }
+
+
+/**
+ * orta_set_send_hook:
+ * 
+ * Passes every UDP packet `o' sends through `hook', or straight to
+ * the socket again if `hook' is NULL. Meant for simulations, where
+ * the hook adds the latency and loss of the network being modelled;
+ * it should be set before connecting.
+ */
+void orta_set_send_hook( orta_t *o, orta_send_hook_t hook, void *arg )
+{
+	o->send_hook_arg= arg;
+	o->send_hook= hook;
+}
+
+
+/**
+ * orta_send_raw:
+ * 
+ * Sends a UDP packet handed to a send hook on `sd' to `dest', past
+ * the hook.
+ * 
+ * Returns as sendto() would.
+ */
+ssize_t orta_send_raw( orta_t *o, int sd, const void *buf, size_t len, 
+		       const struct sockaddr_in *dest )
+{
+	return o->transport->ops->dgram_send( o->transport, sd, buf, len, 
+					      dest );
+}
@@ -3,11 +3,227 @@
 #define __ORTA_
 
 #include <sys/time.h>
+#include <sys/types.h>
 #include <time.h>
 #include <stdint.h>
 
 struct orta;
 typedef struct orta orta_t;
+struct sockaddr_in;
+
+
+/**
+ * What happens to incoming data when a bounded channel's queue is
+ * full:
+ * * ORTA_DROP_NEWEST: the arriving packet is discarded.
+ * * ORTA_DROP_OLDEST: the packet queued longest is discarded.
+ * * ORTA_BLOCK: the receive thread waits for the application to read.
+ */
+enum orta_overflow_policy {
+	ORTA_DROP_NEWEST,
+	ORTA_DROP_OLDEST,
+	ORTA_BLOCK,
+};
+
+
+/**
+ * What a relay does with parity packets, on channels with forward
+ * error correction (see orta_set_channel_fec()):
+ * * ORTA_FEC_PASS: passes them on as they arrive.
+ * * ORTA_FEC_REENCODE: passes on parity only for groups it holds
+ *   whole, having rebuilt any one packet lost on the way, so that
+ *   parity reaching a subtree is always of use there.
+ */
+enum orta_fec_relay {
+	ORTA_FEC_PASS,
+	ORTA_FEC_REENCODE,
+};
+
+
+/**
+ * Classes of data channel, most urgent first (see
+ * orta_register_channel_priority()). Data is forwarded in the class
+ * of the channel it was sent on at its source; channels not given
+ * one are ORTA_PRIORITY_NORMAL.
+ */
+enum orta_priority {
+	ORTA_PRIORITY_REALTIME,
+	ORTA_PRIORITY_NORMAL,
+	ORTA_PRIORITY_BULK,
+	ORTA_PRIORITIES
+};
+
+
+/**
+ * How the classes share a paced link when data is waiting on it:
+ * * ORTA_SCHED_STRICT: the most urgent class waiting always goes
+ *   first, and pushes out less urgent data when the link's queue is
+ *   full.
+ * * ORTA_SCHED_DRR: deficit round robin; each class waiting sends up
+ *   to its quantum of bytes in turn.
+ */
+enum orta_scheduler {
+	ORTA_SCHED_STRICT,
+	ORTA_SCHED_DRR,
+};
+
+
+/**
+ * How an instance reaches its peers:
+ * * ORTA_TRANSPORT_KERNEL: UDP and TCP sockets.
+ * * ORTA_TRANSPORT_LOCAL: Unix domain sockets, for instances on one
+ *   host which need no network; each instance must be given an
+ *   address to stand for.
+ * * ORTA_TRANSPORT_URING: UDP and TCP sockets, with data received and
+ *   forwarded through io_uring, saving most of the system calls on a
+ *   busy relay. Falls back to ORTA_TRANSPORT_KERNEL where the kernel
+ *   doesn't support it.
+ */
+enum orta_transport {
+	ORTA_TRANSPORT_KERNEL,
+	ORTA_TRANSPORT_LOCAL,
+	ORTA_TRANSPORT_URING,
+};
+
+
+/**
+ * Counts kept for a paced link, from orta_link_stats().
+ */
+typedef struct
+{
+	/* Bytes per second the link is paced to, or 0 */
+	uint32_t rate;
+	/* Bytes and packets sent over the link while it was paced */
+	uint64_t sent_bytes;
+	uint32_t sent_packets;
+	/* Bytes and packets waiting their turn now, and the most bytes
+	 * that have waited at once */
+	uint32_t queued_bytes;
+	uint32_t queued_packets;
+	uint32_t high_water;
+	/* Packets dropped as the link's queue was full */
+	uint32_t drops;
+	/* Microseconds added to the link's distance while it is found
+	 * congested, under congestion_control */
+	uint32_t penalty;
+} orta_link_stats_t;
+
+
+/**
+ * Tunable protocol timers and thresholds, for orta_init_config().
+ * Start from orta_config_default() and change what is needed. Times
+ * are in seconds or microseconds, as named; distances are in
+ * microseconds.
+ */
+typedef struct
+{
+	/* Periods of the scheduled control tasks: link state refresh,
+	 * evaluating links to add and drop, pinging random members,
+	 * checking for partitions, and (with DEBUG_PRINT_STATE) dumping
+	 * state */
+	uint32_t refresh_cycle_s;
+	uint32_t evaluate_cycle_s;
+	uint32_t random_ping_cycle_s;
+	uint32_t partition_cycle_s;
+	uint32_t debug_cycle_s;
+	/* Each task runs within this percentage of its period */
+	uint32_t sched_jitter_percent;
+
+	/* Silence after which a member is probed, and failing that
+	 * removed from the group */
+	uint32_t member_timeout_s;
+
+	/* Non-neighbours pinged each random ping cycle, and the age past
+	 * which their RTTs are no longer used to consider adding links */
+	uint32_t probes_per_cycle;
+	uint32_t probe_fresh_s;
+
+	/* Bounds and starting point of each neighbour's ping interval */
+	uint32_t ping_interval_min_us;
+	uint32_t ping_interval_max_us;
+	uint32_t ping_interval_init_us;
+
+	/* Smallest weight a link may advertise, and the weight of a
+	 * link before it has been measured */
+	uint32_t min_weight;
+	uint32_t default_dist;
+	/* Advertise the minimum RTT over a window if TRUE, or the
+	 * smoothed RTT if FALSE */
+	int weight_min_rtt;
+
+	/* Scales the utility a link must add or lose for it to be added
+	 * or dropped, and the margin between the two */
+	float threshold_constant;
+	float threshold_buffer;
+
+	/* Fraction a link's weight must move before it is refreshed, and
+	 * the number of refreshes it may otherwise be left out of */
+	float offset_fraction;
+	uint32_t refresh_cycles_for_send;
+
+	/* Keep distances between every pair of nodes, updated as links
+	 * change, for groups of up to this many nodes; 0 to work out
+	 * each source's paths as they are needed instead */
+	uint32_t all_pairs_max_nodes;
+
+	/* Time-to-live of data sent from this host */
+	uint32_t ttl;
+	/* Path MTU; data too large to fit is split into fragments of
+	 * this size, which are forwarded as packets in their own right,
+	 * sent and received in batches with UDP GSO and GRO where the
+	 * kernel has them, and put back together by each receiver. 0 to
+	 * send each piece of data as one packet, leaving it to IP to
+	 * fragment. */
+	uint32_t mtu;
+	/* Bytes of fragments held awaiting the rest of their message,
+	 * and microseconds a message may wait for its last fragment */
+	uint32_t reassembly_max_bytes;
+	uint32_t reassembly_timeout_us;
+	/* One of enum orta_fec_relay */
+	int fec_relay;
+	/* Bytes per second data may be forwarded over each link, 0 for
+	 * no limit; bytes a link may send at once; and bytes held for
+	 * a link waiting their turn, past which more are dropped. See
+	 * also orta_set_link_rate(). */
+	uint32_t pace_rate;
+	uint32_t pace_burst;
+	uint32_t pace_queue_bytes;
+	/* One of enum orta_scheduler, and under ORTA_SCHED_DRR, the bytes
+	 * each class of enum orta_priority sends per turn */
+	int scheduler;
+	uint32_t drr_quantum[ORTA_PRIORITIES];
+	/* If TRUE, tell each neighbour every cc_report_interval_us how
+	 * the data it forwards here is arriving, and from what they tell
+	 * us pace each link to as fast as it goes without queuing data
+	 * for more than cc_target_delay_us, between cc_min_rate and
+	 * cc_max_rate bytes per second. Each link starts at pace_rate, or
+	 * cc_max_rate if that is 0, until loss or delay pull it down.
+	 * Links which stay congested are advertised as that much longer,
+	 * so routes move around them. */
+	int congestion_control;
+	uint32_t cc_report_interval_us;
+	uint32_t cc_target_delay_us;
+	uint32_t cc_min_rate;
+	uint32_t cc_max_rate;
+	/* Port pings are sent from and answered on, 0 for the port
+	 * above udp_rx_port. Other members are pinged on the port as far
+	 * from udp_tx_port, so every member should use the same
+	 * setting. */
+	uint16_t ping_port;
+	/* Threads receiving and forwarding data; with more than one,
+	 * the receive port is opened to be shared between them */
+	int rx_workers;
+	/* One of enum orta_transport */
+	int transport;
+} orta_config_t;
+
+
+/**
+ * orta_config_default:
+ * 
+ * Fills `config' with the default settings.
+ */
+void orta_config_default( orta_config_t *config );
 
 
 /**
@@ -48,7 +264,8 @@ orta_t* orta_init(uint16_t udp_rx_port, uint16_t udp_tx_port, int ttl);
  * orta_init_if:
  * 
  * addr: character string containing an IPv4 network address.
- * iface: character string containing an interface name.
+ * iface: character string containing an interface name or IPv4
+ *        address to run on, or NULL for the host's address.
  * rx_port: receive port.
  * tx_port: transmit port.
  * ttl: time-to-live value for transmitted packets.
@@ -62,6 +279,43 @@ orta_t* orta_init_if(const char *iface, uint16_t udp_rx_port,
 		     uint16_t udp_tx_port, int ttl);
 
 
+/**
+ * orta_set_rx_workers:
+ * 
+ * Raises the number of threads receiving and forwarding UDP traffic
+ * to `n', each with its own socket on the receive port. The system
+ * spreads incoming flows across the sockets, so packets from any one
+ * peer keep their order. The count can only grow, and only past one
+ * if the instance was configured with rx_workers above one: only then
+ * is the receive port opened to be shared, as otherwise another
+ * process binding it should be refused.
+ * 
+ * Returns TRUE on success, or FALSE if `n' is fewer than the current
+ * number of workers or more than MAX_RX_WORKERS (16), or more than one
+ * when the instance was configured with one, or the sockets could not
+ * be opened.
+ */
+int orta_set_rx_workers( orta_t *o, int n );
+
+
+/**
+ * orta_init_config:
+ * 
+ * iface: character string containing an interface name or IPv4
+ *        address to run on, or NULL for the host's address.
+ * udp_rx_port: receive port.
+ * udp_tx_port: transmit port.
+ * config: settings to use, which are copied.
+ * 
+ * As orta_init_if(), with the protocol's timers and thresholds taken
+ * from `config'.
+ * 
+ * Returns: either a valid orta_t*, or NULL.
+ **/
+orta_t* orta_init_config(const char *iface, uint16_t udp_rx_port, 
+			 uint16_t udp_tx_port, const orta_config_t *config);
+
+
 /**
  * orta_connect: 
  * 
@@ -78,10 +332,120 @@ int orta_connect( orta_t *o, const char *dest );
  * Registers a new data channel at this host for the purposes of
  * recieving UDP data on that particular channel. Channels can be seen
  * as an emulation of system ports.
+ *
+ * Returns TRUE on success, or FALSE if the channel is already
+ * registered or no more channels can be registered.
  */
 int orta_register_channel( orta_t *o, uint32_t channel );
 
 
+/**
+ * orta_register_channel_bounded:
+ * 
+ * As orta_register_channel(), but holds at most `capacity' packets
+ * for the application on this channel (0 meaning no limit). `policy'
+ * is an orta_overflow_policy deciding what happens to packets which
+ * arrive once the channel is full.
+ *
+ * Returns TRUE on success, or FALSE if the channel is already
+ * registered or no more channels can be registered.
+ */
+int orta_register_channel_bounded( orta_t *o, uint32_t channel, 
+				   uint32_t capacity, int policy );
+
+
+/**
+ * orta_register_channel_priority:
+ * 
+ * As orta_register_channel_bounded(), but also puts data this host
+ * sends on `channel' in class `priority', one of enum orta_priority.
+ * Every host forwards it in that class, so that where a paced link
+ * is busy, more urgent channels are served ahead of it, or in
+ * proportion, as set by the scheduler in the configuration.
+ * Classes only take effect on paced links, where data can wait: set
+ * pace_rate or congestion_control in the configuration, or call
+ * orta_set_link_rate(). Over unpaced links data goes out as it comes,
+ * whatever its class.
+ *
+ * Returns TRUE on success, or FALSE if the channel is already
+ * registered, no more channels can be registered, or `priority' is
+ * not a class.
+ */
+int orta_register_channel_priority( orta_t *o, uint32_t channel, 
+				    uint32_t capacity, int policy, 
+				    int priority );
+
+
+/**
+ * orta_channel_stats:
+ * 
+ * Places the number of packets dropped on `channel' because its queue
+ * was full into `drops', and the largest number of packets the queue
+ * has held into `high_water'.
+ *
+ * Returns TRUE on success, or FALSE if the channel is not registered.
+ */
+int orta_channel_stats( orta_t *o, uint32_t channel, uint32_t *drops, 
+			uint32_t *high_water );
+
+
+/**
+ * orta_set_channel_fec:
+ * 
+ * Protects data this host sends on `channel' by following every
+ * `group' packets with a parity packet, from which any one of them
+ * can be rebuilt by each host below a loss, without asking for it
+ * again; 0 to stop. Packets on the channel leave a little room for
+ * the parity header, so it fits the MTU too.
+ *
+ * Returns TRUE on success, or FALSE if `group' is more than 32.
+ */
+int orta_set_channel_fec( orta_t *o, uint32_t channel, uint32_t group );
+
+/**
+ * orta_set_channel_reorder:
+ * 
+ * Delivers data arriving on `channel' in the order each source sent
+ * it. A packet following one which hasn't arrived is held back, for
+ * up to `max_delay_us', until the missing one does; no more than
+ * `depth' are held from a source at once. A packet whose turn has
+ * passed is dropped. A `depth' of 0 delivers packets as they arrive,
+ * as channels do by default. Either way, copies of a packet are
+ * delivered and forwarded only once.
+ *
+ * Returns TRUE on success, or FALSE if `depth' is more than 1024.
+ */
+int orta_set_channel_reorder( orta_t *o, uint32_t channel, 
+			      uint32_t depth, uint32_t max_delay_us );
+
+/**
+ * orta_set_link_rate:
+ * 
+ * Paces data forwarded to `neighbour' to `rate' bytes per second,
+ * sent in bursts of up to `burst' bytes, in place of the configured
+ * pace_rate and pace_burst; a rate of 0 leaves the link unpaced. Data
+ * beyond the rate waits its turn, up to pace_queue_bytes of it, and
+ * past that is dropped. Under congestion_control, the rate is replaced
+ * as the neighbour reports how data is arriving.
+ *
+ * Returns TRUE on success, or FALSE if `neighbour' isn't an IPv4
+ * address or there is no memory.
+ */
+int orta_set_link_rate( orta_t *o, const char *neighbour, uint32_t rate, 
+			uint32_t burst );
+
+/**
+ * orta_link_stats:
+ * 
+ * Places the counts kept for data forwarded to `neighbour' while it
+ * was paced, and any penalty it carries, into `stats'.
+ *
+ * Returns TRUE on success, or FALSE if the link has never been paced.
+ */
+int orta_link_stats( orta_t *o, const char *neighbour, 
+		     orta_link_stats_t *stats );
+
+
 /**
  * orta_disconnect:
  * 
@@ -179,4 +543,43 @@ int orta_select( orta_t *o, struct timeval *timeout, int* channels, int *count )
  */
 void orta_set_update_membership_callback( orta_t *o, void *u_m );
 
+
+/**
+ * orta_send_hook_t:
+ * 
+ * Called with the `arg' given to orta_set_send_hook() in place of
+ * sendto() for each UDP packet, data or ping, which `sd' would send
+ * to `dest'. The hook may send the packet on with orta_send_raw(),
+ * now or later, or drop it; `buf' is only valid for the duration of
+ * the call.
+ * 
+ * Returns as sendto() would.
+ */
+typedef ssize_t (*orta_send_hook_t)( void *arg, int sd, const void *buf, 
+				     size_t len, 
+				     const struct sockaddr_in *dest );
+
+
+/**
+ * orta_set_send_hook:
+ * 
+ * Passes every UDP packet `o' sends through `hook', or straight to
+ * the socket again if `hook' is NULL. Meant for simulations, where
+ * the hook adds the latency and loss of the network being modelled;
+ * it should be set before connecting.
+ */
+void orta_set_send_hook( orta_t *o, orta_send_hook_t hook, void *arg );
+
+
+/**
+ * orta_send_raw:
+ * 
+ * Sends a UDP packet handed to a send hook on `sd' to `dest', past
+ * the hook.
+ * 
+ * Returns as sendto() would.
+ */
+ssize_t orta_send_raw( orta_t *o, int sd, const void *buf, size_t len, 
+		       const struct sockaddr_in *dest );
+
 #endif
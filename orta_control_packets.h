@@ -17,6 +17,7 @@
  * * leave: Member is leaving the group.
  * * ping_request: A ping request.
  * * ping_response: A ping response.
+ * * link_report: How data forwarded by a neighbour is arriving.
  */
 enum control_type {
 	/* Packet types for initiating control operations */
@@ -40,6 +41,10 @@ enum control_type {
 	ping_response, 
 
 	data, 
+	data_parity, 
+
+	/* Packet types sent to one neighbour alone */
+	link_report, 
 };
 
 
@@ -60,13 +65,19 @@ typedef struct _control_packet_header
  * ping_packet.
  * 
  * Same packet type can be used for ping_req, and ping_resp; all that the 
- * ping response should really do is change the header type and return the 
- * packet.
+ * ping response should really do is change the header type, fill in
+ * `hold' and return the packet.
+ * * sec, nsec: time the request was sent, on the requester's ping
+ *     clock. Only the requester interprets this.
+ * * hold: microseconds the responder held the request before
+ *     answering, to be taken off the round trip time.
  */
 typedef struct _ping_packet
 {
 	control_packet_header_t header;
-	struct timeval time;
+	uint32_t sec;
+	uint32_t nsec;
+	uint32_t hold;
 } ping_packet_t;
 
 
@@ -175,5 +186,27 @@ typedef struct _flood_member_leave
 	link_name_t data;
 } flood_member_leave_t;
 
+
+/**
+ * Packet type link_report tells a neighbour how the data it forwards
+ * to us is arriving, for it to adapt the rate it sends at:
+ * * received: data and parity packets which have arrived from it
+ *     since we began hearing from it, for it to take from those it
+ *     has sent to count those lost on the way;
+ * * bytes: the bytes which arrived since the last report;
+ * * interval_us: microseconds since the last report;
+ * * queue_delay_us: the least one-way delay seen since the last
+ *     report, less the least seen over the last several minutes,
+ *     taken as the time spent queued.
+ */
+typedef struct _link_report_packet
+{
+	control_packet_header_t header;
+	uint32_t received;
+	uint32_t bytes;
+	uint32_t interval_us;
+	uint32_t queue_delay_us;
+} link_report_packet_t;
+
 #endif
 
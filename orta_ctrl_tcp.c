@@ -1,7 +1,10 @@
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include <assert.h>
 
 #include "orta.h"
@@ -13,22 +16,84 @@
 #include "orta_control_packets.h"
 #include "linked_list.h"
 #include "orta_routing.h"
-#include "netTCP.h"
+#include "orta_ctrl_udp.h"
+#include "utility.h"
+#include "orta_debug.h"
 
 
-/* OFFSET_FRACTION is the distance from the advertised value the
- * current known weight of a link must be before it is definitely sent
- * in a refresh packet.*/
-#define OFFSET_FRACTION 0.1
-
-/* REFRESH_CYCLES_FOR_SEND is the number of times the refresh
- * dispatcher will run before information on a link is guaranteed to
- * be sent to the rest of the group. */
-#define REFRESH_CYCLES_FOR_SEND 5
-
 /* Used to store a list of members to pass back to the application */
 static int* members_array= NULL;
 
+/* Most ready connections ctrl_port_listener() handles per wakeup */
+#define CTRL_MAX_EVENTS 64
+
+
+/**
+ * ctrl_watch, ctrl_unwatch:
+ * Start and stop ctrl_port_listener() reading from socket `sd'. The
+ * listener uses epoll rather than select(), so that it copes with
+ * descriptors numbered above FD_SETSIZE, as happens when many
+ * instances share one process.
+ */
+static void ctrl_watch( orta_t *o, int sd )
+{
+	struct epoll_event ev;
+
+	memset( &ev, 0, sizeof(ev) );
+	ev.events= EPOLLIN;
+	ev.data.fd= sd;
+	if ( epoll_ctl( o->ctrl_epfd, EPOLL_CTL_ADD, sd, &ev ) == -1 )
+		perror( "ctrl_watch" );
+}
+
+static void ctrl_unwatch( orta_t *o, int sd )
+{
+	epoll_ctl( o->ctrl_epfd, EPOLL_CTL_DEL, sd, NULL );
+}
+
+
+/**
+ * ctrl_send, ctrl_recv, ctrl_close:
+ * Send and receive control messages on connection `sd', and close it,
+ * through the instance's transport.
+ */
+static ssize_t ctrl_send( orta_t *o, int sd, const void *buf, size_t len )
+{
+	return o->transport->ops->stream_send( o->transport, sd, buf, len );
+}
+
+static ssize_t ctrl_recv( orta_t *o, int sd, void *buf, size_t len )
+{
+	return o->transport->ops->stream_recv( o->transport, sd, buf, len );
+}
+
+static void ctrl_close( orta_t *o, int sd )
+{
+	o->transport->ops->close( o->transport, sd );
+}
+
+
+/**
+ * ctrl_rm_neighbour:
+ * Removes the neighbour on `sd', as neighbours_rm() does, and stops
+ * pacing the link to it, dropping any data still waiting for it and
+ * forgetting how congested it was. The caller must hold the
+ * neighbours lock.
+ * Returns its address, which the caller must free, or NULL if `sd' is
+ * no longer a neighbour.
+ */
+static struct sockaddr_in *ctrl_rm_neighbour( orta_t *o, uint32_t sd )
+{
+	struct sockaddr_in *addr= neighbours_rm( o->neighbours, sd );
+
+	if ( addr != NULL ) {
+		pacer_forget( o->pacer, addr->sin_addr.s_addr );
+		cc_forget( o->cc, addr->sin_addr.s_addr );
+	}
+
+	return addr;
+}
+
 
 /**
  * update_membership_for_app:
@@ -70,7 +135,7 @@ static void flood( orta_t *o, void* packet, uint32_t packet_length )
 
 	/* Send this data to all neighbours */
 	for( nbr= o->neighbours->head; nbr != NULL; nbr= nbr->next ) {
-		send( nbr->sd, packet, packet_length, 0 );
+		ctrl_send( o, nbr->sd, packet, packet_length );
 	}
 }
 
@@ -92,7 +157,7 @@ static void fwd_flood(orta_t *o, void *packet, uint32_t pkt_size, uint32_t sd)
 
 	for ( n= o->neighbours->head; n!= NULL; n= n->next ) {
 		if ( n->sd != sd ) {
-			send( n->sd, packet, pkt_size, 0 );
+			ctrl_send( o, n->sd, packet, pkt_size );
 		}
 	}
 }
@@ -292,7 +357,7 @@ static int process_drop_link_packet( orta_t *o, flood_drop_links_t *msg,
 
 		if ( link->from == o->local_ip && (sd= neighbours_contains(o->neighbours, link->to))) {
 			struct sockaddr_in *addr;
-			addr= neighbours_rm(o->neighbours, sd);
+			addr= ctrl_rm_neighbour( o, sd );
 			free(addr);
 		}
 
@@ -370,7 +435,7 @@ static int process_member_leave_packet( orta_t *o, flood_member_leave_t *msg,
 	/* Check if this member is a neighbour; if it is, remove it. */
 	if (sd= neighbours_contains(o->neighbours, msg->member)) {
 		struct sockaddr_in *addr;
-		addr= neighbours_rm(o->neighbours, sd);
+		addr= ctrl_rm_neighbour( o, sd );
 		free(addr);
 	}
 
@@ -391,7 +456,7 @@ static int process_member_leave_packet( orta_t *o, flood_member_leave_t *msg,
  */
 static float threshold_for_add( orta_t *o, uint32_t ip )
 {
-	float constant= 0.008;
+	float constant= o->config.threshold_constant;
 	uint32_t nbr1= o->neighbours->length;
 	uint32_t nbr2= num_links_from(o->links, ip);
 	float mem= o->members->length;
@@ -405,7 +470,7 @@ static float threshold_for_add( orta_t *o, uint32_t ip )
  */
 static float threshold_for_drop( orta_t *o, uint32_t ip )
 {
-	float constant= 0.008;
+	float constant= o->config.threshold_constant;
 	uint32_t nbr1= (o->neighbours->length-1);
 	uint32_t nbr2= num_links_from(o->links, ip)-1;
 	float mem= o->members->length;
@@ -413,7 +478,7 @@ static float threshold_for_drop( orta_t *o, uint32_t ip )
 	if ( nbr2 < 0 ) nbr2= 0;
 
 	/* FIXME: I doubt this is really necessary. */
-	return (constant*mem*nbr1*nbr2)-THRESHOLD_BUFFER;
+	return (constant*mem*nbr1*nbr2)-o->config.threshold_buffer;
 }
 
 
@@ -433,6 +498,7 @@ void* ctrl_refresh_dispatcher( orta_t *orta )
 
 	int packet_length;
 	int fwd;
+	float offset= orta->config.offset_fraction;
 
 	packet->header.type= flood_refresh;
 	packet->header.seq= ++(orta->local_seq);
@@ -456,9 +522,9 @@ void* ctrl_refresh_dispatcher( orta_t *orta )
 						   dest_ip );
 
 		/* FIXME: Check this. */
-		if ( ( n->distance > (ad_weight+(int)(ad_weight*OFFSET_FRACTION)) || 
-		       n->distance < (ad_weight-(int)(ad_weight*OFFSET_FRACTION)) ) ||
-		     n->last_sent == REFRESH_CYCLES_FOR_SEND ) {
+		if ( ( n->distance > (ad_weight+(int)(ad_weight*offset)) || 
+		       n->distance < (ad_weight-(int)(ad_weight*offset)) ) ||
+		     n->last_sent >= orta->config.refresh_cycles_for_send ) {
 			packet->link_count++;
 
 			link_data->to=     dest_ip;
@@ -498,6 +564,83 @@ void* ctrl_refresh_dispatcher( orta_t *orta )
 }
 
 
+/**
+ * send_link_report:
+ * Sends `report' on the data arriving from `addr' back to it, if it is
+ * still a neighbour.
+ */
+static void send_link_report( void *o, uint32_t addr, 
+			      link_report_packet_t *report )
+{
+	orta_t *orta= (orta_t*)o;
+	int sd;
+
+	report->header.type= link_report;
+	report->header.source_ip= orta->local_ip;
+	report->header.seq= orta->local_seq;
+
+	pthread_mutex_lock( orta->neighbours->lock );
+	sd= neighbours_contains( orta->neighbours, addr );
+	pthread_mutex_unlock( orta->neighbours->lock );
+
+	if ( sd )
+		ctrl_send( orta, sd, report, sizeof(link_report_packet_t) );
+}
+
+/**
+ * ctrl_report_links:
+ * Tells each neighbour how the data it forwards here has arrived since
+ * it was last told.
+ */
+void ctrl_report_links( orta_t *orta )
+{
+	cc_report( orta->cc, orta->transport->ops->now_us( orta->transport ),
+		   &send_link_report, orta );
+}
+
+
+/**
+ * process_link_report:
+ * Adapts the rate data is forwarded over the link on `sd' at from the
+ * neighbour's `report', and the penalty on the link's distance.
+ */
+static void process_link_report( orta_t *o, link_report_packet_t *report, 
+				 uint32_t sd )
+{
+	neighbour_t *n;
+	pacer_stats_t ps;
+	uint32_t addr, rate, penalty;
+
+	if ( !o->config.congestion_control )
+		return;
+
+	pthread_mutex_lock( o->neighbours->lock );
+	n= neighbours_get_nbr( o->neighbours, sd );
+	addr= n != NULL ? n->addr->sin_addr.s_addr : 0;
+	pthread_mutex_unlock( o->neighbours->lock );
+
+	if ( n == NULL )
+		return;
+
+	/* Until its first report, the link isn't paced, and nothing
+	 * sent over it is counted */
+	if ( !pacer_stats( o->pacer, addr, &ps ) )
+		memset( &ps, 0, sizeof(ps) );
+
+	if ( !cc_feedback( o->cc, addr, report, ps.sent_packets, ps.drops, 
+			   ps.queued_bytes, &rate, &penalty ) )
+		return;
+
+	pacer_set_rate( o->pacer, addr, rate, o->config.pace_burst );
+
+	pthread_mutex_lock( o->neighbours->lock );
+	if ( (n= neighbours_get_nbr( o->neighbours, sd )) != NULL && 
+	     n->penalty != penalty )
+		neighbour_penalise( o->neighbours, n, penalty );
+	pthread_mutex_unlock( o->neighbours->lock );
+}
+
+
 /*****************************************************************************/
 /* Functions used to initiate state change in the group                      */
 /*****************************************************************************/
@@ -512,7 +655,7 @@ void* ctrl_refresh_dispatcher( orta_t *orta )
  * system. If the connection cannot be made, will return FALSE, else
  * will return TRUE.  Once a connection is formed, the member to which
  * `dest' points will be our neighbour. The socket descriptor made by
- * this connection will be added to the master read set for reading in
+ * this connection will be watched for reading by
  * ctrl_port_listener().
  */
 int ctrl_join( orta_t *o, char *dest )
@@ -540,7 +683,12 @@ int ctrl_join( orta_t *o, char *dest )
 #ifdef ORTA_DEBUG
 	printf( "ctrl_join: Connecting to destination port %u\n", TCP_PORT );
 #endif
-	if ( !connectTCP( dest, TCP_PORT, &sd, addr ) ) {
+	memset( addr, 0, sizeof(sockaddr_in_t) );
+	addr->sin_family= AF_INET;
+	addr->sin_port= htons(TCP_PORT);
+	if ( !inet_aton( dest, &(addr->sin_addr) ) || 
+	     (sd= o->transport->ops->stream_connect( o->transport, o->bind_ip, 
+						     addr )) == -1 ) {
 		fprintf(stderr,
 			"ctrl_join: Could not connect to %s.\n",
 			dest );
@@ -551,13 +699,14 @@ int ctrl_join( orta_t *o, char *dest )
 	/* Send a 'join' packet */
 	packet.type= join;
 
-	send( sd, &packet, sizeof(control_packet_header_t), 0 );
+	ctrl_send( o, sd, &packet, sizeof(control_packet_header_t) );
 
 	/* Wait for a join_ok packet */
-	if ( (recv( sd, response, PACKET_SIZE, 0 ) <= 0) ||
+	if ( (ctrl_recv( o, sd, response, PACKET_SIZE ) <= 0) ||
 	     (response->header.type != join_ok) ) {
 		/* There was an error ... free up memory and signal our 
 		 * defeat. */
+		ctrl_close( o, sd );
 		free( addr );
 		free( response );
 		return FALSE;
@@ -600,13 +749,12 @@ int ctrl_join( orta_t *o, char *dest )
 	members_add( o->members, o->local_ip );
 	links_add( o->links, new_ip,      o->local_ip );
 	links_add( o->links, o->local_ip, new_ip );
-	neighbours_add( o->neighbours, sd, addr );
+	if ( neighbours_add( o->neighbours, sd, addr ) )
+		pinger_wake( o );
 
-	/* We've succeeded; add this socket descriptor to the read set
-	 * for the main select clause to watch */
-	if ( sd > o->fdmax )
-		o->fdmax= sd;
-	FD_SET(sd, o->master);
+	/* We've succeeded; have the control listener watch this socket
+	 * descriptor */
+	ctrl_watch( o, sd );
 
 
 	/* Build our routing table given the information we've
@@ -623,7 +771,7 @@ int ctrl_join( orta_t *o, char *dest )
 	flood_pkt.header.seq=       o->local_seq;
 	flood_pkt.header.source_ip= o->local_ip;
 	flood_pkt.to= new_ip;
-	flood_pkt.weight= DEFAULT_DIST;
+	flood_pkt.weight= o->config.default_dist;
 
 	/* We've accepted the join; flood information out to other
 	 * members */
@@ -680,8 +828,8 @@ int ctrl_leave_group( orta_t *o )
 	/* Close off all sockets now we've informed neighbours */
 	nbr= o->neighbours->head;
 	while ( nbr != NULL ) {
-		FD_CLR( nbr->sd, o->master );
-		close( nbr->sd );
+		ctrl_unwatch( o, nbr->sd );
+		ctrl_close( o, nbr->sd );
 		nbr= nbr->next;
 	}
 
@@ -697,7 +845,9 @@ int ctrl_leave_group( orta_t *o )
 /**
  * ctrl_drop_link:
  * 
- * Removes a member of the overlay from our local state.
+ * Removes a member of the overlay from our local state. Takes the
+ * links, members and neighbours locks itself, so the caller must not
+ * hold them. Returns FALSE if the neighbour on `sd' has already gone.
  */
 static int ctrl_drop_link( orta_t *orta, uint32_t sd )
 {
@@ -708,15 +858,24 @@ static int ctrl_drop_link( orta_t *orta, uint32_t sd )
 	flood_drop_links_t *flood_pkt= (flood_drop_links_t*)malloc(packet_len);
 	link_name_t *link= &(flood_pkt->data);
 
-	/* Remove this socket descriptor from the read set */
-	if ( sd == orta->fdmax )
-		orta->fdmax--;
-	FD_CLR(sd, orta->master);
+	pthread_mutex_lock( orta->links->lock );
+	pthread_mutex_lock( orta->members->lock );
+	pthread_mutex_lock( orta->neighbours->lock );
 
-	/* Get destination address */
-        addr= neighbours_rm( orta->neighbours, sd );
+	/* Get destination address; the connection may have closed since
+	 * the link was chosen */
+        if ( (addr= ctrl_rm_neighbour( orta, sd )) == NULL ) {
+		pthread_mutex_unlock( orta->neighbours->lock );
+		pthread_mutex_unlock( orta->members->lock );
+		pthread_mutex_unlock( orta->links->lock );
+		free( flood_pkt );
+		return FALSE;
+	}
         dest_ip= addr->sin_addr.s_addr;
 
+	/* Stop watching this socket descriptor */
+	ctrl_unwatch( orta, sd );
+
 	/* Sort out packet for flooding knowledge of this new link out
 	 * into the overlay, and send. */
 	flood_pkt->header.type= flood_drop_links;
@@ -761,7 +920,11 @@ static int ctrl_drop_link( orta_t *orta, uint32_t sd )
 		print_ip(orta->local_ip) );
 #endif
 
-	close( sd );
+	pthread_mutex_unlock( orta->neighbours->lock );
+	pthread_mutex_unlock( orta->members->lock );
+	pthread_mutex_unlock( orta->links->lock );
+
+	ctrl_close( orta, sd );
 	free(flood_pkt);
 
 	return TRUE;
@@ -776,6 +939,11 @@ static int ctrl_drop_link( orta_t *orta, uint32_t sd )
  * be made, this function returns -1.  If the connection can be made,
  * but the peer rejects the connection, 0 is returned.  If the
  * connection is succesful, the socket descriptor is returned.
+ *
+ * The caller must not hold the links, members or neighbours locks:
+ * the peer's listener may need its own locks to answer, and its
+ * holder may in turn be waiting on us, so the exchange with the peer
+ * happens unlocked and the locks are only taken to record the link.
  */
 static int ctrl_add_weighted_link( orta_t *o, uint32_t ip, uint32_t weight )
 {
@@ -789,7 +957,12 @@ static int ctrl_add_weighted_link( orta_t *o, uint32_t ip, uint32_t weight )
 	flood_new_link_t flood_pkt;
 
 	/* Attempt to make the connection. */
-	if ( !connectTCP( (char*)print_ip(ip), TCP_PORT, &sd, addr ) ) {
+	memset( addr, 0, sizeof(sockaddr_in_t) );
+	addr->sin_family= AF_INET;
+	addr->sin_port= htons(TCP_PORT);
+	addr->sin_addr.s_addr= ip;
+	if ( (sd= o->transport->ops->stream_connect( o->transport, o->bind_ip, 
+						     addr )) == -1 ) {
 		printf("ctrl_add_link: Could not connect to %s.\n",
 			print_ip(ip) );
 		free(addr);
@@ -799,10 +972,10 @@ static int ctrl_add_weighted_link( orta_t *o, uint32_t ip, uint32_t weight )
 	/* Send a 'add_link' request packet */
 	packet.type= req_add_link;
 
-	send( sd, &packet, sizeof(control_packet_header_t), 0 );
+	ctrl_send( o, sd, &packet, sizeof(control_packet_header_t) );
 
 	/* Wait for a reply_add_link packet */
-	if ( recv( sd, &packet, sizeof(control_packet_header_t), 0 ) <= 0 ) {
+	if ( ctrl_recv( o, sd, &packet, sizeof(control_packet_header_t) ) <= 0 ) {
 #ifdef ORTA_DEBUG
 		printf( "Our connection to %s was rejected.\n",
 			print_ip(ip));
@@ -810,6 +983,7 @@ static int ctrl_add_weighted_link( orta_t *o, uint32_t ip, uint32_t weight )
 #endif
 		/*debug_packet( &packet, 28 );*/
 		/* Error in connection, free up memory and return failure */
+		ctrl_close( o, sd );
 		free( addr );
 		return -1;
 	}
@@ -820,6 +994,7 @@ static int ctrl_add_weighted_link( orta_t *o, uint32_t ip, uint32_t weight )
 		printf( "packet type %u\n", packet.type );
 #endif
 		/*debug_packet( &packet, 28 );*/
+		ctrl_close( o, sd );
 		free( addr );
 		return FALSE;
 	}
@@ -839,19 +1014,23 @@ static int ctrl_add_weighted_link( orta_t *o, uint32_t ip, uint32_t weight )
 	   state */
 	new_ip= addr->sin_addr.s_addr;
 
+	pthread_mutex_lock( o->links->lock );
+	pthread_mutex_lock( o->members->lock );
+	pthread_mutex_lock( o->neighbours->lock );
+
 	links_add(   o->links, new_ip,      o->local_ip );
 	link_update( o->links, new_ip,      o->local_ip, weight );
 	links_add(   o->links, o->local_ip, new_ip );
 	link_update( o->links, o->local_ip, new_ip,      weight );
 
-	neighbours_add( o->neighbours, sd, addr );
-	neighbour_update(neighbours_get_nbr(o->neighbours, sd), weight);
+	if ( neighbours_add( o->neighbours, sd, addr ) )
+		pinger_wake( o );
+	neighbour_update(o->neighbours, neighbours_get_nbr(o->neighbours, sd), 
+			 weight);
 
-	/* We've succeeded; add this socket descriptor to the read set for 
-	 * the main select clause to watch */
-	if ( sd > o->fdmax )
-		o->fdmax= sd;
-	FD_SET(sd, o->master);
+	/* We've succeeded; have the control listener watch this socket
+	 * descriptor */
+	ctrl_watch( o, sd );
 
 	/* Build our routing table given the information we've recieved. */
 	routing_build_table( o );
@@ -867,6 +1046,10 @@ static int ctrl_add_weighted_link( orta_t *o, uint32_t ip, uint32_t weight )
 	/* We've accepted the join; flood information out to other members */
 	flood( o, &flood_pkt, sizeof(flood_new_link_t) );
 
+	pthread_mutex_unlock( o->neighbours->lock );
+	pthread_mutex_unlock( o->members->lock );
+	pthread_mutex_unlock( o->links->lock );
+
 	return sd;
 }
 
@@ -877,7 +1060,7 @@ static int ctrl_add_weighted_link( orta_t *o, uint32_t ip, uint32_t weight )
  */
 static int ctrl_add_link( orta_t *o, uint32_t ip )
 {
-	return ctrl_add_weighted_link( o, ip, DEFAULT_DIST );
+	return ctrl_add_weighted_link( o, ip, o->config.default_dist );
 }
 
 
@@ -887,202 +1070,150 @@ static int ctrl_add_link( orta_t *o, uint32_t ip )
 
 
 /**
- * evaluate_drop_link:
- * Looks at the list of links this peer currently has, and determines whether 
- * or not to drop a given link.
+ * drop_utility:
+ * Sums, over all members, the fraction by which the distance to each
+ * would grow under the last spt_without_link(). Losing a member
+ * altogether counts as INFINITY.
  */
-void evaluate_drop_link( orta_t *orta )
+static float drop_utility( orta_t *orta )
 {
-	linked_list_t *distances_with, *distances_without;
-	member_t *mem;
-	neighbour_t *nbr;
+	spt_cache_t *c= orta->spt;
 
-	float utility;
-	uint32_t tmp_weight;
+	return utility_sum( c->member_what_if, c->member_dist, c->num_members );
+}
 
-	uint16_t sd;
-	uint32_t dest_ip;
 
-	int random;
-	member_t *member;
+/**
+ * add_utility:
+ * Sums, over all members, the fraction by which the distance to each
+ * would shrink under the last spt_with_link(). A member unreachable
+ * either way counts as INFINITY.
+ */
+static float add_utility( orta_t *o )
+{
+	spt_cache_t *c= o->spt;
 
-	int i;
+	return utility_sum( c->member_dist, c->member_what_if, c->num_members );
+}
 
-	utility= 0;
 
-	list_init( &distances_with );
-	list_init( &distances_without );
+/**
+ * evaluate_links:
+ * 
+ * Scores every neighbour for dropping, and every member recently
+ * pinged for adding, then adds and drops the best link of each kind
+ * that clears its threshold. All the candidates are judged against
+ * the same cached shortest paths, so each costs only the part of the
+ * tree its link affects.
+ */
+void evaluate_links( orta_t *o )
+{
+	neighbour_t *nbr;
+	member_t *member, *add= NULL;
+	uint32_t add_ip= 0, add_rtt= 0;
+	struct timeval now;
 
-	pthread_mutex_lock( orta->links->lock );
-	pthread_mutex_lock( orta->members->lock );
-	pthread_mutex_lock( orta->neighbours->lock );
+	float utility, margin;
+	float best_add= 0, best_drop= 0;
+	int drop_sd= -1;
+	uint32_t drop_ip= 0;
+	int all_pairs;
 
-	if ( !orta->neighbours->length ) {
-		pthread_mutex_unlock( orta->neighbours->lock );
-		pthread_mutex_unlock( orta->members->lock );
-		pthread_mutex_unlock( orta->links->lock );
+	pthread_mutex_lock( o->links->lock );
+	pthread_mutex_lock( o->members->lock );
+	pthread_mutex_lock( o->neighbours->lock );
 
-		return;
-	}
+	if ( !spt_baseline( o->spt, o->local_ip, o->links ) ||
+	     !spt_members( o->spt, o->members ) ) {
+		pthread_mutex_unlock( o->neighbours->lock );
+		pthread_mutex_unlock( o->members->lock );
+		pthread_mutex_unlock( o->links->lock );
 
-	random= rand()%orta->neighbours->length;
-	nbr= orta->neighbours->head;
-	for ( i= 0; i<random; i++ ) {
-		nbr= nbr->next;
+		return;
 	}
 
-	dest_ip= nbr->addr->sin_addr.s_addr;
-	sd= nbr->sd;
-
-	/* Calculate shortest paths with all links in place */
-	shortest_paths( orta->local_ip, orta->links, distances_with );
-	/* Remove the link, but remember its weight */
-	tmp_weight= links_rm( orta->links, orta->local_ip, dest_ip );
-	/* Calculate shortest path over the new graph */
-	shortest_paths( orta->local_ip, orta->links, distances_without );
-	/* Replace the link to return to previous state */
-	links_add(   orta->links, orta->local_ip, dest_ip );
-	link_update( orta->links, orta->local_ip, dest_ip, tmp_weight );
+	/* The neighbour furthest beneath its threshold is dropped */
+	for ( nbr= o->neighbours->head; nbr != NULL; nbr= nbr->next ) {
+		uint32_t ip= nbr->addr->sin_addr.s_addr;
 
+		spt_without_link( o->spt, ip );
+		utility= drop_utility( o );
+		margin= threshold_for_drop( o, ip )-utility;
 
 #ifdef ORTA_DEBUG
-	/*printf( "evaluate_drop_link: distances_with all links in place:\n" );
-	  dijkstra_print_links_list( distances_with );*/
-
-	/* printf( "evaluate_drop_link: Looking at link from here (%s) to ", 
-	   print_ip(m->local_ip));
-	   printf( "%s.\n", print_ip(nbr->addr->sin_addr.s_addr ) );
-	   printf( "\nevaluate_drop_link: distances_without this link:\n" );
-	   dijkstra_print_links_list( distances_without );*/
+		printf( "evaluate_links: Drop %s: utility %f, threshold %f.\n",
+			print_ip(ip), utility, threshold_for_drop(o, ip) );
 #endif
 
-	for (mem= orta->members->head; mem != NULL; mem= mem->next ) {
-		int current_latency, new_latency;
-
-		/* Skip local host */
-		if ( mem->member == orta->local_ip )
-			continue;
-
-		new_latency=     link_distance_to( distances_without, 
-						   mem->member);
-		current_latency= link_distance_to( distances_with,
-						   mem->member);
-
-		/* If by dropping this link we lose the ability to reach 
-		 * a node, we simply don't want to drop the link. */
-		if ( new_latency == INFINITY ) {
-			utility= INFINITY;
-			break;
+		if ( margin > best_drop ) {
+			best_drop= margin;
+			drop_sd= nbr->sd;
+			drop_ip= ip;
 		}
-
-		if ( new_latency > current_latency )
-			utility += ((float)(new_latency-current_latency))/((float)new_latency);
-	}
-
-#ifdef ORTA_DEBUG
-	printf( "## Utility == %f\n", utility );
-	printf( "## Threshold to be beneath for drop is: %f.\n", 
-		threshold_for_drop(orta, dest_ip) );
-#endif
-
-	pthread_mutex_unlock( orta->neighbours->lock );
-	pthread_mutex_unlock( orta->members->lock );
-	pthread_mutex_unlock( orta->links->lock );
-
-	if ( utility < threshold_for_drop(orta, dest_ip) ) {
-#ifdef ORTA_DEBUG
-		printf( "## Dropping link to %s.\n", print_ip(dest_ip) );
-#endif
-		ctrl_drop_link( orta, sd );
 	}
 
-	list_destroy( &distances_without );
-	list_destroy( &distances_with );
-}
-
-
-/**
- * evaluate_add_link:
- * 
- * Looks at the list of links this peer currently has, and determines
- * whether or not it would be beneficial to add a link to `dest_ip',
- * given the weight of the link as indicated by `weight'.
- */
-void evaluate_add_link( orta_t *o, uint32_t dest_ip, uint32_t weight )
-{
-	linked_list_t *distances_with, *distances_without;
-	member_t *member;
-	float utility= 0;
+	/* The member furthest above its threshold is added; RTTs too old
+	 * to trust are passed over. With the all-pairs matrix a new link
+	 * is scored straight from the rows of its two ends. */
+	all_pairs= o->apsp != NULL && apsp_sync( o->apsp, o->links );
+	gettimeofday( &now, NULL );
+	for (member= o->members->head; member != NULL; member= member->next) {
+		if ( member->member == o->local_ip || !member->probe_rtt ||
+		     now.tv_sec-member->probe_tv.tv_sec > o->config.probe_fresh_s ||
+		     neighbours_contains( o->neighbours, member->member ) )
+			continue;
 
-	pthread_mutex_lock( o->links->lock );
-	pthread_mutex_lock( o->members->lock );
-	pthread_mutex_lock( o->neighbours->lock );
+		if ( all_pairs )
+			apsp_with_link( o->apsp, o->local_ip, member->member,
+					member->probe_rtt, o->spt->member_ip,
+					o->spt->num_members,
+					o->spt->member_what_if );
+		else
+			spt_with_link( o->spt, member->member, member->probe_rtt );
+		utility= add_utility( o );
+		margin= utility-threshold_for_add( o, member->member );
 
 #ifdef ORTA_DEBUG
-	printf( "evaluate_add_link: Recv'd ping response from non-neighbour: %s: %d\n", 
-		print_ip(dest_ip), weight);
+		printf( "evaluate_links: Add %s at %u: utility %f, threshold %f.\n",
+			print_ip(member->member), member->probe_rtt, utility,
+			threshold_for_add(o, member->member) );
 #endif
 
-	/* Add the link and calculate shortest paths */
-	links_add( o->links, o->local_ip, dest_ip );
-	link_update( o->links, o->local_ip, dest_ip, weight );
-	list_init( &distances_with );
-	shortest_paths( o->local_ip, o->links, distances_with );
-
-	/* Remove the link, and calculate shortest paths */
-	links_rm( o->links, o->local_ip, dest_ip );
-	list_init( &distances_without );
-	shortest_paths( o->local_ip, o->links, distances_without );
-
-	for (member= o->members->head; member != NULL; member= member->next) {
-		int current_latency, new_latency;
-
-		/* Skip local host */
-		if ( member->member == o->local_ip )
-			continue;
-
-		new_latency=     link_distance_to( distances_with, 
-						   member->member);
-		current_latency= link_distance_to( distances_without,
-						   member->member);
-
-		/* FIXME: Check this. */
-		if (new_latency == INFINITY || current_latency == INFINITY) {
-			utility= INFINITY;
-			continue;
+		if ( margin > best_add ) {
+			best_add= margin;
+			add= member;
 		}
+	}
 
-		else if ( new_latency < current_latency )
-			utility += ((float)(current_latency-new_latency))/((float)current_latency);
+	/* Whether or not the add works, don't ask again on this RTT */
+	if ( add != NULL ) {
+		add_ip= add->member;
+		add_rtt= add->probe_rtt;
+		add->probe_rtt= 0;
 	}
 
-#ifdef ORTA_DEBUG
-	/* If we're over a given threshold, add as a new neighbour. */
-	printf( "evaluate_add_link: %s -- ", print_ip(o->local_ip) );
-	printf( "%s.\n", print_ip(dest_ip) );
-	printf( "evaluate_add_link: Utility: %f.\n", utility );
-	printf( "evaluate_add_link: Threshold is %f for %u neighbours.\n", 
-		threshold_for_add(o, dest_ip), o->neighbours->length );
-#endif
+	pthread_mutex_unlock( o->neighbours->lock );
+	pthread_mutex_unlock( o->members->lock );
+	pthread_mutex_unlock( o->links->lock );
 
-	if ( utility > threshold_for_add(o, dest_ip) ) {
+	if ( add_ip ) {
 #ifdef ORTA_DEBUG
-		printf( "evaluate_add_link: Adding link to %s\n", print_ip(dest_ip) );
+		printf( "evaluate_links: Adding link to %s\n", print_ip(add_ip) );
 #endif
-
-		if ( ctrl_add_weighted_link( o, dest_ip, weight ) <= 0 ) {
+		if ( ctrl_add_weighted_link( o, add_ip, add_rtt ) <= 0 ) {
 #ifdef ORTA_DEBUG
-			printf( "evaluate_add_link: Add link to %s failed.\n", 
-				print_ip(dest_ip) );
+			printf( "evaluate_links: Add link to %s failed.\n", 
+				print_ip(add_ip) );
 #endif
 		}
 	}
-	pthread_mutex_unlock( o->neighbours->lock );
-	pthread_mutex_unlock( o->members->lock );
-	pthread_mutex_unlock( o->links->lock );
 
-	list_destroy( &distances_with );
-	list_destroy( &distances_without );
+	if ( drop_sd != -1 ) {
+#ifdef ORTA_DEBUG
+		printf( "evaluate_links: Dropping link to %s.\n", print_ip(drop_ip) );
+#endif
+		ctrl_drop_link( o, drop_sd );
+	}
 }
 
 
@@ -1090,124 +1221,143 @@ void evaluate_add_link( orta_t *o, uint32_t dest_ip, uint32_t weight )
 /**
  * ctrl_fix_partition:
  * 
+ * Tries to link to each member we haven't heard from in a while, and
+ * removes those which can't be reached from the group.
  */
 int ctrl_fix_partition( orta_t *o )
 {
-	member_t *mbr, *temp_mbr;
+	member_t *mbr;
 	struct timeval time;
 	flood_member_leave_t *leave;
 	link_name_t *pkt_link;
-	link_to_t *links, *next_link;
+	link_to_t *links;
 	uint32_t packet_size;
+	uint32_t *silent;
+	int num_silent, i, n;
 	int sd;
 
 	gettimeofday( &time, NULL );
 
+	/* Skim through all members, noting those we haven't heard from
+	 * for longer than some threshold (ideally a little larger than
+	 * the normal refresh cycle time). */
+	pthread_mutex_lock( o->members->lock );
+
+	silent= (uint32_t*)malloc( members_length(o->members)*sizeof(uint32_t) );
+	if ( silent == NULL ) {
+		pthread_mutex_unlock( o->members->lock );
+		return FALSE;
+	}
+	num_silent= 0;
+	for ( mbr= o->members->head; mbr != NULL; mbr= mbr->next ) {
+		if ( mbr->member != o->local_ip &&
+		     (time.tv_sec - mbr->tv.tv_sec) > o->config.member_timeout_s )
+			silent[num_silent++]= mbr->member;
+	}
+
+	pthread_mutex_unlock( o->members->lock );
+
+	/* Attempt to add a link to each; ctrl_add_link() takes the locks
+	 * itself. Those which can't be reached are kept. */
+	for ( i= 0, n= 0; i < num_silent; i++ ) {
+		if ( ctrl_add_link( o, silent[i] ) < 0 )
+			silent[n++]= silent[i];
+	}
+
 	pthread_mutex_lock( o->links->lock );
 	pthread_mutex_lock( o->members->lock );
 
-	/* Skim through all members. If the time since we last heard
-	 * from any member is greater than some threshold (ideally a
-	 * little larger than the normal refresh cycle time), attempt
-	 * to add a link. If adding the link fails, remove member
-	 * state and flood that the member and it's links are dead. */
-	for ( mbr= o->members->head; mbr != NULL; ) {
-		/* Iterate here, else we can segfault on next 
-		 * execution of 'for...'. */
-		temp_mbr= mbr;
-		mbr= mbr->next;
-
-		/* FIXME: Constant in code. */
-		/* If [time this member has been silent for is > X AND
-		 * attempt to create link fails] OR [time this member
-		 * has been silent for is > Y], X being cause for
-		 * probing and Y being cause for removing the member,
-		 * craft a member_leave packet in their honour, and
-		 * flood. */
-		if ( (time.tv_sec - temp_mbr->tv.tv_sec) > 70 && 
-		     ctrl_add_link(o, temp_mbr->member) < 0 ) {
+	/* Remove state for members which have fallen silent and won't
+	 * take a link, crafting a member_leave packet in their honour
+	 * and flooding it. */
+	for ( i= 0; i < n; i++ ) {
+		/* Someone else may have already seen to it */
+		if ( !members_contains( o->members, silent[i] ) )
+			continue;
+
 #ifdef ORTA_DEBUG
-			printf( "ctrl_fix_partition: " );
-			printf("Member %s has fallen silent and isn't responding.\n", 
-			       print_ip( temp_mbr->member ) );
-			printf("Removing that member and informing the group.\n" );
+		printf( "ctrl_fix_partition: " );
+		printf("Member %s has fallen silent and isn't responding.\n", 
+		       print_ip( silent[i] ) );
+		printf("Removing that member and informing the group.\n" );
 #endif
 
-			packet_size= sizeof(flood_member_leave_t)-sizeof(link_name_t);
-			leave= (flood_member_leave_t*)malloc(PACKET_SIZE);
-			leave->header.type= flood_member_leave;
+		packet_size= sizeof(flood_member_leave_t)-sizeof(link_name_t);
+		leave= (flood_member_leave_t*)malloc(PACKET_SIZE);
+		leave->header.type= flood_member_leave;
 
-			leave->member= temp_mbr->member;
-			leave->link_count= 0;
-			pkt_link= &(leave->data);
+		leave->member= silent[i];
+		leave->link_count= 0;
+		pkt_link= &(leave->data);
 
-			links= links_from( o->links, temp_mbr->member );
+		links= links_from( o->links, silent[i] );
 
-			while ( links != NULL ) {
-				uint32_t end1= temp_mbr->member;
-				uint32_t end2= links->ip;
-				links= links->next_link;
+		while ( links != NULL ) {
+			uint32_t end1= silent[i];
+			uint32_t end2= links->ip;
+			links= links->next_link;
 
-				pkt_link->from= end1;
-				pkt_link->to  = end2;
+			pkt_link->from= end1;
+			pkt_link->to  = end2;
 
 #ifdef ORTA_DEBUG
-				printf( "Removing: %s -- ", print_ip(end1) );
-				printf( "%s\n", print_ip(end2) );
+			printf( "Removing: %s -- ", print_ip(end1) );
+			printf( "%s\n", print_ip(end2) );
 #endif
-				links_rm(o->links, end1, end2);
+			links_rm(o->links, end1, end2);
 
-				pthread_mutex_lock( o->neighbours->lock );
+			pthread_mutex_lock( o->neighbours->lock );
 
-				/* Is this a link to one of our neighbours? */
-				if (end1 == o->local_ip && (sd= neighbours_contains(o->neighbours, end2))) {
-					struct sockaddr_in *addr;
-					addr= neighbours_rm(o->neighbours, sd);
-					free( addr );
-				}
+			/* Is this a link to one of our neighbours? */
+			if (end1 == o->local_ip && (sd= neighbours_contains(o->neighbours, end2))) {
+				struct sockaddr_in *addr;
+				addr= ctrl_rm_neighbour( o, sd );
+				free( addr );
+			}
 
-				packet_size+= sizeof(link_name_t);
-				leave->link_count++;
-				pkt_link++;
+			packet_size+= sizeof(link_name_t);
+			leave->link_count++;
+			pkt_link++;
 
-				pkt_link->from= end2;
-				pkt_link->to  = end1;
+			pkt_link->from= end2;
+			pkt_link->to  = end1;
 
 #ifdef ORTA_DEBUG
-				printf( "Removing: %s -- ", print_ip(end2) );
-				printf( "%s\n", print_ip(end1) );
+			printf( "Removing: %s -- ", print_ip(end2) );
+			printf( "%s\n", print_ip(end1) );
 #endif
-				links_rm(o->links, end2, end1);
+			links_rm(o->links, end2, end1);
 
-				/* Is this a link to one of our neighbours? */
-                                if (end2 == o->local_ip && (sd= neighbours_contains(o->neighbours, end1))) {
-                                        struct sockaddr_in *addr;
-                                        addr= neighbours_rm(o->neighbours, sd);
-                                        free( addr );
-                                }
+			/* Is this a link to one of our neighbours? */
+			if (end2 == o->local_ip && (sd= neighbours_contains(o->neighbours, end1))) {
+				struct sockaddr_in *addr;
+				addr= ctrl_rm_neighbour( o, sd );
+				free( addr );
+			}
 
-				packet_size+= sizeof(link_name_t);
-				leave->link_count++;
-				pkt_link++;
+			packet_size+= sizeof(link_name_t);
+			leave->link_count++;
+			pkt_link++;
 
-				pthread_mutex_unlock( o->neighbours->lock );
-			}
+			pthread_mutex_unlock( o->neighbours->lock );
+		}
 
-			members_rm( o->members, leave->member );
+		members_rm( o->members, leave->member );
 
-			/* Flood new information */
-			flood( o, leave, packet_size );
+		/* Flood new information */
+		flood( o, leave, packet_size );
 
-			/* Rebuild routing table */
-			routing_build_table( o );
+		/* Rebuild routing table */
+		routing_build_table( o );
 
-			free(leave);
-		}
+		free(leave);
 	}
 
 	pthread_mutex_unlock( o->members->lock );
 	pthread_mutex_unlock( o->links->lock );
 
+	free( silent );
+
 	return TRUE;
 }
 
@@ -1227,29 +1377,19 @@ static int handle_connection( orta_t *o, uint32_t sd )
 {
 	int new_sd= 0;
 	struct sockaddr_in addr;
-	int addr_len= sizeof(struct sockaddr);
-
-	struct linger linger = {1,1};
 
 #ifdef ORTA_DEBUG
 	printf("handle_connection: Entering handle_connection with sd == %d\n",
 	       sd );
 #endif
 
-	if ( (new_sd= accept(sd, (struct sockaddr*)&addr, &addr_len) ) == -1){
+	if ( (new_sd= o->transport->ops->stream_accept( o->transport, sd, 
+							&addr ) ) == -1){
 		perror("accept");
 		return -1;
 	}
-	/* Get the name of the connecting host; would see "0.0.0.0" otherwise*/
-	getpeername( new_sd, (struct sockaddr *)&addr, &addr_len );
 
-	if (setsockopt(new_sd, SOL_SOCKET, SO_LINGER, &linger,sizeof(linger)) == -1) {
-		printf( "Couldn't set SO_LINGER on new socket.\n" );
-        }
-
-	FD_SET(new_sd, o->master);
-	if ( sd > o->fdmax )
-		o->fdmax= sd;
+	ctrl_watch( o, new_sd );
 
 	return new_sd;
 }
@@ -1328,7 +1468,7 @@ static uint32_t send_state( orta_t *o, uint32_t sd )
 	pthread_mutex_unlock( o->links->lock );
 
 	/* Send the state packet */
-	send( sd, packet, packet_length, 0 );
+	ctrl_send( o, sd, packet, packet_length );
 
 	free( packet );
 
@@ -1358,14 +1498,13 @@ static int parse_message( orta_t *orta, control_packet_header_t *packet,
 	case join: {
 		struct sockaddr_in* addr= 
 		       (struct sockaddr_in*)malloc(sizeof(struct sockaddr_in));
-		int addrlen= sizeof(struct sockaddr);
 
 #ifdef ORTA_DEBUG
 		printf( "handle_control_data: Recieved join request on %d.\n", 
 			sd );
 #endif
 
-		getpeername( sd, (struct sockaddr *)addr, &addrlen );
+		orta->transport->ops->stream_peer( orta->transport, sd, addr );
 
 		/* FIXME: Simply allowing any connections. Good? Bad? */
 		pthread_mutex_lock( orta->neighbours->lock );
@@ -1378,6 +1517,7 @@ static int parse_message( orta_t *orta, control_packet_header_t *packet,
 
 		if ( neighbours_add( orta->neighbours, sd, addr ) ) {
 			pthread_mutex_unlock( orta->neighbours->lock );
+			pinger_wake( orta );
 			packet_length= send_state( orta, sd );
 		}
 		else {
@@ -1385,7 +1525,8 @@ static int parse_message( orta_t *orta, control_packet_header_t *packet,
 			packet->type= join_deny;
 			free( addr );
 
-			send(sd, packet, sizeof(control_packet_header_t), 0);
+			ctrl_send( orta, sd, packet, 
+				   sizeof(control_packet_header_t) );
 			packet_length= sizeof(control_packet_header_t);
 		}
 
@@ -1395,9 +1536,8 @@ static int parse_message( orta_t *orta, control_packet_header_t *packet,
 	case req_add_link: {
 		struct sockaddr_in* addr= 
 		       (struct sockaddr_in*)malloc(sizeof(struct sockaddr_in));
-		int addrlen= sizeof(struct sockaddr);
 
-		getpeername( sd, (struct sockaddr *)addr, &addrlen );
+		orta->transport->ops->stream_peer( orta->transport, sd, addr );
 
 #ifdef ORTA_DEBUG
  		printf("handle_control_data: Recv'd req_add_link on %d (%s)\n",
@@ -1410,14 +1550,17 @@ static int parse_message( orta_t *orta, control_packet_header_t *packet,
 		if ( !neighbours_add( orta->neighbours, sd, addr ) ) {
 			packet->type= req_add_link_deny;
 
-			send( sd, packet, sizeof(control_packet_header_t), 0 );
+			ctrl_send( orta, sd, packet, 
+				   sizeof(control_packet_header_t) );
 			free( addr );
 		}
 		else {
 			packet->type= req_add_link_ok;
 			packet->type= 4;
 
-			send( sd, packet, sizeof(control_packet_header_t), 0 );
+			ctrl_send( orta, sd, packet, 
+				   sizeof(control_packet_header_t) );
+			pinger_wake( orta );
 		}
 
 		pthread_mutex_unlock( orta->neighbours->lock );
@@ -1428,6 +1571,15 @@ static int parse_message( orta_t *orta, control_packet_header_t *packet,
 		break;
 	}
 
+	/* Recieved word from a neighbour on the data we forward to it. */
+	case link_report: {
+		packet_length= sizeof(link_report_packet_t);
+
+		process_link_report( orta, (link_report_packet_t*)packet, sd );
+
+		break;
+	}
+
 		/*************************************************************/
 		/* Flooding packets next.                                    */
 		/*************************************************************/
@@ -1501,12 +1653,16 @@ static int parse_message( orta_t *orta, control_packet_header_t *packet,
 		printf( "---------------------------------\n" );
 		printf( "---------------------------------\n" );
 		printf( "Recieved abnormal packet from %d (%s)",
-			sd, print_ip( addr->sin_addr.s_addr ));
+			sd, addr != NULL ? print_ip( addr->sin_addr.s_addr ) : "?" );
 		debug_packet( packet, buffer_length );
 		printf( "---------------------------------\n" );
 		printf( "---------------------------------\n" );
 		printf( "---------------------------------\n" );
 		printf( "---------------------------------\n" );
+
+		/* Lost our place in the stream; skip the rest of this read
+		 * rather than parse it over and over */
+		packet_length= buffer_length;
 		break;
 	}
 	}
@@ -1532,16 +1688,14 @@ static void handle_control_data( orta_t *orta, uint32_t sd )
 	 * connection. Note just the connection has been closed; we
 	 * cannot assume that the peer at the other end of the
 	 * connection is dead. */
-	if ((nbytes= recv( sd, packet, PACKET_SIZE, 0 )) <= 0) {
+	if ((nbytes= ctrl_recv( orta, sd, packet, PACKET_SIZE )) <= 0) {
 		struct sockaddr_in *addr;
 
-		if ( sd == orta->fdmax )
-			orta->fdmax--;
-		FD_CLR( sd, orta->master );
-		close( sd );
+		ctrl_unwatch( orta, sd );
+		ctrl_close( orta, sd );
 
 		pthread_mutex_lock( orta->neighbours->lock );
-		addr= neighbours_rm( orta->neighbours, sd );
+		addr= ctrl_rm_neighbour( orta, sd );
 		if ( addr != NULL ) free(addr);
 		pthread_mutex_unlock( orta->neighbours->lock );
 
@@ -1571,70 +1725,43 @@ static void handle_control_data( orta_t *orta, uint32_t sd )
 void* ctrl_port_listener( void* d )
 {
 	struct connect_data* data= (struct connect_data*)d;
-	int socket= data->sd;
 	int port= data->port;
 	orta_t *orta= data->orta;
 
-	int i;
-	int newfd;
-
-	struct timeval timeout;
-	int addrlen= sizeof(struct sockaddr);
+	struct epoll_event events[CTRL_MAX_EVENTS];
+	int i, ready;
 
 	int listener_sd;
-	listener_sd= bindTCP( port );
-
-	fd_set read_fds; /* temp file descriptor list for select()*/
 
-
-	/* listen*/
-	if ( listen( listener_sd, 10 ) == -1 ) {
+	/* bind and listen */
+	if ( (listener_sd= orta->transport->ops->stream_listen( 
+		      orta->transport, orta->bind_ip, port )) == -1 ) {
 		perror("connection_listener: listen\n");
 		exit(1);
 	}
 
-	/* add the listener to the master set*/
-	if ( listener_sd > orta->fdmax )
-		orta->fdmax= listener_sd;
-
-	FD_SET(listener_sd, orta->master);
+	/* watch the listener along with the connections */
+	ctrl_watch( orta, listener_sd );
 
 
 	/* main loop*/
 	while( orta->alive ) {
-		/* FIXME: */
-		/* Essentially polling, to ensure we're looking at the
-		 * maximum known file descriptor. Why? Because links
-		 * can be added outwith the connection handler called
-		 * within this code. */
-		timeout.tv_sec=  0;
-		timeout.tv_usec= 100000;
-
-		read_fds= *(orta->master);
-
-		/* Keep highest fdmax value */
-		if ( orta->fdmax < listener_sd )
-			orta->fdmax= listener_sd;
-
-		if (select( orta->fdmax+1, &read_fds, NULL, NULL, &timeout) == -1) {
-			perror("select");
+		/* Wake at least every 100ms to notice shutdown */
+		if ( (ready= epoll_wait( orta->ctrl_epfd, events, 
+					 CTRL_MAX_EVENTS, 100 )) == -1 ) {
+			if ( errno == EINTR )
+				continue;
+			perror("epoll_wait");
 			exit(1);
 		}
 
-		/* run through the existing connections looking for
-		   data to read */
-		for( i= 0; i <= orta->fdmax; i++ ) {
-			if (FD_ISSET(i, &read_fds)) {
-				if ( i == listener_sd ) {
-					/* Dealing with a new connection */
-					newfd= handle_connection( orta, i );
-					if ( newfd > orta->fdmax )
-						/* keep track of the maximum*/
-						orta->fdmax = newfd;
-				}
-				else
-					handle_control_data( orta, i );
-			}
+		/* run through the connections with data to read */
+		for( i= 0; i < ready; i++ ) {
+			if ( events[i].data.fd == listener_sd )
+				/* Dealing with a new connection */
+				handle_connection( orta, listener_sd );
+			else
+				handle_control_data( orta, events[i].data.fd );
 		}
 	}
 
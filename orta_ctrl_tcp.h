@@ -17,9 +17,13 @@
  */
 void update_membership_for_app( orta_t *o );
 
-/*void evaluate_add_link( orta_t *orta, uint32_t dest_ip, uint32_t weight );*/
-
-void evaluate_drop_link( orta_t *orta );
+/**
+ * evaluate_links:
+ * Scores every neighbour for dropping, and every member recently
+ * pinged for adding, then adds and drops the best link of each kind
+ * that clears its threshold.
+ */
+void evaluate_links( orta_t *orta );
 
 /**
  * ctrl_join: Attempts to join the overlay.
@@ -29,7 +33,7 @@ void evaluate_drop_link( orta_t *orta );
  * system. If the connection cannot be made, will return FALSE, else
  * will return TRUE.  Once a connection is formed, the member to which
  * `dest' points will be our neighbour. The socket descriptor made by
- * this connection will be added to the master read set for reading in
+ * this connection will be watched for reading by
  * ctrl_port_listener().
  */
 int ctrl_join( orta_t *o, char *dest );
@@ -40,6 +44,13 @@ int ctrl_join( orta_t *o, char *dest );
  */
 void* ctrl_refresh_dispatcher( orta_t *overlay );
 
+/**
+ * ctrl_report_links:
+ * Tells each neighbour how the data it forwards here has arrived since
+ * it was last told.
+ */
+void ctrl_report_links( orta_t *orta );
+
 
 /**
  * ctrl_fix_partition:
@@ -1,9 +1,15 @@
+#define _GNU_SOURCE /* struct mmsghdr */
+
 #include "orta_ctrl_udp.h"
 
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <sched.h>
 
 
 #include "common_defs.h"
@@ -19,138 +25,497 @@
 
 #include "links.h"
 
+#include <linux/net_tstamp.h>
+
+/* Round trip times above this are taken to be the result of a clock
+ * step between sending and receiving, and are discarded. */
+#define PING_MAX_RTT 10000000
+
+/* Most pings sent in one system call */
+#define PING_BATCH 64
+
+/* A neighbour's RTT is considered stable, and pings to it are backed
+ * off, while its deviation is within this fraction of its RTT. */
+#define PING_STABLE_FRACTION 8
+
+
+/**
+ * ping_stamp:
+ * Marks `ping' with the current time, just before it is sent. Pings
+ * are timed against the monotonic clock, which is immune to steps.
+ */
+static void ping_stamp( orta_t *orta, ping_packet_t *ping )
+{
+	struct timespec now;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	ping->sec=  now.tv_sec;
+	ping->nsec= now.tv_nsec;
+	ping->hold= 0;
+}
+
+
+/**
+ * ping_elapsed:
+ * Returns the microseconds from `sec'.`nsec' to `to'.
+ */
+static int64_t ping_elapsed( uint32_t sec, uint32_t nsec, struct timespec *to )
+{
+	return ((int64_t)to->tv_sec-sec)*1000000 + 
+		((int64_t)to->tv_nsec-nsec)/1000;
+}
+
+
+/**
+ * ping_recv:
+ * Receives one packet from the ping socket into `ping', placing the
+ * sender in `from' and the time of arrival in `when', on the
+ * monotonic clock. The arrival time comes from the kernel if it
+ * provided one, and is read from the clock otherwise.
+ * Returns the number of bytes received, or -1 on error.
+ */
+static int ping_recv( orta_t *orta, ping_packet_t *ping, 
+		      struct sockaddr_in *from, struct timespec *when )
+{
+	char control[256];
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	struct timespec mono, real;
+	int64_t age, at;
+	int nbytes;
+	int stamped= FALSE;
+
+	iov.iov_base= ping;
+	iov.iov_len= sizeof(ping_packet_t);
+
+	memset( &msg, 0, sizeof(msg) );
+	msg.msg_name= from;
+	msg.msg_namelen= sizeof(struct sockaddr_in);
+	msg.msg_iov= &iov;
+	msg.msg_iovlen= 1;
+	msg.msg_control= control;
+	msg.msg_controllen= sizeof(control);
+
+	if ( (nbytes= orta->transport->ops->dgram_recv( orta->transport, 
+							orta->ping_sd, 
+							&msg )) <= 0 )
+		return -1;
+
+	for ( cmsg= CMSG_FIRSTHDR(&msg); cmsg != NULL; 
+	      cmsg= CMSG_NXTHDR(&msg, cmsg) ) {
+		if ( cmsg->cmsg_level != SOL_SOCKET )
+			continue;
+
+#ifdef SCM_TIMESTAMPING
+		/* Software stamp is the first of the three */
+		if ( cmsg->cmsg_type == SCM_TIMESTAMPING ) {
+			struct timespec *ts= (struct timespec*)CMSG_DATA(cmsg);
+
+			if ( ts[0].tv_sec || ts[0].tv_nsec ) {
+				*when= ts[0];
+				stamped= TRUE;
+			}
+		}
+#endif
+#ifdef SCM_TIMESTAMPNS
+		if ( cmsg->cmsg_type == SCM_TIMESTAMPNS ) {
+			*when= *(struct timespec*)CMSG_DATA(cmsg);
+			stamped= TRUE;
+		}
+#endif
+	}
+
+	clock_gettime( CLOCK_MONOTONIC, &mono );
+
+	/* Kernel stamps are realtime, so are moved onto the monotonic
+	 * clock by how long ago they were taken */
+	if ( stamped && orta->ping_kernel_ts ) {
+		clock_gettime( CLOCK_REALTIME, &real );
+		age= ping_elapsed( when->tv_sec, when->tv_nsec, &real );
+		if ( age < 0 )
+			age= 0;
+		at= ping_elapsed( 0, 0, &mono )-age;
+		when->tv_sec= at/1000000;
+		when->tv_nsec= at%1000000*1000;
+	}
+	else
+		*when= mono;
+
+	return nbytes;
+}
+
+
 /**
  * random_ping:
- * 
+ * Pings up to `probes_per_cycle' members who are not yet neighbours,
+ * chosen at random, so that evaluate_links() has fresh RTTs with
+ * which to judge adding links to them.
  */
 void* random_ping( orta_t *orta )
 {
 	ping_packet_t ping;
 	int length= sizeof(ping_packet_t);
 	sockaddr_in_t dest;
+	uint32_t chosen[PING_BATCH];
+	uint32_t wanted, seen, i;
+	member_t *member;
+
 	dest.sin_family= AF_INET;
-	dest.sin_port= htons(orta->udp_tx_port);
+	dest.sin_port= htons(orta->peer_ping_port);
 	memset(&(dest.sin_zero), '\0', 8);
 
 	ping.header.type= ping_request;
-	gettimeofday( &(ping.time), NULL );
+
+	wanted= orta->config.probes_per_cycle;
+	if ( wanted > PING_BATCH )
+		wanted= PING_BATCH;
 
 	pthread_mutex_lock( orta->members->lock );
 	pthread_mutex_lock( orta->neighbours->lock );
 
-	/* Ping a random member of the group if we have members in the
-	 * group who are not yet out neighbour.
-	 */
-	/* Do a -1 on members length to take into account this peer */
-	if ( orta->members->length && 
-	     (orta->members->length-1) > orta->neighbours->length) {
-		int random, i;
-		member_t *member;
-		struct in_addr a1;
+	/* Pick the members to ping by reservoir sampling over those who
+	 * are not this peer or one of its neighbours */
+	seen= 0;
+	for ( member= orta->members->head; member != NULL; member= member->next ) {
+		if ( member->member == orta->local_ip || 
+		     neighbours_contains( orta->neighbours, member->member ) )
+			continue;
 
-		member= orta->members->head;
+		if ( seen < wanted )
+			chosen[seen]= member->member;
+		else if ( (i= rand()%(seen+1)) < wanted )
+			chosen[i]= member->member;
+		seen++;
+	}
 
-		do {
-			random= rand()%orta->members->length;
-			member= orta->members->head;
-			for ( i= 0; i<random; i++ ) {
-				member= member->next;
-			}
-		} while ( member->member == orta->local_ip || 
-			  neighbours_contains( orta->neighbours, 
-					       member->member ) );
+	pthread_mutex_unlock( orta->neighbours->lock );
+	pthread_mutex_unlock( orta->members->lock );
+
+	if ( seen > wanted )
+		seen= wanted;
 
-		a1.s_addr= member->member;
+	for ( i= 0; i < seen; i++ ) {
 #ifdef ORTA_DEBUG
-		printf( "random_ping: Pinging %s\n", print_ip(member->member));
+		printf( "random_ping: Pinging %s\n", print_ip(chosen[i]) );
 #endif
-
-
-		dest.sin_addr= a1;
-		if ( sendto( orta->udp_sd, &ping, length, 0, 
-			     (struct sockaddr*)&dest, 
-			     sizeof(struct sockaddr) ) <= 0 ) {
+		dest.sin_addr.s_addr= chosen[i];
+		ping_stamp( orta, &ping );
+		if ( orta_sendto( orta, orta->ping_sd, &ping, length, 
+				  &dest ) <= 0 ) {
 			perror( "random_ping" );
 		}
 	}
 
-	pthread_mutex_unlock( orta->neighbours->lock );
-	pthread_mutex_unlock( orta->members->lock );
+	return NULL;
 }
 
 
 /**
- * Repeatedly pings orta neighbours.
+ * ping_now:
+ * Returns the transport's monotonic time in microseconds, for ping
+ * scheduling.
  */
-void* pinger( orta_t *orta )
+static uint64_t ping_now( orta_t *orta )
 {
-	ping_packet_t ping;
-	unsigned int key;
-	int length= sizeof( ping_packet_t );
+	return orta->transport->ops->now_us( orta->transport );
+}
+
+
+/**
+ * ping_jitter:
+ * Returns `interval' scattered randomly by up to a quarter either
+ * way, so that pings to many neighbours don't fall into step.
+ */
+static uint32_t ping_jitter( uint32_t interval )
+{
+	return interval-interval/4+(uint32_t)(rand()%(interval/2+1));
+}
+
+
+/**
+ * ping_speed_up, ping_back_off:
+ * Halve or lengthen by half the interval between pings to `n', within
+ * the configured bounds.
+ */
+static void ping_speed_up( orta_t *orta, neighbour_t *n )
+{
+	n->ping_interval/= 2;
+	if ( n->ping_interval < orta->config.ping_interval_min_us )
+		n->ping_interval= orta->config.ping_interval_min_us;
+}
+
+static void ping_back_off( orta_t *orta, neighbour_t *n )
+{
+	n->ping_interval+= n->ping_interval/2;
+	if ( n->ping_interval > orta->config.ping_interval_max_us )
+		n->ping_interval= orta->config.ping_interval_max_us;
+}
+
+
+/**
+ * pinger:
+ * Pings each neighbour whose ping is due, and schedules its next.
+ * Neighbours whose RTT is steady are pinged less often, and those
+ * whose RTT is varying, or which failed to answer the last ping, more
+ * often. A neighbour's next ping waits for its last to come back or
+ * be counted lost. The pings are built under the neighbours lock and
+ * then sent together once it is released.
+ * Returns the number of microseconds until the next ping is due.
+ */
+uint32_t pinger( orta_t *orta )
+{
+	ping_packet_t pings[PING_BATCH];
+	sockaddr_in_t dests[PING_BATCH];
+	struct iovec iovs[PING_BATCH];
+	struct mmsghdr msgs[PING_BATCH];
+	int count;
+
 	neighbour_t *neighbour;
+	uint64_t now, next, due;
 
-	sockaddr_in_t dest;
-	dest.sin_family= AF_INET;
-	dest.sin_port= htons(orta->udp_tx_port);
-	memset(&(dest.sin_zero), '\0', 8);
+	do {
+		count= 0;
+		now= ping_now( orta );
+		next= now+orta->config.ping_interval_max_us;
 
+		pthread_mutex_lock( orta->neighbours->lock );
 
-	ping.header.type= ping_request;
-	gettimeofday( &(ping.time), NULL );
+		for( neighbour= orta->neighbours->head; neighbour != NULL; 
+		     neighbour= neighbour->next ) {
+			if ( neighbour->next_ping > now ) {
+				if ( neighbour->next_ping < next )
+					next= neighbour->next_ping;
+				continue;
+			}
 
-	pthread_mutex_lock( orta->members->lock );
-	pthread_mutex_lock( orta->neighbours->lock );
+			/* Last ping may still be on its way; it is only
+			 * lost once it has been out longer than the RTO */
+			if ( neighbour->outstanding ) {
+				due= neighbour->ping_sent+
+					neighbour_rto( neighbour );
+				if ( due > now ) {
+					neighbour->next_ping= due;
+					if ( due < next )
+						next= due;
+					continue;
+				}
+			}
+
+			/* Batch is full; go round again for the rest */
+			if ( count == PING_BATCH ) {
+				next= now;
+				break;
+			}
 
-	for( neighbour= orta->neighbours->head; neighbour != NULL; neighbour= neighbour->next ) {
-		/* Set end-point address for ping */
-		dest.sin_addr= neighbour->addr->sin_addr;
+			/* Last ping never came back */
+			if ( neighbour->outstanding ) {
+				neighbour->losses++;
+				ping_speed_up( orta, neighbour );
+			}
 
-		if ( sendto( orta->udp_sd, &ping, length, 0, 
-			     (struct sockaddr*)&dest, 
-			     sizeof(struct sockaddr) ) <= 0 ) {
-			perror( "pinger" );
+			pings[count].header.type= ping_request;
+			ping_stamp( orta, &(pings[count]) );
+
+			/* Set end-point address for ping */
+			dests[count].sin_family= AF_INET;
+			dests[count].sin_port= htons(orta->peer_ping_port);
+			dests[count].sin_addr= neighbour->addr->sin_addr;
+			memset(&(dests[count].sin_zero), '\0', 8);
+
+			iovs[count].iov_base= &(pings[count]);
+			iovs[count].iov_len= sizeof(ping_packet_t);
+
+			memset( &(msgs[count]), 0, sizeof(struct mmsghdr) );
+			msgs[count].msg_hdr.msg_name= &(dests[count]);
+			msgs[count].msg_hdr.msg_namelen= sizeof(sockaddr_in_t);
+			msgs[count].msg_hdr.msg_iov= &(iovs[count]);
+			msgs[count].msg_hdr.msg_iovlen= 1;
+			count++;
+
+			neighbour->outstanding= TRUE;
+			neighbour->ping_sent= now;
+			neighbour->next_ping= now+
+				ping_jitter( neighbour->ping_interval );
+			if ( neighbour->next_ping < next )
+				next= neighbour->next_ping;
 		}
+
+		pthread_mutex_unlock( orta->neighbours->lock );
+
+		if ( count )
+			orta_send_batch( orta, orta->ping_sd, msgs, count );
+
+	} while ( next <= now );
+
+	return (uint32_t)(next-now);
+}
+
+
+/**
+ * pinger_wake:
+ * Brings the next round of pings forward to now, for when a neighbour
+ * has been added.
+ */
+void pinger_wake( orta_t *orta )
+{
+	timer_wheel_expedite( orta->sched, &(orta->ping_event), 0 );
+}
+
+
+/**
+ * ping_reschedule:
+ * Adjusts the interval between pings to `n', which has just answered
+ * one, according to how steady its RTT is. Called with the neighbours
+ * lock held.
+ */
+static void ping_reschedule( orta_t *orta, neighbour_t *n )
+{
+	uint64_t now;
+
+	n->outstanding= FALSE;
+
+	if ( n->consecutive_rejects || 
+	     n->rttvar > n->srtt/PING_STABLE_FRACTION ) {
+		ping_speed_up( orta, n );
+
+		/* Don't wait out the longer interval already scheduled */
+		now= ping_now( orta );
+		if ( n->next_ping > now+n->ping_interval )
+			n->next_ping= now+ping_jitter( n->ping_interval );
+	}
+	else {
+		ping_back_off( orta, n );
+	}
+}
+
+
+/**
+ * ping_response_process:
+ * Works out the round trip time for the returned `ping' from
+ * `ip_addr', which arrived at `when', and updates that neighbour's
+ * distance. A response from a member who is not a neighbour is one of
+ * our random pings; its RTT is kept with the member for evaluating the
+ * usefulness of adding that link.
+ */
+static void ping_response_process( orta_t *orta, uint32_t ip_addr, 
+				   ping_packet_t *ping, struct timespec *when )
+{
+	int64_t rtt;
+	uint32_t difference;
+	neighbour_t *neighbour;
+
+	/* Time spent at the far end isn't part of the link */
+	rtt= ping_elapsed( ping->sec, ping->nsec, when ) - ping->hold;
+
+	if ( rtt < 0 || rtt > PING_MAX_RTT ) {
+#ifdef ORTA_DEBUG
+		printf( "handle_ping_data: Discarding RTT %lld from %s\n", 
+			(long long)rtt, print_ip(ip_addr) );
+#endif
+		return;
+	}
+
+	difference= (uint32_t)rtt;
+
+	if ( difference < orta->config.min_weight )
+		difference= orta->config.min_weight;
+
+	pthread_mutex_lock( orta->neighbours->lock );
+
+	for (neighbour= orta->neighbours->head;
+	     neighbour != NULL; 
+	     neighbour= neighbour->next) {
+		if (neighbour->addr->sin_addr.s_addr == ip_addr)
+			break;
+	}
+
+	if ( neighbour != NULL ) {
+		neighbour_update( orta->neighbours, neighbour, difference );
+		ping_reschedule( orta, neighbour );
 	}
 
 	pthread_mutex_unlock( orta->neighbours->lock );
-	pthread_mutex_unlock( orta->members->lock );
+
+	if (neighbour == NULL) {
+		member_t *member;
+
+#ifdef ORTA_DEBUG
+		printf( "handle_ping_data: Random ping from %s\n", print_ip(ip_addr) );
+		printf( "hold: %u\n", ping->hold );
+		printf( "difference: %u\n", difference );
+#endif
+		/* Kept for the next evaluate_links() */
+		pthread_mutex_lock( orta->members->lock );
+		if ( (member= members_get( orta->members, ip_addr )) != NULL )
+			member_probed( member, difference );
+		pthread_mutex_unlock( orta->members->lock );
+	}
 }
 
 
 /**
- * handle_udp_data:
- * 
+ * ping_thread_priority:
+ * Asks for the calling thread to run ahead of the data threads, so
+ * that ping responses are not held up behind forwarding. This needs
+ * privileges the process may not have, in which case pings are still
+ * kept off the data socket but run at normal priority.
+ */
+static void ping_thread_priority( )
+{
+	struct sched_param param;
+
+	param.sched_priority= sched_get_priority_min( SCHED_FIFO );
+	if ( pthread_setschedparam( pthread_self(), SCHED_FIFO, &param ) != 0 ) {
+#ifdef ORTA_DEBUG
+		printf( "handle_ping_data: Running at normal priority.\n" );
+#endif
+	}
+}
+
+
+/**
+ * handle_ping_data:
+ * Receive loop for the ping socket. Answers ping requests and
+ * measures round trip times from ping responses, kept apart from the
+ * data path so that measurements don't include time spent queued
+ * behind data.
  */
-void* handle_udp_data( void* o )
+void* handle_ping_data( void* o )
 {
 	orta_t *orta= (orta_t*)o;
 
-	int nbytes, i;
-	data_packet_header_t *packet= (data_packet_header_t*)malloc(PACKET_SIZE);
+	int nbytes;
+	ping_packet_t ping;
 	struct sockaddr_in dest;
-	int addr_len= sizeof(struct sockaddr);
-	uint32_t *temp;
+	struct timespec when, now;
+
+	ping_thread_priority( );
 
 	while( orta->alive ) {
-		/* If we have actual data, packet size is 1 or more.*/
-		if ((nbytes= recvfrom(orta->udp_sd, packet, PACKET_SIZE, 0, 
-				      (sockaddr_t*)&dest, &addr_len )) <= 0) {
-			perror( "handle_udp_data" );
-			/* FIXME: Look into this; is this what I want? :) */
+		if ((nbytes= ping_recv( orta, &ping, &dest, &when )) <= 0) {
+			/* Woken by orta_destroy() shutting the socket */
+			if ( !orta->alive )
+				break;
+			perror( "handle_ping_data" );
 			continue;
 		}
 
-		switch (packet->type) {
+		if ( nbytes < sizeof(ping_packet_t) )
+			continue;
+
+		switch (ping.header.type) {
 
 		/* Recieved a ping request; send a ping response back. */
 		case ping_request: {
-			ping_packet_t *ping= (ping_packet_t*)packet;
+			ping.header.type= ping_response;
 
-			ping->header.type= ping_response;
+			clock_gettime( CLOCK_MONOTONIC, &now );
+			ping.hold= ping_elapsed( when.tv_sec, when.tv_nsec, 
+						 &now );
 
-			sendto(orta->udp_sd, ping, sizeof( ping_packet_t ), 0, 
-			       (struct sockaddr*)&dest, 
-			       sizeof(struct sockaddr));
+			orta_sendto( orta, orta->ping_sd, &ping, 
+				     sizeof( ping_packet_t ), &dest );
 
 			break;
 		}
@@ -158,61 +523,116 @@ void* handle_udp_data( void* o )
 		/* Recieved a ping response; calculate amount of time that has 
 		   passed, and update pings table as appropriate. */
 		case ping_response: {
-			ping_packet_t *ping= (ping_packet_t*)packet;
-			struct timeval time;
-			uint32_t ip_addr= dest.sin_addr.s_addr;
-			uint32_t difference;
-			neighbour_t *neighbour= orta->neighbours->head;
+			ping_response_process( orta, dest.sin_addr.s_addr, 
+					       &ping, &when );
+			break;
+		}
 
-			gettimeofday( &time, NULL );
+		/* Nothing else is sent to the ping port */
+		default:
+			break;
+
+		} /* end switch */
+	}
 
-			pthread_mutex_lock( orta->neighbours->lock );
+#ifdef ORTA_DEBUG
+	printf( "Finished ping recv'er.\n" );
+#endif
+	pthread_exit(NULL);
+}
 
-			for (neighbour= orta->neighbours->head;
-			     neighbour != NULL; 
-			     neighbour= neighbour->next) {
-				if (neighbour->addr->sin_addr.s_addr == ip_addr)
-					break;
-			}
 
-			pthread_mutex_unlock( orta->neighbours->lock );
+/**
+ * handle_udp_data:
+ * Receive loop for one udp_worker_t, passed as `w'. Several of these
+ * may run at once, each on its own socket, so anything touched here
+ * must be safe to share.
+ */
+void* handle_udp_data( void* w )
+{
+	udp_worker_t *worker= (udp_worker_t*)w;
+	orta_t *orta= worker->orta;
+	int sd= worker->sd;
 
-			/* FIXME: Comment */
-			/* We've recieved a ping response from a group member 
-			 * who is not our neighbour. This is one of our random 
-			 * pings; evaluate the usefullness of adding this link.
-			 */
+	int nbytes, i, seg;
+	data_packet_header_t *packet= (data_packet_header_t*)malloc(PACKET_SIZE);
+	struct sockaddr_in dest;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char control[64];
+	uint32_t *temp;
 
+	iov.iov_base= packet;
+	iov.iov_len= PACKET_SIZE;
 
-			/* FIXME -- is this correct? */
-			difference= (((time.tv_sec)-(ping->time.tv_sec))*1000000)+
-				((time.tv_usec)-(ping->time.tv_usec));
+	while( orta->alive ) {
+		memset( &msg, 0, sizeof(msg) );
+		msg.msg_name= &dest;
+		msg.msg_namelen= sizeof(dest);
+		msg.msg_iov= &iov;
+		msg.msg_iovlen= 1;
+		msg.msg_control= control;
+		msg.msg_controllen= sizeof(control);
 
-			if ( difference < MIN_WEIGHT )
-				difference= MIN_WEIGHT;
+		/* If we have actual data, packet size is 1 or more.*/
+		if ((nbytes= orta->transport->ops->dgram_recv( orta->transport, 
+							       sd, &msg )) <= 0) {
+			/* Woken by orta_destroy() shutting the socket */
+			if ( !orta->alive )
+				break;
+			perror( "handle_udp_data" );
+			/* FIXME: Look into this; is this what I want? :) */
+			continue;
+		}
 
-			if (neighbour == NULL) {
-#ifdef ORTA_DEBUG
-				printf( "handle_udp_data: Random ping from %s\n", print_ip(ip_addr) );
-				printf( "time.tv_sec: %u\n", time.tv_sec );
-				printf( "ping->time.tv_sec: %u\n", ping->time.tv_sec );
-				printf( "time.tv_usec: %u\n", time.tv_usec );
-				printf( "ping->time.tv_usec: %u\n", ping->time.tv_usec);
-				printf( "difference: %u\n", difference );
+		/* Packets the kernel has coalesced come with the size they
+		 * were sent at */
+		seg= 0;
+#ifdef UDP_GRO
+		for ( cmsg= CMSG_FIRSTHDR(&msg); cmsg != NULL; 
+		      cmsg= CMSG_NXTHDR(&msg, cmsg) ) {
+			if ( cmsg->cmsg_level == SOL_UDP &&
+			     cmsg->cmsg_type == UDP_GRO )
+				seg= *(int*)CMSG_DATA(cmsg);
+		}
 #endif
-				evaluate_add_link( orta, ip_addr, difference );
-			}
-			else {
-				neighbour_update( neighbour, difference );
-			}
-
-			break;
+		/* Measured before forwarding restamps the packets */
+		if ( orta->config.congestion_control )
+			cc_arrived( orta->cc, dest.sin_addr.s_addr, 
+				    (char*)packet, nbytes, 
+				    seg > 0 ? seg : nbytes, 
+				    orta->transport->ops->now_us( 
+					    orta->transport ) );
+
+		if ( seg > 0 && seg < nbytes ) {
+			handle_segments( orta, (char*)packet, nbytes, seg );
+			continue;
 		}
+
+		/* Data, and parity above all, is only as long as what
+		 * arrived, whatever its header claims */
+		if ( nbytes < sizeof(data_header_t) ||
+		     ((data_packet_t*)packet)->datalen > 
+		     nbytes-sizeof(data_header_t) )
+			continue;
+
+		switch (packet->type) {
+
 		case data: {
 			handle_data( orta, (data_packet_t*)packet );
 			break;
 		}
 
+		case data_parity: {
+			handle_parity( orta, (data_packet_t*)packet );
+			break;
+		}
+
+		/* Nothing else is sent to the data port */
+		default:
+			break;
+
 		} /* end switch */
 	}
 
@@ -6,10 +6,33 @@
 
 
 
-void* pinger( orta_t *orta );
-
-
-void* handle_udp_data( void* o );
+/**
+ * pinger:
+ * Pings each neighbour whose ping is due. Returns the number of
+ * microseconds until the next ping is due.
+ */
+uint32_t pinger( orta_t *orta );
+
+/**
+ * pinger_wake:
+ * Brings the next round of pings forward to now, for when a neighbour
+ * has been added.
+ */
+void pinger_wake( orta_t *orta );
+
+
+/**
+ * handle_ping_data:
+ * Receive loop for the ping socket of the orta_t passed as `o'.
+ */
+void* handle_ping_data( void* o );
+
+
+/**
+ * handle_udp_data:
+ * Receive loop for one udp_worker_t, passed as `w'.
+ */
+void* handle_udp_data( void* w );
 
 #endif
 
@@ -1,25 +1,336 @@
+#define _GNU_SOURCE /* struct mmsghdr */
+
+#include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <netinet/udp.h>
 #include "orta_data.h"
+#include "pool.h"
+#include "fec.h"
+#include "rx_streams.h"
+#include "pacer.h"
+
+/* Most messages handed to the transport at once */
+#define ROUTE_BATCH 64
+
+/* Most segments sent in one buffer, and most bytes in it, within the
+ * limits of UDP GSO */
+#define SEGMENT_BATCH 64
+#define SEGMENT_BYTES 65000
+
+
+static pool_t holder_pool= POOL_INITIALISER( "packet_holder_t", 
+					     sizeof(packet_holder_t)+
+					     PACKET_HOLDER_INLINE );
+
 
 /**
- * route_m:
- * 
+ * packet_holder_alloc:
+ * Returns a packet holder with room for `len' bytes of data at
+ * ph->data, or NULL if no memory is available.
  */
-int route_m( orta_t *orta, data_packet_t* packet )
+packet_holder_t *packet_holder_alloc( uint32_t len )
 {
-	route_t *route;
-	struct sockaddr_in dest;
+	packet_holder_t *ph= (packet_holder_t*)pool_alloc( &holder_pool );
 
-#ifdef EVAL_RDP
-	uint32_t *last_hop, *dist_to_here, *packet_no;
-	uint32_t neighbour_sd;
+	if ( ph == NULL )
+		return NULL;
+
+	if ( len <= PACKET_HOLDER_INLINE ) {
+		ph->data= (char*)(ph+1);
+	}
+	else if ( (ph->data= (char*)malloc(len)) == NULL ) {
+		pool_free( &holder_pool, ph );
+		return NULL;
+	}
+
+	ph->len= len;
+
+	return ph;
+}
+
+
+/**
+ * packet_holder_free:
+ * Releases a packet holder obtained from packet_holder_alloc(),
+ * along with its data.
+ */
+void packet_holder_free( packet_holder_t *ph )
+{
+	if ( ph->data != (char*)(ph+1) )
+		free( ph->data );
+
+	pool_free( &holder_pool, ph );
+}
+
+
+/**
+ * orta_sendto:
+ * Sends `len' bytes of `buf' from UDP socket `sd' to `dest', through
+ * the instance's send hook if it has one, or its transport.
+ * Returns as sendto().
+ */
+ssize_t orta_sendto( orta_t *orta, int sd, const void *buf, size_t len, 
+		     const sockaddr_in_t *dest )
+{
+	if ( orta->send_hook != NULL )
+		return orta->send_hook( orta->send_hook_arg, sd, buf, len, dest );
+
+	return orta->transport->ops->dgram_send( orta->transport, sd, buf, len, 
+						 dest );
+}
+
+/**
+ * orta_send_batch:
+ * Sends the first `count' messages of `msgs' from UDP socket `sd', in
+ * as few calls to the transport as it allows, or one by one through
+ * the send hook if there is one. A message which can't be sent is
+ * skipped.
+ */
+void orta_send_batch( orta_t *orta, int sd, struct mmsghdr *msgs, int count )
+{
+	transport_t *t= orta->transport;
+	int i, sent;
+
+	if ( orta->send_hook != NULL ) {
+		for ( i= 0; i < count; i++ )
+			orta_sendto( orta, sd, 
+				     msgs[i].msg_hdr.msg_iov->iov_base,
+				     msgs[i].msg_hdr.msg_iov->iov_len,
+				     (sockaddr_in_t*)msgs[i].msg_hdr.msg_name );
+		return;
+	}
+
+	for ( i= 0; i < count; i+= sent ) {
+		if ( (sent= t->ops->dgram_send_batch( t, sd, msgs+i, 
+						      count-i )) > 0 )
+			continue;
+
+		/* Skip the message that failed and carry on */
+		perror( "orta_send_batch" );
+		sent= 1;
+	}
+}
+
+/**
+ * route_flush:
+ * Sends the `len' bytes at `buf', a run of packets `seg' bytes apart,
+ * to the first `count' of `dests'. Each destination is sent the whole
+ * run in one buffer if udp_sd can have the kernel cut it up, or else
+ * each packet of it separately; either way as few calls are made as
+ * the transport allows.
+ */
+static void route_flush( orta_t *orta, char *buf, int len, int seg, 
+			 sockaddr_in_t *dests, int count )
+{
+	struct mmsghdr msgs[ROUTE_BATCH];
+	struct iovec iov[ROUTE_BATCH];
+	int i, off, n= 0, whole;
+#ifdef UDP_SEGMENT
+	char control[CMSG_SPACE(sizeof(uint16_t))];
+	struct cmsghdr *cmsg;
+#endif
+
+	whole= len <= seg || (orta->udp_segments && orta->send_hook == NULL &&
+			      (len+seg-1)/seg <= SEGMENT_BATCH);
+
+#ifdef UDP_SEGMENT
+	/* Read by the kernel only, so shared by every message */
+	if ( whole && len > seg ) {
+		memset( control, 0, sizeof(control) );
+		cmsg= (struct cmsghdr*)control;
+		cmsg->cmsg_level= SOL_UDP;
+		cmsg->cmsg_type= UDP_SEGMENT;
+		cmsg->cmsg_len= CMSG_LEN(sizeof(uint16_t));
+		*(uint16_t*)CMSG_DATA(cmsg)= seg;
+	}
+#endif
+
+	for ( i= 0; i < count; i++ ) {
+		for ( off= 0; off < len; off+= iov[n++].iov_len ) {
+			if ( n == ROUTE_BATCH ) {
+				orta_send_batch( orta, orta->udp_sd, msgs, n );
+				n= 0;
+			}
+
+			iov[n].iov_base= buf+off;
+			iov[n].iov_len= whole ? len : 
+				(len-off < seg ? len-off : seg);
+
+			memset( &(msgs[n]), 0, sizeof(struct mmsghdr) );
+			msgs[n].msg_hdr.msg_name= &(dests[i]);
+			msgs[n].msg_hdr.msg_namelen= sizeof(sockaddr_in_t);
+			msgs[n].msg_hdr.msg_iov= &(iov[n]);
+			msgs[n].msg_hdr.msg_iovlen= 1;
+#ifdef UDP_SEGMENT
+			if ( whole && len > seg ) {
+				msgs[n].msg_hdr.msg_control= control;
+				msgs[n].msg_hdr.msg_controllen= sizeof(control);
+			}
 #endif
+		}
+	}
+
+	if ( n )
+		orta_send_batch( orta, orta->udp_sd, msgs, n );
+}
+
+/**
+ * route_stamp:
+ * Marks each packet of the run of `len' bytes at `buf', `seg' bytes
+ * apart, with the time it is sent, for the receiver to measure the
+ * link's delay by.
+ */
+static void route_stamp( char *buf, int len, int seg, uint64_t now_us )
+{
+	int off;
+
+	for ( off= 0; off < len; off+= seg )
+		((data_packet_t*)(buf+off))->sent_us= now_us;
+}
+
+/**
+ * route_children:
+ * Forwards the `len' bytes at `buf', a run of packets `seg' bytes
+ * apart from `source', to each of this host's children in the tree
+ * rooted at `source', sending up to ROUTE_BATCH copies at a time.
+ * Children over paced links may have to wait their turn.
+ */
+static void route_children( orta_t *orta, uint32_t source, char *buf, 
+			    int len, int seg )
+{
+	route_t *route;
+	struct sockaddr_in dest;
+	sockaddr_in_t dests[ROUTE_BATCH];
+	data_packet_t *packet= (data_packet_t*)buf;
+	int count= 0;
+	uint64_t now_us= orta->transport->ops->now_us( orta->transport );
+	uint32_t wait, next_wait= 0;
 
 	/* Sort out sockaddr stuff */
 	dest.sin_family= AF_INET;
 	dest.sin_port= htons(orta->udp_tx_port);
 	memset(&(dest.sin_zero), '\0', 8);
 
+	route_stamp( buf, len, seg, now_us );
+
+	pthread_rwlock_rdlock( orta->route->lock );
+
+	route= orta->route->head;
+	while ( route != NULL && route->source != source )
+		route= route->next_node;
+
+	while ( route != NULL ) {
+		switch ( pacer_admit( orta->pacer, route->fwd_link, buf, len, 
+				      seg, packet->header.priority, now_us, 
+				      &wait ) ) {
+		case PACER_QUEUED:
+			if ( next_wait == 0 || wait < next_wait )
+				next_wait= wait;
+			/* Fall through */
+		case PACER_DROPPED:
+			route= route->next_link;
+			continue;
+		}
+
+		dest.sin_addr.s_addr= route->fwd_link;
+
+#ifdef ORTA_DEBUG
+/* 		printf( "Sending %d bytes to %s\n", */
+/* 			len, print_ip(route->fwd_link) ); */
+#endif
+
+		dests[count++]= dest;
+		if ( count == ROUTE_BATCH ) {
+			route_flush( orta, buf, len, seg, dests, count );
+			count= 0;
+		}
+		route= route->next_link;
+	}
+
+	if ( count )
+		route_flush( orta, buf, len, seg, dests, count );
+
+	pthread_rwlock_unlock( orta->route->lock );
+
+	if ( next_wait != 0 )
+		timer_wheel_expedite( orta->sched, &(orta->pace_event), 
+				      next_wait );
+}
+
+
+/**
+ * pace_send:
+ * Sends data the pacer has let go to `addr', stamped with the time it
+ * leaves rather than the time it was queued.
+ */
+static void pace_send( void *o, uint32_t addr, char *buf, uint32_t len, 
+		       uint32_t seg )
+{
+	orta_t *orta= (orta_t*)o;
+	sockaddr_in_t dest;
+
+	memset( &dest, 0, sizeof(dest) );
+	dest.sin_family= AF_INET;
+	dest.sin_port= htons(orta->udp_tx_port);
+	dest.sin_addr.s_addr= addr;
+
+	route_stamp( buf, len, seg, 
+		     orta->transport->ops->now_us( orta->transport ) );
+	route_flush( orta, buf, len, seg, &dest, 1 );
+}
+
+
+/**
+ * pace_flush:
+ * Forwards data held back on paced links as far as their rates now
+ * allow, and has this run again when more may go.
+ */
+void pace_flush( orta_t *orta )
+{
+	uint32_t wait;
+
+	wait= pacer_drain( orta->pacer, 
+			   orta->transport->ops->now_us( orta->transport ),
+			   &pace_send, orta );
+	if ( wait != 0 )
+		timer_wheel_expedite( orta->sched, &(orta->pace_event), wait );
+}
+
+/**
+ * route_segments:
+ * Forwards a run of `len' bytes of segments at `buf', each `seg'
+ * bytes but the last, which all share a source and ttl.
+ */
+static void route_segments( orta_t *orta, char *buf, int len, int seg )
+{
+	data_packet_t *packet= (data_packet_t*)buf;
+	int off;
+
+	/* Decrement ttl; if ttl hits zero, return and don't forward */
+	if ( !packet->ttl )
+		return;
+	for ( off= 0; off < len; off+= seg )
+		((data_packet_t*)(buf+off))->ttl--;
+
+	route_children( orta, packet->source, buf, len, seg );
+}
+
+/**
+ * route_m:
+ * Forwards `packet' to each of this host's children in the tree
+ * rooted at its source.
+ */
+int route_m( orta_t *orta, data_packet_t* packet )
+{
+	int len= (packet->datalen)+sizeof(data_header_t);
+
+#ifdef EVAL_RDP
+	uint32_t *last_hop, *dist_to_here, *packet_no;
+	uint32_t neighbour_sd;
+#endif
+
 	/* Decrement ttl; if ttl hits zero, return and don't forward */
 	if ( !packet->ttl-- )
 		return 1;
@@ -58,98 +369,380 @@ int route_m( orta_t *orta, data_packet_t* packet )
 #endif
 	/** End RDP evaluation section */
 
-	pthread_mutex_lock( orta->route->lock );
+	route_children( orta, packet->source, (char*)packet, len, len );
 
-	route= orta->route->head;
-	while ( route != NULL && route->source != packet->source )
-		route= route->next_node;
+	return 1;
+}
 
-	while ( route != NULL ) {
-		dest.sin_addr.s_addr= route->fwd_link;
 
-#ifdef ORTA_DEBUG
-/* 		printf( "Sending %d bytes to %s\n", */
-/* 			(packet->datalen)+sizeof(data_header_t), */
-/* 			print_ip(route->fwd_link) ); */
-/* 		printf( "Sending %d bytes of data to %s\n", */
-/* 			(packet->datalen), */
-/* 			print_ip(route->fwd_link) ); */
-#endif
+/**
+ * route_split:
+ * Sends `buflen' bytes of `buffer' as the fragments of one message,
+ * each carrying up to `chunk' bytes, in class `priority', built up in
+ * runs of up to SEGMENT_BATCH. Any parity packets due are sent after
+ * each run.
+ */
+static int route_split( orta_t *orta, uint32_t channel, char *buffer, 
+			int buflen, int ttl, int chunk, int priority )
+{
+	char store[SEGMENT_BYTES];
+	data_packet_t *packet;
+	data_packet_t *parity[SEGMENT_BATCH];
+	int seg= sizeof(data_header_t)+chunk;
+	int per_run= SEGMENT_BYTES/seg;
+	int off= 0, len, n, i, num_parity;
+	uint32_t msg_id;
+	uint16_t frag= 0, frags;
+
+	if ( (buflen+chunk-1)/chunk > UINT16_MAX )
+		return -1;
+	frags= (buflen+chunk-1)/chunk;
+	msg_id= __sync_fetch_and_add( &(orta->next_msg_id), 1 );
+
+	if ( per_run > SEGMENT_BATCH )
+		per_run= SEGMENT_BATCH;
+
+	while ( off < buflen ) {
+		num_parity= 0;
+
+		for ( n= 0, len= 0; n < per_run && off < buflen; n++ ) {
+			packet= (data_packet_t*)(store+len);
+			packet->header.type= data;
+			packet->header.channel= channel;
+			packet->header.priority= priority;
+			packet->source= orta->local_ip;
+			packet->ttl= ttl;
+			packet->datalen= buflen-off < chunk ? buflen-off : chunk;
+			packet->msg_id= msg_id;
+			packet->frag= frag++;
+			packet->frags= frags;
+
+			memcpy( &(packet->data), buffer+off, packet->datalen );
+
+			if ( (parity[num_parity]= fec_encode( orta->fec, 
+							      packet )) != NULL )
+				num_parity++;
+
+			off+= packet->datalen;
+			len+= sizeof(data_header_t)+packet->datalen;
+		}
 
-		if ( sendto( orta->udp_sd, 
-			     packet, 
-			     (packet->datalen)+sizeof(data_header_t), 
-			     0, 
-			     (struct sockaddr*)&dest, 
-			     sizeof(struct sockaddr) ) <= 0 ) {
-			perror( "route_m" );
+		route_segments( orta, store, len, seg );
+
+		for ( i= 0; i < num_parity; i++ ) {
+			route_m( orta, parity[i] );
+			free( parity[i] );
 		}
-		route= route->next_link;
 	}
 
-	pthread_mutex_unlock( orta->route->lock );
-
-	return 1;
+	return buflen;
 }
 
 
 /**
  * route:
- * 
+ * Sends `buflen' bytes of `buffer' on `channel' to the rest of the
+ * group, in fragments if they won't fit in one packet.
  */
 int route( orta_t *orta, uint32_t channel, char *buffer, int buflen, int ttl )
 {
 	char store[PACKET_SIZE];
 	data_packet_t *packet= (data_packet_t*)&store;
+	data_packet_t *parity;
+	int chunk= orta->segment_size-sizeof(data_header_t);
+	int priority= channel_table_priority( orta->channels, channel, 
+					      ORTA_PRIORITY_NORMAL );
+
+	/* Packets on a protected channel leave room for parity to fit
+	 * the MTU as well */
+	if ( orta->segment_size && fec_group( orta->fec, channel ) )
+		chunk-= FEC_OVERHEAD;
+
+	if ( orta->segment_size && buflen > chunk )
+		return route_split( orta, channel, buffer, buflen, ttl, chunk,
+				    priority );
 
 	/* Sort out actual packet stuff. */
 	packet->header.type= data;
 	packet->header.channel= channel;
+	packet->header.priority= priority;
 	packet->source= orta->local_ip;
 	packet->ttl= ttl;
 	packet->datalen= buflen;
+	packet->msg_id= __sync_fetch_and_add( &(orta->next_msg_id), 1 );
+	packet->frag= 0;
+	packet->frags= 1;
 
 	memcpy( &(packet->data), buffer, buflen );
 
+	parity= fec_encode( orta->fec, packet );
+
 	route_m( orta, packet );
 
+	if ( parity != NULL ) {
+		route_m( orta, parity );
+		free( parity );
+	}
+
 	/* FIXME: Do something more intelligent? */
 	return buflen;
 }
 
 
 /**
- * handle_data:
- * 
+ * deliver_now:
+ * Queues the data of `packet' on its channel, if this host has
+ * registered it. A fragment is held back until the rest of its
+ * message has arrived, and the message queued whole.
  */
-void handle_data( orta_t *orta, data_packet_t *packet )
+static void deliver_now( void *o, data_packet_t *packet )
 {
+	orta_t *orta= (orta_t*)o;
 	uint32_t channel= packet->header.channel;
 	queue_t *data_queue;
+	reasm_msg_t *msg= NULL;
+
+	packet_holder_t *ph, *dropped;
+
+	/* Get the queue for the appropriate data channel. If this host
+	 * hasn't registered the channel, nothing is delivered locally,
+	 * but the packet is still routed onward. */
+	data_queue= channel_table_get( orta->channels, channel );
+	if ( data_queue == NULL )
+		return;
+
+	if ( packet->frags > 1 ) {
+		msg= reasm_add( orta->reasm, packet->source, packet->msg_id,
+				channel, packet->frag, packet->frags,
+				&packet->data, packet->datalen,
+				orta->transport->ops->now_us( orta->transport ) );
+		if ( msg == NULL ) {
+			/* Given up on if the rest doesn't follow in time */
+			timer_wheel_expedite( orta->sched, &(orta->reasm_event),
+					      orta->reasm->timeout_us+1 );
+			return;
+		}
+	}
 
-	/* Packet holder placed into queue */
-	packet_holder_t *ph= (packet_holder_t*)malloc(sizeof(packet_holder_t));
-	/* packet data placed into packet holder. */
-	char *tempdata= (char*)malloc(packet->datalen);
-
-	/* Get the queue for the appropriate data channel */
-	pthread_mutex_lock( orta->data_queues->lock );
-	list_get( orta->data_queues, channel, (void**)&data_queue );
-	pthread_mutex_unlock( orta->data_queues->lock );
-
-	memcpy(tempdata, &packet->data, packet->datalen);
+	/* Packet holder, with packet data, placed into queue */
+	ph= packet_holder_alloc( msg != NULL ? msg->len : packet->datalen );
+	if ( ph == NULL ) {
+		if ( msg != NULL )
+			reasm_msg_free( msg );
+		return;
+	}
 
-	ph->data= tempdata;
-	ph->len= packet->datalen;
+	if ( msg != NULL ) {
+		reasm_copy( msg, ph->data );
+		reasm_msg_free( msg );
+	}
+	else
+		memcpy(ph->data, &packet->data, packet->datalen);
 
 	pthread_mutex_lock( data_queue->lock );
-	queue_add( data_queue, ph );
 
-	pthread_cond_signal( data_queue->flag );
-	pthread_cond_signal( &(orta->data_arrived) );
+	/* If the channel is full, either this packet or the oldest one
+	 * queued is discarded, depending on the channel's policy. */
+	if ( queue_add_bounded( data_queue, ph, (void**)&dropped ) ) {
+		pthread_cond_signal( data_queue->flag );
+		pthread_cond_signal( &(orta->data_arrived) );
+	}
+	else {
+		dropped= ph;
+	}
 
 	pthread_mutex_unlock( data_queue->lock );
 
+	if ( dropped != NULL )
+		packet_holder_free( dropped );
+}
+
+
+/**
+ * deliver:
+ * Delivers `packet', once those before it have been on a reordered
+ * channel, if this host has registered its channel.
+ */
+static void deliver( orta_t *orta, data_packet_t *packet )
+{
+	uint32_t wait;
+
+	if ( channel_table_get( orta->channels, packet->header.channel ) == NULL )
+		return;
+
+	wait= rx_streams_order( orta->streams, packet, 
+				orta->transport->ops->now_us( orta->transport ),
+				&deliver_now, orta );
+	if ( wait != 0 )
+		timer_wheel_expedite( orta->sched, &(orta->reorder_event), wait );
+}
+
+
+/**
+ * is_fresh:
+ * Returns TRUE if `packet' hasn't been seen before. Packets held back
+ * on a stream given up on meanwhile are delivered.
+ */
+static int is_fresh( orta_t *orta, data_packet_t *packet )
+{
+	return rx_streams_fresh( orta->streams, packet,
+				 orta->transport->ops->now_us( orta->transport ),
+				 &deliver_now, orta );
+}
+
+
+/**
+ * reorder_flush:
+ * Delivers packets held back on reordered channels whose wait for a
+ * missing one is up, and has this run again when the next wait is.
+ */
+void reorder_flush( orta_t *orta )
+{
+	uint32_t wait;
+
+	wait= rx_streams_flush( orta->streams, 
+				orta->transport->ops->now_us( orta->transport ),
+				&deliver_now, orta );
+	if ( wait != 0 )
+		timer_wheel_expedite( orta->sched, &(orta->reorder_event), wait );
+}
+
+
+/**
+ * reasm_flush:
+ * Gives up on fragmented messages whose wait for the rest is up, and
+ * has this run again when the next wait is.
+ */
+void reasm_flush( orta_t *orta )
+{
+	uint32_t wait;
+
+	wait= reasm_expire( orta->reasm, 
+			    orta->transport->ops->now_us( orta->transport ) );
+	if ( wait != 0 )
+		timer_wheel_expedite( orta->sched, &(orta->reasm_event), wait );
+}
+
+
+/**
+ * handle_repair:
+ * Delivers and forwards `recovered', unless a copy of it has arrived
+ * meanwhile, and forwards `parity', either of which may be NULL, and
+ * frees them.
+ */
+static void handle_repair( orta_t *orta, data_packet_t *recovered, 
+			   data_packet_t *parity )
+{
+	if ( recovered != NULL ) {
+		if ( is_fresh( orta, recovered ) ) {
+			deliver( orta, recovered );
+			route_m( orta, recovered );
+		}
+		free( recovered );
+	}
+
+	if ( parity != NULL ) {
+		route_m( orta, parity );
+		free( parity );
+	}
+}
+
+
+/**
+ * handle_data:
+ * 
+ */
+void handle_data( orta_t *orta, data_packet_t *packet )
+{
+	data_packet_t *recovered, *parity;
+
+	/* Copies, and packets already rebuilt from parity, go no
+	 * further */
+	if ( !is_fresh( orta, packet ) ||
+	     !fec_data( orta->fec, packet, &recovered, &parity ) )
+		return;
+
+	deliver( orta, packet );
+
 	/* Attempt to route the data packet onward */
 	route_m( orta, packet );
+
+	handle_repair( orta, recovered, parity );
+}
+
+
+/**
+ * handle_parity:
+ * Rebuilds a lost packet from `parity' if it can, and passes the
+ * parity on as it came, or in re-encoding mode once all of its
+ * group is here.
+ */
+void handle_parity( orta_t *orta, data_packet_t *parity )
+{
+	data_packet_t *recovered, *forward;
+
+	if ( !is_fresh( orta, parity ) )
+		return;
+
+	fec_parity( orta->fec, parity, &recovered, &forward );
+
+	if ( !orta->fec->reencode )
+		route_m( orta, parity );
+
+	handle_repair( orta, recovered, forward );
+}
+
+
+/**
+ * handle_segments:
+ * Handles `len' bytes of packets arriving together in `buf', each
+ * `seg' bytes but the last. Each is delivered as a packet of its own,
+ * and runs of data from one source are forwarded as they came.
+ * Anything from the first malformed packet on is dropped.
+ */
+void handle_segments( orta_t *orta, char *buf, int len, int seg )
+{
+	data_packet_t *packet, *first= NULL;
+	data_packet_t *recovered, *parity;
+	int off, n, fresh;
+
+	for ( off= 0; off < len; off+= seg ) {
+		packet= (data_packet_t*)(buf+off);
+		n= len-off < seg ? len-off : seg;
+
+		if ( n < (int)sizeof(data_header_t) || 
+		     (packet->header.type != data && 
+		      packet->header.type != data_parity) ||
+		     packet->datalen != n-sizeof(data_header_t) )
+			break;
+
+		fresh= packet->header.type == data &&
+			is_fresh( orta, packet ) &&
+			fec_data( orta->fec, packet, &recovered, &parity );
+
+		/* Parity, and packets already seen, end the run */
+		if ( first != NULL && (!fresh || packet->source != first->source ||
+				       packet->ttl != first->ttl) ) {
+			route_segments( orta, (char*)first, 
+					(char*)packet-(char*)first, seg );
+			first= NULL;
+		}
+
+		if ( packet->header.type == data_parity ) {
+			handle_parity( orta, packet );
+			continue;
+		}
+		if ( !fresh )
+			continue;
+
+		if ( first == NULL )
+			first= packet;
+
+		deliver( orta, packet );
+		handle_repair( orta, recovered, parity );
+	}
+
+	if ( first != NULL )
+		route_segments( orta, (char*)first, 
+				buf+(off < len ? off : len)-(char*)first, seg );
 }
@@ -5,6 +5,10 @@
 #include "orta_t.h"
 #include "orta_data_packets.h"
 
+/* Payloads up to this size are stored in the same pool object as
+ * their packet holder; larger ones are malloc'd separately. */
+#define PACKET_HOLDER_INLINE 1472
+
 typedef struct _packet_holder
 {
 	char* data;
@@ -12,9 +16,80 @@ typedef struct _packet_holder
 } packet_holder_t;
 
 
+/**
+ * packet_holder_alloc:
+ * Returns a packet holder with room for `len' bytes of data at
+ * ph->data, or NULL if no memory is available.
+ */
+packet_holder_t *packet_holder_alloc( uint32_t len );
+
+/**
+ * packet_holder_free:
+ * Releases a packet holder obtained from packet_holder_alloc(),
+ * along with its data.
+ */
+void packet_holder_free( packet_holder_t *ph );
+
+/**
+ * orta_sendto:
+ * Sends `len' bytes of `buf' from UDP socket `sd' to `dest', through
+ * the instance's send hook if it has one, or its transport.
+ * Returns as sendto().
+ */
+ssize_t orta_sendto( orta_t *orta, int sd, const void *buf, size_t len, 
+		     const sockaddr_in_t *dest );
+
+/**
+ * orta_send_batch:
+ * Sends the first `count' messages of `msgs' from UDP socket `sd', in
+ * as few calls to the transport as it allows, or one by one through
+ * the send hook if there is one. A message which can't be sent is
+ * skipped.
+ */
+void orta_send_batch( orta_t *orta, int sd, struct mmsghdr *msgs, int count );
+
+
 int route( orta_t *orta, uint32_t channel, char *buffer, int buflen, int ttl );
 
 void handle_data( orta_t *orta, data_packet_t *packet );
 
+/**
+ * handle_parity:
+ * Rebuilds a lost packet from `parity' if it can, and passes the
+ * parity on as it came, or in re-encoding mode once all of its
+ * group is here.
+ */
+void handle_parity( orta_t *orta, data_packet_t *parity );
+
+/**
+ * handle_segments:
+ * Handles `len' bytes of packets arriving together in `buf', each
+ * `seg' bytes but the last. Each is delivered as a packet of its own,
+ * and runs of data from one source are forwarded as they came.
+ * Anything from the first malformed packet on is dropped.
+ */
+void handle_segments( orta_t *orta, char *buf, int len, int seg );
+
+/**
+ * reorder_flush:
+ * Delivers packets held back on reordered channels whose wait for a
+ * missing one is up, and has this run again when the next wait is.
+ */
+void reorder_flush( orta_t *orta );
+
+/**
+ * reasm_flush:
+ * Gives up on fragmented messages whose wait for the rest is up, and
+ * has this run again when the next wait is.
+ */
+void reasm_flush( orta_t *orta );
+
+/**
+ * pace_flush:
+ * Forwards data held back on paced links as far as their rates now
+ * allow, and has this run again when more may go.
+ */
+void pace_flush( orta_t *orta );
+
 #endif
 
@@ -12,6 +12,8 @@ typedef struct _data_packet_header
 {
 	enum control_type type;
 	uint16_t channel;
+	/* Class it is forwarded in, one of enum orta_priority */
+	uint8_t priority;
 } data_packet_header_t;
 
 
@@ -21,6 +23,19 @@ typedef struct _data_header
 	uint32_t source;
 	uint32_t ttl;
 	uint32_t datalen;
+	/* Message this is part of, numbered by its source, and which of
+	 * its fragments it is; fragment 0 of 1 for one sent whole */
+	uint32_t msg_id;
+	uint16_t frag;
+	uint16_t frags;
+	/* Position of the packet among those its source has sent on the
+	 * channel */
+	uint32_t seq;
+	/* Low 32 bits of the microsecond clock of the host which last
+	 * forwarded it, as it was sent; the clocks of different hosts
+	 * aren't in step, but their differences change only as the
+	 * delay of the link does */
+	uint32_t sent_us;
 } data_header_t;
 
 typedef struct _data_packet
@@ -29,7 +44,28 @@ typedef struct _data_packet
 	uint32_t source;
 	uint32_t ttl;
 	uint32_t datalen;
+	uint32_t msg_id;
+	uint16_t frag;
+	uint16_t frags;
+	uint32_t seq;
+	uint32_t sent_us;
 	char data;
 } data_packet_t;
 
+/**
+ * A data_parity packet is a data packet header, with the XOR of the
+ * msg_id, frag and frags of the packets it covers in its own, then a
+ * parity_header_t and the XOR of their data, each zero padded to the
+ * longest. It covers the `count' packets from `first' on, in sequence,
+ * from its source on its channel, and any one of them can be rebuilt
+ * from it and the others.
+ */
+typedef struct _parity_header
+{
+	uint32_t first;
+	uint16_t count;
+	/* XOR of the datalen of each packet covered */
+	uint16_t datalen;
+} parity_header_t;
+
 #endif
@@ -5,6 +5,7 @@
 #include "members.h"
 
 #include "linked_list.h"
+#include "pool.h"
 
 #include <netdb.h>
 #include <stdio.h>
@@ -89,12 +90,18 @@ static void print_neighbours( orta_t * orta )
 
 	printf( "---- NEIGHBOURS: (length: %d) --\n", 
 		orta->neighbours->length );
-	printf( "-- SD --+---- IP Addr -----------+------ DISTANCE ------+\n");
+	printf( "-- SD --+---- IP Addr -----------+------ DISTANCE ------+"
+		"-- SRTT --+- RTTVAR -+- MIN RTT -+- SAMPLES/REJECTS -+\n");
 	while ( neighbour != NULL ) {
-		printf( "%u\t|\t%s\t|\t%d\t\n", 
+		printf( "%u\t|\t%s\t|\t%d\t|%u\t|%u\t|%u\t|%u/%u\n", 
 			neighbour->sd, 
 			inet_ntoa(neighbour->addr->sin_addr), 
-			neighbour->distance
+			neighbour->distance,
+			neighbour->srtt,
+			neighbour->rttvar,
+			neighbour->min_rtt,
+			neighbour->samples,
+			neighbour->rejects
 			);
 		neighbour= neighbour->next;
 	}
@@ -118,6 +125,30 @@ static void print_group_members( orta_t * orta )
 }
 
 
+/**
+ * print_pools:
+ * Prints the counters for every object pool in use. Allocation rates
+ * can be found by differencing successive outputs.
+ */
+void print_pools( )
+{
+	pool_stats_t stats;
+	int i;
+
+	printf( "---- POOLS: (count: %d) --\n", pool_count() );
+	printf( "---- NAME ----------+- SIZE -+- SLABS -+---- ALLOCS ----+----- FREES -----+\n" );
+	for ( i= 0; i < pool_count(); i++ ) {
+		pool_stats( pool_get(i), &stats );
+		printf( "%-20s|\t%u\t|\t%u\t|\t%llu\t|\t%llu\n",
+			stats.name,
+			(unsigned int)stats.size,
+			stats.slabs,
+			(unsigned long long)stats.allocs,
+			(unsigned long long)stats.frees );
+	}
+}
+
+
 void print_state( orta_t *orta )
 {
 	printf("-------------------------------------------------\n");
@@ -130,6 +161,8 @@ void print_state( orta_t *orta )
 	print_links( orta );
 	printf("\n");fflush(stdout);
 	print_routes( orta );
+	printf("\n");fflush(stdout);
+	print_pools( );
 	printf("-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-\n");
 	fflush(stdout);
 	printf( "print_state: Sleeping.\n" );
@@ -11,6 +11,8 @@ char* print_ip( uint32_t ip );
 
 void print_links( orta_t *orta );
 
+void print_pools( );
+
 void print_state( orta_t *orta );
 
 #endif
@@ -46,40 +46,67 @@ int routing_build_table( orta_t *o )
 	if ( !routing_table_init( &r ) )
 		return FALSE;
 
-	links_init( &shortest_paths );
-
-	/* Calculate shortest path spanning tree from each source, then store 
-	 * the links in the tree rooted at that source, but only links which 
-	 * move away from the source (such that information is not forwarded 
-	 * back up the tree). */
-	for(member= o->members->head; member != NULL; member= member->next){
-
-		shortest_path_graph(member->member, o->links, shortest_paths);
-
- 		tempnode= shortest_paths->head;
- 		while (tempnode != NULL && tempnode->ip != o->local_ip) {
-			tempnode= tempnode->next_node;
- 		}
-
-		if ( tempnode != NULL ) {
-			templink= tempnode->links;
-			while (templink != NULL) {
-				routing_table_add( r, 
-						   member->member, 
-						   templink->ip );
-				templink= templink->next_link;
+	/* Scratch space for each source's tree comes from the new
+	 * table's arena, and is reused from one source to the next. */
+	if ( !links_init_arena( &shortest_paths, r->arena ) )
+		goto fail;
+
+	/* With the all-pairs matrix current, each source's tree is read
+	 * straight from its row: we forward to every node we precede. */
+	if ( o->apsp != NULL && apsp_sync( o->apsp, o->links ) ) {
+		uint32_t *children= (uint32_t*)arena_alloc( r->arena, 
+				o->apsp->num_nodes*sizeof(uint32_t) );
+		uint32_t i, n;
+
+		if ( children == NULL )
+			goto fail;
+
+		for ( member= o->members->head; member != NULL; 
+		      member= member->next ) {
+			n= apsp_children( o->apsp, member->member, 
+					  o->local_ip, children );
+			for ( i= 0; i < n; i++ ) {
+				if ( !routing_table_add( r, member->member, 
+							 children[i] ) )
+					goto fail;
 			}
 		}
+	}
+	else {
+		/* Calculate shortest path spanning tree from each source, then store 
+		 * the links in the tree rooted at that source, but only links which 
+		 * move away from the source (such that information is not forwarded 
+		 * back up the tree). */
+		for(member= o->members->head; member != NULL; member= member->next){
+
+			shortest_path_graph(member->member, o->links, shortest_paths);
+
+	 		tempnode= shortest_paths->head;
+	 		while (tempnode != NULL && tempnode->ip != o->local_ip) {
+				tempnode= tempnode->next_node;
+	 		}
+
+			if ( tempnode != NULL ) {
+				templink= tempnode->links;
+				while (templink != NULL) {
+					if ( !routing_table_add( r, 
+								 member->member, 
+								 templink->ip ) )
+						goto fail;
+					templink= templink->next_link;
+				}
+			}
 
-		links_clear( shortest_paths );
+			links_clear( shortest_paths );
+		}
 	}
 
-	pthread_mutex_lock( o->route->lock );
+	pthread_rwlock_wrlock( o->route->lock );
 
 	/* Destroy the lock that was created for the new routing table.
 	 * Replace it with the lock from the old routing table.
 	 * Anybody holding onto the lock shant be dissappointed this way. */
-	pthread_mutex_destroy( r->lock );
+	pthread_rwlock_destroy( r->lock );
 	free( r->lock );
 
 	tmp_r= o->route;
@@ -87,12 +114,20 @@ int routing_build_table( orta_t *o )
 	/* Pass on the lock */
 	o->route->lock= tmp_r->lock;
 
-	pthread_mutex_unlock( o->route->lock );
+	pthread_rwlock_unlock( o->route->lock );
 
-	/* Destroy temporary links table */
-	links_destroy( &shortest_paths );
-	/* Destroy old route table, but not its mutex. */
+	/* Destroy old route table, but not its mutex. This releases the
+	 * old table's routes and its scratch space in one go. */
 	routing_table_free( &tmp_r );
 
 	return TRUE;
+
+ fail:
+	/* The new table was never shared, nor its lock taken; the old
+	 * one stays in use */
+	pthread_rwlock_destroy( r->lock );
+	free( r->lock );
+	routing_table_free( &r );
+
+	return FALSE;
 }
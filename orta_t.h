@@ -5,10 +5,32 @@
 #include <stdlib.h>
 #include <pthread.h>
 
+#include "orta.h"
 #include "links.h"
+#include "spt_cache.h"
+#include "apsp.h"
 #include "members.h"
 #include "neighbours.h"
 #include "routing_table.h"
+#include "channel_table.h"
+#include "timer_wheel.h"
+#include "transport.h"
+#include "reassembly.h"
+#include "fec.h"
+#include "rx_streams.h"
+#include "pacer.h"
+#include "congestion.h"
+#include "common_defs.h"
+
+struct orta;
+
+/* A thread receiving and forwarding UDP traffic from its own socket */
+typedef struct
+{
+	struct orta *orta;
+	int sd;
+	pthread_t thread;
+} udp_worker_t;
 
 struct orta
 {
@@ -17,13 +39,34 @@ struct orta
 	/* Connected marker. Set to false when not connected. */
 	int connected;
 
+	/* Settings this instance was created with */
+	orta_config_t config;
+
+	/* Scheduler for periodic control tasks, run by ctrl_sched_thread,
+	 * and the events it runs */
+	timer_wheel_t *sched;
+	timer_event_t refresh_event;
+	timer_event_t evaluate_event;
+	timer_event_t random_ping_event;
+	timer_event_t partition_event;
+	timer_event_t ping_event;
+	timer_event_t reorder_event;
+	timer_event_t reasm_event;
+	timer_event_t pace_event;
+	timer_event_t report_event;
+	timer_event_t debug_event;
+
 	/* Thread descriptors */
 	pthread_t ctrl_recv_thread;
-	pthread_t ctrl_udp_thread;
+	pthread_t ctrl_ping_thread;
 	pthread_t ctrl_sched_thread;
 
 	/* List containing links */
 	links_t *links;
+	/* Shortest paths from here over `links', and optionally between
+	 * every pair of nodes; both guarded by its lock */
+	spt_cache_t *spt;
+	apsp_t *apsp;
 	/* List of known members */
 	members_list_t *members;
 	/* Table storing socket descriptor:info (FIXME) pairs */
@@ -33,22 +76,62 @@ struct orta
 
 	/* Local IP addr */
 	uint32_t local_ip;
+	/* Address sockets are bound to: local_ip if the instance was
+	 * given an interface, INADDR_ANY otherwise */
+	uint32_t bind_ip;
 	/* Local sequence number */
 	uint32_t local_seq;
 
-	/* List of queues, indexed by channel number */
-	linked_list_t *data_queues;
+	/* Table of queues, indexed by channel number */
+	channel_table_t *channels;
 	pthread_cond_t data_arrived;
 
 
-	/* Read set for connected TCP ports. */
-	int fdmax;
-	fd_set *master;
+	/* epoll instance watching the TCP listener and the connections
+	 * to neighbours, for ctrl_port_listener() */
+	int ctrl_epfd;
+
+	/* Sockets, and the clock, are reached through this */
+	transport_t *transport;
 
 	/* UDP socket for sending/recieving */
 	int udp_sd;
+	/* Threads receiving UDP traffic. The first reads from udp_sd;
+	 * any others have their own sockets on the same port, and the
+	 * kernel spreads incoming flows across them. */
+	udp_worker_t rx_workers[MAX_RX_WORKERS];
+	int num_rx_workers;
+
+	/* UDP socket for pings alone, on ping_port; and the port
+	 * neighbours answer pings on */
+	int ping_sd;
+	uint16_t ping_port;
+	uint16_t peer_ping_port;
+	/* TRUE if the kernel timestamps pings as they arrive */
+	int ping_kernel_ts;
+	/* Largest data packet sent, from config.mtu, or 0 for no limit;
+	 * and TRUE if udp_sd sends runs of such packets in one buffer */
+	uint32_t segment_size;
+	int udp_segments;
+	/* Id of the next message sent from this host */
+	uint32_t next_msg_id;
+	/* Fragments of messages to this host, until they are whole */
+	reasm_t *reasm;
+	/* Parity sent, and packets held to rebuild others from it */
+	fec_t *fec;
+	/* Packets seen from each source on each channel, and those held
+	 * back to be delivered in order */
+	rx_streams_t *streams;
+	/* Data forwarded to each neighbour, held to its rate */
+	pacer_t *pacer;
+	/* How data from each neighbour is arriving, and how fast each
+	 * link to one goes, under congestion control */
+	cc_t *cc;
 	uint16_t udp_rx_port;
 	uint16_t udp_tx_port;
+	/* Called in place of sendto() for UDP traffic, if set */
+	orta_send_hook_t send_hook;
+	void *send_hook_arg;
 
 	/* Callback to inform application of current group
 	   membership */
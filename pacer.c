@@ -0,0 +1,484 @@
+
+#include "pacer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+/**
+ * pacer_hash:
+ * Chain for the link to `addr'.
+ */
+static uint32_t pacer_hash( uint32_t addr )
+{
+	return (addr*2654435761u) >> 24 & (PACER_BUCKETS-1);
+}
+
+
+/**
+ * pacer_init:
+ * Creates a pacer holding every link to `rate' bytes per second, with
+ * bursts of up to `burst' and up to `max_queue' bytes waiting, and
+ * makes `p' point to it. A rate of 0 leaves links unpaced. Waiting
+ * classes take turns sending `quantum' bytes each, or if `quantum' is
+ * NULL, the most urgent class waiting is always sent first, and may
+ * push out less urgent data to make room.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int pacer_init( pacer_t **p, uint32_t rate, uint32_t burst,
+		uint32_t max_queue, const uint32_t *quantum )
+{
+	pacer_t *t= (pacer_t*)calloc( 1, sizeof(pacer_t) );
+	int i;
+
+	if ( t == NULL )
+		return FALSE;
+
+	t->rate= rate;
+	t->burst= burst;
+	t->max_queue= max_queue;
+
+	/* Every class must get some turn for round robin to end */
+	for ( i= 0; quantum != NULL && i < PACER_CLASSES; i++ )
+		t->quantum[i]= quantum[i] ? quantum[i] : 1;
+
+	t->lock= (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
+	pthread_mutex_init( t->lock, NULL );
+
+	*p= t;
+	return TRUE;
+}
+
+
+/**
+ * pacer_link:
+ * Returns the link to `addr', starting it at the default rate with a
+ * full bucket if it is new. The caller must hold p->lock.
+ * Returns NULL if there is no memory.
+ */
+static pacer_link_t *pacer_link( pacer_t *p, uint32_t addr, uint64_t now_us )
+{
+	uint32_t h= pacer_hash( addr );
+	pacer_link_t *l= p->buckets[h];
+
+	while ( l != NULL && l->addr != addr )
+		l= l->chain;
+
+	if ( l != NULL )
+		return l;
+
+	if ( (l= (pacer_link_t*)calloc( 1, sizeof(pacer_link_t) )) == NULL )
+		return NULL;
+
+	l->addr= addr;
+	l->rate= p->rate;
+	l->burst= p->burst;
+	l->tokens= l->burst;
+	l->filled_us= now_us;
+	l->stats.rate= l->rate;
+
+	l->chain= p->buckets[h];
+	p->buckets[h]= l;
+	l->next= p->links;
+	p->links= l;
+
+	return l;
+}
+
+
+/**
+ * pacer_fill:
+ * Adds to the bucket of `l' what its rate has earned since it was
+ * last filled.
+ */
+static void pacer_fill( pacer_link_t *l, uint64_t now_us )
+{
+	uint64_t elapsed;
+
+	if ( now_us <= l->filled_us )
+		return;
+
+	/* Long enough to fill any bucket, and short enough not to
+	 * overflow */
+	elapsed= now_us-l->filled_us;
+	if ( elapsed > PACER_MAX_FILL_US )
+		elapsed= PACER_MAX_FILL_US;
+
+	l->tokens+= elapsed*l->rate/1000000;
+	if ( l->tokens > (int64_t)l->burst )
+		l->tokens= l->burst;
+
+	/* Keep the time the part of a byte earned stands for, so that
+	 * slow links aren't starved by frequent filling */
+	if ( l->rate && l->tokens < (int64_t)l->burst )
+		l->filled_us= now_us-elapsed*l->rate%1000000/l->rate;
+	else
+		l->filled_us= now_us;
+}
+
+
+/**
+ * pacer_wait:
+ * Returns the microseconds until the bucket of `l' is out of debt, at
+ * least 1, or 0 if nothing is waiting on it.
+ */
+static uint32_t pacer_wait( pacer_link_t *l )
+{
+	if ( l->stats.queued_packets == 0 )
+		return 0;
+
+	if ( l->rate == 0 || l->tokens >= 0 )
+		return 1;
+
+	return (uint32_t)(-l->tokens*1000000/l->rate)+1;
+}
+
+
+/**
+ * pacer_sent:
+ * Takes `len' bytes, packets `seg' apart, sent on `l' from its bucket
+ * and counts them.
+ */
+static void pacer_sent( pacer_link_t *l, uint32_t len, uint32_t seg )
+{
+	if ( l->rate )
+		l->tokens-= len;
+
+	l->stats.sent_bytes+= len;
+	l->stats.sent_packets+= (len+seg-1)/seg;
+}
+
+
+/**
+ * pacer_dequeue:
+ * Takes the first item off the queue of class `cls' of `l'.
+ */
+static pacer_item_t *pacer_dequeue( pacer_link_t *l, uint32_t cls )
+{
+	pacer_item_t *item= l->head[cls];
+
+	if ( (l->head[cls]= item->next) == NULL )
+		l->tail[cls]= NULL;
+
+	l->stats.queued_bytes-= item->len;
+	l->stats.queued_packets-= (item->len+item->seg-1)/item->seg;
+
+	return item;
+}
+
+
+/**
+ * pacer_push_out:
+ * Drops the item queued last in the least urgent class below `cls'
+ * of `l' which has any.
+ * Returns FALSE if there was none.
+ */
+static int pacer_push_out( pacer_link_t *l, uint32_t cls )
+{
+	pacer_item_t *item, *prev= NULL;
+	uint32_t c;
+
+	for ( c= PACER_CLASSES-1; c > cls && l->head[c] == NULL; c-- )
+		;
+	if ( c <= cls )
+		return FALSE;
+
+	for ( item= l->head[c]; item->next != NULL; item= item->next )
+		prev= item;
+
+	if ( prev != NULL ) prev->next= NULL;
+	else                l->head[c]= NULL;
+	l->tail[c]= prev;
+
+	l->stats.queued_bytes-= item->len;
+	l->stats.queued_packets-= (item->len+item->seg-1)/item->seg;
+	l->stats.drops+= (item->len+item->seg-1)/item->seg;
+	free( item );
+
+	return TRUE;
+}
+
+
+/**
+ * pacer_pick:
+ * Returns the class of `l', which must have something queued, to send
+ * from next.
+ */
+static uint32_t pacer_pick( pacer_t *p, pacer_link_t *l )
+{
+	uint32_t c;
+
+	if ( p->quantum[0] == 0 ) {
+		for ( c= 0; l->head[c] == NULL; c++ )
+			;
+		return c;
+	}
+
+	/* Each class with data waiting gets its quantum on its turn, and
+	 * keeps what it doesn't use while it still has data waiting */
+	while ( l->head[l->turn] == NULL ||
+		l->deficit[l->turn] < l->head[l->turn]->len ) {
+		if ( l->head[l->turn] == NULL )
+			l->deficit[l->turn]= 0;
+
+		l->turn= (l->turn+1) % PACER_CLASSES;
+		if ( l->head[l->turn] != NULL )
+			l->deficit[l->turn]+= p->quantum[l->turn];
+	}
+
+	return l->turn;
+}
+
+
+/**
+ * pacer_set_rate:
+ * Paces the link to `addr' to `rate' bytes per second, with bursts of
+ * up to `burst'; 0 leaves it unpaced. Data waiting is released at
+ * the new rate.
+ * Returns TRUE on success, FALSE if there is no memory.
+ */
+int pacer_set_rate( pacer_t *p, uint32_t addr, uint32_t rate,
+		    uint32_t burst )
+{
+	pacer_link_t *l;
+
+	pthread_mutex_lock( p->lock );
+
+	if ( (l= pacer_link( p, addr, 0 )) == NULL ) {
+		pthread_mutex_unlock( p->lock );
+		return FALSE;
+	}
+
+	if ( l->own_rate && l->rate != 0 )
+		__atomic_sub_fetch( &(p->num_paced), 1, __ATOMIC_RELEASE );
+	if ( rate != 0 )
+		__atomic_add_fetch( &(p->num_paced), 1, __ATOMIC_RELEASE );
+
+	l->own_rate= TRUE;
+	l->rate= rate;
+	l->burst= burst;
+	if ( l->tokens > (int64_t)burst )
+		l->tokens= burst;
+	l->stats.rate= rate;
+
+	pthread_mutex_unlock( p->lock );
+
+	return TRUE;
+}
+
+
+/**
+ * pacer_forget:
+ * Stops following the link to `addr', dropping any data waiting on
+ * it, as when the neighbour is gone.
+ */
+void pacer_forget( pacer_t *p, uint32_t addr )
+{
+	pacer_link_t **c= &(p->buckets[pacer_hash( addr )]);
+	pacer_link_t **n, *l;
+	pacer_item_t *item;
+	int i;
+
+	pthread_mutex_lock( p->lock );
+
+	while ( *c != NULL && (*c)->addr != addr )
+		c= &((*c)->chain);
+
+	if ( (l= *c) == NULL ) {
+		pthread_mutex_unlock( p->lock );
+		return;
+	}
+
+	*c= l->chain;
+	for ( n= &(p->links); *n != l; n= &((*n)->next) )
+		;
+	*n= l->next;
+
+	if ( l->own_rate && l->rate != 0 )
+		__atomic_sub_fetch( &(p->num_paced), 1, __ATOMIC_RELEASE );
+
+	pthread_mutex_unlock( p->lock );
+
+	for ( i= 0; i < PACER_CLASSES; i++ ) {
+		while ( (item= l->head[i]) != NULL ) {
+			l->head[i]= item->next;
+			free( item );
+		}
+	}
+	free( l );
+}
+
+
+/**
+ * pacer_admit:
+ * Decides whether `len' bytes at `buf', packets `seg' bytes apart in
+ * class `cls', may be sent to `addr' now. If not, a copy is queued,
+ * unless the link's queues are full, and *wait_us set to the
+ * microseconds until pacer_drain() may send it.
+ * Returns PACER_SEND, PACER_QUEUED or PACER_DROPPED.
+ */
+int pacer_admit( pacer_t *p, uint32_t addr, const char *buf, uint32_t len,
+		 uint32_t seg, uint32_t cls, uint64_t now_us, 
+		 uint32_t *wait_us )
+{
+	pacer_link_t *l;
+	pacer_item_t *item;
+
+	/* Nothing is paced, so nothing need be looked up */
+	if ( p->rate == 0 && 
+	     __atomic_load_n( &(p->num_paced), __ATOMIC_ACQUIRE ) == 0 )
+		return PACER_SEND;
+
+	pthread_mutex_lock( p->lock );
+
+	if ( (l= pacer_link( p, addr, now_us )) == NULL || l->rate == 0 ) {
+		pthread_mutex_unlock( p->lock );
+		return PACER_SEND;
+	}
+
+	pacer_fill( l, now_us );
+
+	/* Goes now if nothing is waiting, and the bucket isn't in
+	 * debt */
+	if ( l->stats.queued_packets == 0 && l->tokens >= 0 ) {
+		pacer_sent( l, len, seg );
+		pthread_mutex_unlock( p->lock );
+		return PACER_SEND;
+	}
+
+	if ( cls >= PACER_CLASSES )
+		cls= PACER_CLASSES-1;
+
+	/* Under strict priority, less urgent data makes way */
+	while ( p->quantum[0] == 0 && l->stats.queued_bytes+len > p->max_queue &&
+		pacer_push_out( l, cls ) )
+		;
+
+	if ( l->stats.queued_bytes+len > p->max_queue ||
+	     (item= (pacer_item_t*)malloc( sizeof(pacer_item_t)+len )) == NULL ) {
+		l->stats.drops+= (len+seg-1)/seg;
+		pthread_mutex_unlock( p->lock );
+		return PACER_DROPPED;
+	}
+
+	item->next= NULL;
+	item->len= len;
+	item->seg= seg;
+	memcpy( &(item->data), buf, len );
+
+	if ( l->tail[cls] != NULL ) l->tail[cls]->next= item;
+	else                        l->head[cls]= item;
+	l->tail[cls]= item;
+
+	l->stats.queued_bytes+= len;
+	l->stats.queued_packets+= (len+seg-1)/seg;
+	if ( l->stats.queued_bytes > l->stats.high_water )
+		l->stats.high_water= l->stats.queued_bytes;
+
+	*wait_us= pacer_wait( l );
+
+	pthread_mutex_unlock( p->lock );
+
+	return PACER_QUEUED;
+}
+
+
+/**
+ * pacer_drain:
+ * Passes data waiting on each link to `fn', as far as the link's rate
+ * allows by now.
+ * Returns the microseconds until more may be sent, or 0 if nothing is
+ * waiting.
+ */
+uint32_t pacer_drain( pacer_t *p, uint64_t now_us, pacer_send_fn_t fn,
+		      void *arg )
+{
+	pacer_link_t *l;
+	pacer_item_t *item;
+	uint32_t wait, next_wait= 0, cls;
+
+	pthread_mutex_lock( p->lock );
+
+	for ( l= p->links; l != NULL; l= l->next ) {
+		if ( l->stats.queued_packets == 0 )
+			continue;
+
+		pacer_fill( l, now_us );
+
+		/* Sent under the lock, so that nothing admitted meanwhile
+		 * overtakes what is already waiting */
+		while ( l->stats.queued_packets > 0 &&
+			(l->rate == 0 || l->tokens >= 0) ) {
+			cls= pacer_pick( p, l );
+			item= pacer_dequeue( l, cls );
+			l->deficit[cls]-= l->deficit[cls] < item->len ? 
+				l->deficit[cls] : item->len;
+			pacer_sent( l, item->len, item->seg );
+
+			fn( arg, l->addr, &(item->data), item->len, item->seg );
+			free( item );
+		}
+
+		wait= pacer_wait( l );
+		if ( wait != 0 && (next_wait == 0 || wait < next_wait) )
+			next_wait= wait;
+	}
+
+	pthread_mutex_unlock( p->lock );
+
+	return next_wait;
+}
+
+
+/**
+ * pacer_stats:
+ * Copies the counts kept for the link to `addr' into `stats'.
+ * Returns TRUE on success, or FALSE if the link has never been paced.
+ */
+int pacer_stats( pacer_t *p, uint32_t addr, pacer_stats_t *stats )
+{
+	pacer_link_t *l;
+
+	pthread_mutex_lock( p->lock );
+
+	l= p->buckets[pacer_hash( addr )];
+	while ( l != NULL && l->addr != addr )
+		l= l->chain;
+
+	if ( l != NULL )
+		*stats= l->stats;
+
+	pthread_mutex_unlock( p->lock );
+
+	return l != NULL;
+}
+
+
+/**
+ * pacer_destroy:
+ * Frees the pacer and any data waiting in it, and sets *p to NULL.
+ */
+void pacer_destroy( pacer_t **p )
+{
+	pacer_t *t= *p;
+	pacer_link_t *l;
+	pacer_item_t *item;
+	int i;
+
+	while ( (l= t->links) != NULL ) {
+		t->links= l->next;
+		for ( i= 0; i < PACER_CLASSES; i++ ) {
+			while ( (item= l->head[i]) != NULL ) {
+				l->head[i]= item->next;
+				free( item );
+			}
+		}
+		free( l );
+	}
+
+	pthread_mutex_destroy( t->lock );
+	free( t->lock );
+	free( t );
+
+	*p= NULL;
+}
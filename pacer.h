@@ -0,0 +1,173 @@
+#ifndef __PACER_
+#define __PACER_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "common_defs.h"
+
+/* Number of hash chains; must be a power of two */
+#define PACER_BUCKETS 64
+
+/* Classes data is queued in, most urgent first; one for each of enum
+ * orta_priority */
+#define PACER_CLASSES 3
+
+/* Longest a bucket is taken to have been filling for */
+#define PACER_MAX_FILL_US 10000000
+
+/* What pacer_admit() decided */
+#define PACER_SEND    0
+#define PACER_QUEUED  1
+#define PACER_DROPPED 2
+
+/**
+ * Data waiting for its turn on a link: `len' bytes of packets `seg'
+ * bytes apart, sent together.
+ */
+typedef struct _pacer_item
+{
+	struct _pacer_item *next;
+	uint32_t len;
+	uint32_t seg;
+	char data;
+} pacer_item_t;
+
+/**
+ * Counts kept for each paced link.
+ */
+typedef struct
+{
+	/* Bytes per second the link is paced to, or 0 */
+	uint32_t rate;
+	/* Sent since pacing began */
+	uint64_t sent_bytes;
+	uint32_t sent_packets;
+	/* Waiting now, and the most bytes that have waited at once */
+	uint32_t queued_bytes;
+	uint32_t queued_packets;
+	uint32_t high_water;
+	/* Dropped as there was no room to queue them */
+	uint32_t drops;
+} pacer_stats_t;
+
+/**
+ * The token bucket and queues of data to one neighbour. The bucket
+ * fills at `rate' bytes per second up to `burst'; data is sent while
+ * it isn't in debt, and may take it into debt, so that a burst of 0
+ * spaces every packet out. Data waits in the queue of its class, and
+ * the classes take turns as the pacer's scheduler decides.
+ */
+typedef struct _pacer_link
+{
+	uint32_t addr;
+	uint32_t rate;
+	uint32_t burst;
+	/* TRUE if the rate was set for this link, rather than taken
+	 * from the default */
+	int own_rate;
+	int64_t tokens;
+	uint64_t filled_us;
+
+	pacer_item_t *head[PACER_CLASSES], *tail[PACER_CLASSES];
+	/* For deficit round robin, the class whose turn it is, and the
+	 * bytes each may still send in its turn */
+	uint32_t turn;
+	uint32_t deficit[PACER_CLASSES];
+	pacer_stats_t stats;
+
+	/* Hash chain, and the list of every link */
+	struct _pacer_link *chain;
+	struct _pacer_link *next;
+} pacer_link_t;
+
+typedef struct
+{
+	pacer_link_t *buckets[PACER_BUCKETS];
+	pacer_link_t *links;
+	/* Rate and burst of links not given their own, and the most
+	 * bytes queued for any one link */
+	uint32_t rate;
+	uint32_t burst;
+	uint32_t max_queue;
+	/* Bytes each class may send per turn, under deficit round robin,
+	 * or all 0 for strict priority */
+	uint32_t quantum[PACER_CLASSES];
+	/* Links with a rate; while there are none, data goes straight
+	 * out without being looked at. Changed under the lock, but read
+	 * without it. */
+	uint32_t num_paced;
+	pthread_mutex_t *lock;
+} pacer_t;
+
+/* Sends data released by pacer_drain() to `addr' */
+typedef void (*pacer_send_fn_t)( void *arg, uint32_t addr, char *buf,
+				 uint32_t len, uint32_t seg );
+
+
+/**
+ * pacer_init:
+ * Creates a pacer holding every link to `rate' bytes per second, with
+ * bursts of up to `burst' and up to `max_queue' bytes waiting, and
+ * makes `p' point to it. A rate of 0 leaves links unpaced. Waiting
+ * classes take turns sending `quantum' bytes each, or if `quantum' is
+ * NULL, the most urgent class waiting is always sent first, and may
+ * push out less urgent data to make room.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int pacer_init( pacer_t **p, uint32_t rate, uint32_t burst,
+		uint32_t max_queue, const uint32_t *quantum );
+
+/**
+ * pacer_destroy:
+ * Frees the pacer and any data waiting in it, and sets *p to NULL.
+ */
+void pacer_destroy( pacer_t **p );
+
+/**
+ * pacer_set_rate:
+ * Paces the link to `addr' to `rate' bytes per second, with bursts of
+ * up to `burst'; 0 leaves it unpaced. Data waiting is released at
+ * the new rate.
+ * Returns TRUE on success, FALSE if there is no memory.
+ */
+int pacer_set_rate( pacer_t *p, uint32_t addr, uint32_t rate,
+		    uint32_t burst );
+
+/**
+ * pacer_forget:
+ * Stops following the link to `addr', dropping any data waiting on
+ * it, as when the neighbour is gone.
+ */
+void pacer_forget( pacer_t *p, uint32_t addr );
+
+/**
+ * pacer_admit:
+ * Decides whether `len' bytes at `buf', packets `seg' bytes apart in
+ * class `cls', may be sent to `addr' now. If not, a copy is queued,
+ * unless the link's queues are full, and *wait_us set to the
+ * microseconds until pacer_drain() may send it.
+ * Returns PACER_SEND, PACER_QUEUED or PACER_DROPPED.
+ */
+int pacer_admit( pacer_t *p, uint32_t addr, const char *buf, uint32_t len,
+		 uint32_t seg, uint32_t cls, uint64_t now_us, 
+		 uint32_t *wait_us );
+
+/**
+ * pacer_drain:
+ * Passes data waiting on each link to `fn', as far as the link's rate
+ * allows by now.
+ * Returns the microseconds until more may be sent, or 0 if nothing is
+ * waiting.
+ */
+uint32_t pacer_drain( pacer_t *p, uint64_t now_us, pacer_send_fn_t fn,
+		      void *arg );
+
+/**
+ * pacer_stats:
+ * Copies the counts kept for the link to `addr' into `stats'.
+ * Returns TRUE on success, or FALSE if the link has never been paced.
+ */
+int pacer_stats( pacer_t *p, uint32_t addr, pacer_stats_t *stats );
+
+#endif
@@ -0,0 +1,279 @@
+
+#include "pool.h"
+
+#include <stdio.h>
+
+
+typedef struct
+{
+	pool_obj_t *head;
+	uint32_t count;
+	uint32_t allocs;
+	uint32_t frees;
+} pool_cache_t;
+
+/* Per-thread caches, indexed by pool id-1 */
+static __thread pool_cache_t pool_caches[POOL_MAX];
+
+/* Every pool which has been used, indexed by id-1 */
+static pool_t *pools[POOL_MAX];
+static int num_pools= 0;
+static pthread_mutex_t pools_lock= PTHREAD_MUTEX_INITIALIZER;
+
+/* Used to hand back a thread's cached objects when it exits */
+static pthread_key_t pool_thread_key;
+static pthread_once_t pool_key_once= PTHREAD_ONCE_INIT;
+static __thread int pool_thread_registered= FALSE;
+
+
+/**
+ * pool_flush:
+ * Moves `n' objects from the thread's cache `c' onto the shared free
+ * list of `pool', and adds in the thread's counters. Called with
+ * pool->lock held.
+ */
+static void pool_flush( pool_t *pool, pool_cache_t *c, uint32_t n )
+{
+	pool_obj_t *obj;
+
+	while ( n-- && (obj= c->head) != NULL ) {
+		c->head= obj->next;
+		c->count--;
+
+		obj->next= pool->free;
+		pool->free= obj;
+		pool->free_count++;
+	}
+
+	pool->allocs+= c->allocs;
+	pool->frees+=  c->frees;
+	c->allocs= 0;
+	c->frees=  0;
+}
+
+
+/**
+ * pool_thread_exit:
+ * Thread-specific data destructor; returns everything the exiting
+ * thread has cached to the shared free lists.
+ */
+static void pool_thread_exit( void *unused )
+{
+	int i;
+
+	for ( i= 0; i < num_pools; i++ ) {
+		pthread_mutex_lock( &(pools[i]->lock) );
+		pool_flush( pools[i], &(pool_caches[i]), POOL_CACHE_SIZE*2 );
+		pthread_mutex_unlock( &(pools[i]->lock) );
+	}
+}
+
+static void pool_key_init( )
+{
+	pthread_key_create( &pool_thread_key, pool_thread_exit );
+}
+
+/**
+ * pool_thread_init:
+ * Arranges for pool_thread_exit() to run when the calling thread
+ * exits. Only does any work the first time a thread uses any pool.
+ */
+static void pool_thread_init( )
+{
+	if ( !pool_thread_registered ) {
+		pthread_once( &pool_key_once, pool_key_init );
+		pthread_setspecific( pool_thread_key, (void*)&pool_caches );
+		pool_thread_registered= TRUE;
+	}
+}
+
+
+/**
+ * pool_register:
+ * Assigns `pool' an id on first use, and rounds its object size up so
+ * that every object can hold a free list link and stays aligned.
+ */
+static int pool_register( pool_t *pool )
+{
+	pthread_mutex_lock( &pools_lock );
+
+	if ( !pool->id ) {
+		if ( num_pools == POOL_MAX ) {
+			pthread_mutex_unlock( &pools_lock );
+			fprintf( stderr, "pool_register: Too many pools.\n" );
+			return FALSE;
+		}
+
+		if ( pool->size < sizeof(pool_obj_t) )
+			pool->size= sizeof(pool_obj_t);
+		pool->size= (pool->size+15) & ~((size_t)15);
+
+		pools[num_pools]= pool;
+		num_pools++;
+
+		__sync_synchronize();
+		pool->id= num_pools;
+	}
+
+	pthread_mutex_unlock( &pools_lock );
+
+	return TRUE;
+}
+
+
+/**
+ * pool_refill:
+ * Moves up to half a cache's worth of objects from the shared free
+ * list into the thread's cache, carving a new slab if the shared
+ * list is empty.
+ * Returns FALSE if no memory could be found.
+ */
+static int pool_refill( pool_t *pool, pool_cache_t *c )
+{
+	pool_obj_t *obj;
+	uint32_t n;
+
+	pthread_mutex_lock( &(pool->lock) );
+
+	if ( pool->free == NULL ) {
+		char *slab= (char*)malloc( pool->size*POOL_SLAB_OBJECTS );
+
+		if ( slab == NULL ) {
+			pthread_mutex_unlock( &(pool->lock) );
+			return FALSE;
+		}
+
+		for ( n= 0; n < POOL_SLAB_OBJECTS; n++ ) {
+			obj= (pool_obj_t*)(slab+n*pool->size);
+			obj->next= pool->free;
+			pool->free= obj;
+		}
+		pool->free_count+= POOL_SLAB_OBJECTS;
+		pool->slabs++;
+	}
+
+	for ( n= 0; n < POOL_CACHE_SIZE/2 && pool->free != NULL; n++ ) {
+		obj= pool->free;
+		pool->free= obj->next;
+		pool->free_count--;
+
+		obj->next= c->head;
+		c->head= obj;
+		c->count++;
+	}
+
+	/* Nothing to flush, but pick up the counters while locked */
+	pool_flush( pool, c, 0 );
+
+	pthread_mutex_unlock( &(pool->lock) );
+
+	return TRUE;
+}
+
+
+/**
+ * pool_alloc:
+ * Returns an object from `pool', or NULL if no memory is available.
+ * The object's contents are undefined.
+ */
+void *pool_alloc( pool_t *pool )
+{
+	pool_cache_t *c;
+	pool_obj_t *obj;
+
+	if ( !pool->id && !pool_register( pool ) )
+		return malloc( pool->size );
+
+	pool_thread_init( );
+
+	c= &(pool_caches[pool->id-1]);
+
+	if ( c->head == NULL && !pool_refill( pool, c ) )
+		return NULL;
+
+	obj= c->head;
+	c->head= obj->next;
+	c->count--;
+	c->allocs++;
+
+	return obj;
+}
+
+
+/**
+ * pool_free:
+ * Returns `obj', which must have come from pool_alloc() on the same
+ * pool, to `pool'. Any thread may free an object.
+ */
+void pool_free( pool_t *pool, void *obj )
+{
+	pool_cache_t *c;
+	pool_obj_t *o= (pool_obj_t*)obj;
+
+	if ( o == NULL )
+		return;
+
+	/* Pool couldn't be registered; object came from malloc() */
+	if ( !pool->id ) {
+		free( o );
+		return;
+	}
+
+	pool_thread_init( );
+
+	c= &(pool_caches[pool->id-1]);
+
+	o->next= c->head;
+	c->head= o;
+	c->count++;
+	c->frees++;
+
+	/* Objects allocated on one thread and freed on another pile up
+	 * here; pass half of them back for other threads to use. */
+	if ( c->count > POOL_CACHE_SIZE ) {
+		pthread_mutex_lock( &(pool->lock) );
+		pool_flush( pool, c, POOL_CACHE_SIZE/2 );
+		pthread_mutex_unlock( &(pool->lock) );
+	}
+}
+
+
+/**
+ * pool_stats:
+ * Fills `stats' with the current counters for `pool'.
+ */
+void pool_stats( pool_t *pool, pool_stats_t *stats )
+{
+	pthread_mutex_lock( &(pool->lock) );
+
+	stats->name=   pool->name;
+	stats->size=   pool->size;
+	stats->slabs=  pool->slabs;
+	stats->allocs= pool->allocs;
+	stats->frees=  pool->frees;
+
+	pthread_mutex_unlock( &(pool->lock) );
+}
+
+
+/**
+ * pool_count:
+ * Returns the number of pools which have been used so far.
+ */
+int pool_count( )
+{
+	return num_pools;
+}
+
+
+/**
+ * pool_get:
+ * Returns the `i'th pool to have been used, for walking all pools.
+ */
+pool_t *pool_get( int i )
+{
+	if ( i < 0 || i >= num_pools )
+		return NULL;
+
+	return pools[i];
+}
@@ -0,0 +1,101 @@
+#ifndef __POOL_
+#define __POOL_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#define TRUE 1
+#define FALSE 0
+
+/* Maximum number of pools in the process; each thread keeps a cache
+ * for every pool. */
+#define POOL_MAX 16
+
+/* Number of objects a thread may hold in its cache for one pool
+ * before half of them are handed back to the shared free list. */
+#define POOL_CACHE_SIZE 64
+
+/* Number of objects carved from each malloc'd slab. */
+#define POOL_SLAB_OBJECTS 64
+
+typedef struct _pool_obj
+{
+	struct _pool_obj *next;
+} pool_obj_t;
+
+/**
+ * A pool hands out fixed-size objects of one type. Objects are carved
+ * from slabs which are never returned to the system; freed objects go
+ * onto a small per-thread cache, and overflow from there onto the
+ * shared free list, so that most allocations and frees take no lock.
+ * Pools are declared statically with POOL_INITIALISER.
+ */
+typedef struct
+{
+	const char *name;
+	size_t size;
+	/* Index of this pool in the per-thread caches; 0 until the
+	 * pool is first used. */
+	volatile int id;
+
+	/* Shared free list, protected by `lock' */
+	pool_obj_t *free;
+	uint32_t free_count;
+	uint32_t slabs;
+
+	/* Allocation counters. Threads count locally and add their
+	 * counts in here whenever they visit the shared free list, so
+	 * these lag slightly behind the true totals. */
+	uint64_t allocs;
+	uint64_t frees;
+
+	pthread_mutex_t lock;
+} pool_t;
+
+#define POOL_INITIALISER(name, size) \
+	{ (name), (size), 0, NULL, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER }
+
+typedef struct
+{
+	const char *name;
+	size_t size;
+	uint32_t slabs;
+	uint64_t allocs;
+	uint64_t frees;
+} pool_stats_t;
+
+
+/**
+ * pool_alloc:
+ * Returns an object from `pool', or NULL if no memory is available.
+ * The object's contents are undefined.
+ */
+void *pool_alloc( pool_t *pool );
+
+/**
+ * pool_free:
+ * Returns `obj', which must have come from pool_alloc() on the same
+ * pool, to `pool'. Any thread may free an object.
+ */
+void pool_free( pool_t *pool, void *obj );
+
+/**
+ * pool_stats:
+ * Fills `stats' with the current counters for `pool'.
+ */
+void pool_stats( pool_t *pool, pool_stats_t *stats );
+
+/**
+ * pool_count:
+ * Returns the number of pools which have been used so far.
+ */
+int pool_count( );
+
+/**
+ * pool_get:
+ * Returns the `i'th pool to have been used, for walking all pools.
+ */
+pool_t *pool_get( int i );
+
+#endif
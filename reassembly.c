@@ -0,0 +1,338 @@
+
+#include "reassembly.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+/**
+ * reasm_hash:
+ * Chain for message `msg_id' from `source'. Ids from one source run
+ * consecutively, so they are spread with a multiplicative hash.
+ */
+static uint32_t reasm_hash( uint32_t source, uint32_t msg_id )
+{
+	return ((source^msg_id)*2654435761u) >> 24 & (REASM_BUCKETS-1);
+}
+
+
+/**
+ * reasm_init:
+ * Creates an empty reassembly buffer holding up to `max_bytes' of
+ * fragments for up to `timeout_us' each, and makes `r' point to it.
+ * No fragment but the last of a message may carry less than
+ * `min_frag' bytes.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int reasm_init( reasm_t **r, uint32_t max_bytes, uint32_t min_frag,
+		uint64_t timeout_us )
+{
+	reasm_t *t= (reasm_t*)calloc( 1, sizeof(reasm_t) );
+
+	if ( t == NULL )
+		return FALSE;
+
+	t->max_bytes= max_bytes;
+	t->min_frag= min_frag ? min_frag : 1;
+	t->timeout_us= timeout_us;
+
+	t->lock= (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
+	pthread_mutex_init( t->lock, NULL );
+
+	*r= t;
+	return TRUE;
+}
+
+
+/**
+ * reasm_cost:
+ * Bytes a message of `frags' fragments is charged for over and above
+ * its data: the message itself, and its tables of fragments.
+ */
+static uint32_t reasm_cost( uint16_t frags )
+{
+	return sizeof(reasm_msg_t)+frags*(sizeof(char*)+sizeof(uint32_t));
+}
+
+
+/**
+ * reasm_unlink:
+ * Takes `m' out of the buffer, without freeing it.
+ */
+static void reasm_unlink( reasm_t *r, reasm_msg_t *m )
+{
+	reasm_msg_t **p= &(r->buckets[reasm_hash( m->source, m->msg_id )]);
+
+	while ( *p != m )
+		p= &((*p)->chain);
+	*p= m->chain;
+
+	if ( m->older != NULL ) m->older->newer= m->newer;
+	else                    r->oldest= m->newer;
+	if ( m->newer != NULL ) m->newer->older= m->older;
+	else                    r->newest= m->older;
+
+	r->bytes-= m->len+reasm_cost( m->frags );
+}
+
+
+/**
+ * reasm_msg_free:
+ * Frees a message returned by reasm_add().
+ */
+void reasm_msg_free( reasm_msg_t *m )
+{
+	uint32_t i;
+
+	for ( i= 0; i < m->frags; i++ )
+		free( m->frag[i] );
+	free( m->frag );
+	free( m->frag_len );
+	free( m );
+}
+
+
+/**
+ * reasm_drop_oldest:
+ * Drops the oldest message in the buffer.
+ */
+static void reasm_drop_oldest( reasm_t *r )
+{
+	reasm_msg_t *m= r->oldest;
+
+	reasm_unlink( r, m );
+	reasm_msg_free( m );
+}
+
+
+/**
+ * reasm_drop_expired:
+ * Gives up on messages which have waited too long by `now_us'. They
+ * are in order of age, so only the oldest need be looked at. Another
+ * thread may have read the clock later but locked first. The caller
+ * must hold r->lock.
+ */
+static void reasm_drop_expired( reasm_t *r, uint64_t now_us )
+{
+	while ( r->oldest != NULL && now_us > r->oldest->started_us &&
+		now_us-r->oldest->started_us > r->timeout_us )
+		reasm_drop_oldest( r );
+}
+
+
+/**
+ * reasm_find:
+ * Returns message `msg_id' from `source', or NULL if none of it is
+ * held.
+ */
+static reasm_msg_t *reasm_find( reasm_t *r, uint32_t source,
+				uint32_t msg_id )
+{
+	reasm_msg_t *m= r->buckets[reasm_hash( source, msg_id )];
+
+	while ( m != NULL && (m->source != source || m->msg_id != msg_id) )
+		m= m->chain;
+
+	return m;
+}
+
+
+/**
+ * reasm_new:
+ * Adds an empty message of `frags' fragments to the buffer, as its
+ * newest, charging the buffer for it.
+ * Returns the message, or NULL if there is no memory.
+ */
+static reasm_msg_t *reasm_new( reasm_t *r, uint32_t source, uint32_t msg_id,
+			       uint32_t channel, uint16_t frags,
+			       uint64_t now_us )
+{
+	reasm_msg_t *m= (reasm_msg_t*)calloc( 1, sizeof(reasm_msg_t) );
+	uint32_t h= reasm_hash( source, msg_id );
+
+	if ( m == NULL )
+		return NULL;
+
+	m->frag= (char**)calloc( frags, sizeof(char*) );
+	m->frag_len= (uint32_t*)calloc( frags, sizeof(uint32_t) );
+	if ( m->frag == NULL || m->frag_len == NULL ) {
+		free( m->frag );
+		free( m->frag_len );
+		free( m );
+		return NULL;
+	}
+
+	m->source= source;
+	m->msg_id= msg_id;
+	m->channel= channel;
+	m->frags= frags;
+	m->started_us= now_us;
+
+	m->chain= r->buckets[h];
+	r->buckets[h]= m;
+
+	m->older= r->newest;
+	if ( r->newest != NULL ) r->newest->newer= m;
+	else                     r->oldest= m;
+	r->newest= m;
+
+	r->bytes+= reasm_cost( frags );
+
+	return m;
+}
+
+
+/**
+ * reasm_add:
+ * Adds fragment `frag' of `frags', `len' bytes of `data', to message
+ * `msg_id' from `source' on `channel'. Fragments which don't fit with
+ * those already held, or repeat one, are ignored, as are messages
+ * which could never fit in the buffer.
+ * Returns the message if this fragment completed it, having taken it
+ * out of the buffer, or NULL.
+ */
+reasm_msg_t *reasm_add( reasm_t *r, uint32_t source, uint32_t msg_id,
+			uint32_t channel, uint16_t frag, uint16_t frags,
+			const char *data, uint32_t len, uint64_t now_us )
+{
+	reasm_msg_t *m, *victim, *next;
+	uint32_t least, need;
+	char *copy;
+
+	if ( frag >= frags || len > r->max_bytes )
+		return NULL;
+
+	/* Every fragment but the last carries as much as the sender's
+	 * MTU allows, at least min_frag and no less than any other, so
+	 * this one says how little the whole message can be. One which
+	 * could never fit is turned away before anything is held. */
+	if ( frag+1 < frags && len < r->min_frag )
+		return NULL;
+	least= len > r->min_frag ? len : r->min_frag;
+	if ( (uint64_t)(frags-1)*least+reasm_cost( frags ) > r->max_bytes )
+		return NULL;
+
+	if ( (copy= (char*)malloc( len ? len : 1 )) == NULL )
+		return NULL;
+	memcpy( copy, data, len );
+
+	pthread_mutex_lock( r->lock );
+
+	reasm_drop_expired( r, now_us );
+
+	m= reasm_find( r, source, msg_id );
+	if ( m != NULL && (m->frags != frags || m->channel != channel ||
+			   m->frag[frag] != NULL) ) {
+		pthread_mutex_unlock( r->lock );
+		free( copy );
+		return NULL;
+	}
+
+	/* Make room, sparing the message this fragment belongs to; a new
+	 * message needs room for itself too */
+	need= m != NULL ? len : len+reasm_cost( frags );
+	for ( victim= r->oldest; victim != NULL && r->bytes+need > r->max_bytes;
+	      victim= next ) {
+		next= victim->newer;
+		if ( victim != m ) {
+			reasm_unlink( r, victim );
+			reasm_msg_free( victim );
+		}
+	}
+	if ( r->bytes+need > r->max_bytes ) {
+		/* The message alone would overflow the buffer */
+		if ( m != NULL ) {
+			reasm_unlink( r, m );
+			reasm_msg_free( m );
+		}
+		pthread_mutex_unlock( r->lock );
+		free( copy );
+		return NULL;
+	}
+
+	if ( m == NULL &&
+	     (m= reasm_new( r, source, msg_id, channel, frags, now_us )) == NULL ) {
+		pthread_mutex_unlock( r->lock );
+		free( copy );
+		return NULL;
+	}
+
+	m->frag[frag]= copy;
+	m->frag_len[frag]= len;
+	m->have++;
+	m->len+= len;
+	r->bytes+= len;
+
+	if ( m->have == m->frags )
+		reasm_unlink( r, m );
+	else
+		m= NULL;
+
+	pthread_mutex_unlock( r->lock );
+
+	return m;
+}
+
+
+/**
+ * reasm_expire:
+ * Gives up on messages which have waited too long for their last
+ * fragment by `now_us'.
+ * Returns the microseconds until the next must be given up on, at
+ * least 1, or 0 if none is held.
+ */
+uint32_t reasm_expire( reasm_t *r, uint64_t now_us )
+{
+	uint64_t waited;
+	uint32_t wait= 0;
+
+	pthread_mutex_lock( r->lock );
+
+	reasm_drop_expired( r, now_us );
+
+	if ( r->oldest != NULL ) {
+		waited= now_us > r->oldest->started_us ? 
+			now_us-r->oldest->started_us : 0;
+		wait= r->timeout_us-waited+1;
+	}
+
+	pthread_mutex_unlock( r->lock );
+
+	return wait;
+}
+
+
+/**
+ * reasm_copy:
+ * Copies the data of complete message `m', in order, to `buf', which
+ * must have room for m->len bytes.
+ */
+void reasm_copy( reasm_msg_t *m, char *buf )
+{
+	uint32_t i;
+
+	for ( i= 0; i < m->frags; i++ ) {
+		memcpy( buf, m->frag[i], m->frag_len[i] );
+		buf+= m->frag_len[i];
+	}
+}
+
+
+/**
+ * reasm_destroy:
+ * Frees the buffer and every message still in it, and sets *r to
+ * NULL.
+ */
+void reasm_destroy( reasm_t **r )
+{
+	reasm_t *t= *r;
+
+	while ( t->oldest != NULL )
+		reasm_drop_oldest( t );
+
+	pthread_mutex_destroy( t->lock );
+	free( t->lock );
+	free( t );
+
+	*r= NULL;
+}
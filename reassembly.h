@@ -0,0 +1,108 @@
+#ifndef __REASSEMBLY_
+#define __REASSEMBLY_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "common_defs.h"
+
+/* Number of hash chains; must be a power of two */
+#define REASM_BUCKETS 256
+
+/**
+ * A message partway through reassembly: the fragments of it which
+ * have arrived so far, each held separately until the last is in.
+ */
+typedef struct _reasm_msg
+{
+	uint32_t source;
+	uint32_t msg_id;
+	uint32_t channel;
+	uint16_t frags;
+	uint16_t have;
+	/* Bytes held, over all fragments */
+	uint32_t len;
+	uint64_t started_us;
+
+	/* Data and length of each fragment, NULL until it arrives */
+	char **frag;
+	uint32_t *frag_len;
+
+	/* Hash chain, and the list of messages from oldest to newest */
+	struct _reasm_msg *chain;
+	struct _reasm_msg *older, *newer;
+} reasm_msg_t;
+
+/**
+ * The reassembly buffer of one host. Messages are dropped, whole,
+ * once they have waited `timeout_us' for their last fragment, or to
+ * make room when more than `max_bytes' are held, oldest first. Each
+ * message is charged for itself and its tables of fragments as well
+ * as its data.
+ */
+typedef struct
+{
+	reasm_msg_t *buckets[REASM_BUCKETS];
+	reasm_msg_t *oldest, *newest;
+	uint32_t bytes;
+	uint32_t max_bytes;
+	uint32_t min_frag;
+	uint64_t timeout_us;
+	pthread_mutex_t *lock;
+} reasm_t;
+
+
+/**
+ * reasm_init:
+ * Creates an empty reassembly buffer holding up to `max_bytes' of
+ * fragments for up to `timeout_us' each, and makes `r' point to it.
+ * No fragment but the last of a message may carry less than
+ * `min_frag' bytes.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int reasm_init( reasm_t **r, uint32_t max_bytes, uint32_t min_frag,
+		uint64_t timeout_us );
+
+/**
+ * reasm_add:
+ * Adds fragment `frag' of `frags', `len' bytes of `data', to message
+ * `msg_id' from `source' on `channel'. Fragments which don't fit with
+ * those already held, or repeat one, are ignored, as are messages
+ * which could never fit in the buffer.
+ * Returns the message if this fragment completed it, having taken it
+ * out of the buffer, or NULL.
+ */
+reasm_msg_t *reasm_add( reasm_t *r, uint32_t source, uint32_t msg_id,
+			uint32_t channel, uint16_t frag, uint16_t frags,
+			const char *data, uint32_t len, uint64_t now_us );
+
+/**
+ * reasm_expire:
+ * Gives up on messages which have waited too long for their last
+ * fragment by `now_us'.
+ * Returns the microseconds until the next must be given up on, at
+ * least 1, or 0 if none is held.
+ */
+uint32_t reasm_expire( reasm_t *r, uint64_t now_us );
+
+/**
+ * reasm_copy:
+ * Copies the data of complete message `m', in order, to `buf', which
+ * must have room for m->len bytes.
+ */
+void reasm_copy( reasm_msg_t *m, char *buf );
+
+/**
+ * reasm_msg_free:
+ * Frees a message returned by reasm_add().
+ */
+void reasm_msg_free( reasm_msg_t *m );
+
+/**
+ * reasm_destroy:
+ * Frees the buffer and every message still in it, and sets *r to
+ * NULL.
+ */
+void reasm_destroy( reasm_t **r );
+
+#endif
@@ -9,11 +9,16 @@ int routing_table_init( route_table_t **r )
 	route_table_t *table= (route_table_t*)malloc(sizeof(route_table_t));
 
 	if ( table ) {
+		if ( !arena_init( &(table->arena), ROUTE_ARENA_CHUNK ) ) {
+			free( table );
+			return FALSE;
+		}
+
 		table->head= NULL;
 		table->length= 0;
 
-		table->lock= (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
-		pthread_mutex_init( table->lock, NULL );
+		table->lock= (pthread_rwlock_t*)malloc(sizeof(pthread_rwlock_t));
+		pthread_rwlock_init( table->lock, NULL );
 
 		*r= table;
 		return TRUE;
@@ -22,11 +27,17 @@ int routing_table_init( route_table_t **r )
 }
 
 
-void routing_table_add( route_table_t *r, uint32_t source, uint32_t fwd_link )
+/* Adds the route for `source' through `fwd_link', unless the table
+ * already has it.
+ * Returns TRUE on success, or FALSE if there is no memory. */
+int routing_table_add( route_table_t *r, uint32_t source, uint32_t fwd_link )
 {
- 	route_t *route= (route_t*)malloc(sizeof(route_t));
+	route_t *route= (route_t*)arena_alloc( r->arena, sizeof(route_t) );
 	route_t *temproute, *prevroute;
 
+	if ( route == NULL )
+		return FALSE;
+
 	route->source=   source;
 	route->fwd_link= fwd_link;
 
@@ -37,7 +48,7 @@ void routing_table_add( route_table_t *r, uint32_t source, uint32_t fwd_link )
 		r->length= 1;
 		r->head= route;
 
-		return;
+		return TRUE;
 	}
 
 	if ( source < (r->head->source) ) {
@@ -47,7 +58,7 @@ void routing_table_add( route_table_t *r, uint32_t source, uint32_t fwd_link )
 		r->length++;
 		r->head= route;
 
-		return;
+		return TRUE;
 	}
 
 	/* We know that the list is at least one element long, so */
@@ -74,7 +85,7 @@ void routing_table_add( route_table_t *r, uint32_t source, uint32_t fwd_link )
 
 		r->length++;
 
-		return;
+		return TRUE;
 	}
 	if ( source == temproute->source ) {
 		/* Must scan all entries in this chain to make sure we're not 
@@ -93,7 +104,7 @@ void routing_table_add( route_table_t *r, uint32_t source, uint32_t fwd_link )
 			r->length++;
 		}
 
-		return;
+		return TRUE;
 	}
 
 	if ( source < temproute->source ) {
@@ -112,18 +123,19 @@ void routing_table_add( route_table_t *r, uint32_t source, uint32_t fwd_link )
 		}
 		r->length++;
 
-		return;
+		return TRUE;
 	}
 
 	/* Can we get here?? */
 	fprintf( stderr, "routing_table_add: Failed to add \"%u -- %u\"", 
 		 source, 
 		 fwd_link );
-	return;
+	return FALSE;
 }
 
 /* FIXME: Comments */
-/* Removes the specified link from the table.
+/* Removes the specified link from the table. The route's memory stays
+ * in the table's arena until the table is cleared or freed.
  * Return value is the weight being removed, or -1 if the link does not 
  * exist. */
 int routing_table_rm( route_table_t *r, uint32_t source, uint32_t fwd_link )
@@ -193,20 +205,18 @@ int routing_table_rm( route_table_t *r, uint32_t source, uint32_t fwd_link )
 	}
 
 	r->length--;
-	free(temproute);
 	return 1;
 }
 
+/* Empties the table, releasing all routes at once. */
 int routing_table_clear( route_table_t *r )
 {
-	route_t *tmp_route;
+	arena_reset( r->arena );
 
-	while ( r->length ) {
-		tmp_route= r->head;
-
-		routing_table_rm(r, tmp_route->source,tmp_route->fwd_link);
-	}
+	r->head= NULL;
+	r->length= 0;
 
+	return TRUE;
 }
 
 /* Frees the data structures without giving up the lock. */
@@ -214,7 +224,7 @@ int routing_table_free( route_table_t **r )
 {
 	route_table_t *route= *r;
 
-	routing_table_clear( route );
+	arena_destroy( &(route->arena) );
 
 	free( route );
 
@@ -227,10 +237,11 @@ int  routing_table_destroy( route_table_t **r )
 {
 	route_table_t *route= *r;
 
-	routing_table_clear( route );
+	arena_destroy( &(route->arena) );
 
-	pthread_mutex_unlock( route->lock );
-	pthread_mutex_destroy( route->lock );
+	pthread_rwlock_unlock( route->lock );
+	pthread_rwlock_destroy( route->lock );
+	free( route->lock );
 	free( route );
 
 	*r= NULL;
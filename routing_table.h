@@ -5,6 +5,11 @@
 #include <stdint.h>
 #include <pthread.h>
 
+#include "arena.h"
+
+/* Size of each chunk of a routing table's arena */
+#define ROUTE_ARENA_CHUNK 16384
+
 typedef struct _route_t
 { 
 	uint32_t source;
@@ -17,13 +22,20 @@ typedef struct
 {
 	route_t *head;
 	uint32_t length;
-	pthread_mutex_t *lock;
+	/* Forwarding threads hold this for reading while they walk the
+	 * table; it is held for writing only to replace or clear it. */
+	pthread_rwlock_t *lock;
+	/* Every route in the table is allocated from here, along with
+	 * any scratch space used to build the table, so the whole table
+	 * is released at once. */
+	arena_t *arena;
 } route_table_t;
 
 int  routing_table_init( route_table_t **r );
-void routing_table_add( route_table_t *r, uint32_t source, uint32_t fwd_link );
+int  routing_table_add( route_table_t *r, uint32_t source, uint32_t fwd_link );
 int  routing_table_rm( route_table_t *r, uint32_t source, uint32_t fwd_link );
 int  routing_table_clear( route_table_t *r );
+int  routing_table_free( route_table_t **r );
 int  routing_table_destroy( route_table_t **r );
 
 #endif
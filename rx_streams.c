@@ -0,0 +1,622 @@
+
+#include "rx_streams.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Packets released while the table is locked, passed on once it isn't.
+ * Most calls release few, which fit in `first'. */
+#define RX_OUT_FIRST 16
+
+typedef struct
+{
+	data_packet_t **packets;
+	data_packet_t *first[RX_OUT_FIRST];
+	uint32_t num;
+	uint32_t max;
+} rx_out_t;
+
+
+/**
+ * rx_hash:
+ * Chain for the stream on `channel' from `source'.
+ */
+static uint32_t rx_hash( uint32_t source, uint32_t channel )
+{
+	return ((source^channel)*2654435761u) >> 24 & (RX_BUCKETS-1);
+}
+
+
+/**
+ * rx_out_init:
+ * Starts `o' empty.
+ */
+static void rx_out_init( rx_out_t *o )
+{
+	o->packets= o->first;
+	o->num= 0;
+	o->max= RX_OUT_FIRST;
+}
+
+
+/**
+ * rx_out_add:
+ * Adds `packet' to those to be passed on from `o'.
+ * Returns TRUE on success, or FALSE if there is no memory.
+ */
+static int rx_out_add( rx_out_t *o, data_packet_t *packet )
+{
+	data_packet_t **more;
+
+	if ( o->num == o->max ) {
+		if ( o->packets == o->first ) {
+			more= (data_packet_t**)malloc( 2*o->max*sizeof(data_packet_t*) );
+			if ( more != NULL )
+				memcpy( more, o->first, o->num*sizeof(data_packet_t*) );
+		}
+		else
+			more= (data_packet_t**)realloc( o->packets, 
+					2*o->max*sizeof(data_packet_t*) );
+		if ( more == NULL )
+			return FALSE;
+
+		o->packets= more;
+		o->max*= 2;
+	}
+
+	o->packets[o->num++]= packet;
+	return TRUE;
+}
+
+
+/**
+ * rx_out_pass:
+ * Passes the packets in `o' to `fn' in the order they were added, and
+ * frees them, all but the caller's own `packet'. The caller must not
+ * hold the table's lock.
+ */
+static void rx_out_pass( rx_out_t *o, data_packet_t *packet,
+			 rx_release_fn_t fn, void *arg )
+{
+	uint32_t i;
+
+	for ( i= 0; i < o->num; i++ ) {
+		fn( arg, o->packets[i] );
+		if ( o->packets[i] != packet )
+			free( o->packets[i] );
+	}
+
+	if ( o->packets != o->first )
+		free( o->packets );
+}
+
+
+/**
+ * rx_streams_init:
+ * Creates an empty stream table and makes `t' point to it.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int rx_streams_init( rx_streams_t **t )
+{
+	rx_streams_t *r= (rx_streams_t*)calloc( 1, sizeof(rx_streams_t) );
+
+	if ( r == NULL )
+		return FALSE;
+
+	r->lock= (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
+	pthread_mutex_init( r->lock, NULL );
+
+	*t= r;
+	return TRUE;
+}
+
+
+/**
+ * rx_drop_held:
+ * Frees the packets held in the reorder buffer of `s', and the buffer.
+ */
+static void rx_drop_held( rx_stream_t *s )
+{
+	uint32_t i;
+
+	if ( s->held == NULL )
+		return;
+
+	for ( i= 0; i < s->depth; i++ )
+		free( s->held[i] );
+	free( s->held );
+
+	s->held= NULL;
+	s->depth= 0;
+	s->num_held= 0;
+}
+
+
+/**
+ * rx_stream_free:
+ * Stops following stream `s'. The caller must hold t->lock.
+ */
+static void rx_stream_free( rx_streams_t *t, rx_stream_t *s )
+{
+	rx_stream_t **p= &(t->buckets[rx_hash( s->source, s->channel )]);
+
+	while ( *p != s )
+		p= &((*p)->chain);
+	*p= s->chain;
+
+	if ( s->older != NULL ) s->older->newer= s->newer;
+	else                    t->oldest= s->newer;
+	if ( s->newer != NULL ) s->newer->older= s->older;
+	else                    t->newest= s->older;
+	t->num_streams--;
+
+	rx_drop_held( s );
+	free( s );
+}
+
+
+/**
+ * rx_mark:
+ * Notes that packet `seq' of `s' has been seen.
+ */
+static void rx_mark( rx_stream_t *s, uint32_t seq )
+{
+	s->seen[(seq/64) % (RX_WINDOW/64)]|= (uint64_t)1 << (seq%64);
+}
+
+
+/**
+ * rx_seen:
+ * Returns non-zero if packet `seq' of `s' has been seen.
+ */
+static uint64_t rx_seen( rx_stream_t *s, uint32_t seq )
+{
+	return s->seen[(seq/64) % (RX_WINDOW/64)] & (uint64_t)1 << (seq%64);
+}
+
+
+/**
+ * rx_release:
+ * Adds the packet held in the slot of `s' for its next, if there is
+ * one, to `out', and moves on past it.
+ */
+static void rx_release( rx_stream_t *s, rx_out_t *out )
+{
+	data_packet_t **slot= &(s->held[s->next % s->depth]);
+
+	if ( *slot != NULL ) {
+		if ( !rx_out_add( out, *slot ) )
+			free( *slot );
+		*slot= NULL;
+		s->num_held--;
+	}
+
+	s->next++;
+}
+
+
+/**
+ * rx_release_run:
+ * Adds the packets held which follow on in order, up to the next gap,
+ * to `out'. A wait for a gap after them begins at `now_us'.
+ */
+static void rx_release_run( rx_stream_t *s, uint64_t now_us, rx_out_t *out )
+{
+	while ( s->num_held > 0 && s->held[s->next % s->depth] != NULL )
+		rx_release( s, out );
+
+	s->gap_since_us= now_us;
+}
+
+
+/**
+ * rx_skip:
+ * Gives up on whatever hasn't arrived before packet `seq', adding
+ * those held before it to `out' in order.
+ */
+static void rx_skip( rx_stream_t *s, uint32_t seq, rx_out_t *out )
+{
+	while ( s->num_held > 0 && (int32_t)(seq-s->next) > 0 )
+		rx_release( s, out );
+
+	if ( (int32_t)(seq-s->next) > 0 )
+		s->next= seq;
+}
+
+
+/**
+ * rx_release_all:
+ * Adds all the packets held by `s' to `out' in order, and frees its
+ * reorder buffer.
+ */
+static void rx_release_all( rx_stream_t *s, rx_out_t *out )
+{
+	if ( s->held != NULL )
+		rx_skip( s, s->next+s->depth, out );
+
+	rx_drop_held( s );
+}
+
+
+/**
+ * rx_restart:
+ * Starts `s' over at packet `seq', as though nothing had been seen
+ * before it, nor it yet, adding any packets it holds to `out'.
+ */
+static void rx_restart( rx_stream_t *s, uint32_t seq, rx_out_t *out )
+{
+	memset( s->seen, 0, sizeof(s->seen) );
+	s->top= seq;
+
+	rx_release_all( s, out );
+}
+
+
+/**
+ * rx_stream:
+ * Returns the stream on `channel' from `source', following it from
+ * packet `seq' on if it isn't already, and giving up on the least
+ * recently heard if too many are followed, adding the packets it held
+ * to `out'. The caller must hold t->lock.
+ * Returns NULL if there is no memory.
+ */
+static rx_stream_t *rx_stream( rx_streams_t *t, uint32_t source,
+			       uint32_t channel, uint32_t seq, rx_out_t *out )
+{
+	uint32_t h= rx_hash( source, channel );
+	rx_stream_t *s= t->buckets[h];
+
+	while ( s != NULL && (s->source != source || s->channel != channel) )
+		s= s->chain;
+
+	if ( s != NULL ) {
+		/* Most recently heard moves to the end of the list */
+		if ( s != t->newest ) {
+			if ( s->older != NULL ) s->older->newer= s->newer;
+			else                    t->oldest= s->newer;
+			s->newer->older= s->older;
+
+			s->older= t->newest;
+			s->newer= NULL;
+			t->newest->newer= s;
+			t->newest= s;
+		}
+		return s;
+	}
+
+	if ( t->num_streams >= RX_STREAMS ) {
+		rx_release_all( t->oldest, out );
+		rx_stream_free( t, t->oldest );
+	}
+
+	if ( (s= (rx_stream_t*)calloc( 1, sizeof(rx_stream_t) )) == NULL )
+		return NULL;
+
+	s->source= source;
+	s->channel= channel;
+	rx_restart( s, seq, out );
+
+	s->chain= t->buckets[h];
+	t->buckets[h]= s;
+
+	s->older= t->newest;
+	if ( t->newest != NULL ) t->newest->newer= s;
+	else                     t->oldest= s;
+	t->newest= s;
+	t->num_streams++;
+
+	return s;
+}
+
+
+/**
+ * rx_streams_fresh:
+ * Notes that `packet' has arrived at `now_us'. Packets held in order
+ * on a stream which is given up on to make room, or which starts
+ * again, are passed to `fn'.
+ * Returns TRUE if it is the first time, or FALSE if it is a copy of
+ * one already seen.
+ */
+int rx_streams_fresh( rx_streams_t *t, data_packet_t *packet,
+		      uint64_t now_us, rx_release_fn_t fn, void *arg )
+{
+	uint32_t channel= packet->header.channel;
+	uint32_t seq= packet->seq;
+	rx_stream_t *s;
+	rx_out_t out;
+	int32_t ahead;
+	int fresh= TRUE;
+
+	if ( packet->header.type == data_parity )
+		channel|= RX_PARITY;
+
+	rx_out_init( &out );
+
+	pthread_mutex_lock( t->lock );
+
+	/* With no memory to follow the stream, let everything through */
+	if ( (s= rx_stream( t, packet->source, channel, seq, &out )) == NULL ) {
+		pthread_mutex_unlock( t->lock );
+		rx_out_pass( &out, NULL, fn, arg );
+		return TRUE;
+	}
+
+	ahead= (int32_t)(seq-s->top);
+
+	if ( ahead > 0 ) {
+		/* Slide the window on, forgetting what it leaves behind */
+		if ( ahead >= RX_WINDOW ) {
+			memset( s->seen, 0, sizeof(s->seen) );
+			s->top= seq;
+		}
+		else
+			while ( s->top != seq ) {
+				s->top++;
+				s->seen[(s->top/64) % (RX_WINDOW/64)]&=
+					~((uint64_t)1 << (s->top%64));
+			}
+		rx_mark( s, seq );
+	}
+	else if ( s->top-seq >= RX_WINDOW ) {
+		/* Too old to tell, so a copy, unless the source has been
+		 * quiet long enough to have started again */
+		if ( now_us-s->heard_us >= RX_IDLE_US ) {
+			rx_restart( s, seq, &out );
+			rx_mark( s, seq );
+		}
+		else {
+			t->duplicates++;
+			fresh= FALSE;
+		}
+	}
+	else if ( rx_seen( s, seq ) ) {
+		t->duplicates++;
+		fresh= FALSE;
+	}
+	else {
+		rx_mark( s, seq );
+	}
+	s->heard_us= now_us;
+
+	pthread_mutex_unlock( t->lock );
+
+	rx_out_pass( &out, NULL, fn, arg );
+
+	return fresh;
+}
+
+
+/**
+ * rx_streams_set_reorder:
+ * Puts packets on `channel' from each source back in order, holding
+ * up to `depth' of them for at most `delay_us' waiting for one
+ * missing; a depth of 0 passes them on as they come.
+ * Returns TRUE on success, or FALSE if `depth' is more than
+ * RX_REORDER_MAX or there is no memory.
+ */
+int rx_streams_set_reorder( rx_streams_t *t, uint32_t channel,
+			    uint32_t depth, uint32_t delay_us )
+{
+	rx_reorder_t *r;
+
+	if ( depth > RX_REORDER_MAX )
+		return FALSE;
+
+	pthread_mutex_lock( t->lock );
+
+	for ( r= t->reorder; r != NULL && r->channel != channel; r= r->next )
+		;
+
+	if ( r == NULL ) {
+		if ( (r= (rx_reorder_t*)calloc( 1, sizeof(rx_reorder_t) )) == NULL ) {
+			pthread_mutex_unlock( t->lock );
+			return FALSE;
+		}
+		r->channel= channel;
+		r->next= t->reorder;
+		t->reorder= r;
+	}
+
+	r->depth= depth;
+	r->delay_us= delay_us;
+
+	pthread_mutex_unlock( t->lock );
+
+	return TRUE;
+}
+
+
+/**
+ * rx_wait:
+ * Returns the microseconds from `now_us' until the gap `s' is waiting
+ * on must be given up on, at least 1, or 0 if it isn't waiting.
+ */
+static uint32_t rx_wait( rx_stream_t *s, uint64_t now_us )
+{
+	uint64_t waited;
+
+	if ( s->num_held == 0 )
+		return 0;
+
+	waited= now_us > s->gap_since_us ? now_us-s->gap_since_us : 0;
+
+	return waited < s->delay_us ? s->delay_us-waited : 1;
+}
+
+
+/**
+ * rx_streams_order:
+ * Passes `packet' to `fn', along with any it lets follow, if it is
+ * next in order on its stream or its channel isn't reordered. A packet
+ * after a gap is held back; one which missed its turn is dropped.
+ * Returns the microseconds until a gap must be given up on, or 0 if
+ * none is waiting on this stream.
+ */
+uint32_t rx_streams_order( rx_streams_t *t, data_packet_t *packet,
+			   uint64_t now_us, rx_release_fn_t fn, void *arg )
+{
+	uint32_t channel= packet->header.channel;
+	uint32_t seq= packet->seq;
+	uint32_t len= sizeof(data_header_t)+packet->datalen;
+	data_packet_t **slot;
+	rx_reorder_t *r;
+	rx_stream_t *s;
+	rx_out_t out;
+	int32_t ahead;
+	uint32_t wait;
+
+	rx_out_init( &out );
+
+	pthread_mutex_lock( t->lock );
+
+	for ( r= t->reorder; r != NULL && r->channel != channel; r= r->next )
+		;
+
+	/* Most channels aren't reordered, and need no more than that */
+	if ( r == NULL ) {
+		pthread_mutex_unlock( t->lock );
+		fn( arg, packet );
+		return 0;
+	}
+
+	if ( (s= rx_stream( t, packet->source, channel, seq, &out )) == NULL ) {
+		pthread_mutex_unlock( t->lock );
+		rx_out_add( &out, packet );
+		rx_out_pass( &out, packet, fn, arg );
+		return 0;
+	}
+
+	/* The settings have changed since the buffer was made; what it
+	 * holds is passed on before it is remade */
+	if ( s->held != NULL && s->depth != r->depth )
+		rx_release_all( s, &out );
+	s->delay_us= r->delay_us;
+
+	if ( r->depth == 0 ) {
+		pthread_mutex_unlock( t->lock );
+		rx_out_add( &out, packet );
+		rx_out_pass( &out, packet, fn, arg );
+		return 0;
+	}
+
+	if ( s->held == NULL ) {
+		s->held= (data_packet_t**)calloc( r->depth, sizeof(data_packet_t*) );
+		if ( s->held == NULL ) {
+			pthread_mutex_unlock( t->lock );
+			rx_out_add( &out, packet );
+			rx_out_pass( &out, packet, fn, arg );
+			return 0;
+		}
+		s->depth= r->depth;
+		s->next= seq;
+	}
+
+	ahead= (int32_t)(seq-s->next);
+
+	if ( ahead < 0 ) {
+		/* Its place in order has gone */
+		t->late++;
+		wait= rx_wait( s, now_us );
+		pthread_mutex_unlock( t->lock );
+		rx_out_pass( &out, packet, fn, arg );
+		return wait;
+	}
+
+	/* No room for it without giving up on the oldest gaps */
+	if ( ahead >= (int32_t)s->depth ) {
+		rx_skip( s, seq-s->depth+1, &out );
+		rx_release_run( s, now_us, &out );
+		ahead= (int32_t)(seq-s->next);
+	}
+
+	if ( ahead == 0 ) {
+		rx_out_add( &out, packet );
+		s->next++;
+		rx_release_run( s, now_us, &out );
+	}
+	else {
+		slot= &(s->held[seq % s->depth]);
+		if ( *slot == NULL &&
+		     (*slot= (data_packet_t*)malloc( len )) != NULL ) {
+			memcpy( *slot, packet, len );
+			if ( s->num_held++ == 0 )
+				s->gap_since_us= now_us;
+		}
+	}
+
+	wait= rx_wait( s, now_us );
+
+	pthread_mutex_unlock( t->lock );
+
+	rx_out_pass( &out, packet, fn, arg );
+
+	return wait;
+}
+
+
+/**
+ * rx_streams_flush:
+ * Gives up on gaps which have been waited on long enough, passing the
+ * packets held after them to `fn'.
+ * Returns the microseconds until the next gap must be given up on, or
+ * 0 if none is waiting.
+ */
+uint32_t rx_streams_flush( rx_streams_t *t, uint64_t now_us,
+			   rx_release_fn_t fn, void *arg )
+{
+	rx_stream_t *s;
+	rx_out_t out;
+	uint32_t wait, next_wait= 0;
+
+	rx_out_init( &out );
+
+	pthread_mutex_lock( t->lock );
+
+	for ( s= t->oldest; s != NULL; s= s->newer ) {
+		if ( s->num_held == 0 )
+			continue;
+
+		if ( now_us >= s->gap_since_us &&
+		     now_us-s->gap_since_us >= s->delay_us ) {
+			while ( s->held[s->next % s->depth] == NULL )
+				s->next++;
+			rx_release_run( s, now_us, &out );
+		}
+
+		wait= rx_wait( s, now_us );
+		if ( wait != 0 && (next_wait == 0 || wait < next_wait) )
+			next_wait= wait;
+	}
+
+	pthread_mutex_unlock( t->lock );
+
+	rx_out_pass( &out, NULL, fn, arg );
+
+	return next_wait;
+}
+
+
+/**
+ * rx_streams_destroy:
+ * Frees the table, with any packets held in it, and sets *t to NULL.
+ */
+void rx_streams_destroy( rx_streams_t **t )
+{
+	rx_streams_t *r= *t;
+	rx_reorder_t *next;
+
+	while ( r->oldest != NULL )
+		rx_stream_free( r, r->oldest );
+
+	while ( r->reorder != NULL ) {
+		next= r->reorder->next;
+		free( r->reorder );
+		r->reorder= next;
+	}
+
+	pthread_mutex_destroy( r->lock );
+	free( r->lock );
+	free( r );
+
+	*t= NULL;
+}
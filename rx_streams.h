@@ -0,0 +1,143 @@
+#ifndef __RX_STREAMS_
+#define __RX_STREAMS_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "common_defs.h"
+#include "orta_data_packets.h"
+
+/* Sequence numbers behind the highest seen which are remembered, to
+ * tell copies from packets arriving late; a multiple of 64. A packet
+ * further behind than this is taken as a copy, unless nothing has been
+ * heard on its stream for RX_IDLE_US, when its source is taken to have
+ * started again. */
+#define RX_WINDOW 1024
+#define RX_IDLE_US 2000000
+
+/* Streams followed at once, and their hash chains */
+#define RX_STREAMS 256
+#define RX_BUCKETS 256
+
+/* Most packets a reorder buffer may hold */
+#define RX_REORDER_MAX 1024
+
+/* Set in the channel of a stream of parity packets, which are
+ * numbered apart from the data they cover */
+#define RX_PARITY 0x10000
+
+/**
+ * The packets arriving on one channel from one source.
+ */
+typedef struct _rx_stream
+{
+	uint32_t source;
+	uint32_t channel;
+
+	/* Highest sequence number seen, and a bit for each of the
+	 * RX_WINDOW up to it, indexed by sequence number, set if it has
+	 * been seen */
+	uint32_t top;
+	uint64_t seen[RX_WINDOW/64];
+	uint64_t heard_us;
+
+	/* Reorder buffer, on channels with one: the next packet to be
+	 * released, those waiting for it, indexed by sequence number,
+	 * and how long they may wait from when the wait began */
+	uint32_t next;
+	data_packet_t **held;
+	uint32_t depth;
+	uint32_t delay_us;
+	uint32_t num_held;
+	uint64_t gap_since_us;
+
+	/* Hash chain, and the list from least to most recently heard */
+	struct _rx_stream *chain;
+	struct _rx_stream *older, *newer;
+} rx_stream_t;
+
+/* Reorder settings of one channel */
+typedef struct _rx_reorder
+{
+	uint32_t channel;
+	uint32_t depth;
+	uint32_t delay_us;
+	struct _rx_reorder *next;
+} rx_reorder_t;
+
+typedef struct
+{
+	rx_stream_t *buckets[RX_BUCKETS];
+	rx_stream_t *oldest, *newest;
+	uint32_t num_streams;
+	rx_reorder_t *reorder;
+
+	/* Packets dropped as copies, and as too late to be put back in
+	 * order */
+	uint32_t duplicates;
+	uint32_t late;
+
+	pthread_mutex_t *lock;
+} rx_streams_t;
+
+/* Takes a packet released by a reorder buffer */
+typedef void (*rx_release_fn_t)( void *arg, data_packet_t *packet );
+
+
+/**
+ * rx_streams_init:
+ * Creates an empty stream table and makes `t' point to it.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int rx_streams_init( rx_streams_t **t );
+
+/**
+ * rx_streams_destroy:
+ * Frees the table, with any packets held in it, and sets *t to NULL.
+ */
+void rx_streams_destroy( rx_streams_t **t );
+
+/**
+ * rx_streams_fresh:
+ * Notes that `packet' has arrived at `now_us'. Packets held in order
+ * on a stream which is given up on to make room, or which starts
+ * again, are passed to `fn'.
+ * Returns TRUE if it is the first time, or FALSE if it is a copy of
+ * one already seen.
+ */
+int rx_streams_fresh( rx_streams_t *t, data_packet_t *packet,
+		      uint64_t now_us, rx_release_fn_t fn, void *arg );
+
+/**
+ * rx_streams_set_reorder:
+ * Puts packets on `channel' from each source back in order, holding
+ * up to `depth' of them for at most `delay_us' waiting for one
+ * missing; a depth of 0 passes them on as they come.
+ * Returns TRUE on success, or FALSE if `depth' is more than
+ * RX_REORDER_MAX or there is no memory.
+ */
+int rx_streams_set_reorder( rx_streams_t *t, uint32_t channel,
+			    uint32_t depth, uint32_t delay_us );
+
+/**
+ * rx_streams_order:
+ * Passes `packet' to `fn', along with any it lets follow, if it is
+ * next in order on its stream or its channel isn't reordered. A packet
+ * after a gap is held back; one which missed its turn is dropped.
+ * Returns the microseconds until a gap must be given up on, or 0 if
+ * none is waiting on this stream.
+ */
+uint32_t rx_streams_order( rx_streams_t *t, data_packet_t *packet,
+			   uint64_t now_us, rx_release_fn_t fn, void *arg );
+
+/**
+ * rx_streams_flush:
+ * Gives up on gaps which have been waited on long enough, passing the
+ * packets held after them to `fn'.
+ * Returns the microseconds until the next gap must be given up on, or
+ * 0 if none is waiting.
+ */
+uint32_t rx_streams_flush( rx_streams_t *t, uint64_t now_us,
+			   rx_release_fn_t fn, void *arg );
+
+#endif
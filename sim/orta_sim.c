@@ -0,0 +1,643 @@
+
+/**
+ * orta_sim:
+ * Runs many Orta instances in one process, each on its own loopback
+ * address (127.1.x.y), to measure how the protocol behaves at scale
+ * without a testbed of real hosts.
+ *
+ * Every UDP packet an instance sends, data and pings alike, passes
+ * through a delay line which holds it back by the one-way latency
+ * between the two nodes, or drops it with the configured probability,
+ * before handing it to the transport. Pings therefore see the modelled
+ * network, and link weights and routes follow from it. Control
+ * connections run at loopback speed, over TCP, or with -u over Unix
+ * domain sockets, which keeps the IP stack out of the measurements.
+ *
+ * Latencies come from a matrix file of whitespace-separated one-way
+ * latencies in milliseconds, row i holding those from node i, or are
+ * generated by placing the nodes at random in a square 100ms across.
+ * Placement, join order and losses are all drawn from the seed, so
+ * runs with the same options see the same network; thread scheduling
+ * still varies from run to run.
+ *
+ * Reports:
+ * * convergence: time from the first join until every instance knows
+ *   every member;
+ * * routing: CPU time taken by one rebuild of each routing table;
+ * * data: packets and bytes delivered to the whole group when node 0
+ *   sends a burst, and the rate at which they arrived.
+ */
+
+#define _GNU_SOURCE /* pthread_setattr_default_np */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* The library has its own INFINITY, a distance rather than a float */
+#undef INFINITY
+#include "orta.h"
+#include "orta_t.h"
+#include "orta_routing.h"
+
+#define SIM_PORT         6000
+#define SIM_JOIN_TRIES   50
+/* Stack for each thread the instances start; the data path keeps a
+ * whole packet on the stack */
+#define SIM_THREAD_STACK (2*1024*1024)
+
+typedef struct
+{
+	int id;
+	orta_t *orta;
+	uint32_t ip;
+	/* Drawn from for this node's losses, under the delay line lock */
+	unsigned int rng;
+	uint32_t received;
+} sim_node_t;
+
+/* A packet held in the delay line until `due' */
+typedef struct
+{
+	uint64_t due;
+	sim_node_t *from;
+	int sd;
+	sockaddr_in_t dest;
+	size_t len;
+	char data[];
+} sim_packet_t;
+
+typedef struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_t thread;
+	int running;
+
+	/* Binary min-heap of packets, by due time */
+	sim_packet_t **heap;
+	uint32_t length;
+	uint32_t space;
+
+	uint64_t sent;
+	uint64_t dropped;
+} sim_delay_t;
+
+
+static int num_nodes= 100;
+static sim_node_t *nodes;
+/* One-way latency from node i to node j is lat_us[i*num_nodes+j] */
+static uint32_t *lat_us;
+static double loss= 0;
+static sim_delay_t delay;
+
+
+/**
+ * sim_now:
+ * Returns the monotonic time in microseconds.
+ */
+static uint64_t sim_now( )
+{
+	struct timespec now;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return (uint64_t)now.tv_sec*1000000+now.tv_nsec/1000;
+}
+
+
+/**
+ * sim_cpu_now:
+ * Returns the CPU time used by the calling thread in microseconds.
+ */
+static uint64_t sim_cpu_now( )
+{
+	struct timespec now;
+
+	clock_gettime( CLOCK_THREAD_CPUTIME_ID, &now );
+	return (uint64_t)now.tv_sec*1000000+now.tv_nsec/1000;
+}
+
+
+/**
+ * sim_addr, sim_node_of:
+ * Map node numbers to their loopback addresses, in network byte
+ * order, and back. sim_node_of() returns -1 for other addresses.
+ */
+static uint32_t sim_addr( int id )
+{
+	return htonl( (127<<24) | (1<<16) | (id+1) );
+}
+
+static int sim_node_of( uint32_t ip )
+{
+	uint32_t h= ntohl( ip );
+	int id= (int)(h & 0xffff)-1;
+
+	if ( (h >> 16) != ((127<<8) | 1) || id < 0 || id >= num_nodes )
+		return -1;
+
+	return id;
+}
+
+
+/**
+ * delay_push, delay_pop:
+ * Add a packet to the delay line's heap, and take the earliest due
+ * off it. The caller holds the delay line lock.
+ */
+static int delay_push( sim_packet_t *p )
+{
+	uint32_t i, parent;
+
+	if ( delay.length == delay.space ) {
+		uint32_t space= delay.space ? delay.space*2 : 1024;
+		sim_packet_t **heap= (sim_packet_t**)realloc( delay.heap,
+						space*sizeof(sim_packet_t*) );
+
+		if ( heap == NULL )
+			return FALSE;
+		delay.heap= heap;
+		delay.space= space;
+	}
+
+	for ( i= delay.length++; i > 0; i= parent ) {
+		parent= (i-1)/2;
+		if ( delay.heap[parent]->due <= p->due )
+			break;
+		delay.heap[i]= delay.heap[parent];
+	}
+	delay.heap[i]= p;
+
+	return TRUE;
+}
+
+static sim_packet_t *delay_pop( )
+{
+	sim_packet_t *top= delay.heap[0];
+	sim_packet_t *last= delay.heap[--delay.length];
+	uint32_t i, child;
+
+	for ( i= 0; (child= 2*i+1) < delay.length; i= child ) {
+		if ( child+1 < delay.length &&
+		     delay.heap[child+1]->due < delay.heap[child]->due )
+			child++;
+		if ( last->due <= delay.heap[child]->due )
+			break;
+		delay.heap[i]= delay.heap[child];
+	}
+	delay.heap[i]= last;
+
+	return top;
+}
+
+
+/**
+ * delay_thread:
+ * Hands each packet in the delay line to the transport once it is due.
+ */
+static void *delay_thread( void *arg )
+{
+	sim_packet_t *p;
+	struct timespec until;
+	uint64_t now;
+
+	pthread_mutex_lock( &delay.lock );
+
+	while ( delay.running ) {
+		if ( delay.length == 0 ) {
+			pthread_cond_wait( &delay.wake, &delay.lock );
+			continue;
+		}
+
+		now= sim_now( );
+		if ( delay.heap[0]->due > now ) {
+			/* The condition variable runs on the real time clock */
+			clock_gettime( CLOCK_REALTIME, &until );
+			until.tv_sec+=  (delay.heap[0]->due-now)/1000000;
+			until.tv_nsec+= ((delay.heap[0]->due-now)%1000000)*1000;
+			if ( until.tv_nsec >= 1000000000 ) {
+				until.tv_sec++;
+				until.tv_nsec-= 1000000000;
+			}
+			pthread_cond_timedwait( &delay.wake, &delay.lock,
+						&until );
+			continue;
+		}
+
+		p= delay_pop( );
+		pthread_mutex_unlock( &delay.lock );
+
+		orta_send_raw( p->from->orta, p->sd, p->data, p->len,
+			       &(p->dest) );
+		free( p );
+
+		pthread_mutex_lock( &delay.lock );
+	}
+
+	/* Anything still in the line is lost with the network */
+	while ( delay.length )
+		free( delay_pop() );
+
+	pthread_mutex_unlock( &delay.lock );
+
+	return NULL;
+}
+
+
+/**
+ * sim_send:
+ * Send hook given to every instance: drops the packet or queues it in
+ * the delay line for the latency between the two nodes.
+ */
+static ssize_t sim_send( void *arg, int sd, const void *buf, size_t len,
+			 const struct sockaddr_in *dest )
+{
+	sim_node_t *from= (sim_node_t*)arg;
+	sim_packet_t *p;
+	int to= sim_node_of( dest->sin_addr.s_addr );
+
+	if ( to < 0 )
+		return orta_send_raw( from->orta, sd, buf, len, dest );
+
+	pthread_mutex_lock( &delay.lock );
+
+	delay.sent++;
+	if ( !delay.running ||
+	     (loss > 0 && rand_r(&(from->rng)) < loss*RAND_MAX) ) {
+		delay.dropped++;
+		pthread_mutex_unlock( &delay.lock );
+		return len;
+	}
+
+	if ( (p= (sim_packet_t*)malloc( sizeof(sim_packet_t)+len )) == NULL ) {
+		pthread_mutex_unlock( &delay.lock );
+		errno= ENOBUFS;
+		return -1;
+	}
+	p->due= sim_now( )+lat_us[from->id*num_nodes+to];
+	p->from= from;
+	p->sd= sd;
+	p->dest= *dest;
+	p->len= len;
+	memcpy( p->data, buf, len );
+
+	if ( !delay_push( p ) ) {
+		free( p );
+		pthread_mutex_unlock( &delay.lock );
+		errno= ENOBUFS;
+		return -1;
+	}
+	if ( delay.heap[0] == p )
+		pthread_cond_signal( &delay.wake );
+
+	pthread_mutex_unlock( &delay.lock );
+
+	return len;
+}
+
+
+/**
+ * latency_generate:
+ * Places the nodes at random in a square 100ms across, with 2ms added
+ * to every path for the access links at either end.
+ */
+static void latency_generate( unsigned int *seed )
+{
+	double *x= (double*)malloc( num_nodes*sizeof(double) );
+	double *y= (double*)malloc( num_nodes*sizeof(double) );
+	int i, j;
+
+	for ( i= 0; i < num_nodes; i++ ) {
+		x[i]= (double)rand_r( seed )/RAND_MAX;
+		y[i]= (double)rand_r( seed )/RAND_MAX;
+	}
+
+	for ( i= 0; i < num_nodes; i++ )
+		for ( j= 0; j < num_nodes; j++ )
+			lat_us[i*num_nodes+j]= 2000+(uint32_t)(100000*
+				sqrt( (x[i]-x[j])*(x[i]-x[j])+
+				      (y[i]-y[j])*(y[i]-y[j]) ));
+
+	free( x );
+	free( y );
+}
+
+
+/**
+ * latency_load:
+ * Reads the latency matrix from `path'.
+ * Returns TRUE on success, FALSE otherwise.
+ */
+static int latency_load( const char *path )
+{
+	FILE *f;
+	double ms;
+	int i;
+
+	if ( (f= fopen( path, "r" )) == NULL ) {
+		perror( path );
+		return FALSE;
+	}
+
+	for ( i= 0; i < num_nodes*num_nodes; i++ ) {
+		if ( fscanf( f, "%lf", &ms ) != 1 || ms < 0 ) {
+			fprintf( stderr, "%s: need %d latencies, found %d.\n",
+				 path, num_nodes*num_nodes, i );
+			fclose( f );
+			return FALSE;
+		}
+		lat_us[i]= (uint32_t)(ms*1000);
+	}
+
+	fclose( f );
+
+	return TRUE;
+}
+
+
+/**
+ * sim_converged:
+ * Returns the number of instances which know of every member.
+ */
+static int sim_converged( )
+{
+	int i, done= 0;
+
+	for ( i= 0; i < num_nodes; i++ ) {
+		orta_t *o= nodes[i].orta;
+
+		pthread_mutex_lock( o->members->lock );
+		if ( members_length( o->members ) == num_nodes )
+			done++;
+		pthread_mutex_unlock( o->members->lock );
+	}
+
+	return done;
+}
+
+
+/**
+ * sim_routing_cpu:
+ * Rebuilds every instance's routing table once, and returns the mean
+ * CPU time each rebuild took, in microseconds.
+ */
+static double sim_routing_cpu( )
+{
+	uint64_t total= 0, start;
+	int i;
+
+	for ( i= 0; i < num_nodes; i++ ) {
+		orta_t *o= nodes[i].orta;
+
+		pthread_mutex_lock( o->links->lock );
+		pthread_mutex_lock( o->members->lock );
+		start= sim_cpu_now( );
+		routing_build_table( o );
+		total+= sim_cpu_now( )-start;
+		pthread_mutex_unlock( o->members->lock );
+		pthread_mutex_unlock( o->links->lock );
+	}
+
+	return (double)total/num_nodes;
+}
+
+
+/**
+ * sim_data:
+ * Has node 0 send `packets' packets of `bytes' each, and counts those
+ * reaching the other nodes until none has arrived for a second.
+ */
+static void sim_data( int packets, int bytes )
+{
+	char *buffer= (char*)malloc( bytes );
+	struct timeval poll;
+	uint64_t start, last, idle_since;
+	uint64_t delivered= 0, expected;
+	int i, progress;
+
+	memset( buffer, 0xa5, bytes );
+
+	start= last= sim_now( );
+	for ( i= 0; i < packets; i++ )
+		orta_send( nodes[0].orta, 0, buffer, bytes );
+
+	idle_since= sim_now( );
+	while ( sim_now( )-idle_since < 1000000 ) {
+		progress= FALSE;
+		for ( i= 1; i < num_nodes; i++ ) {
+			poll.tv_sec= 0;
+			poll.tv_usec= 0;
+			while ( orta_recv_timeout( nodes[i].orta, 0, buffer,
+						   bytes, &poll ) > 0 ) {
+				nodes[i].received++;
+				delivered++;
+				progress= TRUE;
+			}
+		}
+
+		if ( progress )
+			last= idle_since= sim_now( );
+		else
+			usleep( 1000 );
+	}
+
+	expected= (uint64_t)packets*(num_nodes-1);
+	/* Copies are counted too: while link state is still settling,
+	 * peers' trees can disagree and deliver a packet twice */
+	printf( "data: %llu of %llu packets delivered (%.1f%%)",
+		(unsigned long long)delivered, (unsigned long long)expected,
+		expected ? 100.0*delivered/expected : 0.0 );
+	if ( last > start )
+		printf( ", %.0f packets/s, %.2f Mbit/s",
+			delivered*1e6/(last-start),
+			delivered*bytes*8.0/(last-start) );
+	printf( "\n" );
+
+	free( buffer );
+}
+
+
+static void usage( const char *name )
+{
+	fprintf( stderr,
+		 "usage: %s [-n nodes] [-s seed] [-l loss] [-m matrix] [-a] [-u|-i]\n"
+		 "          [-t timeout_s] [-p packets] [-b bytes] [-f group [-r]]\n"
+		 "  -n  instances to run (default 100)\n"
+		 "  -s  seed for placement, join order and losses\n"
+		 "  -l  probability each UDP packet is lost (default 0)\n"
+		 "  -m  file of one-way latencies in ms, nodes by nodes\n"
+		 "  -a  keep the all-pairs distance matrix in each instance\n"
+		 "  -u  connect the instances with Unix domain sockets\n"
+		 "  -i  receive data through io_uring where available\n"
+		 "  -t  seconds to wait for convergence (default 300)\n"
+		 "  -p  data packets sent by node 0 (default 1000)\n"
+		 "  -b  bytes in each data packet (default 1000)\n"
+		 "  -f  send a parity packet for every `group' data packets\n"
+		 "  -r  have relays pass on parity only for groups they hold whole\n",
+		 name );
+	exit( 1 );
+}
+
+
+int main( int argc, char **argv )
+{
+	unsigned int seed= 1;
+	const char *matrix= NULL;
+	int all_pairs= FALSE, transport= ORTA_TRANSPORT_KERNEL;
+	int timeout_s= 300, packets= 1000, bytes= 1000;
+	int fec_group= 0, fec_relay= ORTA_FEC_PASS;
+	orta_config_t config;
+	pthread_attr_t attr;
+	struct rlimit lim;
+	char addr[INET_ADDRSTRLEN];
+	uint64_t start;
+	struct rusage usage_start, usage_end;
+	int opt, i, j, tries, done;
+
+	/* Report each stage as it finishes, even into a pipe */
+	setvbuf( stdout, NULL, _IOLBF, 0 );
+
+	while ( (opt= getopt( argc, argv, "n:s:l:m:auit:p:b:f:r" )) != -1 ) {
+		switch ( opt ) {
+		case 'n': num_nodes= atoi( optarg );         break;
+		case 's': seed= strtoul( optarg, NULL, 0 );  break;
+		case 'l': loss= atof( optarg );              break;
+		case 'm': matrix= optarg;                    break;
+		case 'a': all_pairs= TRUE;                   break;
+		case 'u': transport= ORTA_TRANSPORT_LOCAL;   break;
+		case 'i': transport= ORTA_TRANSPORT_URING;   break;
+		case 't': timeout_s= atoi( optarg );         break;
+		case 'p': packets= atoi( optarg );           break;
+		case 'b': bytes= atoi( optarg );             break;
+		case 'f': fec_group= atoi( optarg );         break;
+		case 'r': fec_relay= ORTA_FEC_REENCODE;      break;
+		default:  usage( argv[0] );
+		}
+	}
+	if ( num_nodes < 2 || num_nodes > 65534 || loss < 0 || loss >= 1 ||
+	     bytes <= 0 || fec_group < 0 )
+		usage( argv[0] );
+
+	/* Each instance holds several sockets and threads */
+	if ( getrlimit( RLIMIT_NOFILE, &lim ) == 0 ) {
+		lim.rlim_cur= lim.rlim_max;
+		setrlimit( RLIMIT_NOFILE, &lim );
+	}
+	pthread_attr_init( &attr );
+	pthread_attr_setstacksize( &attr, SIM_THREAD_STACK );
+	pthread_setattr_default_np( &attr );
+
+	/* The library draws from rand() for its own timers and probes */
+	srand( seed );
+
+	lat_us= (uint32_t*)malloc( (size_t)num_nodes*num_nodes*sizeof(uint32_t) );
+	nodes= (sim_node_t*)calloc( num_nodes, sizeof(sim_node_t) );
+	if ( lat_us == NULL || nodes == NULL ) {
+		fprintf( stderr, "orta_sim: out of memory.\n" );
+		return 1;
+	}
+	if ( matrix != NULL ) {
+		if ( !latency_load( matrix ) )
+			return 1;
+	}
+	else
+		latency_generate( &seed );
+
+	pthread_mutex_init( &delay.lock, NULL );
+	pthread_cond_init( &delay.wake, NULL );
+	delay.running= TRUE;
+	pthread_create( &delay.thread, NULL, &delay_thread, NULL );
+
+	orta_config_default( &config );
+	if ( all_pairs )
+		config.all_pairs_max_nodes= num_nodes;
+	config.transport= transport;
+	config.fec_relay= fec_relay;
+
+	for ( i= 0; i < num_nodes; i++ ) {
+		nodes[i].id= i;
+		nodes[i].ip= sim_addr( i );
+		nodes[i].rng= seed+i;
+		inet_ntop( AF_INET, &(nodes[i].ip), addr, sizeof(addr) );
+
+		if ( (nodes[i].orta= orta_init_config( addr, SIM_PORT, SIM_PORT,
+						       &config )) == NULL ) {
+			fprintf( stderr, "orta_sim: can't start node %d.\n", i );
+			return 1;
+		}
+		orta_set_send_hook( nodes[i].orta, &sim_send, &(nodes[i]) );
+	}
+	if ( !orta_set_channel_fec( nodes[0].orta, 0, fec_group ) )
+		usage( argv[0] );
+	printf( "started %d nodes\n", num_nodes );
+
+	getrusage( RUSAGE_SELF, &usage_start );
+	start= sim_now( );
+
+	/* Each node joins one picked at random from those before it */
+	orta_connect( nodes[0].orta, NULL );
+	for ( i= 1; i < num_nodes; i++ ) {
+		j= rand_r( &seed )%i;
+		inet_ntop( AF_INET, &(nodes[j].ip), addr, sizeof(addr) );
+
+		/* The listener may not be up yet */
+		for ( tries= 0; tries < SIM_JOIN_TRIES; tries++ ) {
+			if ( orta_connect( nodes[i].orta, addr ) )
+				break;
+			usleep( 10000 );
+		}
+		if ( tries == SIM_JOIN_TRIES ) {
+			fprintf( stderr, "orta_sim: node %d can't join %d.\n",
+				 i, j );
+			return 1;
+		}
+	}
+	printf( "joined in %.3fs\n", (sim_now()-start)/1e6 );
+
+	while ( (done= sim_converged( )) < num_nodes &&
+		sim_now( )-start < (uint64_t)timeout_s*1000000 )
+		usleep( 10000 );
+
+	getrusage( RUSAGE_SELF, &usage_end );
+	printf( "convergence: %d of %d nodes know every member after %.3fs, "
+		"%.3fs CPU\n", done, num_nodes, (sim_now()-start)/1e6,
+		(usage_end.ru_utime.tv_sec-usage_start.ru_utime.tv_sec)+
+		(usage_end.ru_stime.tv_sec-usage_start.ru_stime.tv_sec)+
+		((usage_end.ru_utime.tv_usec-usage_start.ru_utime.tv_usec)+
+		 (usage_end.ru_stime.tv_usec-usage_start.ru_stime.tv_usec))/1e6 );
+
+	printf( "routing: %.1fus CPU per table rebuild\n", sim_routing_cpu() );
+
+	sim_data( packets, bytes );
+
+	pthread_mutex_lock( &delay.lock );
+	printf( "network: %llu UDP packets, %llu dropped\n",
+		(unsigned long long)delay.sent,
+		(unsigned long long)delay.dropped );
+	delay.running= FALSE;
+	pthread_cond_signal( &delay.wake );
+	pthread_mutex_unlock( &delay.lock );
+	pthread_join( delay.thread, NULL );
+
+	/* With the delay line stopped, whatever the instances still send
+	 * is dropped as they are torn down */
+	for ( i= 0; i < num_nodes; i++ ) {
+		orta_disconnect( nodes[i].orta );
+		orta_destroy( &(nodes[i].orta) );
+	}
+
+	free( delay.heap );
+	free( lat_us );
+	free( nodes );
+
+	return done == num_nodes ? 0 : 2;
+}
@@ -0,0 +1,479 @@
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "spt_cache.h"
+#include "dist_heap.h"
+
+
+/**
+ * spt_cache_init:
+ * Creates an empty cache and makes `cache' point to it.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int spt_cache_init( spt_cache_t **cache )
+{
+	spt_cache_t *c= (spt_cache_t*)calloc( 1, sizeof(spt_cache_t) );
+
+	if ( c == NULL )
+		return FALSE;
+
+	c->src= -1;
+	c->extra_dist= INFINITY;
+
+	*cache= c;
+	return TRUE;
+}
+
+
+/**
+ * spt_cache_destroy:
+ * Frees the cache, and sets *cache to NULL.
+ */
+void spt_cache_destroy( spt_cache_t **cache )
+{
+	spt_cache_t *c= *cache;
+
+	free( c->ips );
+	free( c->first );
+	free( c->adj );
+	free( c->weight );
+	free( c->dist );
+	free( c->parent );
+	free( c->order );
+	free( c->what_if );
+	free( c->member_ip );
+	free( c->member_node );
+	free( c->member_dist );
+	free( c->member_what_if );
+	free( c->heap );
+	free( c->mark );
+	free( c );
+
+	*cache= NULL;
+}
+
+
+/**
+ * spt_grow:
+ * Makes sure there is room for `nodes' nodes and `edges' edges.
+ */
+static int spt_grow( spt_cache_t *c, uint32_t nodes, uint32_t edges )
+{
+	void *p;
+
+	if ( nodes > c->node_space ) {
+		nodes*= 2;
+
+		if ( (p= realloc(c->ips, nodes*sizeof(uint32_t))) == NULL )
+			return FALSE;
+		c->ips= p;
+		if ( (p= realloc(c->first, (nodes+1)*sizeof(uint32_t))) == NULL )
+			return FALSE;
+		c->first= p;
+		if ( (p= realloc(c->dist, nodes*sizeof(uint32_t))) == NULL )
+			return FALSE;
+		c->dist= p;
+		if ( (p= realloc(c->parent, nodes*sizeof(int))) == NULL )
+			return FALSE;
+		c->parent= p;
+		if ( (p= realloc(c->order, nodes*sizeof(uint32_t))) == NULL )
+			return FALSE;
+		c->order= p;
+		if ( (p= realloc(c->what_if, nodes*sizeof(uint32_t))) == NULL )
+			return FALSE;
+		c->what_if= p;
+		if ( (p= realloc(c->mark, nodes)) == NULL )
+			return FALSE;
+		c->mark= p;
+
+		c->node_space= nodes;
+	}
+
+	if ( edges > c->edge_space ) {
+		edges*= 2;
+
+		if ( (p= realloc(c->adj, edges*sizeof(uint32_t))) == NULL )
+			return FALSE;
+		c->adj= p;
+		if ( (p= realloc(c->weight, edges*sizeof(uint32_t))) == NULL )
+			return FALSE;
+		c->weight= p;
+
+		c->edge_space= edges;
+	}
+
+	/* Every relaxation pushes at most one entry, plus the start */
+	p= realloc( c->heap, (c->edge_space+c->node_space+1)*sizeof(uint64_t) );
+	if ( p == NULL )
+		return FALSE;
+	c->heap= p;
+
+	return TRUE;
+}
+
+
+static int spt_ip_compare( const void *a, const void *b )
+{
+	uint32_t x= *(const uint32_t*)a, y= *(const uint32_t*)b;
+
+	return x < y ? -1 : x > y;
+}
+
+
+/**
+ * spt_index:
+ * Returns the index of `ip', or -1 if it is not in the graph.
+ */
+static int spt_index( spt_cache_t *c, uint32_t ip )
+{
+	int lo= 0, hi= (int)c->num_nodes-1;
+
+	while ( lo <= hi ) {
+		int mid= (lo+hi)/2;
+
+		if ( c->ips[mid] == ip )
+			return mid;
+		if ( c->ips[mid] < ip )
+			lo= mid+1;
+		else
+			hi= mid-1;
+	}
+
+	return -1;
+}
+
+
+/**
+ * spt_snapshot:
+ * Copies `links' into the cache's arrays.
+ */
+static int spt_snapshot( spt_cache_t *c, links_t *links )
+{
+	link_from_t *from;
+	link_to_t *to;
+	uint32_t nodes= 0, edges= 0, i, n;
+
+	for ( from= links->head; from != NULL; from= from->next_node ) {
+		nodes++;
+		for ( to= from->links; to != NULL; to= to->next_link ) {
+			nodes++;
+			edges++;
+		}
+	}
+
+	if ( !spt_grow( c, nodes+1, edges+1 ) )
+		return FALSE;
+
+	/* Every address mentioned, sorted and without duplicates */
+	n= 0;
+	for ( from= links->head; from != NULL; from= from->next_node ) {
+		c->ips[n++]= from->ip;
+		for ( to= from->links; to != NULL; to= to->next_link )
+			c->ips[n++]= to->ip;
+	}
+	qsort( c->ips, n, sizeof(uint32_t), &spt_ip_compare );
+
+	c->num_nodes= 0;
+	for ( i= 0; i < n; i++ ) {
+		if ( c->num_nodes == 0 || c->ips[c->num_nodes-1] != c->ips[i] )
+			c->ips[c->num_nodes++]= c->ips[i];
+	}
+
+	/* The links table is kept sorted by source, so the edges come
+	 * out grouped by node in index order */
+	c->num_edges= 0;
+	from= links->head;
+	for ( i= 0; i < c->num_nodes; i++ ) {
+		c->first[i]= c->num_edges;
+
+		if ( from == NULL || from->ip != c->ips[i] )
+			continue;
+
+		for ( to= from->links; to != NULL; to= to->next_link ) {
+			c->adj[c->num_edges]= spt_index( c, to->ip );
+			c->weight[c->num_edges]= to->distance;
+			c->num_edges++;
+		}
+		from= from->next_node;
+	}
+	c->first[c->num_nodes]= c->num_edges;
+
+	return TRUE;
+}
+
+
+/**
+ * spt_run:
+ * Dijkstra's algorithm over `dist', starting from whatever the caller
+ * has already put on the heap. The link from the source to `masked'
+ * is ignored, if `masked' is not -1. If `parent' is not NULL the tree
+ * and settling order are recorded.
+ */
+static void spt_run( spt_cache_t *c, uint32_t *dist, uint32_t len,
+		     int masked, int *parent )
+{
+	while ( len ) {
+		uint64_t entry= dist_heap_pop( c->heap, &len );
+		uint32_t u= HEAP_NODE(entry), d= HEAP_DIST(entry), e;
+
+		/* Stale entry; the node was reached more cheaply since */
+		if ( d != dist[u] )
+			continue;
+
+		if ( parent != NULL )
+			c->order[c->num_settled++]= u;
+
+		for ( e= c->first[u]; e < c->first[u+1]; e++ ) {
+			uint32_t v= c->adj[e], nd= d+c->weight[e];
+
+			if ( (int)u == c->src && (int)v == masked )
+				continue;
+			if ( c->weight[e] >= INFINITY || nd >= dist[v] )
+				continue;
+
+			dist[v]= nd;
+			if ( parent != NULL )
+				parent[v]= u;
+			dist_heap_push( c->heap, &len, HEAP_ENTRY(nd, v) );
+		}
+	}
+}
+
+
+/**
+ * spt_baseline:
+ * Brings the cached tree up to date with `links' as seen from
+ * `source', if either has changed since it was last computed. The
+ * caller must hold the links lock.
+ * Returns TRUE on success, FALSE if memory ran out.
+ */
+int spt_baseline( spt_cache_t *c, uint32_t source, links_t *links )
+{
+	uint32_t i, len= 0;
+
+	if ( c->valid && c->version == links->version && c->source == source )
+		return TRUE;
+
+	c->valid= FALSE;
+	if ( !spt_snapshot( c, links ) )
+		return FALSE;
+
+	for ( i= 0; i < c->num_nodes; i++ ) {
+		c->dist[i]= INFINITY;
+		c->parent[i]= -1;
+	}
+	c->num_settled= 0;
+
+	c->src= spt_index( c, source );
+	if ( c->src != -1 ) {
+		c->dist[c->src]= 0;
+		dist_heap_push( c->heap, &len, HEAP_ENTRY(0, c->src) );
+		spt_run( c, c->dist, len, -1, c->parent );
+	}
+
+	c->version= links->version;
+	c->source= source;
+	c->valid= TRUE;
+
+	return TRUE;
+}
+
+
+/**
+ * spt_members:
+ * Gives each of `members' other than the source a slot, and fills in
+ * its baseline distance. Must be called again after spt_baseline()
+ * rebuilds the tree. The caller must hold the members lock.
+ * Returns TRUE on success, FALSE if memory ran out.
+ */
+int spt_members( spt_cache_t *c, members_list_t *members )
+{
+	member_t *m;
+	uint32_t n= 0;
+	void *p;
+
+	if ( members->length > c->member_space ) {
+		uint32_t space= members->length*2;
+
+		if ( (p= realloc(c->member_ip, space*sizeof(uint32_t))) == NULL )
+			return FALSE;
+		c->member_ip= p;
+		if ( (p= realloc(c->member_node, space*sizeof(int))) == NULL )
+			return FALSE;
+		c->member_node= p;
+		if ( (p= realloc(c->member_dist, space*sizeof(uint32_t))) == NULL )
+			return FALSE;
+		c->member_dist= p;
+		if ( (p= realloc(c->member_what_if, space*sizeof(uint32_t))) == NULL )
+			return FALSE;
+		c->member_what_if= p;
+
+		c->member_space= space;
+	}
+
+	for ( m= members->head; m != NULL; m= m->next ) {
+		int i;
+
+		if ( m->member == c->source )
+			continue;
+
+		i= spt_index( c, m->member );
+		c->member_ip[n]= m->member;
+		c->member_node[n]= i;
+		c->member_dist[n]= i == -1 ? INFINITY : c->dist[i];
+		n++;
+	}
+	c->num_members= n;
+
+	return TRUE;
+}
+
+
+/**
+ * spt_gather:
+ * Copies the what-if distances of the members into their slots.
+ */
+static void spt_gather( spt_cache_t *c )
+{
+	uint32_t i;
+
+	for ( i= 0; i < c->num_members; i++ ) {
+		int node= c->member_node[i];
+
+		if ( node != -1 )
+			c->member_what_if[i]= c->what_if[node];
+		else if ( c->member_ip[i] == c->extra_ip )
+			c->member_what_if[i]= c->extra_dist;
+		else
+			c->member_what_if[i]= INFINITY;
+	}
+}
+
+
+/**
+ * spt_distance:
+ * Returns the baseline distance from the source to `ip', or INFINITY.
+ */
+uint32_t spt_distance( spt_cache_t *c, uint32_t ip )
+{
+	int i= spt_index( c, ip );
+
+	if ( i == -1 )
+		return ip == c->source ? 0 : INFINITY;
+
+	return c->dist[i];
+}
+
+
+/**
+ * spt_with_link:
+ * Works out the distances from the source were it to have a link of
+ * `weight' to `to_ip', or the existing link made that light if it is
+ * heavier. Only nodes whose paths improve are visited. Members'
+ * distances are copied to `member_what_if'.
+ */
+void spt_with_link( spt_cache_t *c, uint32_t to_ip, uint32_t weight )
+{
+	int to= spt_index( c, to_ip );
+	uint32_t len= 0;
+
+	memcpy( c->what_if, c->dist, c->num_nodes*sizeof(uint32_t) );
+	c->extra_ip= 0;
+	c->extra_dist= INFINITY;
+
+	/* Nothing is known about links out of a node we have never
+	 * heard of, so only the node itself gets closer */
+	if ( to == -1 ) {
+		c->extra_ip= to_ip;
+		c->extra_dist= weight;
+		spt_gather( c );
+		return;
+	}
+
+	/* Adding a link can only shorten paths, and only those which
+	 * would now run over it */
+	if ( weight < c->what_if[to] ) {
+		c->what_if[to]= weight;
+		dist_heap_push( c->heap, &len, HEAP_ENTRY(weight, to) );
+		spt_run( c, c->what_if, len, -1, NULL );
+	}
+
+	spt_gather( c );
+}
+
+
+/**
+ * spt_without_link:
+ * Works out the distances from the source were its link to `to_ip'
+ * dropped. Only nodes reached through that link are revisited.
+ * Members' distances are copied to `member_what_if'.
+ */
+void spt_without_link( spt_cache_t *c, uint32_t to_ip )
+{
+	int to= spt_index( c, to_ip );
+	uint32_t i, e, len= 0;
+
+	memcpy( c->what_if, c->dist, c->num_nodes*sizeof(uint32_t) );
+	c->extra_ip= 0;
+	c->extra_dist= INFINITY;
+
+	/* If the tree doesn't use the link, no path gets any longer */
+	if ( to == -1 || c->src == -1 || c->parent[to] != c->src ) {
+		spt_gather( c );
+		return;
+	}
+
+	/* Mark the subtree hanging off the link. Parents are settled
+	 * before their children, so one pass in settling order will do. */
+	memset( c->mark, 0, c->num_nodes );
+	for ( i= 0; i < c->num_settled; i++ ) {
+		uint32_t v= c->order[i];
+
+		if ( (int)v == to || (c->parent[v] != -1 && c->mark[c->parent[v]]) ) {
+			c->mark[v]= TRUE;
+			c->what_if[v]= INFINITY;
+		}
+	}
+
+	/* Seed the subtree with the best way in from the rest of the
+	 * tree, whose distances are unaffected */
+	for ( i= 0; i < c->num_nodes; i++ ) {
+		if ( c->mark[i] || c->what_if[i] >= INFINITY )
+			continue;
+
+		for ( e= c->first[i]; e < c->first[i+1]; e++ ) {
+			uint32_t v= c->adj[e], nd= c->what_if[i]+c->weight[e];
+
+			if ( !c->mark[v] || ((int)i == c->src && (int)v == to) )
+				continue;
+			if ( c->weight[e] >= INFINITY || nd >= c->what_if[v] )
+				continue;
+
+			c->what_if[v]= nd;
+			dist_heap_push( c->heap, &len, HEAP_ENTRY(nd, v) );
+		}
+	}
+
+	spt_run( c, c->what_if, len, to, NULL );
+	spt_gather( c );
+}
+
+
+/**
+ * spt_what_if_distance:
+ * Returns the distance to `ip' from the last spt_with_link() or
+ * spt_without_link(), or INFINITY.
+ */
+uint32_t spt_what_if_distance( spt_cache_t *c, uint32_t ip )
+{
+	int i= spt_index( c, ip );
+
+	if ( i == -1 ) {
+		if ( ip == c->extra_ip )
+			return c->extra_dist;
+		return ip == c->source ? 0 : INFINITY;
+	}
+
+	return c->what_if[i];
+}
@@ -0,0 +1,129 @@
+#ifndef __SPT_CACHE_
+#define __SPT_CACHE_
+
+#include <stdint.h>
+
+#include "links.h"
+#include "members.h"
+#include "common_defs.h"
+
+/**
+ * An spt_cache_t holds a compact copy of the links table, taken when
+ * the table was at `version', and the shortest path tree over it from
+ * `source'. The copy is only rebuilt when the table changes, and
+ * "what if" questions about a single link from `source' are answered
+ * against it without touching the links table itself.
+ *
+ * Nodes are numbered by their position in `ips', which is sorted;
+ * the links out of node i are adj[first[i]] .. adj[first[i+1]-1].
+ */
+typedef struct
+{
+	int valid;
+	uint32_t version;
+	uint32_t source;
+	/* Index of `source' in `ips', or -1 if it has no links */
+	int src;
+
+	uint32_t num_nodes;
+	uint32_t num_edges;
+	uint32_t *ips;
+	uint32_t *first;
+	uint32_t *adj;
+	uint32_t *weight;
+
+	/* Baseline tree: distance from `source', predecessor of each
+	 * node (or -1), and the order nodes were settled in */
+	uint32_t *dist;
+	int *parent;
+	uint32_t *order;
+	uint32_t num_settled;
+
+	/* Distances from the most recent spt_with_link() or
+	 * spt_without_link(). A node the question added to the graph
+	 * has no index, so is remembered separately. */
+	uint32_t *what_if;
+	uint32_t extra_ip;
+	uint32_t extra_dist;
+
+	/* Members other than the source, by slot, as set by
+	 * spt_members(): address, node index (or -1), and baseline and
+	 * what-if distances, kept dense for utility_sum() */
+	uint32_t num_members;
+	uint32_t *member_ip;
+	int *member_node;
+	uint32_t *member_dist;
+	uint32_t *member_what_if;
+	uint32_t member_space;
+
+	/* Scratch space: heap of (distance, node) pairs, and marks */
+	uint64_t *heap;
+	uint8_t *mark;
+
+	uint32_t node_space;
+	uint32_t edge_space;
+} spt_cache_t;
+
+
+/**
+ * spt_cache_init:
+ * Creates an empty cache and makes `cache' point to it.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int spt_cache_init( spt_cache_t **cache );
+
+/**
+ * spt_cache_destroy:
+ * Frees the cache, and sets *cache to NULL.
+ */
+void spt_cache_destroy( spt_cache_t **cache );
+
+/**
+ * spt_baseline:
+ * Brings the cached tree up to date with `links' as seen from
+ * `source', if either has changed since it was last computed. The
+ * caller must hold the links lock.
+ * Returns TRUE on success, FALSE if memory ran out.
+ */
+int spt_baseline( spt_cache_t *c, uint32_t source, links_t *links );
+
+/**
+ * spt_members:
+ * Gives each of `members' other than the source a slot, and fills in
+ * its baseline distance. Must be called again after spt_baseline()
+ * rebuilds the tree. The caller must hold the members lock.
+ * Returns TRUE on success, FALSE if memory ran out.
+ */
+int spt_members( spt_cache_t *c, members_list_t *members );
+
+/**
+ * spt_distance:
+ * Returns the baseline distance from the source to `ip', or INFINITY.
+ */
+uint32_t spt_distance( spt_cache_t *c, uint32_t ip );
+
+/**
+ * spt_with_link:
+ * Works out the distances from the source were it to have a link of
+ * `weight' to `to_ip', or the existing link made that light if it is
+ * heavier. Only nodes whose paths improve are visited. Members'
+ * distances are copied to `member_what_if'.
+ */
+void spt_with_link( spt_cache_t *c, uint32_t to_ip, uint32_t weight );
+
+/**
+ * spt_without_link:
+ * Works out the distances from the source were its link to `to_ip'
+ * dropped. Only nodes reached through that link are revisited.
+ * Members' distances are copied to `member_what_if'.
+ */
+void spt_without_link( spt_cache_t *c, uint32_t to_ip );
+
+/**
+ * spt_what_if_distance:
+ * Returns the distance to `ip' from the last spt_with_link() or
+ * spt_without_link(), or INFINITY.
+ */
+uint32_t spt_what_if_distance( spt_cache_t *c, uint32_t ip );
+
+#endif
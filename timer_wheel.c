@@ -0,0 +1,489 @@
+
+#include "timer_wheel.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#define TIMER_MASK (TIMER_SLOTS-1)
+
+/* Furthest ahead, in ticks, an event can be placed without being
+ * parked in the top level */
+#define TIMER_SPAN (((uint64_t)1)<<(TIMER_SLOT_BITS*TIMER_LEVELS))
+
+#define TIMER_NEVER UINT64_MAX
+
+
+/**
+ * timer_clock:
+ * Returns the monotonic time in microseconds.
+ */
+static uint64_t timer_clock( )
+{
+	struct timespec now;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return (uint64_t)now.tv_sec*1000000+now.tv_nsec/1000;
+}
+
+
+/**
+ * timer_ticks:
+ * Returns the current tick of `wheel', which may be ahead of the tick
+ * it has been run up to.
+ */
+static uint64_t timer_ticks( timer_wheel_t *wheel )
+{
+	return (timer_clock( )-wheel->epoch)/TIMER_TICK_US;
+}
+
+
+/**
+ * timer_expiry:
+ * Returns the tick `delay' microseconds from now, rounded up so that
+ * events never fire early.
+ */
+static uint64_t timer_expiry( timer_wheel_t *wheel, uint32_t delay )
+{
+	return (timer_clock( )-wheel->epoch+delay+TIMER_TICK_US-1)/TIMER_TICK_US;
+}
+
+
+/**
+ * timer_insert:
+ * Places `ev' in the slot for its expiry time. Events already due go
+ * in the slot for the next tick to be run. Called with the lock held.
+ */
+static void timer_insert( timer_wheel_t *wheel, timer_event_t *ev )
+{
+	uint64_t when= ev->expires < wheel->now ? wheel->now : ev->expires;
+	uint64_t delta= when-wheel->now;
+	int level= 0;
+
+	if ( delta >= TIMER_SPAN ) {
+		/* Park it as far ahead as the wheel reaches; it is
+		 * placed again as the top level turns */
+		when= wheel->now+TIMER_SPAN-1;
+		level= TIMER_LEVELS-1;
+	}
+	else {
+		while ( delta >= ((uint64_t)1)<<(TIMER_SLOT_BITS*(level+1)) )
+			level++;
+	}
+
+	ev->level= level;
+	ev->slot= (when>>(TIMER_SLOT_BITS*level)) & TIMER_MASK;
+
+	ev->prev= NULL;
+	ev->next= wheel->slots[level][ev->slot];
+	if ( ev->next != NULL )
+		ev->next->prev= ev;
+	wheel->slots[level][ev->slot]= ev;
+
+	ev->pending= TRUE;
+	wheel->count++;
+	if ( level == 0 )
+		wheel->level0++;
+}
+
+
+/**
+ * timer_remove:
+ * Takes `ev' out of its slot. Called with the lock held.
+ */
+static void timer_remove( timer_wheel_t *wheel, timer_event_t *ev )
+{
+	if ( ev->prev != NULL )
+		ev->prev->next= ev->next;
+	else
+		wheel->slots[ev->level][ev->slot]= ev->next;
+
+	if ( ev->next != NULL )
+		ev->next->prev= ev->prev;
+
+	ev->pending= FALSE;
+	wheel->count--;
+	if ( ev->level == 0 )
+		wheel->level0--;
+}
+
+
+/**
+ * timer_cascade:
+ * Called as level 0 starts a new turn; moves the events from the
+ * next slot of each higher level which has also started a new turn
+ * down to the levels below. Called with the lock held.
+ */
+static void timer_cascade( timer_wheel_t *wheel )
+{
+	timer_event_t *ev, *next;
+	int level, slot;
+
+	for ( level= 1; level < TIMER_LEVELS; level++ ) {
+		slot= (wheel->now>>(TIMER_SLOT_BITS*level)) & TIMER_MASK;
+
+		ev= wheel->slots[level][slot];
+		wheel->slots[level][slot]= NULL;
+
+		for ( ; ev != NULL; ev= next ) {
+			next= ev->next;
+			wheel->count--;
+			timer_insert( wheel, ev );
+		}
+
+		/* This level hasn't wrapped, so none above have moved */
+		if ( slot != 0 )
+			break;
+	}
+}
+
+
+/**
+ * timer_next:
+ * Returns the tick of the earliest event on the wheel, or TIMER_NEVER
+ * if it is empty. Slots at each level are visited in time order from
+ * the current one, so only the first occupied slot at each level
+ * need be looked into. Called with the lock held.
+ */
+static uint64_t timer_next( timer_wheel_t *wheel )
+{
+	uint64_t next= TIMER_NEVER;
+	timer_event_t *ev;
+	int level, i, first, slot;
+
+	if ( !wheel->count )
+		return TIMER_NEVER;
+
+	for ( level= 0; level < TIMER_LEVELS; level++ ) {
+		/* Above level 0 the current slot holds events a whole
+		 * turn away, so is visited last */
+		first= (wheel->now>>(TIMER_SLOT_BITS*level)) & TIMER_MASK;
+		if ( level > 0 )
+			first++;
+
+		for ( i= 0; i < TIMER_SLOTS; i++ ) {
+			slot= (first+i) & TIMER_MASK;
+			if ( (ev= wheel->slots[level][slot]) == NULL )
+				continue;
+
+			for ( ; ev != NULL; ev= ev->next ) {
+				if ( ev->expires < next )
+					next= ev->expires;
+			}
+			break;
+		}
+	}
+
+	return next < wheel->now ? wheel->now : next;
+}
+
+
+/**
+ * timer_rearm:
+ * Sets the timerfd to go off when the earliest event is due. Called
+ * with the lock held.
+ */
+static void timer_rearm( timer_wheel_t *wheel )
+{
+	struct itimerspec its;
+	uint64_t next, at;
+
+	if ( wheel->fd < 0 )
+		return;
+
+	if ( (next= timer_next( wheel )) == wheel->armed )
+		return;
+
+	memset( &its, 0, sizeof(its) );
+	if ( next != TIMER_NEVER ) {
+		at= wheel->epoch+next*TIMER_TICK_US;
+		its.it_value.tv_sec=  at/1000000;
+		its.it_value.tv_nsec= (at%1000000)*1000;
+	}
+
+	if ( timerfd_settime( wheel->fd, TFD_TIMER_ABSTIME, &its, NULL ) == -1 )
+		perror( "timer_rearm" );
+
+	wheel->armed= next;
+}
+
+
+/**
+ * timer_schedule:
+ * Places `ev' on the wheel `delay' microseconds from now. Called with
+ * the lock held.
+ */
+static void timer_schedule( timer_wheel_t *wheel, timer_event_t *ev,
+			    uint32_t delay )
+{
+	if ( ev->pending )
+		timer_remove( wheel, ev );
+
+	ev->expires= timer_expiry( wheel, delay );
+	timer_insert( wheel, ev );
+}
+
+
+/**
+ * timer_event_init:
+ * Prepares `ev' to call `fn' with `arg', repeating every `period'
+ * microseconds give or take `jitter', or only once if `period' is 0.
+ */
+void timer_event_init( timer_event_t *ev, timer_fn_t fn, void *arg,
+		       uint32_t period, uint32_t jitter )
+{
+	ev->next= NULL;
+	ev->prev= NULL;
+	ev->pending= FALSE;
+
+	ev->period= period;
+	ev->jitter= jitter > period ? period : jitter;
+
+	ev->fn= fn;
+	ev->arg= arg;
+}
+
+
+/**
+ * timer_wheel_init:
+ * Creates an empty timer wheel and makes `wheel' point to it.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int timer_wheel_init( timer_wheel_t **wheel )
+{
+	timer_wheel_t *w= (timer_wheel_t*)malloc(sizeof(timer_wheel_t));
+
+	if ( w == NULL )
+		return FALSE;
+
+	memset( w->slots, 0, sizeof(w->slots) );
+	w->count= 0;
+	w->level0= 0;
+
+	w->epoch= timer_clock( );
+	w->now= 0;
+
+	w->fd= timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+	w->armed= TIMER_NEVER;
+#ifdef ORTA_DEBUG
+	if ( w->fd < 0 )
+		printf( "timer_wheel_init: No timerfd; polling instead.\n" );
+#endif
+
+	w->lock= (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
+	pthread_mutex_init( w->lock, NULL );
+
+	*wheel= w;
+	return TRUE;
+}
+
+
+/**
+ * timer_wheel_add:
+ * Schedules `ev' to fire `delay' microseconds from now, moving it if
+ * it is already scheduled.
+ */
+void timer_wheel_add( timer_wheel_t *wheel, timer_event_t *ev,
+		      uint32_t delay )
+{
+	pthread_mutex_lock( wheel->lock );
+
+	timer_schedule( wheel, ev, delay );
+	timer_rearm( wheel );
+
+	pthread_mutex_unlock( wheel->lock );
+}
+
+
+/**
+ * timer_wheel_expedite:
+ * As timer_wheel_add(), but never moves an already scheduled `ev'
+ * later than it is.
+ */
+void timer_wheel_expedite( timer_wheel_t *wheel, timer_event_t *ev,
+			   uint32_t delay )
+{
+	uint64_t expires;
+
+	pthread_mutex_lock( wheel->lock );
+
+	expires= timer_expiry( wheel, delay );
+	if ( !ev->pending || expires < ev->expires ) {
+		timer_schedule( wheel, ev, delay );
+		timer_rearm( wheel );
+	}
+
+	pthread_mutex_unlock( wheel->lock );
+}
+
+
+/**
+ * timer_wheel_cancel:
+ * Takes `ev' off the wheel if it is scheduled.
+ */
+void timer_wheel_cancel( timer_wheel_t *wheel, timer_event_t *ev )
+{
+	pthread_mutex_lock( wheel->lock );
+
+	if ( ev->pending ) {
+		timer_remove( wheel, ev );
+		timer_rearm( wheel );
+	}
+
+	pthread_mutex_unlock( wheel->lock );
+}
+
+
+/**
+ * timer_wheel_wait:
+ * Sleeps until the earliest event is due, or at most `max' microseconds.
+ */
+void timer_wheel_wait( timer_wheel_t *wheel, uint32_t max )
+{
+	struct pollfd pfd;
+	struct timespec ts;
+	uint64_t next, now, wait= max;
+	uint64_t expirations;
+
+	pthread_mutex_lock( wheel->lock );
+	next= timer_next( wheel );
+	pthread_mutex_unlock( wheel->lock );
+
+	if ( next != TIMER_NEVER ) {
+		next= wheel->epoch+next*TIMER_TICK_US;
+		now= timer_clock( );
+		wait= next > now ? next-now : 0;
+		if ( wait > max )
+			wait= max;
+	}
+
+	if ( !wait )
+		return;
+
+	if ( wheel->fd >= 0 ) {
+		/* The timerfd wakes us on time, even if an earlier event
+		 * is added while we wait; the timeout is only a backstop */
+		pfd.fd= wheel->fd;
+		pfd.events= POLLIN;
+		if ( poll( &pfd, 1, (max+999)/1000 ) > 0 )
+			read( wheel->fd, &expirations, sizeof(expirations) );
+	}
+	else {
+		ts.tv_sec=  wait/1000000;
+		ts.tv_nsec= (wait%1000000)*1000;
+		nanosleep( &ts, NULL );
+	}
+}
+
+
+/**
+ * timer_wheel_wake:
+ * Makes a thread in timer_wheel_wait() return straight away, where
+ * the system allows it.
+ */
+void timer_wheel_wake( timer_wheel_t *wheel )
+{
+	struct itimerspec its;
+
+	if ( wheel->fd < 0 )
+		return;
+
+	pthread_mutex_lock( wheel->lock );
+
+	/* Any time in the past fires at once */
+	memset( &its, 0, sizeof(its) );
+	its.it_value.tv_nsec= 1;
+	if ( timerfd_settime( wheel->fd, TFD_TIMER_ABSTIME, &its, NULL ) == -1 )
+		perror( "timer_wheel_wake" );
+
+	/* Timer needs setting again next time round */
+	wheel->armed= 0;
+
+	pthread_mutex_unlock( wheel->lock );
+}
+
+
+/**
+ * timer_wheel_run:
+ * Fires every event which has fallen due. Events are called without
+ * the wheel's lock held, so may add or cancel events, themselves
+ * included.
+ * Returns the number of events fired.
+ */
+int timer_wheel_run( timer_wheel_t *wheel )
+{
+	timer_event_t *ev;
+	uint64_t target;
+	uint32_t delay;
+	int fired= 0;
+
+	pthread_mutex_lock( wheel->lock );
+
+	target= timer_ticks( wheel );
+
+	while ( wheel->now <= target ) {
+		/* Nothing in level 0; skip straight to its next turn */
+		if ( !wheel->level0 ) {
+			uint64_t turn= (wheel->now | TIMER_MASK)+1;
+
+			if ( !wheel->count || turn > target ) {
+				wheel->now= target+1;
+				if ( (wheel->now & TIMER_MASK) == 0 )
+					timer_cascade( wheel );
+				break;
+			}
+
+			wheel->now= turn;
+			timer_cascade( wheel );
+			continue;
+		}
+
+		while ( (ev= wheel->slots[0][wheel->now & TIMER_MASK]) != NULL ) {
+			timer_remove( wheel, ev );
+
+			if ( ev->period ) {
+				delay= ev->period-ev->jitter+
+					rand()%(2*ev->jitter+1);
+				timer_schedule( wheel, ev, delay );
+			}
+
+			pthread_mutex_unlock( wheel->lock );
+			ev->fn( ev->arg );
+			fired++;
+			pthread_mutex_lock( wheel->lock );
+		}
+
+		wheel->now++;
+		if ( (wheel->now & TIMER_MASK) == 0 )
+			timer_cascade( wheel );
+	}
+
+	timer_rearm( wheel );
+
+	pthread_mutex_unlock( wheel->lock );
+
+	return fired;
+}
+
+
+/**
+ * timer_wheel_destroy:
+ * Frees the wheel. Any events still on it are simply forgotten.
+ */
+void timer_wheel_destroy( timer_wheel_t **wheel )
+{
+	timer_wheel_t *w= *wheel;
+
+	if ( w->fd >= 0 )
+		close( w->fd );
+
+	pthread_mutex_destroy( w->lock );
+	free( w->lock );
+	free( w );
+
+	*wheel= NULL;
+}
@@ -0,0 +1,135 @@
+#ifndef __TIMER_WHEEL_
+#define __TIMER_WHEEL_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define TRUE 1
+#define FALSE 0
+
+/* Resolution of the wheel, in microseconds */
+#define TIMER_TICK_US 100
+
+/* The wheel has TIMER_LEVELS levels of TIMER_SLOTS slots; each slot at
+ * one level spans a whole turn of the level below. With a 100us tick
+ * this covers about five days before events are parked in the top
+ * level and cascaded down as it turns. */
+#define TIMER_LEVELS 4
+#define TIMER_SLOT_BITS 8
+#define TIMER_SLOTS (1<<TIMER_SLOT_BITS)
+
+typedef void (*timer_fn_t)( void *arg );
+
+/**
+ * A timer_event_t is owned by the caller, and is placed on the wheel
+ * with timer_wheel_add(). If `period' is non-zero the event is put back
+ * on the wheel `period' microseconds after each time it fires, give or
+ * take up to `jitter' microseconds.
+ */
+typedef struct _timer_event
+{
+	struct _timer_event *next;
+	struct _timer_event *prev;
+
+	/* Tick at which the event fires */
+	uint64_t expires;
+	/* TRUE while the event is on the wheel, in slots[level][slot] */
+	int pending;
+	int level;
+	int slot;
+
+	uint32_t period;
+	uint32_t jitter;
+
+	timer_fn_t fn;
+	void *arg;
+} timer_event_t;
+
+typedef struct
+{
+	timer_event_t *slots[TIMER_LEVELS][TIMER_SLOTS];
+	/* Events on the wheel, and how many of them are in level 0 */
+	uint32_t count;
+	uint32_t level0;
+
+	/* Next tick to be run; ticks are counted from `epoch', the
+	 * monotonic time in microseconds the wheel was created */
+	uint64_t now;
+	uint64_t epoch;
+
+	/* timerfd armed for the earliest event, or -1 if timerfds are
+	 * unavailable, in which case timer_wheel_wait() polls with a
+	 * timeout. `armed' is the tick it is set for, or UINT64_MAX. */
+	int fd;
+	uint64_t armed;
+
+	pthread_mutex_t *lock;
+} timer_wheel_t;
+
+
+/**
+ * timer_event_init:
+ * Prepares `ev' to call `fn' with `arg', repeating every `period'
+ * microseconds give or take `jitter', or only once if `period' is 0.
+ */
+void timer_event_init( timer_event_t *ev, timer_fn_t fn, void *arg,
+		       uint32_t period, uint32_t jitter );
+
+/**
+ * timer_wheel_init:
+ * Creates an empty timer wheel and makes `wheel' point to it.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int timer_wheel_init( timer_wheel_t **wheel );
+
+/**
+ * timer_wheel_add:
+ * Schedules `ev' to fire `delay' microseconds from now, moving it if
+ * it is already scheduled.
+ */
+void timer_wheel_add( timer_wheel_t *wheel, timer_event_t *ev,
+		      uint32_t delay );
+
+/**
+ * timer_wheel_expedite:
+ * As timer_wheel_add(), but never moves an already scheduled `ev'
+ * later than it is.
+ */
+void timer_wheel_expedite( timer_wheel_t *wheel, timer_event_t *ev,
+			   uint32_t delay );
+
+/**
+ * timer_wheel_cancel:
+ * Takes `ev' off the wheel if it is scheduled.
+ */
+void timer_wheel_cancel( timer_wheel_t *wheel, timer_event_t *ev );
+
+/**
+ * timer_wheel_wait:
+ * Sleeps until the earliest event is due, or at most `max' microseconds.
+ */
+void timer_wheel_wait( timer_wheel_t *wheel, uint32_t max );
+
+/**
+ * timer_wheel_wake:
+ * Makes a thread in timer_wheel_wait() return straight away, where
+ * the system allows it.
+ */
+void timer_wheel_wake( timer_wheel_t *wheel );
+
+/**
+ * timer_wheel_run:
+ * Fires every event which has fallen due. Events are called without
+ * the wheel's lock held, so may add or cancel events, themselves
+ * included.
+ * Returns the number of events fired.
+ */
+int timer_wheel_run( timer_wheel_t *wheel );
+
+/**
+ * timer_wheel_destroy:
+ * Frees the wheel. Any events still on it are simply forgotten.
+ */
+void timer_wheel_destroy( timer_wheel_t **wheel );
+
+#endif
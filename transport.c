@@ -0,0 +1,293 @@
+#define _GNU_SOURCE /* sendmmsg */
+
+#include "transport.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+#include <linux/net_tstamp.h>
+
+#include "netTCP.h"
+
+/* Send and receive buffers of each datagram socket */
+#define KERNEL_UDP_BUFFER 210944
+
+
+/**
+ * transport_init:
+ * Creates a transport of `kind' and makes `t' point to it.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int transport_init( transport_t **t, int kind )
+{
+	transport_t *tr;
+
+	if ( (tr= (transport_t*)malloc( sizeof(transport_t) )) == NULL )
+		return FALSE;
+
+	tr->state= NULL;
+
+	switch ( kind ) {
+	case TRANSPORT_KERNEL: tr->ops= &transport_kernel_ops; break;
+	case TRANSPORT_LOCAL:  tr->ops= &transport_local_ops;  break;
+	case TRANSPORT_URING:
+		/* Plain sockets where io_uring isn't to be had */
+		if ( !transport_uring_init( tr ) )
+			tr->ops= &transport_kernel_ops;
+		break;
+	default:
+		free( tr );
+		return FALSE;
+	}
+
+	*t= tr;
+	return TRUE;
+}
+
+
+/**
+ * transport_destroy:
+ * Frees the transport, and sets *t to NULL. Descriptors it handed
+ * out must already have been closed.
+ */
+void transport_destroy( transport_t **t )
+{
+	if ( (*t)->ops->destroy != NULL )
+		(*t)->ops->destroy( *t );
+	free( *t );
+	*t= NULL;
+}
+
+
+/* ============================================================================
+ * Kernel sockets
+ * ========================================================================= */
+
+/**
+ * kernel_dgram_open:
+ * Creates a UDP socket bound to `port' on address `ip', which may be
+ * INADDR_ANY for all interfaces. With TRANSPORT_SHARED it allows other
+ * sockets to bind the same port where the system supports it; with
+ * TRANSPORT_PRIORITY it is marked for priority handling both in the
+ * local stack and, through the TOS byte, in the network; with
+ * TRANSPORT_STAMPED arriving packets are timestamped by the kernel if
+ * it can; with TRANSPORT_SEGMENTS the kernel segments large sends
+ * (UDP GSO) and coalesces arrivals (UDP GRO), where it knows how.
+ */
+static int kernel_dgram_open( transport_t *t, uint32_t ip, uint16_t port,
+			      int flags, int *granted )
+{
+	int sd;
+	int on= 1;
+	uint32_t udp_buffer_size= KERNEL_UDP_BUFFER;
+	int priority= 6;
+	/* DSCP Expedited Forwarding */
+	int tos= 0xb8;
+	int ts_flags= SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+	int gso_size= 0;
+	sockaddr_in_t addr;
+
+	*granted= 0;
+
+	if ( (sd= socket( AF_INET, SOCK_DGRAM, 0 )) < 0 )
+		return -1;
+
+	if ( setsockopt(sd, SOL_SOCKET, SO_SNDBUF, &udp_buffer_size, sizeof(udp_buffer_size)) == -1 )
+		perror( "kernel_dgram_open" );
+	if ( setsockopt(sd, SOL_SOCKET, SO_RCVBUF, &udp_buffer_size, sizeof(udp_buffer_size)) == -1 )
+		perror( "kernel_dgram_open" );
+#ifdef SO_REUSEPORT
+	if ( (flags & TRANSPORT_SHARED) &&
+	     setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1 )
+		perror( "kernel_dgram_open" );
+#endif
+
+	if ( flags & TRANSPORT_PRIORITY ) {
+#ifdef SO_PRIORITY
+		if ( setsockopt(sd, SOL_SOCKET, SO_PRIORITY, &priority, sizeof(priority)) == -1 )
+			perror( "kernel_dgram_open" );
+#endif
+		if ( setsockopt(sd, IPPROTO_IP, IP_TOS, &tos, sizeof(tos)) == -1 )
+			perror( "kernel_dgram_open" );
+	}
+
+	if ( flags & TRANSPORT_STAMPED ) {
+#ifdef SO_TIMESTAMPING
+		if ( setsockopt(sd, SOL_SOCKET, SO_TIMESTAMPING, &ts_flags, sizeof(ts_flags)) == 0 )
+			*granted|= TRANSPORT_STAMPED;
+#endif
+#ifdef SO_TIMESTAMPNS
+		if ( !(*granted & TRANSPORT_STAMPED) &&
+		     setsockopt(sd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == 0 )
+			*granted|= TRANSPORT_STAMPED;
+#endif
+	}
+
+#if defined(UDP_SEGMENT) && defined(UDP_GRO)
+	/* The segment size is given with each send, not set here; this
+	 * only finds out whether the kernel has GSO at all */
+	if ( (flags & TRANSPORT_SEGMENTS) &&
+	     setsockopt(sd, SOL_UDP, UDP_SEGMENT, &gso_size, sizeof(gso_size)) == 0 &&
+	     setsockopt(sd, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0 )
+		*granted|= TRANSPORT_SEGMENTS;
+#endif
+
+	addr.sin_family= AF_INET;
+	addr.sin_port= htons(port);
+	addr.sin_addr.s_addr= ip;
+	memset(&(addr.sin_zero), '\0', 8);
+
+	if ( bind(sd, (sockaddr_t*)&addr, sizeof(sockaddr_t)) < 0 ) {
+		perror( "kernel_dgram_open" );
+		close( sd );
+		return -1;
+	}
+
+	return sd;
+}
+
+static ssize_t kernel_dgram_send( transport_t *t, int sd, const void *buf,
+				  size_t len, const sockaddr_in_t *dest )
+{
+	return sendto( sd, buf, len, 0, (const sockaddr_t*)dest,
+		       sizeof(sockaddr_in_t) );
+}
+
+/**
+ * kernel_dgram_send_batch:
+ * Sends the messages in one system call, or one at a time where
+ * sendmmsg() is missing.
+ */
+static int kernel_dgram_send_batch( transport_t *t, int sd,
+				    struct mmsghdr *msgs, unsigned int count )
+{
+	unsigned int i;
+	int sent;
+
+	if ( (sent= sendmmsg( sd, msgs, count, 0 )) >= 0 || errno != ENOSYS )
+		return sent;
+
+	for ( i= 0; i < count; i++ ) {
+		if ( sendmsg( sd, &(msgs[i].msg_hdr), 0 ) < 0 )
+			return i ? i : -1;
+	}
+	return count;
+}
+
+static ssize_t kernel_dgram_recv( transport_t *t, int sd, struct msghdr *msg )
+{
+	return recvmsg( sd, msg, 0 );
+}
+
+static int kernel_stream_listen( transport_t *t, uint32_t ip, uint16_t port )
+{
+	int sd;
+
+	if ( (sd= bindTCP( ip, port )) == -1 )
+		return -1;
+
+	if ( listen( sd, SOMAXCONN ) == -1 ) {
+		close( sd );
+		return -1;
+	}
+
+	return sd;
+}
+
+/**
+ * kernel_stream_accept:
+ * Accepts a connection, which lingers briefly on close so that the
+ * last control messages get out.
+ */
+static int kernel_stream_accept( transport_t *t, int sd, sockaddr_in_t *peer )
+{
+	int new_sd;
+	socklen_t addr_len= sizeof(sockaddr_in_t);
+	struct linger linger = {1,1};
+
+	if ( (new_sd= accept(sd, (sockaddr_t*)peer, &addr_len) ) == -1 )
+		return -1;
+
+	if (setsockopt(new_sd, SOL_SOCKET, SO_LINGER, &linger,sizeof(linger)) == -1) {
+		printf( "Couldn't set SO_LINGER on new socket.\n" );
+	}
+
+	return new_sd;
+}
+
+static int kernel_stream_connect( transport_t *t, uint32_t src_ip,
+				  const sockaddr_in_t *dest )
+{
+	char dest_ip[INET_ADDRSTRLEN];
+	sockaddr_in_t addr;
+	int sd;
+
+	inet_ntop( AF_INET, &(dest->sin_addr), dest_ip, sizeof(dest_ip) );
+	if ( !connectTCP( dest_ip, ntohs(dest->sin_port), &sd, &addr, src_ip ) )
+		return -1;
+
+	return sd;
+}
+
+static int kernel_stream_peer( transport_t *t, int sd, sockaddr_in_t *peer )
+{
+	socklen_t addr_len= sizeof(sockaddr_in_t);
+
+	return getpeername( sd, (sockaddr_t*)peer, &addr_len );
+}
+
+static ssize_t kernel_stream_send( transport_t *t, int sd, const void *buf,
+				   size_t len )
+{
+	return send( sd, buf, len, 0 );
+}
+
+static ssize_t kernel_stream_recv( transport_t *t, int sd, void *buf,
+				   size_t len )
+{
+	return recv( sd, buf, len, 0 );
+}
+
+static void kernel_close( transport_t *t, int sd )
+{
+	close( sd );
+}
+
+static void kernel_shutdown( transport_t *t, int sd )
+{
+	shutdown( sd, SHUT_RDWR );
+}
+
+static uint64_t kernel_now_us( transport_t *t )
+{
+	struct timespec now;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return (uint64_t)now.tv_sec*1000000+now.tv_nsec/1000;
+}
+
+const transport_ops_t transport_kernel_ops= {
+	"kernel",
+	TRUE,
+	&kernel_dgram_open,
+	&kernel_dgram_send,
+	&kernel_dgram_send_batch,
+	&kernel_dgram_recv,
+	&kernel_stream_listen,
+	&kernel_stream_accept,
+	&kernel_stream_connect,
+	&kernel_stream_peer,
+	&kernel_stream_send,
+	&kernel_stream_recv,
+	&kernel_close,
+	&kernel_shutdown,
+	&kernel_now_us,
+	NULL,
+};
@@ -0,0 +1,130 @@
+#ifndef __TRANSPORT_
+#define __TRANSPORT_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "common_defs.h"
+
+struct mmsghdr;
+
+/* Backends, for transport_init() */
+enum transport_kind {
+	/* Kernel UDP and TCP sockets */
+	TRANSPORT_KERNEL,
+	/* Unix domain sockets named after the address and port they
+	 * stand for, so that instances in one host reach each other
+	 * without touching the IP stack */
+	TRANSPORT_LOCAL,
+	/* Kernel sockets, with datagrams received and sent in batches
+	 * through io_uring; the same as TRANSPORT_KERNEL where the
+	 * kernel lacks it */
+	TRANSPORT_URING,
+};
+
+/* Options for dgram_open */
+/* Other sockets may be opened on the same address and port, and
+ * arriving flows are spread across them */
+#define TRANSPORT_SHARED   0x1
+/* Traffic is marked for priority handling */
+#define TRANSPORT_PRIORITY 0x2
+/* Arriving datagrams carry a receive timestamp, as SCM_TIMESTAMPING
+ * or SCM_TIMESTAMPNS control messages on the realtime clock */
+#define TRANSPORT_STAMPED  0x4
+/* Datagrams may be sent as one buffer of equal-sized segments, with a
+ * UDP_SEGMENT control message, and runs of datagrams arriving from one
+ * sender may be coalesced likewise, marked with a UDP_GRO control
+ * message giving the segment size */
+#define TRANSPORT_SEGMENTS 0x8
+
+typedef struct transport transport_t;
+
+/**
+ * The operations a backend provides. Descriptors handed out are file
+ * descriptors which poll and epoll report readable when there is
+ * something to receive, so callers may wait on them as they would on
+ * sockets. Addresses are always given and returned as IPv4 socket
+ * addresses, whatever the backend uses underneath.
+ *
+ * Calls return as the socket calls they stand for, with -1 and errno
+ * set on failure.
+ */
+typedef struct
+{
+	const char *name;
+	/* TRUE if sockets may be bound to INADDR_ANY; otherwise the
+	 * address of the instance must be given */
+	int wildcard;
+
+	/* Datagrams: open a socket on `ip' and `port', asking for the
+	 * options above in `flags', and setting *granted to those which
+	 * took effect; send one; send `count' at once, returning the
+	 * number sent; receive one as recvmsg() */
+	int     (*dgram_open)( transport_t *t, uint32_t ip, uint16_t port,
+			       int flags, int *granted );
+	ssize_t (*dgram_send)( transport_t *t, int sd, const void *buf,
+			       size_t len, const sockaddr_in_t *dest );
+	int     (*dgram_send_batch)( transport_t *t, int sd,
+				     struct mmsghdr *msgs, unsigned int count );
+	ssize_t (*dgram_recv)( transport_t *t, int sd, struct msghdr *msg );
+
+	/* Streams: listen on `ip' and `port'; accept a connection,
+	 * placing the peer in `peer'; connect from `src_ip', which may
+	 * be INADDR_ANY if wildcard is set, to `dest'; find the peer of
+	 * a connection; send and receive */
+	int     (*stream_listen)( transport_t *t, uint32_t ip, uint16_t port );
+	int     (*stream_accept)( transport_t *t, int sd, sockaddr_in_t *peer );
+	int     (*stream_connect)( transport_t *t, uint32_t src_ip,
+				   const sockaddr_in_t *dest );
+	int     (*stream_peer)( transport_t *t, int sd, sockaddr_in_t *peer );
+	ssize_t (*stream_send)( transport_t *t, int sd, const void *buf,
+				size_t len );
+	ssize_t (*stream_recv)( transport_t *t, int sd, void *buf,
+				size_t len );
+
+	/* Closes a descriptor of either kind; shuts one down, so that a
+	 * thread blocked receiving on it returns */
+	void    (*close)( transport_t *t, int sd );
+	void    (*shutdown)( transport_t *t, int sd );
+
+	/* Monotonic time in microseconds */
+	uint64_t (*now_us)( transport_t *t );
+
+	/* Frees `state' */
+	void    (*destroy)( transport_t *t );
+} transport_ops_t;
+
+struct transport
+{
+	const transport_ops_t *ops;
+	void *state;
+};
+
+
+/**
+ * transport_init:
+ * Creates a transport of `kind' and makes `t' point to it.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int transport_init( transport_t **t, int kind );
+
+/**
+ * transport_destroy:
+ * Frees the transport, and sets *t to NULL. Descriptors it handed
+ * out must already have been closed.
+ */
+void transport_destroy( transport_t **t );
+
+/* Backends, in transport.c, transport_local.c and transport_uring.c */
+extern const transport_ops_t transport_kernel_ops;
+extern const transport_ops_t transport_local_ops;
+
+/**
+ * transport_uring_init:
+ * Sets `t' up to use io_uring for datagrams, if this kernel has it.
+ * Returns TRUE on success, FALSE if io_uring is unavailable.
+ */
+int transport_uring_init( transport_t *t );
+
+#endif
@@ -0,0 +1,385 @@
+#define _GNU_SOURCE /* struct mmsghdr */
+
+#include "transport.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+/*
+ * Unix domain sockets in the abstract namespace stand in for UDP and
+ * TCP sockets, named "orta/<kind>/<address>/<port>", where kind is 'd'
+ * for a datagram socket, 's' for a stream listener and 'c' for the
+ * client end of a stream. The names carry the IPv4 address and port
+ * the socket stands for, so the sender of a datagram and the peer of
+ * a connection are read back out of them.
+ *
+ * Nothing leaves the host, and the sockets can be opened on any
+ * address, so many instances can run side by side on one host
+ * without addresses of their own. A datagram socket's receive queue
+ * holds only a few datagrams (net.unix.max_dgram_qlen), so a sender
+ * finding it full waits up to LOCAL_SEND_WAIT_US for room, as a
+ * network would buffer a short burst, before the datagram is dropped
+ * as UDP would drop it. Datagrams to no socket at all are dropped too.
+ */
+
+#define LOCAL_NAME_MAX 48
+
+/* Longest a datagram waits for room in the receiving queue */
+#define LOCAL_SEND_WAIT_US 1000
+
+/* Tells apart the client ends of connections from one address */
+static uint32_t local_clients;
+
+
+/**
+ * local_name:
+ * Fills `sun' with the name of the socket of `kind' for `ip' and
+ * `port'.
+ * Returns the length of the address.
+ */
+static socklen_t local_name( struct sockaddr_un *sun, char kind,
+			     uint32_t ip, uint32_t port )
+{
+	int len;
+
+	memset( sun, 0, sizeof(struct sockaddr_un) );
+	sun->sun_family= AF_UNIX;
+	len= snprintf( sun->sun_path+1, sizeof(sun->sun_path)-1,
+		       "orta/%c/%08x/%u", kind, ntohl(ip), port );
+
+	return offsetof(struct sockaddr_un, sun_path)+1+len;
+}
+
+
+/**
+ * local_addr:
+ * Fills `addr' with the IPv4 address and port named by the `len'
+ * bytes of `sun'.
+ * Returns TRUE on success, or FALSE if it isn't one of our names.
+ */
+static int local_addr( const struct sockaddr_un *sun, socklen_t len,
+		       sockaddr_in_t *addr )
+{
+	char name[LOCAL_NAME_MAX];
+	char kind;
+	uint32_t ip, port;
+	int n= (int)len-(int)offsetof(struct sockaddr_un, sun_path)-1;
+
+	if ( n <= 0 || n >= LOCAL_NAME_MAX || sun->sun_path[0] != '\0' )
+		return FALSE;
+	memcpy( name, sun->sun_path+1, n );
+	name[n]= '\0';
+
+	if ( sscanf( name, "orta/%c/%8x/%u", &kind, &ip, &port ) != 3 )
+		return FALSE;
+
+	memset( addr, 0, sizeof(sockaddr_in_t) );
+	addr->sin_family= AF_INET;
+	addr->sin_addr.s_addr= htonl(ip);
+	addr->sin_port= htons(port);
+
+	return TRUE;
+}
+
+
+/**
+ * local_open:
+ * Creates a socket of `type' bound to `sun'.
+ * Returns the socket descriptor, or -1 on failure.
+ */
+static int local_open( int type, struct sockaddr_un *sun, socklen_t len )
+{
+	int sd;
+
+	if ( (sd= socket( AF_UNIX, type|SOCK_CLOEXEC, 0 )) < 0 )
+		return -1;
+
+	if ( bind( sd, (sockaddr_t*)sun, len ) < 0 ) {
+		close( sd );
+		return -1;
+	}
+
+	return sd;
+}
+
+
+/**
+ * local_dgram_open:
+ * Opens the datagram socket standing for `ip' and `port'. Only one
+ * socket can hold a name, so TRANSPORT_SHARED is refused for a second
+ * socket; TRANSPORT_PRIORITY has no meaning without a network, and
+ * TRANSPORT_SEGMENTS none without UDP.
+ */
+static int local_dgram_open( transport_t *t, uint32_t ip, uint16_t port,
+			     int flags, int *granted )
+{
+	struct sockaddr_un sun;
+	socklen_t len;
+	int sd;
+	int on= 1;
+	struct timeval wait;
+
+	*granted= 0;
+
+	if ( ip == htonl(INADDR_ANY) ) {
+		errno= EINVAL;
+		return -1;
+	}
+
+	len= local_name( &sun, 'd', ip, port );
+	if ( (sd= local_open( SOCK_DGRAM, &sun, len )) < 0 )
+		return -1;
+
+	wait.tv_sec= 0;
+	wait.tv_usec= LOCAL_SEND_WAIT_US;
+	if ( setsockopt(sd, SOL_SOCKET, SO_SNDTIMEO, &wait, sizeof(wait)) == -1 )
+		perror( "local_dgram_open" );
+
+#ifdef SO_TIMESTAMPNS
+	if ( (flags & TRANSPORT_STAMPED) &&
+	     setsockopt(sd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == 0 )
+		*granted|= TRANSPORT_STAMPED;
+#endif
+
+	return sd;
+}
+
+
+/**
+ * local_sendmsg:
+ * Sends `msg', whose name is an IPv4 address, to the datagram socket
+ * standing for it.
+ */
+static ssize_t local_sendmsg( int sd, const struct msghdr *msg )
+{
+	struct sockaddr_un sun;
+	struct msghdr m= *msg;
+	const sockaddr_in_t *dest= (const sockaddr_in_t*)msg->msg_name;
+	ssize_t sent;
+	size_t len;
+	int i;
+
+	m.msg_name= &sun;
+	m.msg_namelen= local_name( &sun, 'd', dest->sin_addr.s_addr,
+				   ntohs(dest->sin_port) );
+
+	if ( (sent= sendmsg( sd, &m, MSG_NOSIGNAL )) >= 0 )
+		return sent;
+
+	if ( errno != EAGAIN && errno != EWOULDBLOCK && 
+	     errno != ECONNREFUSED && errno != ENOENT )
+		return -1;
+
+	/* Lost on the way, as far as the sender can tell */
+	for ( len= 0, i= 0; i < msg->msg_iovlen; i++ )
+		len+= msg->msg_iov[i].iov_len;
+	return len;
+}
+
+static ssize_t local_dgram_send( transport_t *t, int sd, const void *buf,
+				 size_t len, const sockaddr_in_t *dest )
+{
+	struct msghdr msg;
+	struct iovec iov;
+
+	iov.iov_base= (void*)buf;
+	iov.iov_len= len;
+
+	memset( &msg, 0, sizeof(msg) );
+	msg.msg_name= (void*)dest;
+	msg.msg_namelen= sizeof(sockaddr_in_t);
+	msg.msg_iov= &iov;
+	msg.msg_iovlen= 1;
+
+	return local_sendmsg( sd, &msg );
+}
+
+static int local_dgram_send_batch( transport_t *t, int sd,
+				   struct mmsghdr *msgs, unsigned int count )
+{
+	unsigned int i;
+	ssize_t sent;
+
+	for ( i= 0; i < count; i++ ) {
+		if ( (sent= local_sendmsg( sd, &(msgs[i].msg_hdr) )) < 0 )
+			return i ? i : -1;
+		msgs[i].msg_len= sent;
+	}
+
+	return count;
+}
+
+/**
+ * local_dgram_recv:
+ * Receives as recvmsg(), giving the sender as the IPv4 address its
+ * socket stands for.
+ */
+static ssize_t local_dgram_recv( transport_t *t, int sd, struct msghdr *msg )
+{
+	struct sockaddr_un sun;
+	sockaddr_in_t *from= (sockaddr_in_t*)msg->msg_name;
+	ssize_t nbytes;
+
+	if ( from == NULL )
+		return recvmsg( sd, msg, 0 );
+
+	msg->msg_name= &sun;
+	msg->msg_namelen= sizeof(sun);
+
+	nbytes= recvmsg( sd, msg, 0 );
+
+	if ( nbytes >= 0 && !local_addr( &sun, msg->msg_namelen, from ) )
+		memset( from, 0, sizeof(sockaddr_in_t) );
+	msg->msg_name= from;
+	msg->msg_namelen= sizeof(sockaddr_in_t);
+
+	return nbytes;
+}
+
+static int local_stream_listen( transport_t *t, uint32_t ip, uint16_t port )
+{
+	struct sockaddr_un sun;
+	int sd;
+
+	if ( ip == htonl(INADDR_ANY) ) {
+		errno= EINVAL;
+		return -1;
+	}
+
+	if ( (sd= local_open( SOCK_STREAM, &sun,
+			      local_name( &sun, 's', ip, port ) )) < 0 )
+		return -1;
+
+	if ( listen( sd, SOMAXCONN ) == -1 ) {
+		close( sd );
+		return -1;
+	}
+
+	return sd;
+}
+
+static int local_stream_accept( transport_t *t, int sd, sockaddr_in_t *peer )
+{
+	struct sockaddr_un sun;
+	socklen_t len= sizeof(sun);
+	int new_sd;
+
+	if ( (new_sd= accept4( sd, (sockaddr_t*)&sun, &len,
+			       SOCK_CLOEXEC )) == -1 )
+		return -1;
+
+	if ( !local_addr( &sun, len, peer ) )
+		memset( peer, 0, sizeof(sockaddr_in_t) );
+
+	return new_sd;
+}
+
+/**
+ * local_stream_connect:
+ * Connects to the listener standing for `dest', from a socket named
+ * after `src_ip' so that the listener can tell who is calling.
+ */
+static int local_stream_connect( transport_t *t, uint32_t src_ip,
+				 const sockaddr_in_t *dest )
+{
+	struct sockaddr_un sun;
+	socklen_t len;
+	int sd;
+
+	if ( src_ip == htonl(INADDR_ANY) ) {
+		errno= EINVAL;
+		return -1;
+	}
+
+	/* The port of a client end is only there to make it unique */
+	do {
+		len= local_name( &sun, 'c', src_ip,
+				 __sync_add_and_fetch( &local_clients, 1 ) );
+	} while ( (sd= local_open( SOCK_STREAM, &sun, len )) < 0 &&
+		  errno == EADDRINUSE );
+	if ( sd < 0 )
+		return -1;
+
+	len= local_name( &sun, 's', dest->sin_addr.s_addr,
+			 ntohs(dest->sin_port) );
+	if ( connect( sd, (sockaddr_t*)&sun, len ) == -1 ) {
+		close( sd );
+		return -1;
+	}
+
+	return sd;
+}
+
+static int local_stream_peer( transport_t *t, int sd, sockaddr_in_t *peer )
+{
+	struct sockaddr_un sun;
+	socklen_t len= sizeof(sun);
+
+	if ( getpeername( sd, (sockaddr_t*)&sun, &len ) == -1 )
+		return -1;
+
+	if ( !local_addr( &sun, len, peer ) ) {
+		errno= ENOTCONN;
+		return -1;
+	}
+
+	return 0;
+}
+
+static ssize_t local_stream_send( transport_t *t, int sd, const void *buf,
+				  size_t len )
+{
+	return send( sd, buf, len, MSG_NOSIGNAL );
+}
+
+static ssize_t local_stream_recv( transport_t *t, int sd, void *buf,
+				  size_t len )
+{
+	return recv( sd, buf, len, 0 );
+}
+
+static void local_close( transport_t *t, int sd )
+{
+	close( sd );
+}
+
+static void local_shutdown( transport_t *t, int sd )
+{
+	shutdown( sd, SHUT_RDWR );
+}
+
+static uint64_t local_now_us( transport_t *t )
+{
+	struct timespec now;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return (uint64_t)now.tv_sec*1000000+now.tv_nsec/1000;
+}
+
+const transport_ops_t transport_local_ops= {
+	"local",
+	FALSE,
+	&local_dgram_open,
+	&local_dgram_send,
+	&local_dgram_send_batch,
+	&local_dgram_recv,
+	&local_stream_listen,
+	&local_stream_accept,
+	&local_stream_connect,
+	&local_stream_peer,
+	&local_stream_send,
+	&local_stream_recv,
+	&local_close,
+	&local_shutdown,
+	&local_now_us,
+	NULL,
+};
@@ -0,0 +1,904 @@
+#define _GNU_SOURCE /* struct mmsghdr */
+
+#include "transport.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+
+/*
+ * Kernel sockets, with datagrams received and batches sent through
+ * io_uring. Each thread gets its own pair of rings when it first
+ * touches the data path, so no locking is needed around them:
+ *
+ * * Receiving, a multishot recvmsg is armed on the socket the thread
+ *   reads, drawing from a ring of buffers registered with the kernel,
+ *   so that one io_uring_enter() reaps every datagram that has
+ *   arrived since the last.
+ * * Sending a batch, one linked sendmsg per datagram is submitted and
+ *   waited for in a single io_uring_enter(). The link stops the batch
+ *   at the first failure, as sendmmsg() would.
+ * * Shutting a socket down doesn't end a multishot receive on it, so
+ *   the threads receiving on it are woken with a message posted to
+ *   their rings.
+ *
+ * The system calls are made directly, so liburing isn't needed.
+ * Anything the rings can't do -- threads reading more than one
+ * socket, kernels without multishot receive or buffer rings -- goes
+ * through the plain kernel backend
+ * instead, as does everything when io_uring is missing altogether.
+ * Build with -DNO_IO_URING to leave it out.
+ */
+
+#if !defined(NO_IO_URING) && defined(__NR_io_uring_setup) && \
+	defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+
+#include <sys/mman.h>
+#include <linux/io_uring.h>
+
+/* Submission queue entries in each ring, and so the most datagrams
+ * sent in one call */
+#define URING_TX_ENTRIES 64
+#define URING_RX_ENTRIES 4
+
+/* Receive buffers per thread, each big enough for the largest UDP
+ * datagram along with its sender and control messages */
+#define URING_RX_BUFS 32
+#define URING_CONTROL 128
+#define URING_BUF_SIZE (sizeof(struct io_uring_recvmsg_out)+ \
+			sizeof(sockaddr_in_t)+URING_CONTROL+65536)
+#define URING_BGID 0
+
+/* Marks the completion posted to a ring to wake its thread */
+#define URING_WAKE 1
+
+typedef struct
+{
+	int fd;
+	unsigned entries;
+
+	/* Submission queue */
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	struct io_uring_sqe *sqes;
+	/* Completion queue */
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_map, *cq_map;
+	size_t sq_len, cq_len, sqes_len;
+} uring_t;
+
+/* Rings belonging to one thread */
+typedef struct _uring_thread
+{
+	uring_t tx;
+	int tx_ok;
+
+	uring_t rx;
+	/* FALSE once receiving through the ring is found not to work */
+	int rx_ok;
+	/* Socket the receive is armed on, or -1 before the first; set
+	 * under the instance's lock */
+	int rx_sd;
+	int armed;
+	/* Template for the multishot receive: room for the sender and
+	 * URING_CONTROL bytes of control messages */
+	struct msghdr rx_msg;
+	struct io_uring_buf_ring *br;
+	size_t br_len;
+	char *bufs;
+	uint16_t br_tail;
+
+	/* The instance's list of threads' rings, and the table of the
+	 * thread they belong to */
+	struct _uring_state *state;
+	struct _uring_thread *prev, *next;
+	struct _uring_slots *slots;
+} uring_thread_t;
+
+/* A thread's rings for each instance, indexed by the instance's id */
+typedef struct _uring_slots
+{
+	uint32_t len;
+	uring_thread_t **rings;
+} uring_slots_t;
+
+typedef struct _uring_state
+{
+	/* Index of the instance's rings in each thread's table */
+	uint32_t id;
+	/* Every thread's rings, for uring_destroy() to free those of
+	 * threads which haven't exited */
+	uring_thread_t *threads;
+	pthread_mutex_t *lock;
+} uring_state_t;
+
+static transport_ops_t uring_ops;
+static pthread_once_t uring_ops_once= PTHREAD_ONCE_INIT;
+
+/* One key for every instance, as there are only PTHREAD_KEYS_MAX in a
+ * process, holding each thread's uring_slots_t. uring_lock guards the
+ * ids in use, and each thread's table against the others; a thread
+ * reads its own without it. Taken before any instance's lock. */
+static pthread_key_t uring_key;
+static int uring_key_ok;
+static pthread_mutex_t uring_lock= PTHREAD_MUTEX_INITIALIZER;
+static uring_state_t **uring_ids;
+static uint32_t uring_num_ids;
+
+
+/**
+ * uring_setup:
+ * Creates a ring of `entries' submissions and maps its queues.
+ * Returns TRUE on success, FALSE on failure.
+ */
+static int uring_setup( uring_t *r, unsigned entries )
+{
+	struct io_uring_params p;
+
+	memset( &p, 0, sizeof(p) );
+	memset( r, 0, sizeof(uring_t) );
+
+	if ( (r->fd= syscall( __NR_io_uring_setup, entries, &p )) < 0 )
+		return FALSE;
+
+	r->entries= p.sq_entries;
+	r->sq_len= p.sq_off.array+p.sq_entries*sizeof(unsigned);
+	r->cq_len= p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe);
+	r->sqes_len= p.sq_entries*sizeof(struct io_uring_sqe);
+
+	/* Both queues may share one mapping */
+	if ( p.features & IORING_FEAT_SINGLE_MMAP ) {
+		if ( r->cq_len > r->sq_len )
+			r->sq_len= r->cq_len;
+		r->cq_len= 0;
+	}
+
+	r->sq_map= mmap( NULL, r->sq_len, PROT_READ|PROT_WRITE,
+			 MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQ_RING );
+	if ( r->sq_map == MAP_FAILED )
+		goto fail;
+
+	if ( r->cq_len ) {
+		r->cq_map= mmap( NULL, r->cq_len, PROT_READ|PROT_WRITE,
+				 MAP_SHARED|MAP_POPULATE, r->fd,
+				 IORING_OFF_CQ_RING );
+		if ( r->cq_map == MAP_FAILED ) {
+			munmap( r->sq_map, r->sq_len );
+			goto fail;
+		}
+	}
+	else
+		r->cq_map= r->sq_map;
+
+	r->sqes= mmap( NULL, r->sqes_len, PROT_READ|PROT_WRITE,
+		       MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQES );
+	if ( r->sqes == MAP_FAILED ) {
+		if ( r->cq_len )
+			munmap( r->cq_map, r->cq_len );
+		munmap( r->sq_map, r->sq_len );
+		goto fail;
+	}
+
+	r->sq_head=  (unsigned*)((char*)r->sq_map+p.sq_off.head);
+	r->sq_tail=  (unsigned*)((char*)r->sq_map+p.sq_off.tail);
+	r->sq_mask=  (unsigned*)((char*)r->sq_map+p.sq_off.ring_mask);
+	r->sq_array= (unsigned*)((char*)r->sq_map+p.sq_off.array);
+	r->cq_head=  (unsigned*)((char*)r->cq_map+p.cq_off.head);
+	r->cq_tail=  (unsigned*)((char*)r->cq_map+p.cq_off.tail);
+	r->cq_mask=  (unsigned*)((char*)r->cq_map+p.cq_off.ring_mask);
+	r->cqes= (struct io_uring_cqe*)((char*)r->cq_map+p.cq_off.cqes);
+
+	return TRUE;
+
+fail:
+	close( r->fd );
+	return FALSE;
+}
+
+
+/**
+ * uring_free:
+ * Unmaps and closes a ring made by uring_setup().
+ */
+static void uring_free( uring_t *r )
+{
+	munmap( r->sqes, r->sqes_len );
+	if ( r->cq_len )
+		munmap( r->cq_map, r->cq_len );
+	munmap( r->sq_map, r->sq_len );
+	close( r->fd );
+}
+
+
+/**
+ * uring_sqe:
+ * Returns the next free submission queue entry, cleared, or NULL if
+ * the queue is full. It is handed to the kernel by uring_push().
+ */
+static struct io_uring_sqe *uring_sqe( uring_t *r )
+{
+	unsigned tail= *r->sq_tail;
+	struct io_uring_sqe *sqe;
+
+	if ( tail-__atomic_load_n( r->sq_head, __ATOMIC_ACQUIRE ) >= r->entries )
+		return NULL;
+
+	sqe= &(r->sqes[tail & *r->sq_mask]);
+	memset( sqe, 0, sizeof(struct io_uring_sqe) );
+	return sqe;
+}
+
+static void uring_push( uring_t *r )
+{
+	unsigned tail= *r->sq_tail;
+
+	r->sq_array[tail & *r->sq_mask]= tail & *r->sq_mask;
+	__atomic_store_n( r->sq_tail, tail+1, __ATOMIC_RELEASE );
+}
+
+
+/**
+ * uring_enter:
+ * Submits `submit' entries and waits for `wait' completions.
+ * Returns as io_uring_enter().
+ */
+static int uring_enter( uring_t *r, unsigned submit, unsigned wait )
+{
+	return syscall( __NR_io_uring_enter, r->fd, submit, wait,
+			wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0 );
+}
+
+
+/**
+ * uring_cqe, uring_cqe_seen:
+ * Return the oldest completion not yet seen, or NULL if there is
+ * none; and mark it seen, so that its slot can be reused.
+ */
+static struct io_uring_cqe *uring_cqe( uring_t *r )
+{
+	unsigned head= *r->cq_head;
+
+	if ( head == __atomic_load_n( r->cq_tail, __ATOMIC_ACQUIRE ) )
+		return NULL;
+
+	return &(r->cqes[head & *r->cq_mask]);
+}
+
+static void uring_cqe_seen( uring_t *r )
+{
+	__atomic_store_n( r->cq_head, *r->cq_head+1, __ATOMIC_RELEASE );
+}
+
+
+/**
+ * uring_wait_cqe:
+ * Returns the oldest completion not yet seen, waiting for one if
+ * needed, or NULL if waiting failed.
+ */
+static struct io_uring_cqe *uring_wait_cqe( uring_t *r )
+{
+	struct io_uring_cqe *cqe;
+
+	while ( (cqe= uring_cqe( r )) == NULL ) {
+		if ( uring_enter( r, 0, 1 ) < 0 && errno != EINTR )
+			return NULL;
+	}
+
+	return cqe;
+}
+
+
+/**
+ * uring_rx_recycle:
+ * Hands receive buffer `bid' back to the kernel.
+ */
+static void uring_rx_recycle( uring_thread_t *u, uint16_t bid )
+{
+	struct io_uring_buf *buf;
+
+	buf= &(u->br->bufs[u->br_tail & (URING_RX_BUFS-1)]);
+	buf->addr= (uint64_t)(uintptr_t)(u->bufs+(size_t)bid*URING_BUF_SIZE);
+	buf->len= URING_BUF_SIZE;
+	buf->bid= bid;
+
+	u->br_tail++;
+	__atomic_store_n( &(u->br->tail), u->br_tail, __ATOMIC_RELEASE );
+}
+
+
+/**
+ * uring_rx_teardown:
+ * Frees whatever uring_rx_setup() got as far as making.
+ */
+static void uring_rx_teardown( uring_thread_t *u )
+{
+	if ( u->bufs != NULL )
+		munmap( u->bufs, URING_RX_BUFS*URING_BUF_SIZE );
+	if ( u->br != NULL )
+		munmap( u->br, u->br_len );
+	if ( u->rx.fd >= 0 )
+		uring_free( &(u->rx) );
+
+	u->bufs= NULL;
+	u->br= NULL;
+	u->rx.fd= -1;
+}
+
+
+/**
+ * uring_rx_setup:
+ * Makes the receive ring, and registers its buffers with the kernel.
+ * Returns TRUE on success, FALSE if the kernel can't.
+ */
+static int uring_rx_setup( uring_thread_t *u )
+{
+	struct io_uring_buf_reg reg;
+	uint16_t i;
+
+	u->rx.fd= -1;
+	u->bufs= NULL;
+	u->br= NULL;
+
+	if ( !uring_setup( &(u->rx), URING_RX_ENTRIES ) )
+		return FALSE;
+
+	u->br_len= URING_RX_BUFS*sizeof(struct io_uring_buf);
+	u->br= mmap( NULL, u->br_len, PROT_READ|PROT_WRITE,
+		     MAP_PRIVATE|MAP_ANONYMOUS, -1, 0 );
+	u->bufs= mmap( NULL, URING_RX_BUFS*URING_BUF_SIZE,
+		       PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0 );
+	if ( u->br == MAP_FAILED || u->bufs == MAP_FAILED ) {
+		if ( u->br == MAP_FAILED )   u->br= NULL;
+		if ( u->bufs == MAP_FAILED ) u->bufs= NULL;
+		uring_rx_teardown( u );
+		return FALSE;
+	}
+
+	memset( &reg, 0, sizeof(reg) );
+	reg.ring_addr= (uint64_t)(uintptr_t)u->br;
+	reg.ring_entries= URING_RX_BUFS;
+	reg.bgid= URING_BGID;
+	if ( syscall( __NR_io_uring_register, u->rx.fd,
+		      IORING_REGISTER_PBUF_RING, &reg, 1 ) < 0 ) {
+		uring_rx_teardown( u );
+		return FALSE;
+	}
+
+	u->br_tail= 0;
+	for ( i= 0; i < URING_RX_BUFS; i++ )
+		uring_rx_recycle( u, i );
+
+	memset( &(u->rx_msg), 0, sizeof(struct msghdr) );
+	u->rx_msg.msg_namelen= sizeof(sockaddr_in_t);
+	u->rx_msg.msg_controllen= URING_CONTROL;
+	u->armed= FALSE;
+
+	return TRUE;
+}
+
+
+/**
+ * uring_rx_arm:
+ * Starts a multishot receive on the thread's socket.
+ * Returns TRUE on success, FALSE on failure.
+ */
+static int uring_rx_arm( uring_thread_t *u )
+{
+	struct io_uring_sqe *sqe;
+
+	if ( (sqe= uring_sqe( &(u->rx) )) == NULL )
+		return FALSE;
+
+	sqe->opcode= IORING_OP_RECVMSG;
+	sqe->fd= u->rx_sd;
+	sqe->addr= (uint64_t)(uintptr_t)&(u->rx_msg);
+	sqe->ioprio= IORING_RECV_MULTISHOT;
+	sqe->flags= IOSQE_BUFFER_SELECT;
+	sqe->buf_group= URING_BGID;
+	uring_push( &(u->rx) );
+
+	while ( uring_enter( &(u->rx), 1, 0 ) < 0 ) {
+		if ( errno != EINTR )
+			return FALSE;
+	}
+
+	u->armed= TRUE;
+	return TRUE;
+}
+
+
+/**
+ * uring_rx_copy:
+ * Copies the datagram in receive buffer `bid', `len' bytes of which
+ * were filled, into `msg' as recvmsg() would.
+ * Returns the number of bytes of payload copied.
+ */
+static ssize_t uring_rx_copy( uring_thread_t *u, uint16_t bid,
+			      uint32_t len, struct msghdr *msg )
+{
+	char *buf= u->bufs+(size_t)bid*URING_BUF_SIZE;
+	struct io_uring_recvmsg_out *out= (struct io_uring_recvmsg_out*)buf;
+	char *name= buf+sizeof(struct io_uring_recvmsg_out);
+	char *control= name+u->rx_msg.msg_namelen;
+	char *payload= control+u->rx_msg.msg_controllen;
+	size_t avail= len-(payload-buf);
+	size_t copied, n, ctl;
+	int i;
+
+	if ( avail > out->payloadlen )
+		avail= out->payloadlen;
+
+	if ( msg->msg_name != NULL ) {
+		n= out->namelen;
+		if ( n > u->rx_msg.msg_namelen ) n= u->rx_msg.msg_namelen;
+		if ( n > msg->msg_namelen )      n= msg->msg_namelen;
+		memcpy( msg->msg_name, name, n );
+		msg->msg_namelen= out->namelen;
+	}
+
+	ctl= out->controllen;
+	if ( ctl > msg->msg_controllen )
+		ctl= msg->msg_controllen;
+	if ( ctl )
+		memcpy( msg->msg_control, control, ctl );
+
+	for ( copied= 0, i= 0; i < msg->msg_iovlen && copied < avail; i++ ) {
+		n= avail-copied;
+		if ( n > msg->msg_iov[i].iov_len )
+			n= msg->msg_iov[i].iov_len;
+		memcpy( msg->msg_iov[i].iov_base, payload+copied, n );
+		copied+= n;
+	}
+
+	msg->msg_flags= out->flags;
+	if ( copied < out->payloadlen )
+		msg->msg_flags|= MSG_TRUNC;
+	if ( ctl < out->controllen )
+		msg->msg_flags|= MSG_CTRUNC;
+	msg->msg_controllen= ctl;
+
+	return copied;
+}
+
+
+/**
+ * uring_thread_free:
+ * Frees a thread's rings.
+ */
+static void uring_thread_free( uring_thread_t *u )
+{
+	if ( u->tx_ok )
+		uring_free( &(u->tx) );
+	uring_rx_teardown( u );
+	free( u );
+}
+
+
+/**
+ * uring_thread_exit:
+ * Destructor for a thread's table, run as the thread exits; frees its
+ * rings for every instance still open.
+ */
+static void uring_thread_exit( void *arg )
+{
+	uring_slots_t *slots= (uring_slots_t*)arg;
+	uring_thread_t *u;
+	uring_state_t *s;
+	uint32_t i;
+
+	pthread_mutex_lock( &uring_lock );
+	for ( i= 0; i < slots->len; i++ ) {
+		if ( (u= slots->rings[i]) == NULL )
+			continue;
+		s= u->state;
+
+		pthread_mutex_lock( s->lock );
+		if ( u->prev != NULL ) u->prev->next= u->next;
+		else                   s->threads= u->next;
+		if ( u->next != NULL ) u->next->prev= u->prev;
+		pthread_mutex_unlock( s->lock );
+
+		uring_thread_free( u );
+	}
+	pthread_mutex_unlock( &uring_lock );
+
+	free( slots->rings );
+	free( slots );
+}
+
+
+/**
+ * uring_thread:
+ * Returns the calling thread's rings, making them on first use, or
+ * NULL if there is no memory.
+ */
+static uring_thread_t *uring_thread( transport_t *t )
+{
+	uring_state_t *s= (uring_state_t*)t->state;
+	uring_slots_t *slots;
+	uring_thread_t *u, **rings;
+	uint32_t len;
+
+	slots= pthread_getspecific( uring_key );
+	if ( slots != NULL && s->id < slots->len && 
+	     (u= slots->rings[s->id]) != NULL )
+		return u;
+
+	if ( slots == NULL ) {
+		if ( (slots= (uring_slots_t*)calloc( 1, sizeof(uring_slots_t) )) 
+		     == NULL )
+			return NULL;
+		if ( pthread_setspecific( uring_key, slots ) != 0 ) {
+			free( slots );
+			return NULL;
+		}
+	}
+
+	if ( (u= (uring_thread_t*)calloc( 1, sizeof(uring_thread_t) )) == NULL )
+		return NULL;
+
+	u->tx_ok= uring_setup( &(u->tx), URING_TX_ENTRIES );
+	u->rx_ok= TRUE;
+	u->rx_sd= -1;
+	u->rx.fd= -1;
+	u->state= s;
+	u->slots= slots;
+
+	pthread_mutex_lock( &uring_lock );
+
+	if ( s->id >= slots->len ) {
+		len= uring_num_ids;
+		if ( (rings= (uring_thread_t**)realloc( 
+			      slots->rings, len*sizeof(uring_thread_t*) ))
+		     == NULL ) {
+			pthread_mutex_unlock( &uring_lock );
+			uring_thread_free( u );
+			return NULL;
+		}
+		memset( rings+slots->len, 0, 
+			(len-slots->len)*sizeof(uring_thread_t*) );
+		slots->rings= rings;
+		slots->len= len;
+	}
+	slots->rings[s->id]= u;
+
+	pthread_mutex_lock( s->lock );
+	u->next= s->threads;
+	if ( s->threads != NULL )
+		s->threads->prev= u;
+	s->threads= u;
+	pthread_mutex_unlock( s->lock );
+
+	pthread_mutex_unlock( &uring_lock );
+
+	return u;
+}
+
+
+/**
+ * uring_dgram_recv:
+ * Receives the next datagram on `sd' from the thread's multishot
+ * receive, waiting for more to arrive only when every one already
+ * reaped has been taken.
+ */
+static ssize_t uring_dgram_recv( transport_t *t, int sd, struct msghdr *msg )
+{
+	uring_thread_t *u;
+	struct io_uring_cqe *cqe;
+	int32_t res;
+	uint32_t flags;
+
+	if ( (u= uring_thread( t )) == NULL || !u->rx_ok )
+		return recvmsg( sd, msg, 0 );
+
+	if ( u->rx_sd == -1 ) {
+		if ( !uring_rx_setup( u ) ) {
+			u->rx_ok= FALSE;
+			return recvmsg( sd, msg, 0 );
+		}
+		pthread_mutex_lock( u->state->lock );
+		u->rx_sd= sd;
+		pthread_mutex_unlock( u->state->lock );
+	}
+	else if ( u->rx_sd != sd )
+		return recvmsg( sd, msg, 0 );
+
+	for (;;) {
+		if ( !u->armed && !uring_rx_arm( u ) ) {
+			u->rx_ok= FALSE;
+			return recvmsg( sd, msg, 0 );
+		}
+
+		if ( (cqe= uring_wait_cqe( &(u->rx) )) == NULL )
+			return -1;
+
+		/* Woken by uring_shutdown(), as recvmsg() would be */
+		if ( cqe->user_data == URING_WAKE ) {
+			uring_cqe_seen( &(u->rx) );
+			return 0;
+		}
+
+		res= cqe->res;
+		flags= cqe->flags;
+		uring_cqe_seen( &(u->rx) );
+
+		if ( !(flags & IORING_CQE_F_MORE) )
+			u->armed= FALSE;
+
+		if ( res < 0 ) {
+			/* Out of buffers: they're back by now, so rearm */
+			if ( res == -ENOBUFS || res == -EINTR )
+				continue;
+			/* No multishot receive in this kernel */
+			if ( res == -EINVAL || res == -EOPNOTSUPP ) {
+				u->rx_ok= FALSE;
+				return recvmsg( sd, msg, 0 );
+			}
+			errno= -res;
+			return -1;
+		}
+
+		/* Nothing more is coming once the socket is shut down */
+		if ( !(flags & IORING_CQE_F_BUFFER) ) {
+			if ( res == 0 && !u->armed )
+				return 0;
+			continue;
+		}
+
+		res= uring_rx_copy( u, flags >> IORING_CQE_BUFFER_SHIFT, res,
+				    msg );
+		uring_rx_recycle( u, flags >> IORING_CQE_BUFFER_SHIFT );
+
+		return res;
+	}
+}
+
+
+/**
+ * uring_dgram_send_batch:
+ * Sends up to URING_TX_ENTRIES of the messages in one system call,
+ * stopping at the first that fails.
+ * Returns the number sent, or -1 if the first failed.
+ */
+static int uring_dgram_send_batch( transport_t *t, int sd,
+				   struct mmsghdr *msgs, unsigned int count )
+{
+	uring_thread_t *u;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	unsigned int i, n, sent;
+	int err= 0;
+
+	if ( (u= uring_thread( t )) == NULL || !u->tx_ok )
+		return transport_kernel_ops.dgram_send_batch( t, sd, msgs, count );
+
+	n= count < u->tx.entries ? count : u->tx.entries;
+
+	for ( i= 0; i < n; i++ ) {
+		sqe= uring_sqe( &(u->tx) );
+		sqe->opcode= IORING_OP_SENDMSG;
+		sqe->fd= sd;
+		sqe->addr= (uint64_t)(uintptr_t)&(msgs[i].msg_hdr);
+		sqe->len= 1;
+		sqe->user_data= i;
+		if ( i+1 < n )
+			sqe->flags= IOSQE_IO_LINK;
+		uring_push( &(u->tx) );
+	}
+
+	while ( uring_enter( &(u->tx), n, n ) < 0 ) {
+		if ( errno != EINTR ) {
+			/* The entries are stuck in the ring; give it up */
+			u->tx_ok= FALSE;
+			return transport_kernel_ops.dgram_send_batch( t, sd,
+								     msgs,
+								     count );
+		}
+	}
+
+	sent= n;
+	for ( i= 0; i < n; i++ ) {
+		if ( (cqe= uring_wait_cqe( &(u->tx) )) == NULL ) {
+			u->tx_ok= FALSE;
+			return -1;
+		}
+
+		if ( cqe->res >= 0 )
+			msgs[cqe->user_data].msg_len= cqe->res;
+		else if ( cqe->user_data < sent ) {
+			sent= cqe->user_data;
+			err= -cqe->res;
+		}
+		uring_cqe_seen( &(u->tx) );
+	}
+
+	if ( sent == 0 ) {
+		errno= err;
+		return -1;
+	}
+	return sent;
+}
+
+
+/**
+ * uring_wake:
+ * Posts a completion marked URING_WAKE to the receive ring of `to',
+ * through the transmit ring of `from'.
+ */
+static void uring_wake( uring_thread_t *from, uring_thread_t *to )
+{
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+
+	if ( !from->tx_ok || (sqe= uring_sqe( &(from->tx) )) == NULL )
+		return;
+
+	sqe->opcode= IORING_OP_MSG_RING;
+	sqe->fd= to->rx.fd;
+	sqe->addr= IORING_MSG_DATA;
+	sqe->off= URING_WAKE;
+	uring_push( &(from->tx) );
+
+	while ( uring_enter( &(from->tx), 1, 1 ) < 0 ) {
+		if ( errno != EINTR )
+			return;
+	}
+	if ( (cqe= uring_wait_cqe( &(from->tx) )) != NULL )
+		uring_cqe_seen( &(from->tx) );
+}
+
+
+/**
+ * uring_shutdown:
+ * Shuts `sd' down, and wakes the threads receiving on it through
+ * their rings.
+ */
+static void uring_shutdown( transport_t *t, int sd )
+{
+	uring_state_t *s= (uring_state_t*)t->state;
+	uring_thread_t *me, *u;
+
+	shutdown( sd, SHUT_RDWR );
+
+	if ( (me= uring_thread( t )) == NULL )
+		return;
+
+	pthread_mutex_lock( s->lock );
+	for ( u= s->threads; u != NULL; u= u->next ) {
+		if ( u->rx_sd == sd && u->rx.fd >= 0 )
+			uring_wake( me, u );
+	}
+	pthread_mutex_unlock( s->lock );
+}
+
+
+/**
+ * uring_destroy:
+ * Frees the rings of every thread which has used the instance, and
+ * clears them from the threads' tables so the id can be used again.
+ * The threads must be done with it.
+ */
+static void uring_destroy( transport_t *t )
+{
+	uring_state_t *s= (uring_state_t*)t->state;
+	uring_thread_t *u;
+
+	pthread_mutex_lock( &uring_lock );
+
+	while ( (u= s->threads) != NULL ) {
+		s->threads= u->next;
+		u->slots->rings[s->id]= NULL;
+		uring_thread_free( u );
+	}
+	uring_ids[s->id]= NULL;
+
+	pthread_mutex_unlock( &uring_lock );
+
+	pthread_mutex_destroy( s->lock );
+	free( s->lock );
+	free( s );
+	t->state= NULL;
+}
+
+
+static void uring_ops_init( )
+{
+	uring_ops= transport_kernel_ops;
+	uring_ops.name= "uring";
+	uring_ops.dgram_send_batch= &uring_dgram_send_batch;
+	uring_ops.dgram_recv= &uring_dgram_recv;
+	uring_ops.shutdown= &uring_shutdown;
+	uring_ops.destroy= &uring_destroy;
+
+	uring_key_ok= pthread_key_create( &uring_key, &uring_thread_exit ) == 0;
+}
+
+
+/**
+ * uring_id:
+ * Gives `s' the lowest id not in use by another instance.
+ * Returns TRUE on success, FALSE if there is no memory.
+ */
+static int uring_id( uring_state_t *s )
+{
+	uring_state_t **ids;
+	uint32_t id;
+
+	pthread_mutex_lock( &uring_lock );
+
+	for ( id= 0; id < uring_num_ids && uring_ids[id] != NULL; id++ )
+		;
+	if ( id == uring_num_ids ) {
+		if ( (ids= (uring_state_t**)realloc( 
+			      uring_ids, (id+1)*sizeof(uring_state_t*) )) 
+		     == NULL ) {
+			pthread_mutex_unlock( &uring_lock );
+			return FALSE;
+		}
+		uring_ids= ids;
+		uring_num_ids= id+1;
+	}
+	uring_ids[id]= s;
+	s->id= id;
+
+	pthread_mutex_unlock( &uring_lock );
+
+	return TRUE;
+}
+
+
+/**
+ * transport_uring_init:
+ * Sets `t' up to use io_uring for datagrams, if this kernel has it.
+ * Returns TRUE on success, FALSE if io_uring is unavailable.
+ */
+int transport_uring_init( transport_t *t )
+{
+	uring_state_t *s;
+	uring_t probe;
+
+	if ( !uring_setup( &probe, URING_RX_ENTRIES ) )
+		return FALSE;
+	uring_free( &probe );
+
+	pthread_once( &uring_ops_once, &uring_ops_init );
+	if ( !uring_key_ok )
+		return FALSE;
+
+	if ( (s= (uring_state_t*)calloc( 1, sizeof(uring_state_t) )) == NULL )
+		return FALSE;
+	if ( !uring_id( s ) ) {
+		free( s );
+		return FALSE;
+	}
+
+	s->lock= (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
+	pthread_mutex_init( s->lock, NULL );
+
+	t->ops= &uring_ops;
+	t->state= s;
+
+	return TRUE;
+}
+
+#else
+
+int transport_uring_init( transport_t *t )
+{
+	return FALSE;
+}
+
+#endif
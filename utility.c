@@ -0,0 +1,104 @@
+
+#include "utility.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UTILITY_AVX2
+#endif
+
+
+/**
+ * utility_sum_scalar:
+ * utility_sum() one pair at a time, for processors without AVX2 and
+ * for the tail of the arrays.
+ */
+static float utility_sum_scalar( const uint32_t *far, const uint32_t *near,
+				 uint32_t n )
+{
+	float sum= 0;
+	uint32_t i;
+
+	for ( i= 0; i < n; i++ ) {
+		if ( far[i] == INFINITY || near[i] == INFINITY )
+			return INFINITY;
+
+		if ( far[i] > near[i] )
+			sum+= ((float)(far[i]-near[i]))/((float)far[i]);
+	}
+
+	return sum;
+}
+
+
+#ifdef UTILITY_AVX2
+/**
+ * utility_sum_avx2:
+ * utility_sum() eight pairs at a time. Distances are below 2^28, so
+ * converting and comparing them as signed integers is safe.
+ */
+__attribute__((target("avx2")))
+static float utility_sum_avx2( const uint32_t *far, const uint32_t *near,
+			       uint32_t n )
+{
+	const __m256i inf= _mm256_set1_epi32( INFINITY );
+	__m256 acc= _mm256_setzero_ps();
+	float lanes[8], sum;
+	uint32_t i;
+
+	for ( i= 0; i+8 <= n; i+= 8 ) {
+		__m256i f= _mm256_loadu_si256( (const __m256i*)(far+i) );
+		__m256i m= _mm256_loadu_si256( (const __m256i*)(near+i) );
+		__m256i unreachable= _mm256_or_si256( _mm256_cmpeq_epi32(f, inf),
+						      _mm256_cmpeq_epi32(m, inf) );
+		__m256 longer, ff;
+
+		if ( !_mm256_testz_si256(unreachable, unreachable) )
+			return INFINITY;
+
+		/* Pairs where `near' isn't nearer contribute nothing; their
+		 * quotient, 0/0 included, is masked away */
+		longer= _mm256_castsi256_ps( _mm256_cmpgt_epi32(f, m) );
+		ff= _mm256_cvtepi32_ps( f );
+		acc= _mm256_add_ps( acc, _mm256_and_ps(longer,
+			_mm256_div_ps(_mm256_sub_ps(ff, _mm256_cvtepi32_ps(m)), ff)) );
+	}
+
+	_mm256_storeu_ps( lanes, acc );
+	sum= lanes[0]+lanes[1]+lanes[2]+lanes[3]+
+	     lanes[4]+lanes[5]+lanes[6]+lanes[7];
+
+	if ( i < n ) {
+		float tail= utility_sum_scalar( far+i, near+i, n-i );
+
+		if ( tail == INFINITY )
+			return INFINITY;
+		sum+= tail;
+	}
+
+	return sum;
+}
+#endif
+
+
+/**
+ * utility_sum:
+ * Returns the sum, over the `n' pairs where far[i] > near[i], of
+ * (far[i]-near[i])/far[i]: the fraction of each distance which would
+ * be saved by going from `far' to `near'. If any distance in either
+ * array is INFINITY the result is INFINITY.
+ *
+ * Uses AVX2 where the processor has it.
+ */
+float utility_sum( const uint32_t *far, const uint32_t *near, uint32_t n )
+{
+#ifdef UTILITY_AVX2
+	static int avx2= -1;
+
+	if ( avx2 == -1 )
+		avx2= __builtin_cpu_supports( "avx2" ) ? TRUE : FALSE;
+
+	if ( avx2 )
+		return utility_sum_avx2( far, near, n );
+#endif
+	return utility_sum_scalar( far, near, n );
+}
@@ -0,0 +1,19 @@
+#ifndef __UTILITY_
+#define __UTILITY_
+
+#include <stdint.h>
+
+#include "common_defs.h"
+
+/**
+ * utility_sum:
+ * Returns the sum, over the `n' pairs where far[i] > near[i], of
+ * (far[i]-near[i])/far[i]: the fraction of each distance which would
+ * be saved by going from `far' to `near'. If any distance in either
+ * array is INFINITY the result is INFINITY.
+ *
+ * Uses AVX2 where the processor has it.
+ */
+float utility_sum( const uint32_t *far, const uint32_t *near, uint32_t n );
+
+#endif